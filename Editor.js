@@ -1,7 +1,8 @@
 //Editor.js
 import { useCounterStore } from './mesh.js';
-const { defineComponent, ref, onMounted, h, unref } = Vue;
+const { defineComponent, ref, reactive, onMounted, onUnmounted, h, unref } = Vue;
 import { globalVars as v, triggerRefresh, loadHtmlPage } from './globalVars.js'  // 引入全局變數
+import ImageCanvasManager from './ImageCanvasManager.js';
 
 // Editor.js
 export const Editor = defineComponent({
@@ -9,9 +10,25 @@ export const Editor = defineComponent({
   setup() {
     const counter = useCounterStore();
     const renderFn = ref(null);
+    // 伺服器變形後的影像：ImageCanvasManager 以圖塊輪詢並轉送拖曳
+    const view = reactive({
+      status: '',
+      fileDropdown: false,
+      editDropdown: false,
+      $refs: {
+        get imageContainer() {
+          return document.getElementById('warpImage');
+        }
+      }
+    });
+    const manager = new ImageCanvasManager(view);
     onMounted(async () => {
      
       renderFn.value = await loadHtmlPage('./Editor.html');
+      manager.initialize();
+    });
+    onUnmounted(() => {
+      manager.cleanup();
     });
 
     return () => {
@@ -33,7 +50,9 @@ export const Editor = defineComponent({
       return renderFn.value({
         counter,
         v: unwrappedV,
-        triggerRefresh
+        triggerRefresh,
+        view,
+        manager
       });
     };
   },
@@ -1,4 +1,6 @@
 // ImageCanvasManager.js
+import TileClient from './tileClient.js';
+
 export default class ImageCanvasManager {
   constructor(vueInstance) {
     this.imageData = '';
@@ -9,20 +11,51 @@ export default class ImageCanvasManager {
     this.dragStartY = 0;
     this.updateTimer = null;
     this.vueInstance = vueInstance;
+    this.onClickOutside = this.handleClickOutside.bind(this);
+    this.tileCanvas = null;
+    this.tileClient = null;
+    this.fetching = false;
   }
 
   initialize() {
-    document.addEventListener('click', this.handleClickOutside.bind(this));
+    document.addEventListener('click', this.onClickOutside);
     this.startImageUpdates();
   }
 
   cleanup() {
     clearInterval(this.updateTimer);
-    document.removeEventListener('click', this.handleClickOutside);
+    document.removeEventListener('click', this.onClickOutside);
+    if (this.tileCanvas) this.tileCanvas.remove();
+    this.tileCanvas = null;
+    this.tileClient = null;
   }
 
+  // Draw the warped image into the container as tiles: only the visible
+  // tiles whose version changed since they were drawn are downloaded.
   fetchImage() {
-    // Placeholder for image fetching
+    const container = this.vueInstance.$refs.imageContainer;
+    if (!container || this.fetching) return;
+    if (!this.tileClient) {
+      this.tileCanvas = document.createElement('canvas');
+      this.tileCanvas.className = 'image-canvas';
+      this.tileCanvas.style.display = 'block';
+      container.appendChild(this.tileCanvas);
+      this.tileClient = new TileClient(this.tileCanvas);
+    }
+    const viewport = {
+      x: container.scrollLeft,
+      y: container.scrollTop,
+      width: container.clientWidth,
+      height: container.clientHeight
+    };
+    this.fetching = true;
+    this.tileClient.refresh(viewport)
+      .catch(error => {
+        this.vueInstance.status = 'image bad: ' + error.message;
+      })
+      .finally(() => {
+        this.fetching = false;
+      });
   }
 
   startImageUpdates() {
@@ -65,6 +98,7 @@ export default class ImageCanvasManager {
 
   updateImage(newUrl) {
     this.cacheBuster = Date.now();
+    this.fetchImage();
   }
 
   getMousePosition(event) {
@@ -162,7 +196,7 @@ export default class ImageCanvasManager {
       method: 'POST',
       headers: { 'Content-Type': 'application/json' },
       body: JSON.stringify(payload)
-    });
+    }).then(() => this.fetchImage());
   }
 
   sendPointToServer(x, y, event) {
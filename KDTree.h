@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include <iostream>
 #include <opencv2/opencv.hpp>
+#include "logger.h"
 
 using namespace std;
 using namespace cv;
@@ -419,6 +420,15 @@ public:
         root = buildKDTree(points, 0, points.size() - 1, 0);
     }
 
+    // 从 Grid 的节点指针构建 KD 树 (重建前释放旧树)
+    void build(const std::vector<GridNode*>& gridNodes) {
+        deleteTree(root);
+        root = nullptr;
+        if (gridNodes.empty()) return;
+        std::vector<GridNode*> points(gridNodes);
+        root = buildKDTree(points, 0, (int)points.size() - 1, 0);
+    }
+
     // 查找最近点
     GridNode* findNearest(const cv::Point2f& target) {
         if (!root) return nullptr;
@@ -471,7 +481,8 @@ public:
     bool updateNodePosition(GridNode* gridNode, const cv::Point2f& newPosition) {
         if (!gridNode) return false;
 
-        std::cout << " update select gridNode ..." << std::endl;
+        MW_LOG_DEBUG("update select gridNode {},{} -> {},{}", gridNode->position_modified.x,
+                     gridNode->position_modified.y, newPosition.x, newPosition.y);
         KDNode* node = findExact(root, gridNode, 0);
         if (node == nullptr) return false; // 节点不存在
 
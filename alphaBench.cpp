@@ -0,0 +1,112 @@
+// Alpha analysis benchmark: a straightforward per-pixel scan against
+// analyzeAlpha on sprites with transparent borders, checking that both agree.
+//
+// alphaBench [width height [iterations]]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "spriteAlpha.h"
+
+using namespace std;
+
+cv::Mat makeSprite(int width, int height, unsigned seed) {
+    mt19937 rng(seed);
+    cv::Mat image = cv::Mat::zeros(height, width, CV_8UC4);
+    cv::Rect body(width / 7, height / 5, width * 3 / 5, height / 2);
+    image(body).setTo(cv::Scalar(40, 80, 120, 255));
+    // Soft, partly transparent specks around the body, including some at or
+    // below the usual thresholds; the outer border stays fully transparent.
+    uniform_int_distribution<int> x(width / 10, width - 1 - width / 10), y(height / 10, height - 1 - height / 10);
+    uniform_int_distribution<int> alpha(1, 254);
+    for (int i = 0; i < width * height / 500; ++i) {
+        image.at<cv::Vec4b>(y(rng), x(rng))[3] = (uint8_t)alpha(rng);
+    }
+    return image;
+}
+
+AlphaCoverage referenceAlpha(const cv::Mat& image, uint8_t threshold) {
+    const int cell = AlphaCoverage::kCellSize;
+    AlphaCoverage out;
+    out.size = image.size();
+    out.threshold = threshold;
+    out.grid = cv::Size((image.cols + cell - 1) / cell, (image.rows + cell - 1) / cell);
+    out.rows.resize(image.rows);
+    vector<int> visible(out.grid.area()), opaque(out.grid.area());
+    int top = -1, bottom = -1, left = image.cols, right = -1;
+    for (int y = 0; y < image.rows; ++y) {
+        const uint8_t* row = image.ptr(y);
+        for (int x = 0; x < image.cols; ++x) {
+            uint8_t a = row[x * 4 + 3];
+            int c = (y / cell) * out.grid.width + x / cell;
+            opaque[c] += a == 255;
+            if (a <= threshold) continue;
+            visible[c] = 1;
+            if (out.rows[y].first < 0) out.rows[y].first = x;
+            out.rows[y].last = x;
+        }
+        if (out.rows[y].empty()) continue;
+        if (top < 0) top = y;
+        bottom = y;
+        left = min(left, out.rows[y].first);
+        right = max(right, out.rows[y].last);
+    }
+    if (top >= 0) out.bounds = cv::Rect(left, top, right - left + 1, bottom - top + 1);
+    out.cells.resize(out.grid.area());
+    for (int cy = 0; cy < out.grid.height; ++cy) {
+        for (int cx = 0; cx < out.grid.width; ++cx) {
+            int c = cy * out.grid.width + cx;
+            int w = min(cell, image.cols - cx * cell), h = min(cell, image.rows - cy * cell);
+            out.cells[c] = opaque[c] == w * h ? AlphaCoverage::Opaque
+                           : visible[c]       ? AlphaCoverage::Partial
+                                              : AlphaCoverage::Empty;
+        }
+    }
+    return out;
+}
+
+bool same(const AlphaCoverage& a, const AlphaCoverage& b) {
+    if (a.bounds != b.bounds || a.grid != b.grid || a.cells != b.cells || a.rows.size() != b.rows.size()) return false;
+    for (size_t i = 0; i < a.rows.size(); ++i) {
+        if (a.rows[i].first != b.rows[i].first || a.rows[i].last != b.rows[i].last) return false;
+    }
+    return true;
+}
+
+template <typename F>
+double bestMs(int iterations, F f) {
+    double best = 1e30;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = chrono::steady_clock::now();
+        f();
+        best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    int width = argc > 2 ? atoi(argv[1]) : 3840;
+    int height = argc > 2 ? atoi(argv[2]) : 2160;
+    int iterations = argc > 3 ? atoi(argv[3]) : 10;
+
+    printf("analyzeAlpha: %s\n", alphaImplementation());
+    bool ok = true;
+    // Odd sizes exercise the partial blocks at the right and bottom edges.
+    for (cv::Size size : { cv::Size(width, height), cv::Size(width - 5, height - 3), cv::Size(17, 1) }) {
+        cv::Mat image = makeSprite(size.width, size.height, 7);
+        for (uint8_t threshold : { (uint8_t)0, (uint8_t)128 }) {
+            AlphaCoverage reference, fast;
+            double naiveMs = bestMs(iterations, [&] { reference = referenceAlpha(image, threshold); });
+            double fastMs = bestMs(iterations, [&] { fast = analyzeAlpha(image, threshold); });
+            bool match = same(reference, fast);
+            ok &= match;
+            printf("%5dx%-5d t=%3d: naive %8.2f ms, analyzeAlpha %7.2f ms (%5.1fx), bounds %dx%d, %s\n", size.width,
+                   size.height, threshold, naiveMs, fastMs, naiveMs / max(fastMs, 1e-6), fast.bounds.width,
+                   fast.bounds.height, match ? "match" : "MISMATCH");
+        }
+    }
+    return ok ? 0 : 1;
+}
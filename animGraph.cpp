@@ -0,0 +1,546 @@
+#include "animGraph.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ANIM_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ANIM_NEON 1
+#endif
+
+namespace {
+
+// Pose sections, each one float per bone: rotation, x, y, scale x, scale y.
+const size_t kSections = 5;
+const float kIdentity[kSections] = { 0, 0, 0, 1, 1 };
+
+// out = a + (b - a) * w over n lanes, with w = weight * boneWeights[i] or
+// just weight when boneWeights is null. wrap turns angles the short way
+// (either way at exactly half a turn). out may be a or b.
+void blendLanes(const float* a, const float* b, const float* boneWeights, float weight, bool wrap, float* out,
+                size_t n) {
+    size_t i = 0;
+#if defined(ANIM_SSE2)
+    const __m128 uniform = _mm_set1_ps(weight), turn = _mm_set1_ps(360.0f), perTurn = _mm_set1_ps(1 / 360.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i), d = _mm_sub_ps(_mm_loadu_ps(b + i), va);
+        __m128 w = boneWeights ? _mm_mul_ps(_mm_loadu_ps(boneWeights + i), uniform) : uniform;
+        if (wrap) d = _mm_sub_ps(d, _mm_mul_ps(turn, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(d, perTurn)))));
+        _mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(d, w)));
+    }
+#elif defined(ANIM_NEON)
+    const float32x4_t uniform = vdupq_n_f32(weight), turn = vdupq_n_f32(360.0f), perTurn = vdupq_n_f32(1 / 360.0f);
+    const float32x4_t zero = vdupq_n_f32(0), up = vdupq_n_f32(0.5f), down = vdupq_n_f32(-0.5f);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t va = vld1q_f32(a + i), d = vsubq_f32(vld1q_f32(b + i), va);
+        float32x4_t w = boneWeights ? vmulq_f32(vld1q_f32(boneWeights + i), uniform) : uniform;
+        if (wrap) {
+            float32x4_t q = vmulq_f32(d, perTurn);
+            q = vaddq_f32(q, vbslq_f32(vcltq_f32(q, zero), down, up));
+            d = vsubq_f32(d, vmulq_f32(turn, vcvtq_f32_s32(vcvtq_s32_f32(q))));
+        }
+        vst1q_f32(out + i, vaddq_f32(va, vmulq_f32(d, w)));
+    }
+#endif
+    for (; i < n; ++i) {
+        float d = b[i] - a[i];
+        if (wrap) d -= 360.0f * std::round(d / 360.0f);
+        out[i] = a[i] + d * (boneWeights ? boneWeights[i] * weight : weight);
+    }
+}
+
+// base += (add - identity) * w over n lanes, w as in blendLanes.
+void addLanes(const float* add, const float* boneWeights, float weight, float identity, float* base, size_t n) {
+    size_t i = 0;
+#if defined(ANIM_SSE2)
+    const __m128 uniform = _mm_set1_ps(weight), one = _mm_set1_ps(identity);
+    for (; i + 4 <= n; i += 4) {
+        __m128 w = boneWeights ? _mm_mul_ps(_mm_loadu_ps(boneWeights + i), uniform) : uniform;
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(add + i), one);
+        _mm_storeu_ps(base + i, _mm_add_ps(_mm_loadu_ps(base + i), _mm_mul_ps(d, w)));
+    }
+#elif defined(ANIM_NEON)
+    const float32x4_t uniform = vdupq_n_f32(weight), one = vdupq_n_f32(identity);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t w = boneWeights ? vmulq_f32(vld1q_f32(boneWeights + i), uniform) : uniform;
+        float32x4_t d = vsubq_f32(vld1q_f32(add + i), one);
+        vst1q_f32(base + i, vaddq_f32(vld1q_f32(base + i), vmulq_f32(d, w)));
+    }
+#endif
+    for (; i < n; ++i) base[i] += (add[i] - identity) * (boneWeights ? boneWeights[i] * weight : weight);
+}
+
+void blendPose(const float* a, const float* b, const float* boneWeights, float weight, float* out, size_t bones) {
+    for (size_t s = 0; s < kSections; ++s) {
+        blendLanes(a + s * bones, b + s * bones, boneWeights, weight, s == 0, out + s * bones, bones);
+    }
+}
+
+// Spine's additive mix: rotation and translation offsets add, scale factors
+// add their difference from 1.
+void addPose(const float* add, const float* boneWeights, float weight, float* base, size_t bones) {
+    for (size_t s = 0; s < kSections; ++s) {
+        addLanes(add + s * bones, boneWeights, weight, kIdentity[s], base + s * bones, bones);
+    }
+}
+
+void resetPose(float* pose, size_t bones) {
+    for (size_t s = 0; s < kSections; ++s) std::fill(pose + s * bones, pose + (s + 1) * bones, kIdentity[s]);
+}
+
+// The two children a blend plays at its parameter's value, and the
+// second's weight; both are the same child outside the thresholds.
+void blendPair(const std::vector<float>& thresholds, float value, size_t& first, size_t& second, float& weight) {
+    size_t last = thresholds.size() - 1;
+    weight = 0;
+    if (!(value > thresholds[0])) { // NaN included
+        first = second = 0;
+        return;
+    }
+    if (value >= thresholds[last]) {
+        first = second = last;
+        return;
+    }
+    first = 0;
+    while (value >= thresholds[first + 1]) ++first;
+    second = first + 1;
+    weight = (value - thresholds[first]) / (thresholds[second] - thresholds[first]);
+}
+
+} // namespace
+
+// AnimationGraph implementation
+int AnimationGraph::addParameter(const std::string& name, float initial) {
+    parameters.push_back({ name, initial });
+    return (int)parameters.size() - 1;
+}
+
+AnimationGraph::Motion AnimationGraph::addClip(std::shared_ptr<const AnimationClip> clip, float speed) {
+    if (!clip) throw std::invalid_argument("AnimationGraph::addClip: no clip");
+    MotionNode node;
+    node.clip = std::move(clip);
+    node.speed = speed;
+    motions.push_back(std::move(node));
+    return (Motion)motions.size() - 1;
+}
+
+AnimationGraph::Motion AnimationGraph::addBlend1D(int parameter, std::vector<std::pair<float, Motion>> children) {
+    if (parameter < 0 || (size_t)parameter >= parameters.size()) {
+        throw std::out_of_range("AnimationGraph::addBlend1D: no such parameter");
+    }
+    if (children.empty()) throw std::invalid_argument("AnimationGraph::addBlend1D: no motions");
+    std::stable_sort(children.begin(), children.end(),
+                     [](const std::pair<float, Motion>& a, const std::pair<float, Motion>& b) { return a.first < b.first; });
+    MotionNode node;
+    node.parameter = parameter;
+    for (const auto& child : children) {
+        // Children come before their parents, so blends cannot form cycles.
+        if (child.second >= motions.size()) throw std::out_of_range("AnimationGraph::addBlend1D: no such motion");
+        node.thresholds.push_back(child.first);
+        node.children.push_back(child.second);
+    }
+    motions.push_back(std::move(node));
+    return (Motion)motions.size() - 1;
+}
+
+uint32_t AnimationGraph::addLayer(const std::string& name, LayerMode mode, float weight,
+                                  std::unordered_map<std::string, float> mask) {
+    layers.push_back({ name, mode, weight, std::move(mask), {} });
+    return (uint32_t)layers.size() - 1;
+}
+
+uint32_t AnimationGraph::addState(uint32_t layer, const std::string& name, Motion motion, bool loop) {
+    if (layer >= layers.size()) throw std::out_of_range("AnimationGraph::addState: no such layer");
+    if (motion >= motions.size()) throw std::out_of_range("AnimationGraph::addState: no such motion");
+    layers[layer].states.push_back({ name, motion, loop });
+    return (uint32_t)layers[layer].states.size() - 1;
+}
+
+bool AnimationGraph::load(const nlohmann::json& graph,
+                          const std::function<std::shared_ptr<const AnimationClip>(const std::string&)>& clips,
+                          std::string& error) {
+    MW_TRACE_SCOPE("AnimationGraph::load");
+    *this = AnimationGraph();
+    if (!graph.is_object()) {
+        error = "graph is not an object";
+        return false;
+    }
+    auto params = graph.find("parameters");
+    if (params != graph.end()) {
+        if (!params->is_object()) {
+            error = "parameters is not an object";
+            return false;
+        }
+        for (auto p = params->begin(); p != params->end(); ++p) {
+            if (!p->is_number()) {
+                error = "parameter " + p.key() + " is not a number";
+                return false;
+            }
+            addParameter(p.key(), p->get<float>());
+        }
+    }
+
+    // A motion is {"clip": name, "speed": s} or {"blend": {"parameter": name, "motions": [...]}}.
+    std::function<bool(const nlohmann::json&, const std::string&, Motion&)> motion =
+        [&](const nlohmann::json& m, const std::string& what, Motion& out) {
+            auto clip = m.find("clip");
+            auto blend = m.find("blend");
+            if (clip != m.end() && clip->is_string()) {
+                std::shared_ptr<const AnimationClip> found = clips(clip->get<std::string>());
+                if (!found) {
+                    error = what + ": no clip " + clip->get<std::string>();
+                    return false;
+                }
+                auto speed = m.find("speed");
+                out = addClip(std::move(found), speed != m.end() && speed->is_number() ? speed->get<float>() : 1.0f);
+                return true;
+            }
+            if (blend == m.end() || !blend->is_object()) {
+                error = what + ": expected a clip name or a blend object";
+                return false;
+            }
+            auto parameter = blend->find("parameter");
+            int index = parameter != blend->end() && parameter->is_string()
+                            ? findParameter(parameter->get<std::string>()) : -1;
+            if (index < 0) {
+                error = what + ": blend has no known parameter";
+                return false;
+            }
+            auto children = blend->find("motions");
+            if (children == blend->end() || !children->is_array() || children->empty()) {
+                error = what + ": blend needs a non-empty motions array";
+                return false;
+            }
+            std::vector<std::pair<float, Motion>> list;
+            for (size_t i = 0; i < children->size(); ++i) {
+                const nlohmann::json& child = (*children)[i];
+                std::string childWhat = what + " motion " + std::to_string(i);
+                auto threshold = child.is_object() ? child.find("threshold") : child.end();
+                if (!child.is_object() || threshold == child.end() || !threshold->is_number()) {
+                    error = childWhat + ": expected an object with a threshold";
+                    return false;
+                }
+                Motion id;
+                if (!motion(child, childWhat, id)) return false;
+                list.emplace_back(threshold->get<float>(), id);
+            }
+            out = addBlend1D(index, std::move(list));
+            return true;
+        };
+
+    auto layerList = graph.find("layers");
+    if (layerList == graph.end() || !layerList->is_array()) {
+        error = "layers is not an array";
+        return false;
+    }
+    for (size_t l = 0; l < layerList->size(); ++l) {
+        const nlohmann::json& layer = (*layerList)[l];
+        std::string what = "layer " + std::to_string(l);
+        if (!layer.is_object()) {
+            error = what + " is not an object";
+            return false;
+        }
+        std::string mode = layer.value("mode", std::string("override"));
+        if (mode != "override" && mode != "additive") {
+            error = what + ": unknown mode " + mode;
+            return false;
+        }
+        auto weight = layer.find("weight");
+        std::unordered_map<std::string, float> mask;
+        auto maskIt = layer.find("mask");
+        if (maskIt != layer.end()) {
+            if (!maskIt->is_object()) {
+                error = what + ": mask is not an object";
+                return false;
+            }
+            for (auto bone = maskIt->begin(); bone != maskIt->end(); ++bone) {
+                mask[bone.key()] = bone->is_number() ? bone->get<float>() : 1.0f;
+            }
+        }
+        uint32_t id = addLayer(layer.value("name", std::string()),
+                               mode == "additive" ? LayerMode::Additive : LayerMode::Override,
+                               weight != layer.end() && weight->is_number() ? weight->get<float>() : 1.0f,
+                               std::move(mask));
+        auto states = layer.find("states");
+        if (states == layer.end() || !states->is_array()) {
+            error = what + ": states is not an array";
+            return false;
+        }
+        for (size_t s = 0; s < states->size(); ++s) {
+            const nlohmann::json& state = (*states)[s];
+            std::string stateWhat = what + " state " + std::to_string(s);
+            if (!state.is_object()) {
+                error = stateWhat + " is not an object";
+                return false;
+            }
+            Motion m;
+            if (!motion(state, stateWhat, m)) return false;
+            auto loop = state.find("loop");
+            addState(id, state.value("name", std::string()), m, loop == state.end() || !loop->is_boolean() || loop->get<bool>());
+        }
+    }
+    return true;
+}
+
+int AnimationGraph::findParameter(const std::string& name) const {
+    for (size_t i = 0; i < parameters.size(); ++i) {
+        if (parameters[i].name == name) return (int)i;
+    }
+    return -1;
+}
+
+int AnimationGraph::findLayer(const std::string& name) const {
+    for (size_t i = 0; i < layers.size(); ++i) {
+        if (layers[i].name == name) return (int)i;
+    }
+    return -1;
+}
+
+int AnimationGraph::findState(uint32_t layer, const std::string& name) const {
+    if (layer >= layers.size()) return -1;
+    const std::vector<State>& states = layers[layer].states;
+    for (size_t i = 0; i < states.size(); ++i) {
+        if (states[i].name == name) return (int)i;
+    }
+    return -1;
+}
+
+// AnimationGraphInstance implementation
+size_t AnimationGraphInstance::bind(std::shared_ptr<const AnimationGraph> source, SceneStore& store, Entity root) {
+    MW_TRACE_SCOPE("AnimationGraphInstance::bind");
+    graph = std::move(source);
+    bones.clear();
+    if (!graph) return 0;
+
+    // First entity of each name under root, depth first, as ClipBinding.
+    std::unordered_map<std::string, Entity> byName;
+    std::vector<Entity> stack;
+    if (store.alive(root)) stack.push_back(root);
+    while (!stack.empty()) {
+        Entity e = stack.back();
+        stack.pop_back();
+        byName.emplace(store.name(e), e);
+        size_t mark = stack.size();
+        for (Entity c = store.firstChild(e); c.valid(); c = store.nextSibling(c)) stack.push_back(c);
+        std::reverse(stack.begin() + mark, stack.end());
+    }
+
+    // Bones: every bone any clip animates, in order of first use.
+    std::unordered_map<std::string, uint32_t> boneIndex;
+    std::vector<std::string> boneNames;
+    for (const AnimationGraph::MotionNode& node : graph->motions) {
+        if (!node.clip) continue;
+        for (const std::string& name : node.clip->boneNames()) {
+            if (boneIndex.emplace(name, (uint32_t)boneNames.size()).second) boneNames.push_back(name);
+        }
+    }
+    size_t n = boneNames.size(), missing = 0;
+    bones.assign(n, Entity());
+    setup.assign(n * kSections, 0.0f);
+    for (size_t b = 0; b < n; ++b) {
+        auto it = byName.find(boneNames[b]);
+        if (it == byName.end() || !store.transforms.has(it->second.index)) {
+            ++missing;
+            continue;
+        }
+        const Transform t = store.setupPose(it->second);
+        bones[b] = it->second;
+        float values[kSections] = { t.rotation, t.position.x, t.position.y, t.scale.x, t.scale.y };
+        for (size_t s = 0; s < kSections; ++s) setup[s * n + b] = values[s];
+    }
+
+    // Where each clip lane lands in a pose.
+    size_t motionCount = graph->motions.size();
+    motionPoses.assign(motionCount, std::vector<float>(n * kSections, 0.0f));
+    clipSlots.assign(motionCount, ClipSlot());
+    for (size_t m = 0; m < motionCount; ++m) {
+        const AnimationClip* clip = graph->motions[m].clip.get();
+        if (!clip) continue;
+        ClipSlot& slot = clipSlots[m];
+        slot.lanes.assign(clip->laneCount(), 0.0f);
+        slot.cursor.keys.assign(clip->groups().size(), 0);
+        slot.poseIndex.assign(clip->laneCount(), kNoLane);
+        for (const AnimationClip::Channel& channel : clip->channels()) {
+            if (channel.kind != ChannelKind::Rotate && channel.kind != ChannelKind::Translate &&
+                channel.kind != ChannelKind::Scale) continue;
+            uint32_t b = boneIndex[clip->boneNames()[channel.target]];
+            size_t section = channel.kind == ChannelKind::Rotate ? 0 : channel.kind == ChannelKind::Translate ? 1 : 3;
+            for (uint32_t l = 0; l < channel.width; ++l) {
+                slot.poseIndex[channel.lane + l] = (uint32_t)((section + l) * n + b);
+            }
+        }
+    }
+
+    params.clear();
+    for (const AnimationGraph::Parameter& p : graph->parameters) params.push_back(p.initial);
+    size_t layerCount = graph->layers.size();
+    layers.assign(layerCount, LayerState());
+    phases.assign(layerCount, std::vector<float>());
+    for (size_t l = 0; l < layerCount; ++l) {
+        const AnimationGraph::Layer& def = graph->layers[l];
+        LayerState& layer = layers[l];
+        layer.weight = def.weight;
+        layer.pose.assign(n * kSections, 0.0f);
+        layer.source.assign(n * kSections, 0.0f);
+        resetPose(layer.pose.data(), n);
+        if (!def.mask.empty()) {
+            layer.mask.assign(n, 0.0f);
+            for (size_t b = 0; b < n; ++b) {
+                auto it = def.mask.find(boneNames[b]);
+                if (it != def.mask.end()) layer.mask[b] = it->second;
+            }
+        }
+        phases[l].assign(def.states.size(), 0.0f);
+        if (!def.states.empty()) layer.current = 0;
+    }
+    output.assign(n * kSections, 0.0f);
+    resetPose(output.data(), n);
+    return missing;
+}
+
+void AnimationGraphInstance::setParameter(int parameter, float value) {
+    params.at(parameter) = value;
+}
+
+bool AnimationGraphInstance::setParameter(const std::string& name, float value) {
+    int index = graph ? graph->findParameter(name) : -1;
+    if (index < 0) return false;
+    params[index] = value;
+    return true;
+}
+
+void AnimationGraphInstance::setLayerWeight(uint32_t layer, float weight) {
+    layers.at(layer).weight = weight;
+}
+
+void AnimationGraphInstance::play(uint32_t layer, uint32_t state, float fadeSeconds) {
+    LayerState& l = layers.at(layer);
+    if (state >= phases[layer].size()) throw std::out_of_range("AnimationGraphInstance::play: no such state");
+    if (fadeSeconds > 0 && l.current >= 0) {
+        if (l.from < 0 && (int)state != l.current) {
+            l.from = l.current; // keeps playing underneath
+        } else {
+            // Interrupted fade or restart: fade from the pose reached.
+            l.source = l.pose;
+            l.from = kFrozen;
+        }
+        l.fade = 0;
+        l.fadeLength = fadeSeconds;
+    } else {
+        l.from = -1;
+    }
+    l.current = (int)state;
+    phases[layer][state] = 0;
+}
+
+float AnimationGraphInstance::duration(AnimationGraph::Motion motion) const {
+    const AnimationGraph::MotionNode& node = graph->motions[motion];
+    if (node.clip) return node.speed > 0 ? node.clip->duration() / node.speed : 0.0f;
+    size_t first, second;
+    float weight;
+    blendPair(node.thresholds, params[node.parameter], first, second, weight);
+    float a = duration(node.children[first]), b = duration(node.children[second]);
+    return a + (b - a) * weight;
+}
+
+const float* AnimationGraphInstance::evaluate(AnimationGraph::Motion motion, float phase) {
+    const AnimationGraph::MotionNode& node = graph->motions[motion];
+    float* pose = motionPoses[motion].data();
+    size_t n = bones.size();
+    if (node.clip) {
+        ClipSlot& slot = clipSlots[motion];
+        node.clip->sample(phase * node.clip->duration(), slot.cursor, slot.lanes.data());
+        resetPose(pose, n);
+        for (size_t l = 0; l < slot.lanes.size(); ++l) {
+            if (slot.poseIndex[l] != kNoLane) pose[slot.poseIndex[l]] = slot.lanes[l];
+        }
+        return pose;
+    }
+    // Children share the blend's phase, so they stay in step.
+    size_t first, second;
+    float weight;
+    blendPair(node.thresholds, params[node.parameter], first, second, weight);
+    const float* a = evaluate(node.children[first], phase);
+    if (first == second) return a;
+    const float* b = evaluate(node.children[second], phase);
+    blendPose(a, b, nullptr, weight, pose, n);
+    return pose;
+}
+
+void AnimationGraphInstance::advance(uint32_t layer, int state, float seconds) {
+    const AnimationGraph::State& def = graph->layers[layer].states[state];
+    float length = duration(def.motion);
+    if (length <= 0) return;
+    float& phase = phases[layer][state];
+    phase += seconds / length;
+    if (def.loop) {
+        phase -= std::floor(phase);
+    } else {
+        phase = std::min(std::max(phase, 0.0f), 1.0f);
+    }
+}
+
+void AnimationGraphInstance::update(float seconds) {
+    MW_TRACE_SCOPE("AnimationGraphInstance::update");
+    if (!graph) return;
+    size_t n = bones.size(), floats = n * kSections;
+    resetPose(output.data(), n);
+    for (size_t i = 0; i < layers.size(); ++i) {
+        LayerState& layer = layers[i];
+        if (layer.current < 0) continue;
+        const std::vector<AnimationGraph::State>& states = graph->layers[i].states;
+        advance((uint32_t)i, layer.current, seconds);
+        if (layer.from >= 0) advance((uint32_t)i, layer.from, seconds);
+        if (layer.from != -1) {
+            layer.fade += seconds;
+            if (layer.fade >= layer.fadeLength) layer.from = -1;
+        }
+
+        // The source first: a motion the states share keeps one pose buffer.
+        if (layer.from >= 0) {
+            const float* from = evaluate(states[layer.from].motion, phases[i][layer.from]);
+            std::memcpy(layer.source.data(), from, floats * sizeof(float));
+        }
+        const float* current = evaluate(states[layer.current].motion, phases[i][layer.current]);
+        if (layer.from != -1) {
+            blendPose(layer.source.data(), current, nullptr, layer.fade / layer.fadeLength, layer.pose.data(), n);
+        } else {
+            std::memcpy(layer.pose.data(), current, floats * sizeof(float));
+        }
+
+        const float* mask = layer.mask.empty() ? nullptr : layer.mask.data();
+        if (graph->layers[i].mode == LayerMode::Additive) {
+            addPose(layer.pose.data(), mask, layer.weight, output.data(), n);
+        } else if (!mask && layer.weight >= 1) {
+            std::memcpy(output.data(), layer.pose.data(), floats * sizeof(float));
+        } else {
+            blendPose(output.data(), layer.pose.data(), mask, layer.weight, output.data(), n);
+        }
+    }
+}
+
+void AnimationGraphInstance::apply(SceneStore& store, bool markDirty) const {
+    size_t n = bones.size();
+    const float* pose = output.data();
+    for (size_t b = 0; b < n; ++b) {
+        Entity bone = bones[b];
+        if (!bone.valid() || !store.alive(bone)) continue;
+        Transform* t = store.transforms.find(bone.index);
+        if (!t) continue;
+        t->rotation = setup[b] + pose[b];
+        t->position = cv::Point2f(setup[n + b] + pose[n + b], setup[2 * n + b] + pose[2 * n + b]);
+        t->scale = cv::Point2f(setup[3 * n + b] * pose[3 * n + b], setup[4 * n + b] * pose[4 * n + b]);
+        if (markDirty) store.markDirty(bone);
+    }
+}
+
+void AnimationGraphInstance::restore(SceneStore& store) const {
+    for (Entity bone : bones) {
+        if (bone.valid()) store.restoreSetupPose(bone);
+    }
+}
@@ -0,0 +1,177 @@
+#ifndef ANIMGRAPH_H
+#define ANIMGRAPH_H
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "animation.h"
+
+// How a layer combines with the layers below it.
+enum class LayerMode : uint8_t {
+    Override, // blend towards this layer's pose by its weight
+    Additive  // add this layer's pose (relative to setup) times its weight
+};
+
+// Blend trees in state machines in layers, shared by every character that
+// plays them (see AnimationGraphInstance):
+//
+//   AnimationGraph graph;
+//   int speed = graph.addParameter("speed");
+//   auto walkRun = graph.addBlend1D(speed, { {0, graph.addClip(walk)}, {1, graph.addClip(run)} });
+//   uint32_t base = graph.addLayer("base");
+//   graph.addState(base, "idle", graph.addClip(idle));
+//   graph.addState(base, "move", walkRun);
+//
+// A motion is a clip or a 1D blend of motions by a parameter, whose
+// children play in step (normalized time), so a walk and a run blend
+// without their feet drifting apart. Only the bone channels of clips
+// are blended; deform and color timelines are for ClipPlayer.
+//
+// Ids come from the add calls; bad ids throw std::out_of_range.
+class AnimationGraph {
+public:
+    using Motion = uint32_t;
+
+    int addParameter(const std::string& name, float initial = 0);
+    Motion addClip(std::shared_ptr<const AnimationClip> clip, float speed = 1);
+    // children: (threshold, motion); sorted by threshold here.
+    Motion addBlend1D(int parameter, std::vector<std::pair<float, Motion>> children);
+    // mask: weight per bone name, bones not listed get 0; empty is all 1.
+    uint32_t addLayer(const std::string& name, LayerMode mode = LayerMode::Override, float weight = 1,
+                      std::unordered_map<std::string, float> mask = {});
+    // The first state of a layer plays when an instance is bound.
+    uint32_t addState(uint32_t layer, const std::string& name, Motion motion, bool loop = true);
+
+    // From JSON, with clips by name:
+    //
+    //   {"parameters": {"speed": 0},
+    //    "layers": [{"name": "base", "states": [
+    //                  {"name": "idle", "clip": "idle"},
+    //                  {"name": "move", "blend": {"parameter": "speed", "motions": [
+    //                      {"threshold": 0, "clip": "walk"}, {"threshold": 1, "clip": "run", "speed": 1.2}]}}]},
+    //               {"name": "breathe", "mode": "additive", "weight": 0.5, "mask": {"chest": 1},
+    //                "states": [{"name": "breathe", "clip": "breathe", "loop": true}]}]}
+    //
+    // Replaces this graph; false with a reason if the JSON is malformed or
+    // a clip is missing.
+    bool load(const nlohmann::json& graph,
+              const std::function<std::shared_ptr<const AnimationClip>(const std::string&)>& clips,
+              std::string& error);
+
+    int findParameter(const std::string& name) const;                 // -1 if none
+    int findLayer(const std::string& name) const;                     // -1 if none
+    int findState(uint32_t layer, const std::string& name) const;     // -1 if none
+    size_t parameterCount() const { return parameters.size(); }
+    size_t layerCount() const { return layers.size(); }
+    size_t motionCount() const { return motions.size(); }
+
+private:
+    friend class AnimationGraphInstance;
+
+    struct MotionNode {
+        std::shared_ptr<const AnimationClip> clip; // clip motions
+        float speed = 1;
+        int parameter = -1;              // blend motions
+        std::vector<float> thresholds;   // ascending
+        std::vector<Motion> children;
+    };
+    struct State {
+        std::string name;
+        Motion motion;
+        bool loop;
+    };
+    struct Layer {
+        std::string name;
+        LayerMode mode;
+        float weight;
+        std::unordered_map<std::string, float> mask;
+        std::vector<State> states;
+    };
+    struct Parameter {
+        std::string name;
+        float initial;
+    };
+
+    std::vector<Parameter> parameters;
+    std::vector<MotionNode> motions;
+    std::vector<Layer> layers;
+};
+
+// One character playing an AnimationGraph. bind() sizes every buffer:
+// poses are structure-of-arrays floats per bone (rotation offsets, then x
+// and y offsets, then x and y scale factors, all relative to the setup
+// pose), one per motion and layer, so update() allocates nothing and its
+// blend kernels run over contiguous lanes. Instances are independent, so
+// many characters can be updated from different threads (for instance as
+// the pose stage of a SceneUpdate).
+class AnimationGraphInstance {
+public:
+    // Bones are the bone channels' targets, looked up by name under root
+    // and posed relative to their setup pose, as ClipBinding does. Returns
+    // how many bone names found no entity.
+    size_t bind(std::shared_ptr<const AnimationGraph> graph, SceneStore& store, Entity root);
+    bool bound() const { return graph != nullptr; }
+    const AnimationGraph* definition() const { return graph.get(); }
+
+    void setParameter(int parameter, float value);
+    bool setParameter(const std::string& name, float value); // false if there is no such parameter
+    float parameter(int parameter) const { return params[parameter]; }
+    void setLayerWeight(uint32_t layer, float weight);
+    // Switch layer to state, fading from what it plays now over seconds.
+    // A fade interrupting another fades from the pose it had reached.
+    void play(uint32_t layer, uint32_t state, float fadeSeconds = 0);
+    int currentState(uint32_t layer) const { return layers[layer].current; }
+
+    // Advance every playing state and evaluate the layers into pose().
+    void update(float seconds);
+    // Write pose() into the bones' transforms; see ClipBinding::apply for
+    // markDirty.
+    void apply(SceneStore& store, bool markDirty = true) const;
+    // Put the bones back in their setup pose; before binding elsewhere.
+    void restore(SceneStore& store) const;
+
+    size_t boneCount() const { return bones.size(); }
+    Entity bone(size_t index) const { return bones[index]; } // invalid if its name was not found
+    const float* pose() const { return output.data(); }       // 5 * boneCount() floats
+
+private:
+    struct ClipSlot {
+        ClipCursor cursor;
+        std::vector<float> lanes;
+        std::vector<uint32_t> poseIndex; // per lane: index into a pose, or kNoLane
+    };
+    struct LayerState {
+        int current = -1;
+        int from = -1;       // state faded from, kFrozen for the frozen pose, -1 when not fading
+        float fade = 0;      // seconds into the fade
+        float fadeLength = 0;
+        float weight = 1;
+        std::vector<float> pose;   // this layer's result
+        std::vector<float> source; // the fade's source, evaluated or frozen
+        std::vector<float> mask;   // per bone
+    };
+    static constexpr uint32_t kNoLane = 0xFFFFFFFFu;
+    static constexpr int kFrozen = -2;
+
+    float duration(AnimationGraph::Motion motion) const;
+    const float* evaluate(AnimationGraph::Motion motion, float phase);
+    void advance(uint32_t layer, int state, float seconds);
+
+    std::shared_ptr<const AnimationGraph> graph;
+    std::vector<Entity> bones;
+    std::vector<float> setup;  // per bone, in pose layout: rotation, x, y, scale x, scale y
+    std::vector<float> params;
+    std::vector<std::vector<float>> phases; // per layer and state, 0..1
+    std::vector<LayerState> layers;
+    std::vector<std::vector<float>> motionPoses; // per motion
+    std::vector<ClipSlot> clipSlots;             // per motion, used by clip motions
+    std::vector<float> weights;                  // per bone, scratch
+    std::vector<float> output;
+};
+
+#endif // ANIMGRAPH_H
@@ -0,0 +1,903 @@
+#include "animation.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ANIM_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ANIM_NEON 1
+#endif
+
+namespace {
+
+const size_t kMaxDeformValues = 1 << 20; // per deform key: half a million vertices
+const uint32_t kMaxSpan = 256;           // keys one compressed segment may skip, bounding compress() time
+
+// Compressed clip block: this header, then 16-byte aligned sections in the
+// order of BlockLayout, all in the writer's byte order.
+const char kClipMagic[8] = { 'M', 'W', 'C', 'L', 'I', 'P', 0, 0 };
+const uint32_t kClipVersion = 1;
+const uint32_t kByteOrderMark = 0x01020304;
+
+struct ClipBlockHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    float duration;
+    uint32_t nameBytes; // clip, bone, mesh and slot names, each a uint16_t length and the bytes
+    uint32_t boneCount, meshCount, slotCount;
+    uint32_t channelCount, groupCount, laneCount, keyCount, valueCount;
+    uint32_t reserved[2];
+};
+static_assert(sizeof(ClipBlockHeader) == 64, "clip block header layout");
+
+struct ChannelRecord {
+    uint8_t kind;
+    uint8_t pad[3];
+    uint32_t target, lane, width;
+};
+static_assert(sizeof(ChannelRecord) == 16, "clip block channel layout");
+static_assert(sizeof(AnimationClip::KeyGroup) == 20, "clip block key group layout");
+
+struct BlockLayout {
+    uint64_t names, channels, groups, ranges, times, steps, values, end;
+
+    explicit BlockLayout(const ClipBlockHeader& h) {
+        uint64_t at = sizeof(ClipBlockHeader);
+        auto next = [&at](uint64_t bytes) {
+            uint64_t start = at;
+            at = (at + bytes + 15) & ~(uint64_t)15;
+            return start;
+        };
+        names = next(h.nameBytes);
+        channels = next((uint64_t)h.channelCount * sizeof(ChannelRecord));
+        groups = next((uint64_t)h.groupCount * sizeof(AnimationClip::KeyGroup));
+        ranges = next((uint64_t)h.laneCount * 2 * sizeof(float)); // minimum per lane, then step per lane
+        times = next((uint64_t)h.keyCount * sizeof(float));
+        steps = next(h.keyCount);
+        values = next((uint64_t)h.valueCount * sizeof(uint16_t));
+        end = at;
+    }
+};
+
+// Collects the compressed groups of one clip, then lays out the block.
+class BlockWriter {
+public:
+    explicit BlockWriter(size_t lanes) : ranges(lanes * 2, 0.0f) {}
+
+    // A group's keys, its values quantized as (v - lo) / step.
+    void group(const AnimationClip::KeyGroup& source, const float* t, const uint8_t* hold, const float* v,
+               const float* lo, const float* step) {
+        AnimationClip::KeyGroup g = source;
+        g.firstKey = (uint32_t)times.size();
+        g.firstValue = (uint32_t)values.size();
+        for (uint32_t k = 0; k < g.keyCount; ++k) {
+            times.push_back(t[k]);
+            steps.push_back(hold[k]);
+            for (uint32_t l = 0; l < g.laneCount; ++l) {
+                float q = step[l] > 0 ? std::round((v[(size_t)k * g.laneCount + l] - lo[l]) / step[l]) : 0.0f;
+                values.push_back((uint16_t)std::min(std::max(q, 0.0f), 65535.0f));
+            }
+        }
+        size_t lanes = ranges.size() / 2;
+        std::copy(lo, lo + g.laneCount, ranges.begin() + g.firstLane);
+        std::copy(step, step + g.laneCount, ranges.begin() + lanes + g.firstLane);
+        groups.push_back(g);
+    }
+
+    // The block: names and duration from clip, the given channels.
+    std::vector<uint8_t> finish(const AnimationClip& clip, const std::vector<AnimationClip::Channel>& channels) const {
+        std::string names;
+        auto addName = [&names](const std::string& name) {
+            uint16_t length = (uint16_t)std::min<size_t>(name.size(), 0xFFFF);
+            names.append((const char*)&length, sizeof(length));
+            names.append(name, 0, length);
+        };
+        addName(clip.name());
+        for (const auto* list : { &clip.boneNames(), &clip.meshNames(), &clip.slotNames() }) {
+            for (const std::string& name : *list) addName(name);
+        }
+
+        ClipBlockHeader h = {};
+        memcpy(h.magic, kClipMagic, sizeof(h.magic));
+        h.version = kClipVersion;
+        h.byteOrder = kByteOrderMark;
+        h.duration = clip.duration();
+        h.nameBytes = (uint32_t)names.size();
+        h.boneCount = (uint32_t)clip.boneNames().size();
+        h.meshCount = (uint32_t)clip.meshNames().size();
+        h.slotCount = (uint32_t)clip.slotNames().size();
+        h.channelCount = (uint32_t)channels.size();
+        h.groupCount = (uint32_t)groups.size();
+        h.laneCount = (uint32_t)clip.laneCount();
+        h.keyCount = (uint32_t)times.size();
+        h.valueCount = (uint32_t)values.size();
+        BlockLayout layout(h);
+
+        std::vector<uint8_t> block(layout.end, 0);
+        memcpy(block.data(), &h, sizeof(h));
+        memcpy(block.data() + layout.names, names.data(), names.size());
+        for (size_t c = 0; c < channels.size(); ++c) {
+            const AnimationClip::Channel& channel = channels[c];
+            ChannelRecord r = { (uint8_t)channel.kind, {}, channel.target, channel.lane, channel.width };
+            memcpy(block.data() + layout.channels + c * sizeof(r), &r, sizeof(r));
+        }
+        auto put = [&block](uint64_t offset, const void* data, size_t bytes) {
+            if (bytes) memcpy(block.data() + offset, data, bytes);
+        };
+        put(layout.groups, groups.data(), groups.size() * sizeof(groups[0]));
+        put(layout.ranges, ranges.data(), ranges.size() * sizeof(float));
+        put(layout.times, times.data(), times.size() * sizeof(float));
+        put(layout.steps, steps.data(), steps.size());
+        put(layout.values, values.data(), values.size() * sizeof(uint16_t));
+        return block;
+    }
+
+private:
+    std::vector<AnimationClip::KeyGroup> groups;
+    std::vector<float> ranges;
+    std::vector<float> times;
+    std::vector<uint8_t> steps;
+    std::vector<uint16_t> values;
+};
+
+// A channel as read from the JSON, before grouping.
+struct RawChannel {
+    ChannelKind kind;
+    uint32_t target;
+    uint32_t width;
+    std::vector<float> times;
+    std::vector<uint8_t> stepped;
+    std::vector<float> values; // key-major, width per key
+};
+
+// out = a + (b - a) * t over n lanes.
+void lerpLanes(const float* a, const float* b, float t, float* out, size_t n) {
+    size_t i = 0;
+#if defined(ANIM_SSE2)
+    const __m128 w = _mm_set1_ps(t);
+    for (; i + 4 <= n; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i), vb = _mm_loadu_ps(b + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), w)));
+    }
+#elif defined(ANIM_NEON)
+    const float32x4_t w = vdupq_n_f32(t);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t va = vld1q_f32(a + i), vb = vld1q_f32(b + i);
+        vst1q_f32(out + i, vaddq_f32(va, vmulq_f32(vsubq_f32(vb, va), w)));
+    }
+#endif
+    for (; i < n; ++i) out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+// out = lo + step * (a + (b - a) * t) over n 16-bit lanes.
+void lerpQuantized(const uint16_t* a, const uint16_t* b, float t, const float* lo, const float* step, float* out,
+                   size_t n) {
+    size_t i = 0;
+#if defined(ANIM_SSE2)
+    const __m128 w = _mm_set1_ps(t);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i qa = _mm_loadu_si128((const __m128i*)(a + i)), qb = _mm_loadu_si128((const __m128i*)(b + i));
+        for (int half = 0; half < 2; ++half) {
+            __m128i wa = half ? _mm_unpackhi_epi16(qa, zero) : _mm_unpacklo_epi16(qa, zero);
+            __m128i wb = half ? _mm_unpackhi_epi16(qb, zero) : _mm_unpacklo_epi16(qb, zero);
+            __m128 fa = _mm_cvtepi32_ps(wa), fb = _mm_cvtepi32_ps(wb);
+            __m128 x = _mm_add_ps(fa, _mm_mul_ps(_mm_sub_ps(fb, fa), w));
+            size_t j = i + half * 4;
+            _mm_storeu_ps(out + j, _mm_add_ps(_mm_loadu_ps(lo + j), _mm_mul_ps(_mm_loadu_ps(step + j), x)));
+        }
+    }
+#elif defined(ANIM_NEON)
+    const float32x4_t w = vdupq_n_f32(t);
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t qa = vld1q_u16(a + i), qb = vld1q_u16(b + i);
+        for (int half = 0; half < 2; ++half) {
+            uint32x4_t wa = vmovl_u16(half ? vget_high_u16(qa) : vget_low_u16(qa));
+            uint32x4_t wb = vmovl_u16(half ? vget_high_u16(qb) : vget_low_u16(qb));
+            float32x4_t fa = vcvtq_f32_u32(wa), fb = vcvtq_f32_u32(wb);
+            float32x4_t x = vaddq_f32(fa, vmulq_f32(vsubq_f32(fb, fa), w));
+            size_t j = i + half * 4;
+            vst1q_f32(out + j, vaddq_f32(vld1q_f32(lo + j), vmulq_f32(vld1q_f32(step + j), x)));
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        float fa = a[i], fb = b[i];
+        out[i] = lo[i] + step[i] * (fa + (fb - fa) * t);
+    }
+}
+
+// Last key at or before time (0 before the first key), starting from the
+// key found last time: a few steps forward cover sequential playback,
+// anything further is a binary search.
+uint32_t findKey(const float* times, uint32_t count, float time, uint32_t hint) {
+    if (hint >= count) hint = 0;
+    if (time >= times[hint]) {
+        for (int step = 0; step < 4; ++step) {
+            if (hint + 1 >= count || time < times[hint + 1]) return hint;
+            ++hint;
+        }
+        return (uint32_t)(std::upper_bound(times + hint, times + count, time) - times) - 1;
+    }
+    if (time < times[0]) return 0;
+    return (uint32_t)(std::upper_bound(times, times + hint, time) - times) - 1;
+}
+
+bool parseColor(const nlohmann::json& value, float* rgba) {
+    if (value.is_string()) {
+        const std::string& hex = value.get_ref<const std::string&>();
+        if (hex.size() != 6 && hex.size() != 8) return false;
+        rgba[3] = 1;
+        for (size_t c = 0; c < hex.size() / 2; ++c) {
+            char* end = nullptr;
+            std::string byte = hex.substr(c * 2, 2);
+            long v = std::strtol(byte.c_str(), &end, 16);
+            if (*end) return false;
+            rgba[c] = v / 255.0f;
+        }
+        return true;
+    }
+    if (value.is_array() && value.size() == 4) {
+        for (int c = 0; c < 4; ++c) {
+            if (!value[c].is_number()) return false;
+            rgba[c] = value[c].get<float>();
+        }
+        return true;
+    }
+    return false;
+}
+
+float number(const nlohmann::json& key, const char* field, float fallback) {
+    auto it = key.find(field);
+    return it != key.end() && it->is_number() ? it->get<float>() : fallback;
+}
+
+// Read the keys of one timeline into channel, in time order. fill writes
+// channel.width values for one key.
+template <typename Fill>
+bool readKeys(const nlohmann::json& keys, const std::string& what, RawChannel& channel, std::string& error,
+              Fill fill) {
+    if (!keys.is_array() || keys.empty()) {
+        error = what + ": expected a non-empty array of keys";
+        return false;
+    }
+    std::vector<std::pair<float, size_t>> order;
+    for (size_t k = 0; k < keys.size(); ++k) {
+        if (!keys[k].is_object()) {
+            error = what + ": key " + std::to_string(k) + " is not an object";
+            return false;
+        }
+        float time = number(keys[k], "time", 0);
+        if (!std::isfinite(time) || time < 0) {
+            error = what + ": key " + std::to_string(k) + " has a bad time";
+            return false;
+        }
+        order.emplace_back(time, k);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) {
+        return a.first < b.first;
+    });
+    channel.values.assign(order.size() * channel.width, 0.0f);
+    for (size_t i = 0; i < order.size(); ++i) {
+        const nlohmann::json& key = keys[order[i].second];
+        channel.times.push_back(order[i].first);
+        auto curve = key.find("curve");
+        channel.stepped.push_back(curve != key.end() && *curve == "stepped");
+        if (!fill(key, channel.values.data() + i * channel.width)) {
+            error = what + ": key " + std::to_string(order[i].second) + " has a bad value";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Group channels by key times (and stepping), in order of first use, and
+// lay them out as AnimationClip stores them.
+void groupChannels(const std::vector<RawChannel>& raw, std::vector<AnimationClip::Channel>& channels,
+                   std::vector<AnimationClip::KeyGroup>& groups, std::vector<float>& times,
+                   std::vector<uint8_t>& stepped, std::vector<float>& values) {
+    std::map<std::pair<std::vector<float>, std::vector<uint8_t>>, size_t> groupOf;
+    std::vector<std::vector<size_t>> members;
+    for (size_t c = 0; c < raw.size(); ++c) {
+        auto found = groupOf.emplace(std::make_pair(raw[c].times, raw[c].stepped), members.size());
+        if (found.second) members.emplace_back();
+        members[found.first->second].push_back(c);
+    }
+    uint32_t lanes = 0;
+    for (const std::vector<size_t>& group : members) {
+        const RawChannel& first = raw[group.front()];
+        AnimationClip::KeyGroup g;
+        g.firstKey = (uint32_t)times.size();
+        g.keyCount = (uint32_t)first.times.size();
+        g.firstValue = (uint32_t)values.size();
+        g.firstLane = lanes;
+        g.laneCount = 0;
+        for (size_t c : group) {
+            channels.push_back({ raw[c].kind, raw[c].target, g.firstLane + g.laneCount, raw[c].width });
+            g.laneCount += raw[c].width;
+        }
+        times.insert(times.end(), first.times.begin(), first.times.end());
+        stepped.insert(stepped.end(), first.stepped.begin(), first.stepped.end());
+        for (uint32_t k = 0; k < g.keyCount; ++k) {
+            for (size_t c : group) {
+                const float* key = &raw[c].values[k * raw[c].width];
+                values.insert(values.end(), key, key + raw[c].width);
+            }
+        }
+        lanes += g.laneCount;
+        groups.push_back(g);
+    }
+}
+
+// Keys of channel to keep so that straight lines between them stay within
+// budget (per lane) at every key dropped: greedily, from each kept key as
+// far as possible. Stepped keys, and the key after one, are always kept.
+std::vector<uint32_t> reduceKeys(const RawChannel& channel, const float* budget) {
+    const float* t = channel.times.data();
+    const float* v = channel.values.data();
+    const uint32_t count = (uint32_t)channel.times.size(), width = channel.width;
+    std::vector<uint32_t> kept(1, 0);
+    for (uint32_t a = 0; a + 1 < count;) {
+        uint32_t b = a + 1;
+        while (!channel.stepped[a] && b + 1 < count && b - a < kMaxSpan && !channel.stepped[b]) {
+            uint32_t c = b + 1;
+            if (!(t[c] > t[a])) break;
+            bool fits = true;
+            for (uint32_t i = a + 1; i < c && fits; ++i) {
+                float f = (t[i] - t[a]) / (t[c] - t[a]);
+                const float *va = v + (size_t)a * width, *vc = v + (size_t)c * width, *vi = v + (size_t)i * width;
+                for (uint32_t l = 0; l < width; ++l) {
+                    if (std::fabs(va[l] + (vc[l] - va[l]) * f - vi[l]) > budget[l]) {
+                        fits = false;
+                        break;
+                    }
+                }
+            }
+            if (!fits) break;
+            b = c;
+        }
+        kept.push_back(b);
+        a = b;
+    }
+    return kept;
+}
+
+} // namespace
+
+// AnimationClip implementation
+bool AnimationClip::compile(const nlohmann::json& clip, std::string& error) {
+    MW_TRACE_SCOPE("AnimationClip::compile");
+    *this = AnimationClip();
+    if (!clip.is_object()) {
+        error = "clip is not an object";
+        return false;
+    }
+    clipName = clip.value("name", std::string());
+    std::vector<RawChannel> raw;
+
+    auto section = [&](const char* field, const nlohmann::json*& out) {
+        auto it = clip.find(field);
+        out = it == clip.end() ? nullptr : &*it;
+        if (out && !out->is_object()) {
+            error = std::string(field) + " is not an object";
+            return false;
+        }
+        return true;
+    };
+    const nlohmann::json *boneSection, *deformSection, *slotSection;
+    if (!section("bones", boneSection) || !section("deform", deformSection) || !section("slots", slotSection)) {
+        return false;
+    }
+
+    if (boneSection) {
+        for (auto bone = boneSection->begin(); bone != boneSection->end(); ++bone) {
+            if (!bone->is_object()) {
+                error = "bone " + bone.key() + " is not an object";
+                return false;
+            }
+            uint32_t target = (uint32_t)bones.size();
+            bones.push_back(bone.key());
+            for (auto timeline = bone->begin(); timeline != bone->end(); ++timeline) {
+                std::string what = "bone " + bone.key() + " " + timeline.key();
+                RawChannel channel;
+                channel.target = target;
+                bool ok;
+                if (timeline.key() == "rotate") {
+                    channel.kind = ChannelKind::Rotate;
+                    channel.width = 1;
+                    ok = readKeys(*timeline, what, channel, error, [](const nlohmann::json& key, float* v) {
+                        v[0] = number(key, "angle", number(key, "value", 0));
+                        return true;
+                    });
+                    // Unwrap so every segment turns by at most half a turn.
+                    for (size_t k = 1; ok && k < channel.values.size(); ++k) {
+                        float delta = channel.values[k] - channel.values[k - 1];
+                        channel.values[k] -= 360.0f * std::round(delta / 360.0f);
+                    }
+                } else if (timeline.key() == "translate" || timeline.key() == "scale") {
+                    bool scale = timeline.key() == "scale";
+                    channel.kind = scale ? ChannelKind::Scale : ChannelKind::Translate;
+                    channel.width = 2;
+                    ok = readKeys(*timeline, what, channel, error, [scale](const nlohmann::json& key, float* v) {
+                        v[0] = number(key, "x", scale ? 1.0f : 0.0f);
+                        v[1] = number(key, "y", scale ? 1.0f : 0.0f);
+                        return true;
+                    });
+                } else {
+                    continue; // shear and the like are not supported
+                }
+                if (!ok) return false;
+                raw.push_back(std::move(channel));
+            }
+        }
+    }
+
+    if (deformSection) {
+        for (auto mesh = deformSection->begin(); mesh != deformSection->end(); ++mesh) {
+            std::string what = "deform " + mesh.key();
+            RawChannel channel;
+            channel.kind = ChannelKind::Deform;
+            channel.target = (uint32_t)meshes.size();
+            meshes.push_back(mesh.key());
+            // Keys hold offsets for a run of vertices; the rest stay at zero.
+            size_t width = 0;
+            if (mesh->is_array()) {
+                for (const auto& key : *mesh) {
+                    if (!key.is_object()) continue;
+                    size_t count = key.count("vertices") && key["vertices"].is_array() ? key["vertices"].size() : 0;
+                    float offset = number(key, "offset", 0);
+                    if (offset >= 0 && offset <= (float)kMaxDeformValues) width = std::max(width, (size_t)offset + count);
+                }
+            }
+            if (width > kMaxDeformValues) {
+                error = what + ": too many vertices";
+                return false;
+            }
+            channel.width = (uint32_t)((width + 1) & ~(size_t)1);
+            bool ok = readKeys(*mesh, what, channel, error, [](const nlohmann::json& key, float* v) {
+                auto vertices = key.find("vertices");
+                if (vertices == key.end()) return true;
+                float offset = number(key, "offset", 0);
+                if (!vertices->is_array() || !(offset >= 0 && offset <= (float)kMaxDeformValues)) return false;
+                for (size_t i = 0; i < vertices->size(); ++i) {
+                    if (!(*vertices)[i].is_number()) return false;
+                    v[(size_t)offset + i] = (*vertices)[i].get<float>();
+                }
+                return true;
+            });
+            if (!ok) return false;
+            if (channel.width) raw.push_back(std::move(channel));
+        }
+    }
+
+    if (slotSection) {
+        for (auto slot = slotSection->begin(); slot != slotSection->end(); ++slot) {
+            if (!slot->is_object()) {
+                error = "slot " + slot.key() + " is not an object";
+                return false;
+            }
+            auto color = slot->find("color");
+            if (color == slot->end()) continue;
+            RawChannel channel;
+            channel.kind = ChannelKind::Color;
+            channel.target = (uint32_t)slots.size();
+            channel.width = 4;
+            slots.push_back(slot.key());
+            bool ok = readKeys(*color, "slot " + slot.key() + " color", channel, error,
+                               [](const nlohmann::json& key, float* v) {
+                                   auto value = key.find("color");
+                                   return value != key.end() && parseColor(*value, v);
+                               });
+            if (!ok) return false;
+            raw.push_back(std::move(channel));
+        }
+    }
+
+    groupChannels(raw, channelList, groupList, times, stepped, values);
+    for (const KeyGroup& g : groupList) {
+        lanes += g.laneCount;
+        length = std::max(length, times[g.firstKey + g.keyCount - 1]);
+    }
+    length = std::max(length, number(clip, "duration", 0));
+    keys = times.size();
+    return true;
+}
+
+void AnimationClip::compress(const ClipTolerance& tolerance) {
+    MW_TRACE_SCOPE("AnimationClip::compress");
+    if (compressed()) return;
+    const float byKind[] = { tolerance.rotate, tolerance.translate, tolerance.scale, tolerance.deform,
+                             tolerance.color };
+
+    // Reduce every channel on its own, then regroup the survivors: channels
+    // that keep the same keys share a group again. reduceKeys always keeps
+    // the first and last key, so a constant channel shrinks to those two and
+    // shares a group with every other constant channel of the same span.
+    std::vector<uint32_t> groupOfLane(lanes);
+    for (uint32_t g = 0; g < groupList.size(); ++g) {
+        std::fill_n(groupOfLane.begin() + groupList[g].firstLane, groupList[g].laneCount, g);
+    }
+    std::vector<RawChannel> reduced;
+    for (const Channel& c : channelList) {
+        const KeyGroup& group = groupList[groupOfLane[c.lane]];
+        RawChannel channel;
+        channel.kind = c.kind;
+        channel.target = c.target;
+        channel.width = c.width;
+        channel.times.assign(&times[group.firstKey], &times[group.firstKey] + group.keyCount);
+        channel.stepped.assign(&stepped[group.firstKey], &stepped[group.firstKey] + group.keyCount);
+        for (uint32_t k = 0; k < group.keyCount; ++k) {
+            const float* key = &values[group.firstValue + (size_t)k * group.laneCount + (c.lane - group.firstLane)];
+            channel.values.insert(channel.values.end(), key, key + c.width);
+        }
+        // Quantization takes up to half a step of the tolerance, over the
+        // lane's range; reduction gets the rest.
+        std::vector<float> budget(c.width);
+        for (uint32_t l = 0; l < c.width; ++l) {
+            float mn = channel.values[l], mx = mn;
+            for (uint32_t k = 1; k < group.keyCount; ++k) {
+                mn = std::min(mn, channel.values[(size_t)k * c.width + l]);
+                mx = std::max(mx, channel.values[(size_t)k * c.width + l]);
+            }
+            budget[l] = std::max(byKind[(int)c.kind] - (mx - mn) / 65535.0f * 0.5f, 0.0f);
+        }
+        std::vector<uint32_t> kept = reduceKeys(channel, budget.data());
+        if (kept.size() < group.keyCount) {
+            RawChannel fewer = channel;
+            fewer.times.clear();
+            fewer.stepped.clear();
+            fewer.values.clear();
+            for (uint32_t k : kept) {
+                fewer.times.push_back(channel.times[k]);
+                fewer.stepped.push_back(channel.stepped[k]);
+                const float* key = &channel.values[(size_t)k * c.width];
+                fewer.values.insert(fewer.values.end(), key, key + c.width);
+            }
+            channel = std::move(fewer);
+        }
+        reduced.push_back(std::move(channel));
+    }
+    std::vector<Channel> channels;
+    std::vector<KeyGroup> groups;
+    std::vector<float> keyTimes, keyValues;
+    std::vector<uint8_t> keySteps;
+    groupChannels(reduced, channels, groups, keyTimes, keySteps, keyValues);
+
+    // 16 bits per value over each lane's range within its group.
+    BlockWriter out(lanes);
+    for (const KeyGroup& group : groups) {
+        const float* v = &keyValues[group.firstValue];
+        std::vector<float> lo(group.laneCount), step(group.laneCount);
+        for (uint32_t l = 0; l < group.laneCount; ++l) {
+            float mn = v[l], mx = v[l];
+            for (uint32_t k = 1; k < group.keyCount; ++k) {
+                mn = std::min(mn, v[(size_t)k * group.laneCount + l]);
+                mx = std::max(mx, v[(size_t)k * group.laneCount + l]);
+            }
+            lo[l] = mn;
+            step[l] = (mx - mn) / 65535.0f;
+        }
+        out.group(group, &keyTimes[group.firstKey], &keySteps[group.firstKey], v, lo.data(), step.data());
+    }
+    std::vector<uint8_t> block = out.finish(*this, channels);
+    std::string error;
+    load(block.data(), block.size(), error); // cannot fail on a block just written
+}
+
+bool AnimationClip::load(const void* data, size_t size, std::string& error) {
+    MW_TRACE_SCOPE("AnimationClip::load");
+    AnimationClip clip;
+    const uint8_t* bytes = (const uint8_t*)data;
+    ClipBlockHeader header;
+    if (size < sizeof(header)) {
+        error = "clip block is truncated";
+        return false;
+    }
+    memcpy(&header, bytes, sizeof(header));
+    if (memcmp(header.magic, kClipMagic, sizeof(header.magic)) != 0) {
+        error = "not a clip block";
+        return false;
+    }
+    if (header.byteOrder != kByteOrderMark) {
+        error = "clip block has the other byte order";
+        return false;
+    }
+    if (header.version != kClipVersion) {
+        error = "clip block version " + std::to_string(header.version) + " is not supported";
+        return false;
+    }
+    BlockLayout layout(header);
+    if (layout.end > size || !std::isfinite(header.duration)) {
+        error = "clip block is truncated";
+        return false;
+    }
+
+    // Names: the clip's, then bones, meshes and slots.
+    size_t at = layout.names, namesEnd = layout.names + header.nameBytes;
+    auto readName = [&](std::string& name) {
+        uint16_t length;
+        if (namesEnd - at < sizeof(length)) return false;
+        memcpy(&length, bytes + at, sizeof(length));
+        at += sizeof(length);
+        if (namesEnd - at < length) return false;
+        name.assign((const char*)bytes + at, length);
+        at += length;
+        return true;
+    };
+    // Every name takes at least its length field.
+    if (((uint64_t)header.boneCount + header.meshCount + header.slotCount + 1) * sizeof(uint16_t) > header.nameBytes) {
+        error = "clip block names are damaged";
+        return false;
+    }
+    clip.bones.resize(header.boneCount);
+    clip.meshes.resize(header.meshCount);
+    clip.slots.resize(header.slotCount);
+    bool namesOk = readName(clip.clipName);
+    for (auto* list : { &clip.bones, &clip.meshes, &clip.slots }) {
+        for (size_t i = 0; namesOk && i < list->size(); ++i) namesOk = readName((*list)[i]);
+    }
+    if (!namesOk) {
+        error = "clip block names are damaged";
+        return false;
+    }
+
+    const uint32_t targetCounts[] = { header.boneCount, header.boneCount, header.boneCount, header.meshCount,
+                                      header.slotCount };
+    clip.channelList.resize(header.channelCount);
+    for (uint32_t c = 0; c < header.channelCount; ++c) {
+        ChannelRecord r;
+        memcpy(&r, bytes + layout.channels + c * sizeof(r), sizeof(r));
+        if (r.kind > (uint8_t)ChannelKind::Color || r.target >= targetCounts[r.kind] ||
+            (uint64_t)r.lane + r.width > header.laneCount) {
+            error = "clip block channel " + std::to_string(c) + " is damaged";
+            return false;
+        }
+        clip.channelList[c] = { (ChannelKind)r.kind, r.target, r.lane, r.width };
+    }
+    clip.groupList.resize(header.groupCount);
+    const float* times = (const float*)(bytes + layout.times);
+    for (uint32_t g = 0; g < header.groupCount; ++g) {
+        KeyGroup& group = clip.groupList[g];
+        memcpy(&group, bytes + layout.groups + g * sizeof(group), sizeof(group));
+        bool ok = group.keyCount > 0 && (uint64_t)group.firstKey + group.keyCount <= header.keyCount &&
+                  (uint64_t)group.firstLane + group.laneCount <= header.laneCount &&
+                  (uint64_t)group.firstValue + (uint64_t)group.keyCount * group.laneCount <= header.valueCount;
+        // The key search needs ordered times.
+        float previous = 0;
+        for (uint32_t k = 0; ok && k < group.keyCount; ++k) {
+            float time;
+            memcpy(&time, times + group.firstKey + k, sizeof(time));
+            ok = std::isfinite(time) && (k == 0 || time >= previous);
+            previous = time;
+        }
+        if (!ok) {
+            error = "clip block key group " + std::to_string(g) + " is damaged";
+            return false;
+        }
+    }
+
+    clip.length = header.duration;
+    clip.lanes = header.laneCount;
+    clip.keys = header.keyCount;
+    clip.packed.assign(bytes, bytes + layout.end);
+    clip.rangeOffset = layout.ranges;
+    clip.timeOffset = layout.times;
+    clip.stepOffset = layout.steps;
+    clip.valueOffset = layout.values;
+    *this = std::move(clip);
+    return true;
+}
+
+size_t AnimationClip::memoryBytes() const {
+    size_t names = 0;
+    for (const auto* list : { &bones, &meshes, &slots }) {
+        for (const std::string& name : *list) names += sizeof(std::string) + name.capacity();
+    }
+    return sizeof(*this) + names + channelList.capacity() * sizeof(Channel) +
+           groupList.capacity() * sizeof(KeyGroup) + times.capacity() * sizeof(float) + stepped.capacity() +
+           values.capacity() * sizeof(float) + packed.capacity();
+}
+
+void AnimationClip::sample(float time, ClipCursor& cursor, float* out) const {
+    if (cursor.keys.size() != groupList.size()) cursor.keys.assign(groupList.size(), 0);
+    const bool quantized = compressed();
+    const float* allTimes = quantized ? (const float*)(packed.data() + timeOffset) : times.data();
+    const uint8_t* allSteps = quantized ? packed.data() + stepOffset : stepped.data();
+    const float* laneMin = quantized ? (const float*)(packed.data() + rangeOffset) : nullptr;
+    const float* laneStep = quantized ? laneMin + lanes : nullptr;
+    const uint16_t* allValues = quantized ? (const uint16_t*)(packed.data() + valueOffset) : nullptr;
+    for (size_t g = 0; g < groupList.size(); ++g) {
+        const KeyGroup& group = groupList[g];
+        const float* keyTimes = allTimes + group.firstKey;
+        uint32_t k = findKey(keyTimes, group.keyCount, time, cursor.keys[g]);
+        cursor.keys[g] = k;
+        float* dst = out + group.firstLane;
+        const size_t row = group.firstValue + (size_t)k * group.laneCount;
+        float t = 0;
+        if (k + 1 < group.keyCount && time > keyTimes[k] && !allSteps[group.firstKey + k]) {
+            t = (time - keyTimes[k]) / (keyTimes[k + 1] - keyTimes[k]);
+        }
+        if (quantized) {
+            const uint16_t* a = allValues + row;
+            lerpQuantized(a, t > 0 ? a + group.laneCount : a, t, laneMin + group.firstLane, laneStep + group.firstLane,
+                          dst, group.laneCount);
+        } else if (t > 0) {
+            lerpLanes(&values[row], &values[row + group.laneCount], t, dst, group.laneCount);
+        } else {
+            std::copy(&values[row], &values[row] + group.laneCount, dst);
+        }
+    }
+}
+
+// ClipBinding implementation
+size_t ClipBinding::bind(const AnimationClip& clip, SceneStore& store, Entity root) {
+    MW_TRACE_SCOPE("ClipBinding::bind");
+    // First entity of each name under root, depth first.
+    std::unordered_map<std::string, Entity> anyByName, meshByName, spriteByName;
+    std::vector<Entity> stack;
+    if (store.alive(root)) stack.push_back(root);
+    while (!stack.empty()) {
+        Entity e = stack.back();
+        stack.pop_back();
+        const std::string& name = store.name(e);
+        anyByName.emplace(name, e);
+        if (store.meshes.has(e.index)) meshByName.emplace(name, e);
+        if (store.sprites.has(e.index)) spriteByName.emplace(name, e);
+        // Push children last to first so the first child is visited next.
+        size_t mark = stack.size();
+        for (Entity c = store.firstChild(e); c.valid(); c = store.nextSibling(c)) stack.push_back(c);
+        std::reverse(stack.begin() + mark, stack.end());
+    }
+
+    auto lookup = [](const std::unordered_map<std::string, Entity>& map, const std::string& name) {
+        auto it = map.find(name);
+        return it == map.end() ? Entity() : it->second;
+    };
+    const std::vector<AnimationClip::Channel>& channels = clip.channels();
+    targets.assign(channels.size(), Entity());
+    setup.assign(clip.laneCount(), 0.0f);
+    size_t missing = 0;
+    for (size_t c = 0; c < channels.size(); ++c) {
+        const AnimationClip::Channel& channel = channels[c];
+        switch (channel.kind) {
+        case ChannelKind::Rotate:
+        case ChannelKind::Translate:
+        case ChannelKind::Scale: {
+            Entity bone = lookup(anyByName, clip.boneNames()[channel.target]);
+            if (!bone.valid() || !store.transforms.has(bone.index)) break;
+            const Transform t = store.setupPose(bone);
+            float* s = &setup[channel.lane];
+            if (channel.kind == ChannelKind::Rotate) {
+                s[0] = t.rotation;
+            } else {
+                const cv::Point2f& p = channel.kind == ChannelKind::Translate ? t.position : t.scale;
+                s[0] = p.x;
+                s[1] = p.y;
+            }
+            targets[c] = bone;
+            break;
+        }
+        case ChannelKind::Deform:
+            targets[c] = lookup(meshByName, clip.meshNames()[channel.target]);
+            break;
+        case ChannelKind::Color:
+            targets[c] = lookup(spriteByName, clip.slotNames()[channel.target]);
+            break;
+        }
+        if (!targets[c].valid()) ++missing;
+    }
+    return missing;
+}
+
+void ClipBinding::apply(const AnimationClip& clip, const float* lanes, SceneStore& store, bool markDirty) const {
+    const std::vector<AnimationClip::Channel>& channels = clip.channels();
+    for (size_t c = 0; c < channels.size() && c < targets.size(); ++c) {
+        Entity target = targets[c];
+        if (!target.valid() || !store.alive(target)) continue;
+        const AnimationClip::Channel& channel = channels[c];
+        const float* v = lanes + channel.lane;
+        const float* s = &setup[channel.lane];
+        switch (channel.kind) {
+        case ChannelKind::Rotate:
+        case ChannelKind::Translate:
+        case ChannelKind::Scale: {
+            Transform* t = store.transforms.find(target.index);
+            if (!t) continue;
+            if (channel.kind == ChannelKind::Rotate) t->rotation = s[0] + v[0];
+            else if (channel.kind == ChannelKind::Translate) t->position = cv::Point2f(s[0] + v[0], s[1] + v[1]);
+            else t->scale = cv::Point2f(s[0] * v[0], s[1] * v[1]);
+            if (markDirty) store.markDirty(target);
+            break;
+        }
+        case ChannelKind::Deform: {
+            Mesh* mesh = store.meshes.find(target.index);
+            if (!mesh) continue;
+            size_t count = std::min<size_t>(channel.width / 2, mesh->vertices.size());
+            mesh->deformOffsets.resize(mesh->vertices.size());
+            for (size_t i = 0; i < mesh->vertices.size(); ++i) {
+                mesh->deformOffsets[i] = i < count ? cv::Point2f(v[i * 2], v[i * 2 + 1]) : cv::Point2f(0, 0);
+            }
+            break;
+        }
+        case ChannelKind::Color: {
+            SpriteData* sprite = store.sprites.find(target.index);
+            if (sprite) sprite->color = cv::Scalar(v[0], v[1], v[2], v[3]);
+            break;
+        }
+        }
+    }
+}
+
+void ClipBinding::restore(const AnimationClip& clip, SceneStore& store) const {
+    const std::vector<AnimationClip::Channel>& channels = clip.channels();
+    for (size_t c = 0; c < channels.size() && c < targets.size(); ++c) {
+        Entity target = targets[c];
+        if (!target.valid() || !store.alive(target)) continue;
+        switch (channels[c].kind) {
+        case ChannelKind::Rotate:
+        case ChannelKind::Translate:
+        case ChannelKind::Scale:
+            store.restoreSetupPose(target);
+            break;
+        case ChannelKind::Deform:
+            if (Mesh* mesh = store.meshes.find(target.index)) mesh->deformOffsets.clear();
+            break;
+        case ChannelKind::Color:
+            if (SpriteData* sprite = store.sprites.find(target.index)) sprite->color = cv::Scalar(1, 1, 1, 1);
+            break;
+        }
+    }
+}
+
+// ClipPlayer implementation
+size_t ClipPlayer::play(std::shared_ptr<const AnimationClip> clip, SceneStore& store, Entity root, bool loop) {
+    current = std::move(clip);
+    looping = loop;
+    if (!current) return 0;
+    size_t missing = binding.bind(*current, store, root);
+    sampled.assign(current->laneCount(), 0.0f);
+    cursor.keys.assign(current->groups().size(), 0);
+    sampleAt(0);
+    return missing;
+}
+
+void ClipPlayer::stop() {
+    current.reset();
+    playhead = 0;
+}
+
+void ClipPlayer::advance(float seconds) {
+    if (current) sampleAt(playhead + seconds);
+}
+
+void ClipPlayer::seek(float time) {
+    if (current) sampleAt(time);
+}
+
+void ClipPlayer::sampleAt(float time) {
+    float duration = current->duration();
+    if (looping && duration > 0) {
+        time = std::fmod(time, duration);
+        if (time < 0) time += duration;
+    } else {
+        time = std::min(std::max(time, 0.0f), duration);
+    }
+    playhead = time;
+    current->sample(time, cursor, sampled.data());
+}
+
+void ClipPlayer::apply(SceneStore& store, bool markDirty) const {
+    if (current) binding.apply(*current, sampled.data(), store, markDirty);
+}
+
+void ClipPlayer::restore(SceneStore& store) const {
+    if (current) binding.restore(*current, store);
+}
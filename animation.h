@@ -0,0 +1,172 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include "sceneStore.h"
+
+// What a channel animates, and how many values (lanes) it has per key:
+// Rotate 1 (degrees), Translate 2 and Scale 2 (x, y) on a bone, Deform 2
+// per vertex (x, y offsets) on a mesh, Color 4 (r, g, b, a in 0..1) on a
+// slot, i.e. a sprite.
+enum class ChannelKind : uint8_t { Rotate, Translate, Scale, Deform, Color };
+
+// Largest error AnimationClip::compress() may introduce on a channel, by
+// kind, in the channel's units. Lanes whose range is wider than 65535
+// times the tolerance are limited by 16-bit quantization instead.
+struct ClipTolerance {
+    float rotate = 0.05f;    // degrees
+    float translate = 0.05f; // pixels
+    float scale = 0.0005f;
+    float deform = 0.05f;    // pixels
+    float color = 0.002f;    // half a step of 8-bit color
+};
+
+// Per-playback search state of a clip: the key each group was last found
+// at, so playing forward finds the next key in a step or two.
+struct ClipCursor {
+    std::vector<uint32_t> keys; // by key group
+};
+
+// A clip compiled from its JSON into flat arrays for sampling. The JSON is
+// Spine-like, with times in seconds and values relative to the setup pose:
+//
+//   {"name": "walk", "duration": 1.0,
+//    "bones":  {"arm": {"rotate":    [{"time": 0, "angle": 10, "curve": "stepped"}, ...],
+//                       "translate": [{"time": 0, "x": 1, "y": 2}, ...],
+//                       "scale":     [{"time": 0, "x": 1, "y": 1}, ...]}},
+//    "deform": {"body": [{"time": 0, "offset": 4, "vertices": [dx, dy, ...]}, ...]},
+//    "slots":  {"body": {"color": [{"time": 0, "color": "ffffffff"}, ...]}}}
+//
+// Keys are linear unless stepped; Bezier curves are sampled as linear.
+// Rotations are unwrapped so that consecutive keys turn the short way.
+//
+// Channels keyed at the same times share a key group whose values are
+// stored key-major, so a baked clip with every bone keyed on every frame
+// is one key search and one SIMD lerp across all its bones.
+//
+// compress() drops keys each group can interpolate within tolerance and
+// stores values as 16 bits over per-lane ranges, in one relocatable block
+// (block()) that sample() reads in place. Offline, the block is saved as
+// is (see clipCompress) and load() takes it back.
+class AnimationClip {
+public:
+    struct Channel {
+        ChannelKind kind;
+        uint32_t target; // into boneNames(), meshNames() or slotNames() by kind
+        uint32_t lane;   // first of its lanes in the sampled output
+        uint32_t width;  // number of lanes
+    };
+    struct KeyGroup {
+        uint32_t firstKey;   // into the key times and stepped flags
+        uint32_t keyCount;
+        uint32_t firstValue; // keyCount rows of laneCount values
+        uint32_t firstLane;  // the group writes lanes [firstLane, firstLane + laneCount)
+        uint32_t laneCount;
+    };
+
+    // Replace this clip with clip; false with a reason if it is malformed.
+    bool compile(const nlohmann::json& clip, std::string& error);
+    void compress(const ClipTolerance& tolerance = ClipTolerance());
+    // Replace this clip with a block from block(); false with a reason if
+    // it is not one or is damaged.
+    bool load(const void* data, size_t size, std::string& error);
+    bool compressed() const { return !packed.empty(); }
+    const std::vector<uint8_t>& block() const { return packed; } // empty unless compressed
+
+    const std::string& name() const { return clipName; }
+    float duration() const { return length; }
+    size_t laneCount() const { return lanes; }
+    const std::vector<Channel>& channels() const { return channelList; }
+    const std::vector<KeyGroup>& groups() const { return groupList; }
+    const std::vector<std::string>& boneNames() const { return bones; }
+    const std::vector<std::string>& meshNames() const { return meshes; }
+    const std::vector<std::string>& slotNames() const { return slots; }
+    size_t keyCount() const { return keys; }
+    size_t memoryBytes() const; // heap used by the compiled clip
+
+    // Every lane at time, held at the first and last keys outside them.
+    // out has laneCount() floats; cursor is sized on first use.
+    void sample(float time, ClipCursor& cursor, float* out) const;
+
+private:
+    std::string clipName;
+    float length = 0;
+    size_t lanes = 0;
+    size_t keys = 0;
+    std::vector<std::string> bones, meshes, slots;
+    std::vector<Channel> channelList;
+    std::vector<KeyGroup> groupList;
+    // Uncompressed.
+    std::vector<float> times;     // per key
+    std::vector<uint8_t> stepped; // per key: hold its value until the next key
+    std::vector<float> values;    // per group, key-major
+    // Compressed: the block, and where its per-key and per-lane arrays are.
+    std::vector<uint8_t> packed;
+    size_t rangeOffset = 0; // float minimum per lane, then float step per lane
+    size_t timeOffset = 0;
+    size_t stepOffset = 0;
+    size_t valueOffset = 0; // uint16_t per value
+};
+
+// A clip's channels resolved to entities under one root, with the setup
+// pose they are relative to, taken when bound. Targets destroyed since are
+// skipped; rebind after renaming or adding entities.
+class ClipBinding {
+public:
+    // Targets are looked up by name in root's subtree, depth first; bones
+    // may be any entity, meshes and slots must have a mesh or a sprite.
+    // Bone channels are relative to the bones' SceneStore::setupPose(),
+    // captured here if it was not yet. Returns how many channels found no
+    // target; those are skipped.
+    size_t bind(const AnimationClip& clip, SceneStore& store, Entity root);
+    // Write sampled lanes (AnimationClip::sample) into the store. Transforms
+    // are written directly; with markDirty false the caller must mark them,
+    // e.g. SceneStore::markAllDirty() after posing from several threads.
+    void apply(const AnimationClip& clip, const float* lanes, SceneStore& store, bool markDirty = true) const;
+    // Undo apply(): bones back to their setup pose, deform offsets cleared
+    // and slot colors back to white.
+    void restore(const AnimationClip& clip, SceneStore& store) const;
+
+private:
+    std::vector<Entity> targets; // per channel, invalid when not found
+    std::vector<float> setup;      // per lane: setup rotation, position or scale; unused for the rest
+};
+
+// One clip playing on one skeleton. play() sizes every buffer, so advancing
+// and applying allocate nothing.
+class ClipPlayer {
+public:
+    // Returns the number of channels without a target, as ClipBinding::bind.
+    size_t play(std::shared_ptr<const AnimationClip> clip, SceneStore& store, Entity root, bool loop = true);
+    void stop();
+    // Put what the clip animates back in its setup pose (ClipBinding::restore).
+    void restore(SceneStore& store) const;
+    bool playing() const { return current != nullptr; }
+    const AnimationClip* clip() const { return current.get(); }
+
+    // Move the playhead (wrapping when looping, else holding at the end)
+    // and sample the clip there.
+    void advance(float seconds);
+    void seek(float time);
+    float time() const { return playhead; }
+    const float* lanes() const { return sampled.data(); }
+    void apply(SceneStore& store, bool markDirty = true) const;
+
+private:
+    void sampleAt(float time);
+
+    std::shared_ptr<const AnimationClip> current;
+    ClipBinding binding;
+    ClipCursor cursor;
+    std::vector<float> sampled;
+    float playhead = 0;
+    bool looping = true;
+};
+
+#endif // ANIMATION_H
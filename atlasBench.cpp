@@ -0,0 +1,84 @@
+// Atlas packer benchmark: packs synthetic sprite sets (random sizes with
+// transparent borders) and reports time, page count and occupancy.
+//
+// atlasBench [count ...] [--write]   --write saves bench.atlas and its pages
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "atlasPacker.h"
+
+using namespace std;
+
+vector<AtlasSprite> makeSprites(int count, unsigned seed) {
+    mt19937 rng(seed);
+    uniform_int_distribution<int> side(16, 256), border(0, 24);
+    vector<AtlasSprite> sprites(count);
+    for (int i = 0; i < count; ++i) {
+        int w = side(rng), h = side(rng) / (i % 3 + 1) + 8;
+        sprites[i].name = "sprite_" + to_string(i);
+        sprites[i].image = cv::Mat::zeros(h, w, CV_8UC4);
+        cv::Rect body(border(rng) % (w / 2), border(rng) % (h / 2), 0, 0);
+        body.width = max(1, w - body.x - border(rng) % (w / 2));
+        body.height = max(1, h - body.y - border(rng) % (h / 2));
+        sprites[i].image(body).setTo(cv::Scalar(i % 255, (i * 7) % 255, (i * 13) % 255, 255));
+    }
+    return sprites;
+}
+
+// Regions must stay inside their page and never overlap.
+bool verify(const Atlas& atlas) {
+    vector<cv::Rect> occupied;
+    for (const AtlasRegion& r : atlas.regions) {
+        cv::Rect onPage = r.rotated ? cv::Rect(r.bounds.x, r.bounds.y, r.bounds.height, r.bounds.width) : r.bounds;
+        const cv::Mat& page = atlas.pages[r.page].image;
+        if (onPage.x < 0 || onPage.y < 0 || onPage.x + onPage.width > page.cols || onPage.y + onPage.height > page.rows) {
+            return false;
+        }
+        occupied.push_back(cv::Rect(onPage.x + r.page * 1000000, onPage.y, onPage.width, onPage.height));
+    }
+    for (size_t i = 0; i < occupied.size(); ++i) {
+        for (size_t j = i + 1; j < occupied.size(); ++j) {
+            if (!(occupied[i] & occupied[j]).empty()) return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    vector<int> counts;
+    bool write = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--write") == 0) write = true;
+        else counts.push_back(atoi(argv[i]));
+    }
+    if (counts.empty()) counts = { 100, 1000, 4000 };
+
+    printf("OpenCV threads: %d\n", cv::getNumThreads());
+    for (int count : counts) {
+        vector<AtlasSprite> sprites = makeSprites(count, 42);
+        AtlasOptions options;
+        Atlas atlas;
+        string error;
+        auto start = chrono::steady_clock::now();
+        bool ok = packAtlas(sprites, options, "bench", atlas, error);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (!ok) {
+            printf("%5d sprites: %s\n", count, error.c_str());
+            continue;
+        }
+        int rotated = (int)count_if(atlas.regions.begin(), atlas.regions.end(), [](const AtlasRegion& r) { return r.rotated; });
+        printf("%5d sprites: %8.1f ms, %zu pages, %5.1f%% occupied, %d rotated, %s, %s\n", count, ms, atlas.pages.size(),
+               atlas.occupancy * 100, rotated, atlas.heuristic.c_str(), verify(atlas) ? "valid" : "OVERLAP");
+        if (write) {
+            for (const AtlasPage& page : atlas.pages) cv::imwrite(page.file, page.image);
+            ofstream("bench.atlas") << spineAtlasText(atlas);
+        }
+    }
+    return 0;
+}
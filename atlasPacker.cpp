@@ -0,0 +1,412 @@
+#include "atlasPacker.h"
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <memory>
+#include "spriteAlpha.h"
+#include "trace.h"
+
+namespace {
+
+// Sprite to place: the trimmed image grown by the padding on every side.
+struct Item {
+    int sprite;
+    int width;
+    int height;
+};
+
+struct Placement {
+    int page = -1;
+    cv::Rect cell;
+    bool rotated = false;
+};
+
+// MaxRects (Jylanki, "A Thousand Ways to Pack the Bin"): keeps every maximal
+// free rectangle and places each item in the one that scores best.
+class MaxRectsBin {
+public:
+    enum Heuristic { ShortSide, LongSide, Area, BottomLeft };
+
+    MaxRectsBin(int width, int height, Heuristic heuristic, bool rotate)
+        : heuristic(heuristic), allowRotate(rotate) {
+        freeRects.push_back(cv::Rect(0, 0, width, height));
+    }
+
+    bool insert(int w, int h, cv::Rect& out, bool& rotated) {
+        long bestPrimary = LONG_MAX, bestSecondary = LONG_MAX;
+        bool found = false;
+        for (const cv::Rect& f : freeRects) {
+            for (int turn = 0; turn < (allowRotate && w != h ? 2 : 1); ++turn) {
+                int rw = turn ? h : w, rh = turn ? w : h;
+                if (rw > f.width || rh > f.height) continue;
+                long primary, secondary;
+                score(f, rw, rh, primary, secondary);
+                if (primary < bestPrimary || (primary == bestPrimary && secondary < bestSecondary)) {
+                    bestPrimary = primary;
+                    bestSecondary = secondary;
+                    out = cv::Rect(f.x, f.y, rw, rh);
+                    rotated = turn == 1;
+                    found = true;
+                }
+            }
+        }
+        if (found) place(out);
+        return found;
+    }
+
+private:
+    void score(const cv::Rect& f, int w, int h, long& primary, long& secondary) const {
+        long dx = f.width - w, dy = f.height - h;
+        switch (heuristic) {
+        case ShortSide:
+            primary = std::min(dx, dy);
+            secondary = std::max(dx, dy);
+            break;
+        case LongSide:
+            primary = std::max(dx, dy);
+            secondary = std::min(dx, dy);
+            break;
+        case Area:
+            primary = (long)f.width * f.height - (long)w * h;
+            secondary = std::min(dx, dy);
+            break;
+        default:
+            primary = f.y + h;
+            secondary = f.x;
+            break;
+        }
+    }
+
+    // Split every free rectangle the new one overlaps into the up to four
+    // maximal pieces around it, then drop pieces contained in others. The
+    // untouched rectangles were already maximal among themselves, so only
+    // the new pieces need checking.
+    void place(const cv::Rect& used) {
+        std::vector<cv::Rect> pieces;
+        size_t kept = 0;
+        for (size_t i = 0; i < freeRects.size(); ++i) {
+            const cv::Rect f = freeRects[i];
+            if ((f & used).empty()) {
+                freeRects[kept++] = f;
+                continue;
+            }
+            if (used.x > f.x) pieces.push_back(cv::Rect(f.x, f.y, used.x - f.x, f.height));
+            if (used.x + used.width < f.x + f.width) {
+                pieces.push_back(cv::Rect(used.x + used.width, f.y, f.x + f.width - used.x - used.width, f.height));
+            }
+            if (used.y > f.y) pieces.push_back(cv::Rect(f.x, f.y, f.width, used.y - f.y));
+            if (used.y + used.height < f.y + f.height) {
+                pieces.push_back(cv::Rect(f.x, used.y + used.height, f.width, f.y + f.height - used.y - used.height));
+            }
+        }
+        freeRects.resize(kept);
+
+        auto contains = [](const cv::Rect& a, const cv::Rect& b) {
+            return b.x >= a.x && b.y >= a.y && b.x + b.width <= a.x + a.width && b.y + b.height <= a.y + a.height;
+        };
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            bool redundant = false;
+            for (const cv::Rect& f : freeRects) {
+                if (contains(f, pieces[i])) {
+                    redundant = true;
+                    break;
+                }
+            }
+            for (size_t j = 0; j < pieces.size() && !redundant; ++j) {
+                // Of two equal pieces keep the first.
+                if (j != i && contains(pieces[j], pieces[i]) && (pieces[j] != pieces[i] || j < i)) redundant = true;
+            }
+            if (redundant) continue;
+            freeRects.erase(std::remove_if(freeRects.begin(), freeRects.end(),
+                                           [&](const cv::Rect& f) { return contains(pieces[i], f); }),
+                            freeRects.end());
+            freeRects.push_back(pieces[i]);
+        }
+    }
+
+    Heuristic heuristic;
+    bool allowRotate;
+    std::vector<cv::Rect> freeRects;
+};
+
+// Skyline bottom-left: tracks only the top edge of the packed area. Faster
+// than MaxRects and better on sprites of similar height.
+class SkylineBin {
+public:
+    SkylineBin(int width, int height, bool rotate) : width(width), height(height), allowRotate(rotate) {
+        skyline.push_back({ 0, 0, width });
+    }
+
+    bool insert(int w, int h, cv::Rect& out, bool& rotated) {
+        int bestTop = INT_MAX, bestWidth = INT_MAX;
+        size_t bestNode = 0;
+        bool found = false;
+        for (int turn = 0; turn < (allowRotate && w != h ? 2 : 1); ++turn) {
+            int rw = turn ? h : w, rh = turn ? w : h;
+            for (size_t i = 0; i < skyline.size(); ++i) {
+                int y;
+                if (!fits(i, rw, rh, y)) continue;
+                if (y + rh < bestTop || (y + rh == bestTop && skyline[i].width < bestWidth)) {
+                    bestTop = y + rh;
+                    bestWidth = skyline[i].width;
+                    bestNode = i;
+                    out = cv::Rect(skyline[i].x, y, rw, rh);
+                    rotated = turn == 1;
+                    found = true;
+                }
+            }
+        }
+        if (found) add(bestNode, out);
+        return found;
+    }
+
+private:
+    struct Node {
+        int x, y, width;
+    };
+
+    bool fits(size_t i, int w, int h, int& y) const {
+        int x = skyline[i].x;
+        if (x + w > width) return false;
+        y = skyline[i].y;
+        for (int left = w; left > 0; ++i) {
+            y = std::max(y, skyline[i].y);
+            if (y + h > height) return false;
+            left -= skyline[i].width;
+        }
+        return true;
+    }
+
+    void add(size_t i, const cv::Rect& r) {
+        skyline.insert(skyline.begin() + i, { r.x, r.y + r.height, r.width });
+        for (size_t j = i + 1; j < skyline.size();) {
+            int overlap = skyline[j - 1].x + skyline[j - 1].width - skyline[j].x;
+            if (overlap <= 0) break;
+            skyline[j].x += overlap;
+            skyline[j].width -= overlap;
+            if (skyline[j].width > 0) break;
+            skyline.erase(skyline.begin() + j);
+        }
+        for (size_t j = 0; j + 1 < skyline.size();) {
+            if (skyline[j].y == skyline[j + 1].y) {
+                skyline[j].width += skyline[j + 1].width;
+                skyline.erase(skyline.begin() + j + 1);
+            }
+            else {
+                ++j;
+            }
+        }
+    }
+
+    int width, height;
+    bool allowRotate;
+    std::vector<Node> skyline;
+};
+
+struct Layout {
+    std::string heuristic;
+    std::vector<Placement> placements; // by sprite index
+    std::vector<cv::Size> pages;
+    double area = 0;
+    bool ok = false;
+};
+
+int nextPowerOfTwo(int v) {
+    int p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
+
+// Place items (largest first) on as many pages as needed; each item goes on
+// the first page with room.
+template <class MakeBin>
+Layout packPages(const std::vector<Item>& items, size_t spriteCount, const AtlasOptions& options, MakeBin makeBin) {
+    Layout layout;
+    layout.placements.resize(spriteCount);
+    std::vector<decltype(makeBin())> bins;
+    std::vector<cv::Size> extents;
+    for (const Item& item : items) {
+        Placement& p = layout.placements[item.sprite];
+        for (size_t page = 0; page < bins.size() && p.page < 0; ++page) {
+            if (bins[page]->insert(item.width, item.height, p.cell, p.rotated)) p.page = (int)page;
+        }
+        if (p.page < 0) {
+            bins.push_back(makeBin());
+            extents.push_back(cv::Size());
+            if (!bins.back()->insert(item.width, item.height, p.cell, p.rotated)) return layout;
+            p.page = (int)bins.size() - 1;
+        }
+        cv::Size& extent = extents[p.page];
+        extent.width = std::max(extent.width, p.cell.x + p.cell.width);
+        extent.height = std::max(extent.height, p.cell.y + p.cell.height);
+    }
+    for (cv::Size extent : extents) {
+        if (options.powerOfTwo) extent = cv::Size(nextPowerOfTwo(extent.width), nextPowerOfTwo(extent.height));
+        if (options.square) extent.width = extent.height = std::max(extent.width, extent.height);
+        extent.width = std::min(extent.width, options.maxPageSize);
+        extent.height = std::min(extent.height, options.maxPageSize);
+        layout.pages.push_back(extent);
+        layout.area += (double)extent.area();
+    }
+    layout.ok = true;
+    return layout;
+}
+
+} // namespace
+
+bool packAtlas(const std::vector<AtlasSprite>& sprites, const AtlasOptions& options, const std::string& baseName,
+               Atlas& atlas, std::string& error) {
+    MW_TRACE_SCOPE("packAtlas");
+    atlas = Atlas();
+    const int padding = std::max(0, options.padding);
+    const int margin = padding / 2; // cell edge to region edge
+    const int bleed = std::max(0, std::min(options.bleed, margin));
+    const int n = (int)sprites.size();
+
+    // Normalise to BGRA and trim, one sprite per task.
+    std::vector<cv::Mat> images(n);
+    std::vector<cv::Rect> trims(n);
+    cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            const cv::Mat& src = sprites[i].image;
+            if (src.channels() == 4) images[i] = src;
+            else if (src.channels() == 3) cv::cvtColor(src, images[i], cv::COLOR_BGR2BGRA);
+            else if (!src.empty()) cv::cvtColor(src, images[i], cv::COLOR_GRAY2BGRA);
+            cv::Rect full(0, 0, images[i].cols, images[i].rows);
+            trims[i] = options.trim ? analyzeAlpha(images[i], options.alphaThreshold).bounds : full;
+            // Keep fully transparent sprites as a single pixel so every
+            // attachment still has a region.
+            if (trims[i].empty()) trims[i] = cv::Rect(0, 0, 1, 1) & full;
+        }
+    });
+
+    std::vector<Item> items;
+    for (int i = 0; i < n; ++i) {
+        if (trims[i].empty()) {
+            error = "sprite '" + sprites[i].name + "' has no pixels";
+            return false;
+        }
+        Item item = { i, trims[i].width + padding, trims[i].height + padding };
+        int shortSide = std::min(item.width, item.height), longSide = std::max(item.width, item.height);
+        bool fits = options.rotate ? longSide <= options.maxPageSize && shortSide <= options.maxPageSize
+                                   : item.width <= options.maxPageSize && item.height <= options.maxPageSize;
+        if (!fits) {
+            error = "sprite '" + sprites[i].name + "' does not fit on a " + std::to_string(options.maxPageSize) + " page";
+            return false;
+        }
+        items.push_back(item);
+    }
+    std::stable_sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+        int am = std::max(a.width, a.height), bm = std::max(b.width, b.height);
+        return am != bm ? am > bm : std::min(a.width, a.height) > std::min(b.width, b.height);
+    });
+
+    // Every candidate packs the whole set; they are independent, so run them side by side.
+    const int size = options.maxPageSize;
+    const bool rotate = options.rotate;
+    std::vector<std::function<Layout()>> candidates;
+    const std::pair<const char*, MaxRectsBin::Heuristic> maxRects[] = {
+        { "maxrects-short-side", MaxRectsBin::ShortSide },
+        { "maxrects-long-side", MaxRectsBin::LongSide },
+        { "maxrects-area", MaxRectsBin::Area },
+        { "maxrects-bottom-left", MaxRectsBin::BottomLeft },
+    };
+    for (const auto& h : maxRects) {
+        candidates.push_back([&, h]() {
+            Layout layout = packPages(items, n, options, [&]() { return std::make_unique<MaxRectsBin>(size, size, h.second, rotate); });
+            layout.heuristic = h.first;
+            return layout;
+        });
+    }
+    candidates.push_back([&]() {
+        Layout layout = packPages(items, n, options, [&]() { return std::make_unique<SkylineBin>(size, size, rotate); });
+        layout.heuristic = "skyline-bottom-left";
+        return layout;
+    });
+    std::vector<Layout> layouts(candidates.size());
+    cv::parallel_for_(cv::Range(0, (int)candidates.size()), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) layouts[i] = candidates[i]();
+    }, (double)candidates.size());
+
+    const Layout* best = nullptr;
+    for (const Layout& layout : layouts) {
+        if (!layout.ok) continue;
+        if (!best || layout.pages.size() < best->pages.size() ||
+            (layout.pages.size() == best->pages.size() && layout.area < best->area)) {
+            best = &layout;
+        }
+    }
+    if (!best) {
+        error = "packing failed";
+        return false;
+    }
+    atlas.heuristic = best->heuristic;
+
+    for (size_t p = 0; p < best->pages.size(); ++p) {
+        AtlasPage page;
+        page.file = baseName + (p == 0 ? std::string() : "_" + std::to_string(p + 1)) + ".png";
+        page.image = cv::Mat::zeros(best->pages[p].height, best->pages[p].width, CV_8UC4);
+        atlas.pages.push_back(page);
+    }
+    double spriteArea = 0;
+    atlas.regions.resize(n);
+    for (int i = 0; i < n; ++i) {
+        const Placement& p = best->placements[i];
+        AtlasRegion& region = atlas.regions[i];
+        region.name = sprites[i].name;
+        region.page = p.page;
+        region.rotated = p.rotated;
+        region.trim = trims[i];
+        region.original = images[i].size();
+        region.bounds = cv::Rect(p.cell.x + margin, p.cell.y + margin, trims[i].width, trims[i].height);
+        spriteArea += (double)trims[i].area();
+    }
+    atlas.occupancy = best->area > 0 ? spriteArea / best->area : 0;
+
+    // Regions (with their bleed) never overlap, so they can be drawn concurrently.
+    cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            const AtlasRegion& region = atlas.regions[i];
+            cv::Mat pixels = images[i](region.trim);
+            if (region.rotated) {
+                cv::Mat turned;
+                cv::rotate(pixels, turned, cv::ROTATE_90_COUNTERCLOCKWISE);
+                pixels = turned;
+            }
+            if (bleed > 0) {
+                cv::Mat bordered;
+                cv::copyMakeBorder(pixels, bordered, bleed, bleed, bleed, bleed, cv::BORDER_REPLICATE);
+                pixels = bordered;
+            }
+            cv::Rect target(region.bounds.x - bleed, region.bounds.y - bleed, pixels.cols, pixels.rows);
+            pixels.copyTo(atlas.pages[region.page].image(target));
+        }
+    });
+    return true;
+}
+
+std::string spineAtlasText(const Atlas& atlas) {
+    std::string out;
+    for (size_t p = 0; p < atlas.pages.size(); ++p) {
+        const AtlasPage& page = atlas.pages[p];
+        if (p > 0) out += "\n";
+        out += page.file + "\n";
+        out += "size: " + std::to_string(page.image.cols) + ", " + std::to_string(page.image.rows) + "\n";
+        out += "filter: Linear, Linear\n";
+        for (const AtlasRegion& region : atlas.regions) {
+            if (region.page != (int)p) continue;
+            const cv::Rect& b = region.bounds;
+            out += region.name + "\n";
+            out += "bounds: " + std::to_string(b.x) + ", " + std::to_string(b.y) + ", " + std::to_string(b.width) + ", " +
+                   std::to_string(b.height) + "\n";
+            if (region.trim.size() != region.original) {
+                // Spine measures the offset from the bottom-left corner.
+                int bottom = region.original.height - region.trim.y - region.trim.height;
+                out += "offsets: " + std::to_string(region.trim.x) + ", " + std::to_string(bottom) + ", " +
+                       std::to_string(region.original.width) + ", " + std::to_string(region.original.height) + "\n";
+            }
+            if (region.rotated) out += "rotate: 90\n";
+        }
+    }
+    return out;
+}
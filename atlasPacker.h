@@ -0,0 +1,57 @@
+#ifndef ATLASPACKER_H
+#define ATLASPACKER_H
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+struct AtlasOptions {
+    int maxPageSize = 2048;   // pages never grow past this, extra sprites start a new page
+    int padding = 2;          // transparent pixels between regions
+    int bleed = 1;            // edge pixels repeated outward, at most padding / 2
+    bool trim = true;         // drop fully transparent borders
+    bool rotate = true;       // allow 90 degree rotation when it packs tighter
+    bool powerOfTwo = true;
+    bool square = false;
+    uint8_t alphaThreshold = 0; // alpha at or below this counts as transparent when trimming
+};
+
+struct AtlasSprite {
+    std::string name;  // region name, the attachment path in the skeleton
+    cv::Mat image;     // BGRA
+};
+
+// Placement of one sprite, in the conventions of Spine's .atlas format.
+struct AtlasRegion {
+    std::string name;
+    int page = 0;
+    cv::Rect bounds;   // position on the page; width/height are before rotation
+    bool rotated = false; // stored turned 90 degrees counter-clockwise
+    cv::Rect trim;     // the part of the source image that was kept
+    cv::Size original; // source image size
+};
+
+struct AtlasPage {
+    std::string file;
+    cv::Mat image;     // BGRA
+};
+
+struct Atlas {
+    std::vector<AtlasPage> pages;
+    std::vector<AtlasRegion> regions; // same order as the input sprites
+    std::string heuristic;            // packer that won
+    double occupancy = 0;             // sprite pixels / page pixels
+};
+
+// Trim, pack and render sprites into pages named baseName.png,
+// baseName_2.png... Several MaxRects heuristics and a skyline packer run in
+// parallel and the layout with the fewest, smallest pages is kept.
+bool packAtlas(const std::vector<AtlasSprite>& sprites, const AtlasOptions& options, const std::string& baseName,
+               Atlas& atlas, std::string& error);
+
+// The .atlas text describing atlas, as read by the Spine runtimes (4.x).
+std::string spineAtlasText(const Atlas& atlas);
+
+#endif // ATLASPACKER_H
@@ -0,0 +1,351 @@
+#include "base64.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BASE64_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(BASE64_X86) && !defined(_MSC_VER)
+#define BASE64_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BASE64_TARGET(isa)
+#endif
+
+namespace {
+
+const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+struct DecodeTable {
+    int8_t value[256];
+    DecodeTable() {
+        std::memset(value, -1, sizeof(value));
+        for (int i = 0; i < 64; ++i) value[(uint8_t)kAlphabet[i]] = (int8_t)i;
+    }
+};
+const DecodeTable kDecode;
+
+// Encode whole 3-byte groups; returns bytes consumed.
+size_t encodeScalar(const uint8_t* in, size_t length, char* out) {
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+        *out++ = kAlphabet[v >> 18];
+        *out++ = kAlphabet[(v >> 12) & 63];
+        *out++ = kAlphabet[(v >> 6) & 63];
+        *out++ = kAlphabet[v & 63];
+    }
+    return i;
+}
+
+// Encode the final 1 or 2 bytes with padding.
+void encodeTail(const uint8_t* in, size_t length, char* out) {
+    uint32_t v = (uint32_t)in[0] << 16 | (length > 1 ? (uint32_t)in[1] << 8 : 0);
+    out[0] = kAlphabet[v >> 18];
+    out[1] = kAlphabet[(v >> 12) & 63];
+    out[2] = length > 1 ? kAlphabet[(v >> 6) & 63] : '=';
+    out[3] = '=';
+}
+
+// Decode whole 4-char groups without padding; returns chars consumed or
+// (size_t)-1 on an invalid char.
+size_t decodeScalar(const char* in, size_t length, uint8_t* out) {
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        int a = kDecode.value[(uint8_t)in[i]], b = kDecode.value[(uint8_t)in[i + 1]];
+        int c = kDecode.value[(uint8_t)in[i + 2]], d = kDecode.value[(uint8_t)in[i + 3]];
+        if ((a | b | c | d) < 0) return (size_t)-1;
+        uint32_t v = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6 | (uint32_t)d;
+        *out++ = (uint8_t)(v >> 16);
+        *out++ = (uint8_t)(v >> 8);
+        *out++ = (uint8_t)v;
+    }
+    return i;
+}
+
+#ifdef BASE64_X86
+
+// Vector kernels after W. Mula and D. Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions". Bytes are regrouped into 6-bit indices
+// with one shuffle and two multiplies, then mapped to ASCII through a small
+// offset table; decoding runs the same steps backwards and validates with two
+// nibble lookups.
+
+BASE64_TARGET("ssse3")
+inline __m128i encodeReshuffle(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+BASE64_TARGET("ssse3")
+inline __m128i encodeTranslate(__m128i in) {
+    const __m128i lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i result = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(lut, result), in);
+}
+
+BASE64_TARGET("ssse3")
+size_t encodeSsse3(const uint8_t* in, size_t length, char* out) {
+    size_t i = 0;
+    // Each step reads 16 bytes but consumes 12.
+    for (; i + 16 <= length; i += 12, out += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_si128((__m128i*)out, encodeTranslate(encodeReshuffle(v)));
+    }
+    return i;
+}
+
+BASE64_TARGET("avx2")
+size_t encodeAvx2(const uint8_t* in, size_t length, char* out) {
+    const __m256i shuffle = _mm256_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    // Each step reads bytes [i, i + 28) and consumes 24, 12 per 128-bit lane.
+    for (; i + 28 <= length; i += 24, out += 32) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(in + i + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, shuffle);
+        const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        result = _mm256_add_epi8(_mm256_shuffle_epi8(lut, result), indices);
+        _mm256_storeu_si256((__m256i*)out, result);
+    }
+    return i;
+}
+
+BASE64_TARGET("ssse3")
+size_t decodeSsse3(const char* in, size_t length, uint8_t* out) {
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2F = _mm_set1_epi8(0x2f);
+    size_t i = 0;
+    // Each step consumes 16 chars and stores 16 bytes of which 12 are valid,
+    // so stop while the caller's buffer still has room for the overhang and
+    // leave the last (possibly padded) group to the scalar code.
+    for (; i + 24 <= length; i += 16, out += 12) {
+        __m128i str = _mm_loadu_si128((const __m128i*)(in + i));
+        const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask2F);
+        const __m128i loNibbles = _mm_and_si128(str, mask2F);
+        const __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+        const __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0) break;
+        const __m128i eq2F = _mm_cmpeq_epi8(str, mask2F);
+        str = _mm_add_epi8(str, _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles)));
+
+        const __m128i mergeAbBc = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+        __m128i packed = _mm_madd_epi16(mergeAbBc, _mm_set1_epi32(0x00011000));
+        packed = _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        _mm_storeu_si128((__m128i*)out, packed);
+    }
+    return i;
+}
+
+BASE64_TARGET("avx2")
+size_t decodeAvx2(const char* in, size_t length, uint8_t* out) {
+    const __m256i lutLo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask2F = _mm256_set1_epi8(0x2f);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t i = 0;
+    // 32 chars in, 32 bytes stored (24 valid); see decodeSsse3 for the margin.
+    for (; i + 44 <= length; i += 32, out += 24) {
+        __m256i str = _mm256_loadu_si256((const __m256i*)(in + i));
+        const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask2F);
+        const __m256i loNibbles = _mm256_and_si256(str, mask2F);
+        const __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        const __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        if (!_mm256_testz_si256(lo, hi)) break;
+        const __m256i eq2F = _mm256_cmpeq_epi8(str, mask2F);
+        str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles)));
+
+        const __m256i mergeAbBc = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        __m256i packed = _mm256_madd_epi16(mergeAbBc, _mm256_set1_epi32(0x00011000));
+        packed = _mm256_shuffle_epi8(packed, pack);
+        packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)out, packed);
+    }
+    return i;
+}
+
+enum class Isa { Scalar, Ssse3, Avx2 };
+
+Isa detectIsa() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool ssse3 = (info[2] & (1 << 9)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    return avx2 ? Isa::Avx2 : ssse3 ? Isa::Ssse3 : Isa::Scalar;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Isa::Avx2;
+    if (__builtin_cpu_supports("ssse3")) return Isa::Ssse3;
+    return Isa::Scalar;
+#endif
+}
+
+const Isa kIsa = detectIsa();
+
+#endif // BASE64_X86
+
+} // namespace
+
+const char* base64Implementation() {
+#ifdef BASE64_X86
+    if (kIsa == Isa::Avx2) return "avx2";
+    if (kIsa == Isa::Ssse3) return "ssse3";
+#endif
+    return "scalar";
+}
+
+size_t base64Encode(const uint8_t* data, size_t length, char* out) {
+    size_t i = 0;
+    char* o = out;
+#ifdef BASE64_X86
+    if (kIsa == Isa::Avx2) {
+        i = encodeAvx2(data, length, o);
+        o += i / 3 * 4;
+    }
+    if (kIsa != Isa::Scalar) {
+        size_t n = encodeSsse3(data + i, length - i, o);
+        i += n;
+        o += n / 3 * 4;
+    }
+#endif
+    size_t n = encodeScalar(data + i, length - i, o);
+    i += n;
+    o += n / 3 * 4;
+    if (i < length) {
+        encodeTail(data + i, length - i, o);
+        o += 4;
+    }
+    return (size_t)(o - out);
+}
+
+bool base64Decode(const char* text, size_t length, uint8_t* out, size_t& decodedLength) {
+    decodedLength = 0;
+    if (length % 4 != 0) return false;
+    if (length == 0) return true;
+
+    // The last group may carry padding; everything before it must not.
+    size_t padding = text[length - 1] == '=' ? (text[length - 2] == '=' ? 2 : 1) : 0;
+    size_t body = length - 4;
+
+    size_t i = 0;
+    uint8_t* o = out;
+#ifdef BASE64_X86
+    // The vector loops stop early at an invalid block and leave it to the
+    // scalar loop, which reports the error.
+    if (kIsa == Isa::Avx2) {
+        i = decodeAvx2(text, body, o);
+        o += i / 4 * 3;
+    }
+    if (kIsa != Isa::Scalar) {
+        size_t n = decodeSsse3(text + i, body - i, o);
+        i += n;
+        o += n / 4 * 3;
+    }
+#endif
+    size_t n = decodeScalar(text + i, body - i, o);
+    if (n == (size_t)-1) return false;
+    o += n / 4 * 3;
+
+    char last[4];
+    std::memcpy(last, text + body, 4);
+    for (size_t k = 4 - padding; k < 4; ++k) last[k] = 'A';
+    uint8_t tail[3];
+    if (decodeScalar(last, 4, tail) != 4) return false;
+    std::memcpy(o, tail, 3 - padding);
+    o += 3 - padding;
+
+    decodedLength = (size_t)(o - out);
+    return true;
+}
+
+std::string base64Encode(const std::vector<unsigned char>& data) {
+    std::string encoded(base64EncodedSize(data.size()), '\0');
+    if (!data.empty()) base64Encode(data.data(), data.size(), &encoded[0]);
+    return encoded;
+}
+
+bool base64Decode(const std::string& text, std::vector<unsigned char>& out) {
+    out.resize(base64DecodedMaxSize(text.size()));
+    size_t length = 0;
+    bool ok = base64Decode(text.data(), text.size(), out.data(), length);
+    out.resize(ok ? length : 0);
+    return ok;
+}
+
+size_t Base64Encoder::update(const uint8_t* data, size_t length, char* out) {
+    char* o = out;
+    // Complete a group started by the previous call.
+    if (carryLength > 0) {
+        uint8_t group[3] = { carry[0], carry[1], 0 };
+        size_t need = 3 - carryLength;
+        if (length < need) {
+            std::memcpy(carry + carryLength, data, length);
+            carryLength += length;
+            return 0;
+        }
+        std::memcpy(group + carryLength, data, need);
+        o += base64Encode(group, 3, o);
+        data += need;
+        length -= need;
+        carryLength = 0;
+    }
+
+    size_t whole = length / 3 * 3;
+    o += base64Encode(data, whole, o);
+    carryLength = length - whole;
+    std::memcpy(carry, data + whole, carryLength);
+    return (size_t)(o - out);
+}
+
+size_t Base64Encoder::finish(char* out) {
+    size_t n = carryLength ? base64Encode(carry, carryLength, out) : 0;
+    carryLength = 0;
+    return n;
+}
@@ -0,0 +1,52 @@
+#ifndef BASE64_H
+#define BASE64_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Base64 (RFC 4648, standard alphabet, '=' padding).
+//
+// Encoding and decoding use AVX2 or SSSE3 when the CPU has them, picked once
+// at runtime, with a scalar fallback. All functions write into a buffer the
+// caller has already sized, so large payloads are produced without any
+// per-character appends.
+
+inline size_t base64EncodedSize(size_t length) { return (length + 2) / 3 * 4; }
+inline size_t base64DecodedMaxSize(size_t length) { return (length + 3) / 4 * 3; }
+
+// Encode length bytes into out, which must hold base64EncodedSize(length)
+// chars. Returns the number of chars written.
+size_t base64Encode(const uint8_t* data, size_t length, char* out);
+
+// Decode into out, which must hold base64DecodedMaxSize(length) bytes.
+// Returns false on invalid input; decodedLength receives the byte count.
+bool base64Decode(const char* text, size_t length, uint8_t* out, size_t& decodedLength);
+
+std::string base64Encode(const std::vector<unsigned char>& data);
+bool base64Decode(const std::string& text, std::vector<unsigned char>& out);
+
+// Name of the code path in use: "avx2", "ssse3" or "scalar".
+const char* base64Implementation();
+
+// Incremental encoder for payloads produced or sent in pieces. Up to two
+// input bytes are carried between calls so chunk sizes need not be
+// multiples of three.
+class Base64Encoder {
+public:
+    // Upper bound of chars update() can write for a chunk of length bytes.
+    size_t maxOutput(size_t length) const { return base64EncodedSize(carryLength + length); }
+
+    size_t update(const uint8_t* data, size_t length, char* out);
+    // Flush the carried bytes with padding; writes at most 4 chars.
+    size_t finish(char* out);
+
+private:
+    uint8_t carry[2] = { 0, 0 };
+    size_t carryLength = 0;
+};
+
+#endif // BASE64_H
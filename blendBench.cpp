@@ -0,0 +1,263 @@
+// Animation graph benchmark: a crowd of characters with 200-bone skeletons
+// running a graph with an idle / walk-run blend state machine and a masked
+// additive breathing layer, changing speed every frame and crossfading
+// between the states. Reports update cost serially and as the pose stage
+// of a SceneUpdate, checks that updating allocates nothing, and checks
+// blends, fades and the additive layer against the clips sampled directly.
+//
+// blendBench [characters] [bones] [frames]
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+#include "animGraph.h"
+#include "sceneUpdate.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Heap allocations, to check that updates make none.
+static atomic<size_t> allocations(0);
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+double msSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// A cycle of duration seconds keyed at 30 fps on every bone; bones at or
+// past firstBone only.
+json cycleClip(const string& name, int bones, int firstBone, float duration, float amplitude, mt19937& rng) {
+    uniform_real_distribution<float> phase(0, 6.28f);
+    json timelines = json::object();
+    int keys = (int)lround(duration * 30);
+    for (int b = firstBone; b < bones; ++b) {
+        json rotate = json::array(), translate = json::array(), scale = json::array();
+        float p = phase(rng);
+        for (int k = 0; k <= keys; ++k) {
+            float t = k / 30.0f, a = 6.2832f * k / keys + p;
+            rotate.push_back({ {"time", t}, {"angle", amplitude * sin(a)} });
+            translate.push_back({ {"time", t}, {"x", 0.1f * amplitude * cos(a)}, {"y", 0.05f * amplitude * sin(a)} });
+            scale.push_back({ {"time", t}, {"x", 1 + 0.002f * amplitude * sin(a)}, {"y", 1.0f} });
+        }
+        timelines["bone_" + to_string(b)] = { {"rotate", rotate}, {"translate", translate}, {"scale", scale} };
+    }
+    return { {"name", name}, {"bones", timelines} };
+}
+
+// Pose bone of each bone_<i>, from the first character.
+vector<int> poseBone;
+
+// Pose of one clip at time, in the graph's layout, for checking.
+vector<float> clipPose(const AnimationClip& clip, float time, int bones) {
+    vector<float> lanes(clip.laneCount()), pose(bones * 5, 0.0f);
+    fill(pose.begin() + bones * 3, pose.end(), 1.0f);
+    ClipCursor cursor;
+    clip.sample(time, cursor, lanes.data());
+    for (const AnimationClip::Channel& c : clip.channels()) {
+        int b = poseBone[atoi(clip.boneNames()[c.target].c_str() + 5)];
+        int section = c.kind == ChannelKind::Rotate ? 0 : c.kind == ChannelKind::Translate ? 1 : 3;
+        for (uint32_t l = 0; l < c.width; ++l) pose[(section + l) * bones + b] = lanes[c.lane + l];
+    }
+    return pose;
+}
+
+float maxDifference(const vector<float>& expected, const float* pose, int bones) {
+    float worst = 0;
+    for (int i = 0; i < bones * 5; ++i) {
+        float d = fabs(expected[i] - pose[i]);
+        if (i < bones) d = fabs(d - 360.0f * round(d / 360.0f)); // angles modulo a turn
+        worst = max(worst, d);
+    }
+    return worst;
+}
+
+int main(int argc, char** argv) {
+    int characters = argc > 1 ? atoi(argv[1]) : 300;
+    int boneCount = argc > 2 ? atoi(argv[2]) : 200;
+    int frames = argc > 3 ? atoi(argv[3]) : 120;
+    mt19937 rng(11);
+
+    // Walk and run cycles of different lengths, breathing on the upper half.
+    json clipJson[4] = { cycleClip("idle", boneCount, 0, 2.0f, 5, rng), cycleClip("walk", boneCount, 0, 1.0f, 30, rng),
+                         cycleClip("run", boneCount, 0, 0.6f, 60, rng),
+                         cycleClip("breathe", boneCount, boneCount / 2, 3.0f, 8, rng) };
+    vector<shared_ptr<AnimationClip>> clips;
+    for (const json& c : clipJson) {
+        clips.push_back(make_shared<AnimationClip>());
+        string error;
+        if (!clips.back()->compile(c, error)) {
+            printf("compile failed: %s\n", error.c_str());
+            return 1;
+        }
+    }
+    json mask = json::object();
+    for (int b = boneCount / 2; b < boneCount; ++b) mask["bone_" + to_string(b)] = 1;
+    json graphJson = {
+        {"parameters", { {"speed", 0} }},
+        {"layers", json::array({
+            { {"name", "base"}, {"states", json::array({
+                { {"name", "idle"}, {"clip", "idle"} },
+                { {"name", "move"}, {"blend", { {"parameter", "speed"}, {"motions", json::array({
+                    { {"threshold", 1}, {"clip", "walk"} }, { {"threshold", 3}, {"clip", "run"} } })} }} } })} },
+            { {"name", "breathe"}, {"mode", "additive"}, {"weight", 0.5}, {"mask", mask},
+              {"states", json::array({ { {"name", "breathe"}, {"clip", "breathe"} } })} } })} };
+    auto graph = make_shared<AnimationGraph>();
+    string error;
+    if (!graph->load(graphJson, [&](const string& name) -> shared_ptr<const AnimationClip> {
+            for (auto& c : clips) if (c->name() == name) return c;
+            return nullptr;
+        }, error)) {
+        printf("graph failed: %s\n", error.c_str());
+        return 1;
+    }
+
+    // Characters: chains of 20 bones under a root each.
+    SceneStore store;
+    vector<Entity> roots;
+    for (int c = 0; c < characters; ++c) {
+        Entity root = store.create("character_" + to_string(c));
+        Entity parent = root;
+        for (int b = 0; b < boneCount; ++b) {
+            Entity bone = store.create("bone_" + to_string(b));
+            store.setParent(bone, parent);
+            store.setPosition(bone, cv::Point2f(5, 0));
+            store.bones.add(bone.index);
+            parent = b % 20 == 19 ? root : bone;
+        }
+        roots.push_back(root);
+    }
+    store.update();
+    vector<AnimationGraphInstance> instances(characters);
+    for (int i = 0; i < characters; ++i) {
+        if (instances[i].bind(graph, store, roots[i])) {
+            printf("unbound bones\n");
+            return 1;
+        }
+    }
+
+    // Checks on one character, with the breathing layer off unless tested.
+    bool ok = true;
+    auto check = [&](const char* what, const vector<float>& expected, const AnimationGraphInstance& g) {
+        float error = maxDifference(expected, g.pose(), boneCount);
+        bool pass = error < 1e-3f;
+        ok = ok && pass;
+        printf("  %-44s max error %.2g %s\n", what, error, pass ? "" : "FAILED");
+    };
+    poseBone.resize(boneCount);
+    for (int b = 0; b < boneCount; ++b) poseBone[atoi(store.name(instances[0].bone(b)).c_str() + 5)] = b;
+    {
+        AnimationGraphInstance g;
+        g.bind(graph, store, roots[0]);
+        g.setLayerWeight(1, 0);
+        g.update(0.5f);
+        check("idle at 0.5 s", clipPose(*clips[0], 0.5f, boneCount), g);
+
+        // Walk-run at speed 2: half way, both at the same phase, whose
+        // duration is half way between theirs.
+        g.setParameter(0, 2);
+        g.play(0, 1);
+        g.update(0.4f);
+        float phase = 0.4f / 0.8f;
+        vector<float> walk = clipPose(*clips[1], phase * 1.0f, boneCount), run = clipPose(*clips[2], phase * 0.6f, boneCount);
+        vector<float> blend(walk.size());
+        for (size_t i = 0; i < blend.size(); ++i) {
+            float d = run[i] - walk[i];
+            if (i < (size_t)boneCount) d -= 360.0f * round(d / 360.0f);
+            blend[i] = walk[i] + d * 0.5f;
+        }
+        check("walk-run blend in step", blend, g);
+
+        // Crossfade back to idle over 0.2 s: half way, the blend (still
+        // playing) mixes evenly with idle; done after it.
+        g.play(0, 0, 0.2f);
+        g.update(0.1f);
+        phase = 0.5f + 0.1f / 0.8f;
+        walk = clipPose(*clips[1], phase * 1.0f, boneCount);
+        run = clipPose(*clips[2], phase * 0.6f, boneCount);
+        vector<float> idle = clipPose(*clips[0], 0.1f, boneCount), fade(walk.size());
+        for (size_t i = 0; i < fade.size(); ++i) {
+            bool angle = i < (size_t)boneCount;
+            float d = run[i] - walk[i];
+            if (angle) d -= 360.0f * round(d / 360.0f);
+            float moving = walk[i] + d * 0.5f;
+            d = idle[i] - moving;
+            if (angle) d -= 360.0f * round(d / 360.0f);
+            fade[i] = moving + d * 0.5f;
+        }
+        check("crossfade to idle, half way", fade, g);
+        g.update(0.15f);
+        check("crossfade to idle, finished", clipPose(*clips[0], 0.25f, boneCount), g);
+
+        // Additive breathing at 0.5 on the masked upper half only; its
+        // state has been playing all along, 1.2 s in.
+        g.setLayerWeight(1, 0.5f);
+        g.update(0.05f);
+        vector<float> expected = clipPose(*clips[0], 0.3f, boneCount), breathe = clipPose(*clips[3], 1.2f, boneCount);
+        for (int s = 0; s < 5; ++s) {
+            for (int b = boneCount / 2; b < boneCount; ++b) {
+                size_t i = s * boneCount + poseBone[b];
+                expected[i] += (breathe[i] - (s >= 3 ? 1 : 0)) * 0.5f;
+            }
+        }
+        check("additive layer under its mask", expected, g);
+    }
+
+    // Every character: speed wanders, states switch with fades now and then.
+    uniform_real_distribution<float> speed(0, 3.5f);
+    vector<float> speeds(characters);
+    for (int i = 0; i < characters; ++i) speeds[i] = speed(rng);
+    auto drive = [&](size_t i, int frame) {
+        AnimationGraphInstance& g = instances[i];
+        g.setParameter(0, speeds[i] + sin(frame * 0.05f + i));
+        if ((frame + i) % 90 == 0) g.play(0, g.currentState(0) == 0 ? 1 : 0, 0.25f);
+        g.update(1 / 60.0f);
+    };
+    size_t before = allocations;
+    auto start = chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) {
+        for (int i = 0; i < characters; ++i) drive(i, f);
+    }
+    double updateMs = msSince(start) / frames;
+    size_t allocated = allocations - before;
+    ok = ok && allocated == 0;
+    start = chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) {
+        for (int i = 0; i < characters; ++i) {
+            drive(i, f);
+            instances[i].apply(store, false);
+        }
+        store.markAllDirty();
+        store.update();
+    }
+    double frameMs = msSince(start) / frames;
+    printf("%d characters x %d bones: update %.3f ms/frame (%zu allocations), +apply+scene update %.3f ms/frame\n",
+           characters, boneCount, updateMs, allocated, frameMs);
+
+    // As the pose stage of a SceneUpdate, on one thread and on the pool.
+    int frame = 0;
+    SceneUpdate update(store);
+    update.setPose([&] { return instances.size(); }, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            drive(i, frame);
+            instances[i].apply(store, false);
+        }
+    });
+    JobSystem single(1);
+    JobSystem* systems[2] = { &single, &JobSystem::global() };
+    for (JobSystem* jobs : systems) {
+        start = chrono::steady_clock::now();
+        for (frame = 0; frame < frames; ++frame) update.run(*jobs);
+        printf("SceneUpdate with %zu threads: %.3f ms/frame\n", jobs->threadCount(), msSince(start) / frames);
+    }
+    return ok ? 0 : 1;
+}
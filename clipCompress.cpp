@@ -0,0 +1,110 @@
+// Offline clip compressor: compiles animation clips from JSON, compresses
+// them (AnimationClip::compress) and writes each as <name>.mwclip, the
+// block AnimationClip::load() reads. Reports keys, sizes and the largest
+// error per channel kind, sampled at 1 ms steps against the uncompressed
+// clip.
+//
+// clipCompress <clips.json> <output dir> [rotate translate scale deform color]
+//   clips.json holds one clip or an array of them; tolerances default to
+//   ClipTolerance's.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "animation.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: clipCompress <clips.json> <output dir> [rotate translate scale deform color]\n");
+        return 2;
+    }
+    ClipTolerance tolerance;
+    float* fields[] = { &tolerance.rotate, &tolerance.translate, &tolerance.scale, &tolerance.deform,
+                        &tolerance.color };
+    for (int i = 3; i < argc && i < 8; ++i) *fields[i - 3] = (float)atof(argv[i]);
+
+    json input;
+    try {
+        ifstream in(argv[1]);
+        input = json::parse(in);
+    } catch (const exception& e) {
+        fprintf(stderr, "%s: %s\n", argv[1], e.what());
+        return 1;
+    }
+    if (!input.is_array()) input = json::array({ input });
+
+    const char* kinds[] = { "rotate", "translate", "scale", "deform", "color" };
+    int failures = 0;
+    for (size_t i = 0; i < input.size(); ++i) {
+        AnimationClip original, packed;
+        string error;
+        if (!original.compile(input[i], error)) {
+            fprintf(stderr, "clip %zu: %s\n", i, error.c_str());
+            ++failures;
+            continue;
+        }
+        packed = original;
+        packed.compress(tolerance);
+
+        // Write, then read back what was written.
+        string name = original.name().empty() ? "clip_" + to_string(i) : original.name();
+        replace_if(name.begin(), name.end(), [](char c) { return c == '/' || c == '\\' || c == ':'; }, '_');
+        string path = string(argv[2]) + "/" + name + ".mwclip";
+        ofstream(path, ios::binary).write((const char*)packed.block().data(), packed.block().size());
+        ifstream saved(path, ios::binary);
+        vector<uint8_t> bytes((istreambuf_iterator<char>(saved)), istreambuf_iterator<char>());
+        AnimationClip loaded;
+        if (!loaded.load(bytes.data(), bytes.size(), error)) {
+            fprintf(stderr, "%s: %s\n", path.c_str(), error.c_str());
+            ++failures;
+            continue;
+        }
+
+        // Compression regroups channels, so lanes move: match them by target.
+        auto keysOf = [](const AnimationClip& clip, const AnimationClip::Channel& c) {
+            for (const AnimationClip::KeyGroup& g : clip.groups()) {
+                if (c.lane >= g.firstLane && c.lane < g.firstLane + g.laneCount) return (size_t)g.keyCount;
+            }
+            return (size_t)0;
+        };
+        struct LanePair {
+            uint32_t original, loaded;
+            int kind;
+        };
+        vector<LanePair> lanePairs;
+        size_t channelKeys[2] = {};
+        for (const AnimationClip::Channel& c : original.channels()) {
+            channelKeys[0] += keysOf(original, c);
+            for (const AnimationClip::Channel& d : loaded.channels()) {
+                if (d.kind != c.kind || d.target != c.target) continue;
+                channelKeys[1] += keysOf(loaded, d);
+                for (uint32_t l = 0; l < c.width; ++l) lanePairs.push_back({ c.lane + l, d.lane + l, (int)c.kind });
+            }
+        }
+        double maxError[5] = {};
+        vector<float> a(original.laneCount()), b(loaded.laneCount());
+        ClipCursor ca, cb;
+        for (float t = 0; t <= original.duration() + 0.0005f; t += 0.001f) {
+            original.sample(t, ca, a.data());
+            loaded.sample(t, cb, b.data());
+            for (const LanePair& p : lanePairs) {
+                maxError[p.kind] = max(maxError[p.kind], (double)fabs(a[p.original] - b[p.loaded]));
+            }
+        }
+        printf("%s: %zu -> %zu channel keys in %zu -> %zu groups, %zu -> %zu bytes (JSON %zu), max error:",
+               name.c_str(), channelKeys[0], channelKeys[1], original.groups().size(), loaded.groups().size(),
+               original.memoryBytes(), loaded.memoryBytes(), input[i].dump().size());
+        for (int k = 0; k < 5; ++k) {
+            if (maxError[k] > 0) printf(" %s %.3g", kinds[k], maxError[k]);
+        }
+        printf("\n");
+    }
+    return failures ? 1 : 0;
+}
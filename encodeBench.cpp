@@ -0,0 +1,70 @@
+// Encoder benchmark: encode time and size for each format on the sample
+// images in the repo, next to OpenCV's default imencode(".png").
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "imageEncoder.h"
+
+using namespace cv;
+using namespace std;
+
+// Median wall time in milliseconds over a few runs
+double timeIt(const function<bool()>& fn, bool& ok, int runs = 7) {
+    vector<double> times;
+    for (int i = 0; i < runs; ++i) {
+        auto start = chrono::steady_clock::now();
+        ok = fn();
+        times.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+void report(const string& label, const Mat& img, const function<bool(vector<uchar>&)>& encode) {
+    vector<uchar> out;
+    bool ok = false;
+    double ms = timeIt([&] { return encode(out); }, ok);
+    double raw = (double)img.total() * img.channels();
+    if (!ok) {
+        printf("  %-22s failed\n", label.c_str());
+        return;
+    }
+    printf("  %-22s %8.2f ms %10zu bytes %6.1f%%\n", label.c_str(), ms, out.size(), 100.0 * out.size() / raw);
+}
+
+int main(int argc, char** argv) {
+    vector<string> files = { "png.PNG", "image.jpg", "image(6).jpg", "test.jpg" };
+    if (argc > 1) files.assign(argv + 1, argv + argc);
+
+    printf("OpenCV threads: %d\n", getNumThreads());
+    for (const string& file : files) {
+        Mat img = imread(file, IMREAD_UNCHANGED);
+        if (img.empty()) {
+            printf("%s: cannot read\n", file.c_str());
+            continue;
+        }
+        // Editor layers always carry alpha, so benchmark the BGRA path
+        if (img.channels() == 3) cvtColor(img, img, COLOR_BGR2BGRA);
+        printf("%s: %dx%d, %d channels\n", file.c_str(), img.cols, img.rows, img.channels());
+
+        report("imencode png default", img, [&](vector<uchar>& out) { return imencode(".png", img, out); });
+        for (int level : { 1, 6 }) {
+            for (int stripes : { 1, 0 }) {
+                string label = "png level " + to_string(level) + (stripes == 1 ? " 1 stripe" : " striped");
+                report(label, img, [&](vector<uchar>& out) { return encodePng(img, level, stripes, out); });
+            }
+        }
+        report("qoi", img, [&](vector<uchar>& out) { return encodeQoi(img, out); });
+        report("jpeg q85", img, [&](vector<uchar>& out) {
+            EncodeOptions options;
+            options.format = ImageFormat::JPEG;
+            return encodeImage(img, options, out);
+        });
+        report("raw rgba", img, [&](vector<uchar>& out) { return encodeRawRgba(img, out); });
+    }
+    return 0;
+}
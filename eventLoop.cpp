@@ -0,0 +1,259 @@
+#include "eventLoop.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include "trace.h"
+
+namespace {
+
+// Bookkeeping stored in mg_connection::data for accepted HTTP connections.
+struct ConnState {
+    uint32_t magic;
+    uint32_t requests;
+    int64_t lastActiveUs;
+};
+static_assert(sizeof(ConnState) <= MG_DATA_SIZE, "ConnState must fit mg_connection::data");
+
+const uint32_t kConnMagic = 0x4d57434e; // "MWCN"
+
+// No connection has this id, so the wakeup only breaks mg_mgr_poll.
+const unsigned long kWakeupId = ULONG_MAX;
+
+// How often idle and recycled keep-alive connections are looked for.
+const int64_t kSweepIntervalUs = 250 * 1000;
+
+ConnState* connState(struct mg_connection* conn) {
+    ConnState* state = reinterpret_cast<ConnState*>(conn->data);
+    return state->magic == kConnMagic ? state : nullptr;
+}
+
+} // namespace
+
+EventLoop::Clock EventLoop::nowUs() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void EventLoop::attach(struct mg_mgr* m, const EventLoopOptions& options) {
+    mgr = m;
+    opts = options;
+    lastSweep = nowUs();
+}
+
+void EventLoop::post(Callback fn) {
+    {
+        std::lock_guard<std::mutex> lock(postMutex);
+        posted.push_back({ nowUs(), std::move(fn) });
+    }
+    // Only the first post since the last drain needs to wake the loop.
+    if (!hasPosted.exchange(true) && mgr) {
+        mg_wakeup(mgr, kWakeupId, "", 0);
+    }
+}
+
+void EventLoop::defer(Callback fn) {
+    queue.push_back({ nowUs(), std::move(fn) });
+}
+
+EventLoop::TimerId EventLoop::addTimer(int delayMs, bool repeat, Callback fn) {
+    TimerId id = nextTimerId++;
+    int64_t intervalUs = std::max<int64_t>(delayMs, repeat ? 1 : 0) * 1000;
+    timers[id] = { intervalUs, repeat, std::move(fn) };
+    timerHeap.push({ nowUs() + intervalUs, id });
+    return id;
+}
+
+void EventLoop::cancelTimer(TimerId id) {
+    // The heap entry is dropped lazily when it comes due.
+    timers.erase(id);
+}
+
+struct mg_connection* EventLoop::connection(unsigned long id) const {
+    for (struct mg_connection* c = mgr->conns; c != nullptr; c = c->next) {
+        if (c->id == id) return c;
+    }
+    return nullptr;
+}
+
+void EventLoop::resume(struct mg_connection* conn) {
+    long n = 0;
+    conn->is_resp = 0;
+    mg_call(conn, MG_EV_READ, &n);
+}
+
+bool EventLoop::onEvent(struct mg_connection* conn, int ev) {
+    if (ev == MG_EV_ACCEPT) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if (counters.connections >= opts.maxConnections) {
+            ++counters.rejected;
+            mg_http_reply(conn, 503, "Connection: close\r\nRetry-After: 1\r\n", "Server busy\n");
+            conn->is_draining = 1;
+            return false;
+        }
+        ConnState state = { kConnMagic, 0, nowUs() };
+        std::memcpy(conn->data, &state, sizeof(state));
+        ++counters.accepted;
+        counters.peakConnections = std::max(counters.peakConnections, ++counters.connections);
+        return true;
+    }
+
+    ConnState* state = connState(conn);
+    // Untagged: the listener, or a rejected connection that is draining its 503.
+    if (!state) return !conn->is_draining;
+
+    switch (ev) {
+    case MG_EV_READ:
+    case MG_EV_WRITE:
+        state->lastActiveUs = nowUs();
+        break;
+    case MG_EV_HTTP_MSG:
+        state->lastActiveUs = nowUs();
+        ++state->requests;
+        break;
+    case MG_EV_CLOSE: {
+        state->magic = 0;
+        std::lock_guard<std::mutex> lock(statsMutex);
+        --counters.connections;
+        break;
+    }
+    default:
+        break;
+    }
+    return true;
+}
+
+void EventLoop::sweepConnections(Clock now) {
+    int64_t idleUs = (int64_t)opts.keepAliveIdleMs * 1000;
+    uint64_t idle = 0, recycled = 0;
+    for (struct mg_connection* c = mgr->conns; c != nullptr; c = c->next) {
+        ConnState* state = connState(c);
+        // Never cut a connection with a request in flight or unsent output.
+        if (!state || c->is_draining || c->is_closing || c->is_resp) continue;
+        if (c->send.len > 0 || c->recv.len > 0) continue;
+        if (opts.maxRequestsPerConnection > 0 && state->requests >= opts.maxRequestsPerConnection) {
+            c->is_draining = 1;
+            ++recycled;
+        }
+        else if (idleUs > 0 && now - state->lastActiveUs > idleUs) {
+            c->is_draining = 1;
+            ++idle;
+        }
+    }
+    if (idle || recycled) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        counters.idleClosed += idle;
+        counters.recycled += recycled;
+    }
+}
+
+int EventLoop::pollTimeoutMs(Clock now) {
+    if (queueHead < queue.size() || hasPosted.load()) return 0;
+    int64_t waitUs = (int64_t)opts.maxPollMs * 1000;
+    while (!timerHeap.empty() && !timers.count(timerHeap.top().id)) {
+        timerHeap.pop();
+    }
+    if (!timerHeap.empty()) {
+        waitUs = std::min(waitUs, timerHeap.top().due - now);
+    }
+    // Round up so a timer is not polled for repeatedly just before it is due.
+    return waitUs <= 0 ? 0 : (int)((waitUs + 999) / 1000);
+}
+
+void EventLoop::fireTimers(Clock now) {
+    uint64_t fired = 0;
+    while (!timerHeap.empty() && timerHeap.top().due <= now) {
+        Timer timer = timerHeap.top();
+        timerHeap.pop();
+        auto it = timers.find(timer.id);
+        if (it == timers.end()) continue;
+
+        noteLatency(timer.due, now);
+        ++fired;
+        if (it->second.repeat) {
+            // Schedule from the due time so a repeating timer does not drift.
+            timerHeap.push({ std::max(timer.due + it->second.intervalUs, now), timer.id });
+            Callback fn = it->second.fn;
+            fn();
+        }
+        else {
+            Callback fn = std::move(it->second.fn);
+            timers.erase(it);
+            fn();
+        }
+    }
+    if (fired) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        counters.timersFired += fired;
+    }
+}
+
+void EventLoop::runQueue(Clock start) {
+    if (hasPosted.exchange(false)) {
+        std::lock_guard<std::mutex> lock(postMutex);
+        for (auto& p : posted) queue.push_back(std::move(p));
+        posted.clear();
+    }
+
+    uint64_t ran = 0;
+    Clock now = start;
+    while (queueHead < queue.size()) {
+        if (ran > 0 && now - start >= opts.runBudgetUs) {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            ++counters.budgetExhausted;
+            break;
+        }
+        // Callbacks may defer() more work, which can reallocate the queue.
+        Pending item = std::move(queue[queueHead++]);
+        noteLatency(item.ready, now);
+        item.fn();
+        ++ran;
+        now = nowUs();
+    }
+    if (queueHead == queue.size()) {
+        queue.clear();
+        queueHead = 0;
+    }
+    if (ran) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        counters.tasksRun += ran;
+    }
+}
+
+void EventLoop::noteLatency(Clock ready, Clock now) {
+    uint64_t us = now > ready ? (uint64_t)(now - ready) : 0;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    counters.latencySumUs += us;
+    counters.latencyMaxUs = std::max(counters.latencyMaxUs, us);
+}
+
+void EventLoop::runOnce() {
+    {
+        // Socket reads, writes and every request handler run in here.
+        MW_TRACE_SCOPE("mg_mgr_poll");
+        mg_mgr_poll(mgr, pollTimeoutMs(nowUs()));
+    }
+    Clock now = nowUs();
+    fireTimers(now);
+    runQueue(nowUs());
+
+    if (now - lastSweep >= kSweepIntervalUs) {
+        lastSweep = now;
+        sweepConnections(now);
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    ++counters.iterations;
+}
+
+void EventLoop::run() {
+    while (!stopping.load()) {
+        runOnce();
+    }
+}
+
+EventLoopStats EventLoop::stats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return counters;
+}
@@ -0,0 +1,142 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include "mongoose.h"
+
+// Tunables of the event loop and the HTTP connection policy.
+struct EventLoopOptions {
+    int maxPollMs = 50;                 // Upper bound of one mg_mgr_poll wait
+    int64_t runBudgetUs = 2000;         // Run queue time slice per iteration
+    size_t maxConnections = 256;        // Accepted connections above this get 503
+    int keepAliveIdleMs = 15000;        // Close keep-alive connections idle this long
+    uint32_t maxRequestsPerConnection = 1000; // Close after this many requests
+};
+
+// Counters for tuning the options above under load. Latencies are the time
+// between a callback becoming ready and starting to run.
+struct EventLoopStats {
+    uint64_t iterations = 0;
+    uint64_t tasksRun = 0;
+    uint64_t timersFired = 0;
+    uint64_t budgetExhausted = 0;   // Iterations that left work for the next one
+    uint64_t latencySumUs = 0;
+    uint64_t latencyMaxUs = 0;
+    size_t connections = 0;
+    size_t peakConnections = 0;
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t idleClosed = 0;
+    uint64_t recycled = 0;          // Closed after maxRequestsPerConnection
+};
+
+// Drives mg_mgr_poll with a timeout derived from pending work instead of a
+// fixed interval.
+//
+// post() may be called from any thread and wakes the loop through the
+// mongoose wakeup socketpair (WorkerPool completions come back this way);
+// defer() and the timers are for the loop thread, e.g. to coalesce requests
+// arriving in the same poll into one piece of work.
+// Each iteration polls I/O, fires due timers, then runs queued callbacks
+// until the queue is empty or runBudgetUs is spent. When work is left over
+// the next poll does not block, so queued work never waits on the network.
+//
+// onEvent() must be called at the top of the connection event handler; it
+// enforces the connection limit and keep-alive policy and keeps per
+// connection bookkeeping in mg_connection::data.
+class EventLoop {
+public:
+    using Callback = std::function<void()>;
+    using TimerId = uint64_t;
+
+    EventLoop() = default;
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // mgr must already have mg_wakeup_init() called.
+    void attach(struct mg_mgr* mgr, const EventLoopOptions& options = EventLoopOptions());
+
+    // Thread-safe: queue fn and wake the loop.
+    void post(Callback fn);
+    // Loop thread only: queue fn for the current or next iteration.
+    void defer(Callback fn);
+
+    // Loop thread only. A repeating timer with delayMs == 0 runs every 1 ms.
+    TimerId addTimer(int delayMs, bool repeat, Callback fn);
+    void cancelTimer(TimerId id);
+
+    // Loop thread only: the connection with id, or nullptr once it closed.
+    struct mg_connection* connection(unsigned long id) const;
+    // Loop thread only: reply to a request whose handler set is_resp is
+    // done, so parse the requests pipelined behind it as mg_mgr_poll does
+    // when a handler clears is_resp itself. Not from inside an event handler.
+    static void resume(struct mg_connection* conn);
+
+    // Returns false from onEvent when the connection was rejected and the
+    // handler should not process the event any further.
+    bool onEvent(struct mg_connection* conn, int ev);
+
+    void runOnce();
+    void run();
+    void stop() { stopping.store(true); }
+
+    const EventLoopOptions& options() const { return opts; }
+    EventLoopStats stats() const;
+
+private:
+    using Clock = int64_t; // steady clock, microseconds
+
+    struct Pending {
+        Clock ready;
+        Callback fn;
+    };
+
+    struct Timer {
+        Clock due;
+        TimerId id;
+        bool operator>(const Timer& other) const { return due > other.due; }
+    };
+
+    struct TimerEntry {
+        int64_t intervalUs;
+        bool repeat;
+        Callback fn;
+    };
+
+    static Clock nowUs();
+    int pollTimeoutMs(Clock now);
+    void fireTimers(Clock now);
+    void runQueue(Clock start);
+    void sweepConnections(Clock now);
+    void noteLatency(Clock ready, Clock now);
+
+    struct mg_mgr* mgr = nullptr;
+    EventLoopOptions opts;
+    std::atomic<bool> stopping{ false };
+
+    std::mutex postMutex;
+    std::vector<Pending> posted;
+    std::atomic<bool> hasPosted{ false };
+
+    std::vector<Pending> queue;
+    size_t queueHead = 0;
+
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timerHeap;
+    std::unordered_map<TimerId, TimerEntry> timers;
+    TimerId nextTimerId = 1;
+
+    Clock lastSweep = 0;
+
+    mutable std::mutex statsMutex;
+    EventLoopStats counters;
+};
+
+#endif // EVENTLOOP_H
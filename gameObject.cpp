@@ -1,20 +1,22 @@
 #include "gameObject.h"
-#include <iostream>
-
-// Initialize static registry
-std::unordered_map<std::string, std::weak_ptr<GameObject>> GameObject::registry;
+#include "logger.h"
 
 // GameObject implementation
-GameObject::GameObject(const std::string& name) : name(name) {
-    std::cout << "make name : " << name << std::endl;
+GameObject::GameObject(const std::string& name) : store(SceneStore::global()), entity(store.create(name)) {
+    MW_LOG_DEBUG("make name : {}", name);
     // Do not call weak_from_this() in the constructor
 }
 
+GameObject::~GameObject() {
+    ObjectRegistry::global().remove(handle);
+    store.destroy(entity);
+}
+
 // New method: Register self to the global registry
 void GameObject::RegisterSelf() {
-    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(this);
-    std::cout << " hi regist address: " << address << " is " << name << std::endl;
-    registry[name] = weak_from_this(); // Now the object is managed by shared_ptr
+    MW_LOG_DEBUG("register {} is {}", (const void*)this, GetName());
+    if (handle.valid()) return;
+    handle = ObjectRegistry::global().add(weak_from_this(), GetName()); // Now the object is managed by shared_ptr
 }
 
 std::shared_ptr<GameObject> GameObject::Create(const std::string& name) {
@@ -23,108 +25,294 @@ std::shared_ptr<GameObject> GameObject::Create(const std::string& name) {
     return gameObject;
 }
 
+Transform& GameObject::GetTransform() {
+    return store.transforms.get(entity.index);
+}
+
+void GameObject::SetPosition(const cv::Point2f& position) {
+    store.setPosition(entity, position);
+}
+
+void GameObject::SetRotation(float degrees) {
+    store.setRotation(entity, degrees);
+}
+
+void GameObject::SetScale(const cv::Point2f& scale) {
+    store.setScale(entity, scale);
+}
+
+void GameObject::MarkTransformDirty() {
+    store.markDirty(entity);
+}
+
+cv::Matx23f GameObject::GetWorldMatrix() {
+    return store.world(entity);
+}
+
+cv::Point2f GameObject::GetWorldPosition() {
+    cv::Matx23f world = store.world(entity);
+    return cv::Point2f(world(0, 2), world(1, 2));
+}
+
+Mesh& GameObject::AddMesh() {
+    if (Mesh* mesh = store.meshes.find(entity.index)) return *mesh;
+    return store.meshes.add(entity.index);
+}
+
+Mesh* GameObject::GetMesh() {
+    return store.meshes.find(entity.index);
+}
+
 void GameObject::AddChild(std::shared_ptr<GameObject> child) {
+    if (!store.setParent(child->entity, entity)) return; // Would create a cycle
+    // Take it away from its previous parent
+    if (auto previous = child->parent.lock()) {
+        auto& siblings = previous->children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), child), siblings.end());
+    }
     child->parent = shared_from_this(); // Set parent object
     children.push_back(child); // Add to children list
 }
 
 void GameObject::RemoveChild(const std::string& childName) {
     auto it = std::remove_if(children.begin(), children.end(),
-        [&childName](const std::shared_ptr<GameObject>& child) {
-            return child->GetName() == childName;
+        [&](const std::shared_ptr<GameObject>& child) {
+            if (child->GetName() != childName) return false;
+            store.setParent(child->entity, Entity());
+            child->parent.reset();
+            return true;
         });
     if (it != children.end()) {
         children.erase(it, children.end()); // Remove from children list
     }
 }
 
-json GameObject::GetHierarchyJson() const {
-    json result;
-    result["name"] = name;
-    // Recursively process child objects
-    if (!children.empty()) {
-        result["children"] = json::array();
-        for (const auto& child : children) {
-            result["children"].push_back(child->GetHierarchyJson());
-        }
-    }
-    return result;
+const json& GameObject::GetHierarchyJson() const {
+    return store.hierarchyJson(entity);
+}
+
+uint64_t GameObject::GetHierarchyVersion() const {
+    return store.hierarchyVersion(entity);
 }
 
 std::shared_ptr<GameObject> GameObject::FindByName(const std::string& name) {
-    auto it = registry.find(name);
-    if (it != registry.end()) {
-        std::cout << " I found : " << name << std::endl;
-        return it->second.lock(); // Return the found object (check validity)
+    auto found = ObjectRegistry::global().findLatest(name);
+    if (found) {
+        MW_LOG_DEBUG("found : {}", name);
     }
-    return nullptr; // Return nullptr if not found
+    return found; // nullptr if not found
 }
 
-void GameObject::Update() {
-    std::cout << "Updating GameObject: " << name << std::endl;
+std::vector<std::shared_ptr<GameObject>> GameObject::FindAllByName(const std::string& name) {
+    ObjectRegistry& registry = ObjectRegistry::global();
+    std::vector<std::shared_ptr<GameObject>> found;
+    for (Handle h : registry.find(name)) {
+        if (auto object = registry.resolve(h)) found.push_back(object);
+    }
+    return found;
 }
 
-// Transform implementation
-Transform::Transform() : position(0, 0), rotation(0.0f), scale(1.0f, 1.0f) {}
-
-// Mesh implementation
-Mesh::Mesh() {}
+std::shared_ptr<GameObject> GameObject::Find(Handle handle) {
+    return ObjectRegistry::global().resolve(handle);
+}
 
-void Mesh::LoadFromJson(const json& data) {
-    if (data.count("vertices")) {
-        for (const auto& vertex : data["vertices"]) {
-            vertices.emplace_back(vertex[0], vertex[1]);
-        }
-    }
-    if (data.count("triangles")) {
-        for (const auto& triangle : data["triangles"]) {
-            std::vector<int> indices = { triangle[0], triangle[1], triangle[2] };
-            triangles.push_back(indices);
-        }
-    }
+void GameObject::Update() {
+    MW_LOG_DEBUG("Updating GameObject: {}", GetName());
+    // World transforms of the whole scene are refreshed by SceneStore::update()
 }
 
 // Bone implementation
-Bone::Bone(const std::string& name) : GameObject(name) {}
+Bone::Bone(const std::string& name) : GameObject(name) {
+    store.bones.add(entity.index);
+}
 
-Bone::Bone(Point h, Point t, float th, Scalar c) : GameObject("newBone"),head(h), tail(t), thickness(th), color(c) {}
+Bone::Bone(Point h, Point t, float th, Scalar c) : GameObject("newBone") {
+    store.bones.add(entity.index, BoneData{ h, t, th, c });
+}
 
 std::shared_ptr<Bone> Bone::Create(const std::string& name) {
-    return std::make_shared<Bone>(name);
+    auto object = std::make_shared<Bone>(name);
+    object->RegisterSelf();
+    return object;
+}
+
+BoneData& Bone::GetBone() {
+    return store.bones.get(entity.index);
 }
 
 void Bone::AddChildBone(std::shared_ptr<Bone> bone) {
     childBones.push_back(bone);
     bone->parentBone = std::static_pointer_cast<Bone>(shared_from_this());
+    AddChild(bone);
 }
 
 // SpriteRenderer implementation
-SpriteRenderer::SpriteRenderer(const std::string& name) : GameObject(name) {}
+SpriteRenderer::SpriteRenderer(const std::string& name) : GameObject(name) {
+    store.sprites.add(entity.index);
+}
 
 std::shared_ptr<SpriteRenderer> SpriteRenderer::Create(const std::string& name) {
-    return std::make_shared<SpriteRenderer>(name);
+    auto object = std::make_shared<SpriteRenderer>(name);
+    object->RegisterSelf();
+    return object;
+}
+
+cv::Mat& SpriteRenderer::GetSprite() {
+    return store.sprites.get(entity.index).sprite;
 }
 
 void SpriteRenderer::LoadImage(const std::string& imagePath) {
+    cv::Mat& sprite = GetSprite();
     sprite = cv::imread(imagePath, cv::IMREAD_COLOR);
+    MarkSpriteDirty();
     if (sprite.empty()) {
-        std::cerr << "Failed to load image: " << imagePath << std::endl;
+        MW_LOG_ERROR("Failed to load image: {}", imagePath);
     }
     else {
-        std::cout << "Image loaded successfully: " << imagePath << std::endl;
+        MW_LOG_INFO("Image loaded successfully: {}", imagePath);
+    }
+}
+
+const AlphaCoverage& SpriteRenderer::GetAlphaCoverage(uint8_t threshold) {
+    SpriteData& data = store.sprites.get(entity.index);
+    bool stale = !data.alphaValid || data.alphaData != data.sprite.data ||
+                 data.alphaCoverage.size != data.sprite.size() || data.alphaCoverage.threshold != threshold;
+    if (stale) {
+        data.alphaCoverage = analyzeAlpha(data.sprite, threshold);
+        data.alphaData = data.sprite.data;
+        data.alphaValid = true;
     }
+    return data.alphaCoverage;
+}
+
+void SpriteRenderer::MarkSpriteDirty() {
+    store.sprites.get(entity.index).alphaValid = false;
 }
 
 // AnimationController implementation
 AnimationController::AnimationController(const std::string& name) : GameObject(name) {}
 
 std::shared_ptr<AnimationController> AnimationController::Create(const std::string& name) {
-    return std::make_shared<AnimationController>(name);
+    auto object = std::make_shared<AnimationController>(name);
+    object->RegisterSelf();
+    return object;
+}
+
+std::shared_ptr<const AnimationClip> AnimationController::CompiledClip(const std::string& clipName) {
+    compiledClips.resize(animationClips.size());
+    for (size_t i = 0; i < animationClips.size(); ++i) {
+        const json& data = animationClips[i];
+        if (!data.is_object() || data.value("name", std::string()) != clipName) continue;
+        if (!compiledClips[i]) {
+            auto clip = std::make_shared<AnimationClip>();
+            std::string error;
+            if (!clip->compile(data, error)) {
+                MW_LOG_ERROR("Animation {} does not compile: {}", clipName, error);
+                return nullptr;
+            }
+            if (compressClips) clip->compress(clipTolerance);
+            compiledClips[i] = clip;
+        }
+        return compiledClips[i];
+    }
+    MW_LOG_ERROR("No animation named {}", clipName);
+    return nullptr;
+}
+
+Entity AnimationController::AnimationRoot() const {
+    Entity parent = store.parent(entity);
+    return parent.valid() ? parent : entity;
+}
+
+bool AnimationController::PlayAnimation(const std::string& clipName, bool loop) {
+    MW_LOG_INFO("Playing animation: {}", clipName);
+    std::shared_ptr<const AnimationClip> clip = CompiledClip(clipName);
+    if (!clip) return false;
+    RestoreSetupPose();
+    graphInstance.bind(nullptr, store, entity);
+    size_t missing = player.play(clip, store, AnimationRoot(), loop);
+    if (missing) MW_LOG_WARN("Animation {}: {} channels have no target", clipName, missing);
+    player.apply(store);
+    return true;
+}
+
+bool AnimationController::PlayAnimationGraph(const json& graph) {
+    auto loaded = std::make_shared<AnimationGraph>();
+    std::string error;
+    if (!loaded->load(graph, [this](const std::string& clipName) { return CompiledClip(clipName); }, error)) {
+        MW_LOG_ERROR("Animation graph does not load: {}", error);
+        return false;
+    }
+    RestoreSetupPose();
+    player.stop();
+    size_t missing = graphInstance.bind(loaded, store, AnimationRoot());
+    if (missing) MW_LOG_WARN("Animation graph: {} bones have no target", missing);
+    graphInstance.update(0);
+    graphInstance.apply(store);
+    return true;
+}
+
+bool AnimationController::SetParameter(const std::string& name, float value) {
+    return graphInstance.bound() && graphInstance.setParameter(name, value);
+}
+
+bool AnimationController::SetLayerWeight(const std::string& layer, float weight) {
+    if (!graphInstance.bound()) return false;
+    int index = graphInstance.definition()->findLayer(layer);
+    if (index < 0) return false;
+    graphInstance.setLayerWeight((uint32_t)index, weight);
+    return true;
+}
+
+bool AnimationController::CrossFade(const std::string& state, float seconds, const std::string& layer) {
+    if (!graphInstance.bound()) return false;
+    int layerIndex = layer.empty() ? 0 : graphInstance.definition()->findLayer(layer);
+    int stateIndex = layerIndex < 0 ? -1 : graphInstance.definition()->findState((uint32_t)layerIndex, state);
+    if (stateIndex < 0) {
+        MW_LOG_ERROR("No animation state {}{}", state, layer.empty() ? std::string() : " in layer " + layer);
+        return false;
+    }
+    graphInstance.play((uint32_t)layerIndex, (uint32_t)stateIndex, seconds);
+    return true;
+}
+
+void AnimationController::StopAnimation() {
+    RestoreSetupPose();
+    player.stop();
+    graphInstance.bind(nullptr, store, entity);
+}
+
+// Undo whatever plays now, so the next clip or graph starts from the setup
+// pose instead of on top of this one's last frame.
+void AnimationController::RestoreSetupPose() {
+    player.restore(store);
+    graphInstance.restore(store);
+}
+
+void AnimationController::Advance(float seconds) {
+    if (graphInstance.bound()) {
+        graphInstance.update(seconds);
+        graphInstance.apply(store);
+    }
+    if (!player.playing()) return;
+    player.advance(seconds);
+    player.apply(store);
+}
+
+void AnimationController::Seek(float seconds) {
+    if (!player.playing()) return;
+    player.seek(seconds);
+    player.apply(store);
+}
+
+void AnimationController::ReloadClips() {
+    compiledClips.clear();
 }
 
-void AnimationController::PlayAnimation(const std::string& clipName) {
-    std::cout << "Playing animation: " << clipName << std::endl;
-    // TODO: Implement animation playback logic
+void AnimationController::SetClipCompression(bool enabled, const ClipTolerance& tolerance) {
+    compressClips = enabled;
+    clipTolerance = tolerance;
+    ReloadClips();
 }
 
 //bone control
@@ -7,66 +7,83 @@
 #include <vector>
 #include "json.hpp"
 #include <opencv2/opencv.hpp>
+#include "animation.h"
+#include "animGraph.h"
+#include "sceneStore.h"
+#include "objectRegistry.h"
 
 using json = nlohmann::json;
 using namespace cv;
 // Forward declarations
-class Transform;
-class Mesh;
 class Bone;
 class SpriteRenderer;
 class AnimationController;
 
 class GameObject;
-// GameObject is the base class for all objects
+// GameObject is the base class for all objects. It is a facade over an
+// entity in SceneStore::global(): name, hierarchy and components live in the
+// store's packed arrays, the object itself only keeps child facades alive.
 class GameObject : public std::enable_shared_from_this<GameObject> {
 public:
-    std::shared_ptr<Transform> transform; // Coordinate transformation
     // Constructor
     GameObject(const std::string& name);
+    GameObject(const GameObject&) = delete;
+    GameObject& operator=(const GameObject&) = delete;
     // Static method to create shared_ptr
     static std::shared_ptr<GameObject> Create(const std::string& name);
-    virtual ~GameObject() = default;
+    virtual ~GameObject();
     virtual void Update(); // Update function
     std::string GetName() const {
-        return name;
+        return store.name(entity);
     }
     // Setter method
     void SetName(const std::string& newName) {
-        name = newName;
+        store.setName(entity, newName);
+        if (handle.valid()) ObjectRegistry::global().rename(handle, newName);
     }
+    Entity GetEntity() const {
+        return entity;
+    }
+    // Coordinate transformation. Component references point into the store
+    // and are invalidated when entities are created or destroyed; after
+    // writing through GetTransform(), call MarkTransformDirty().
+    Transform& GetTransform();
+    void SetPosition(const cv::Point2f& position);
+    void SetRotation(float degrees);
+    void SetScale(const cv::Point2f& scale);
+    void MarkTransformDirty();
+    cv::Matx23f GetWorldMatrix(); // local transforms composed down from the root
+    cv::Point2f GetWorldPosition();
+    Mesh& AddMesh();
+    Mesh* GetMesh(); // nullptr without a mesh
     void AddChild(std::shared_ptr<GameObject> child); // Add child object
     void RemoveChild(const std::string& childName); // Remove child object
-    json GetHierarchyJson() const; // Get nested JSON of object relationships
-    static std::shared_ptr<GameObject> FindByName(const std::string& name); // Find object by name
+    // Get nested JSON of object relationships, cached until the hierarchy
+    // under this object changes; see SceneStore::hierarchyPatch for diffs.
+    const json& GetHierarchyJson() const;
+    uint64_t GetHierarchyVersion() const;
+    // Find object by name; with duplicates, the one that took the name last
+    // (created with it or renamed to it). The lookups themselves are safe
+    // from any thread, as are FindAllByName and Find, but the objects they
+    // return read and write the unsynchronized SceneStore::global(): use
+    // them, and release them (the last reference destroys the entity), only
+    // on the thread that owns the scene.
+    static std::shared_ptr<GameObject> FindByName(const std::string& name);
+    static std::vector<std::shared_ptr<GameObject>> FindAllByName(const std::string& name);
+    static std::shared_ptr<GameObject> Find(Handle handle); // O(1), nullptr once destroyed
+    Handle GetHandle() const {
+        return handle;
+    }
 
     // New: Register self to the global registry
     void RegisterSelf();
+protected:
+    SceneStore& store;
+    Entity entity;
 private:
-    static std::unordered_map<std::string, std::weak_ptr<GameObject>> registry; // Global registry
-    std::string name; // Object name
+    Handle handle; // in ObjectRegistry::global(), set by RegisterSelf()
     std::weak_ptr<GameObject> parent; // Parent object (using weak_ptr to avoid circular references)
-    std::vector<std::shared_ptr<GameObject>> children; // Child objects
-};
-
-// Transform is responsible for recording position, rotation, and scale
-class Transform {
-public:
-    cv::Point2f position; // Position
-    float rotation;       // Rotation angle
-    cv::Point2f scale;    // Scale
-
-    Transform();
-};
-
-// Mesh is responsible for recording mesh points
-class Mesh {
-public:
-    std::vector<cv::Point2f> vertices; // Vertices
-    std::vector<std::vector<int>> triangles; // Triangle indices
-
-    Mesh();
-    void LoadFromJson(const json& data); // Load mesh data from JSON
+    std::vector<std::shared_ptr<GameObject>> children; // Child objects, owned here; order and links live in the store
 };
 
 // Bone is responsible for recording skeleton information
@@ -75,22 +92,20 @@ public:
     std::weak_ptr<Bone> parentBone; // Parent bone
     std::vector<std::shared_ptr<Bone>> childBones; // Child bones
 
-    cv::Point head;
-    cv::Point tail;
-    float thickness=5;
-    Scalar color;
     // Constructor
     Bone(const std::string& name);
     Bone(Point h, Point t, float th, Scalar c);
     // Static method to create shared_ptr
     static std::shared_ptr<Bone> Create(const std::string& name);
 
+    BoneData& GetBone(); // head, tail, thickness and color
     void setPoint(cv::Point head,cv::Point tail)
     {
-        this->head=head;
-        this->tail=tail;
+        BoneData& bone = GetBone();
+        bone.head=head;
+        bone.tail=tail;
     }
-    void AddChildBone(std::shared_ptr<Bone> bone);
+    void AddChildBone(std::shared_ptr<Bone> bone); // also makes it a child object
 };
 
 double distancePointToLine(const cv::Point& P, const cv::Point& A, const cv::Point& B);
@@ -98,21 +113,28 @@ cv::Point rotatePoint(const cv::Point& P, const cv::Point& C, double angle);
 // SpriteRenderer is responsible for handling image data
 class SpriteRenderer : public GameObject {
 public:
-    cv::Mat sprite; // Image data
-
     // Constructor
     SpriteRenderer(const std::string& name);
 
     // Static method to create shared_ptr
     static std::shared_ptr<SpriteRenderer> Create(const std::string& name);
 
+    cv::Mat& GetSprite(); // Image data
     void LoadImage(const std::string& imagePath); // Load image
+
+    // Where sprite is visible: bounds, row spans and a coarse cell map.
+    // Computed on first use and kept until sprite is reassigned or resized;
+    // code that edits sprite pixels in place must call MarkSpriteDirty().
+    const AlphaCoverage& GetAlphaCoverage(uint8_t threshold = 0);
+    void MarkSpriteDirty();
 };
 
 // AnimationController is responsible for controlling animation playback
 class AnimationController : public GameObject {
 public:
-    std::vector<json> animationClips; // Animation clips (JSON format)
+    // Animation clips (JSON format, see AnimationClip), compiled the first
+    // time they are played; call ReloadClips() after editing played ones.
+    std::vector<json> animationClips;
 
     // Constructor
     AnimationController(const std::string& name);
@@ -120,7 +142,45 @@ public:
     // Static method to create shared_ptr
     static std::shared_ptr<AnimationController> Create(const std::string& name);
 
-    void PlayAnimation(const std::string& clipName); // Play specified animation
+    // Play the named clip from its start on the object this controller is a
+    // child of (its own subtree without a parent). False when there is no
+    // such clip or it does not compile.
+    bool PlayAnimation(const std::string& clipName, bool loop = true);
+    // Play a blend tree / state machine graph (JSON format, see
+    // AnimationGraph) on the same targets instead, its clips named from
+    // animationClips. False if it does not load or a clip is missing.
+    bool PlayAnimationGraph(const json& graph);
+    // Graph controls; false when no graph plays or the name is unknown.
+    bool SetParameter(const std::string& name, float value);
+    bool SetLayerWeight(const std::string& layer, float weight);
+    // Fade layer (the first by default) to state over seconds.
+    bool CrossFade(const std::string& state, float seconds, const std::string& layer = std::string());
+    // Stop and put the targets back in their setup pose.
+    void StopAnimation();
+    // Move the playhead and pose the targets; Seek jumps to a time instead
+    // (clips only).
+    void Advance(float seconds);
+    void Seek(float seconds);
+    bool IsPlaying() const {
+        return player.playing() || graphInstance.bound();
+    }
+    float GetTime() const {
+        return player.time();
+    }
+    void ReloadClips();
+    // Compress clips as they are compiled (AnimationClip::compress); off by
+    // default. Recompiles clips already played.
+    void SetClipCompression(bool enabled, const ClipTolerance& tolerance = ClipTolerance());
+private:
+    std::shared_ptr<const AnimationClip> CompiledClip(const std::string& clipName);
+    Entity AnimationRoot() const;
+    void RestoreSetupPose();
+
+    std::vector<std::shared_ptr<const AnimationClip>> compiledClips; // by animationClips index
+    bool compressClips = false;
+    ClipTolerance clipTolerance;
+    ClipPlayer player;
+    AnimationGraphInstance graphInstance;
 };
 
 /*
@@ -0,0 +1,330 @@
+#include "imageEncoder.h"
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+#include "trace.h"
+
+namespace {
+
+void putBE32(std::vector<uchar>& out, uint32_t v) {
+    uchar b[4] = { (uchar)(v >> 24), (uchar)(v >> 16), (uchar)(v >> 8), (uchar)v };
+    out.insert(out.end(), b, b + 4);
+}
+
+void putChunk(std::vector<uchar>& out, const char* type, const uchar* data, size_t len) {
+    putBE32(out, (uint32_t)len);
+    size_t typeOffset = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (len) out.insert(out.end(), data, data + len);
+    uLong crc = crc32(0L, out.data() + typeOffset, (uInt)(len + 4));
+    putBE32(out, (uint32_t)crc);
+}
+
+// Write one filtered PNG row: "Sub" filter byte followed by the pixel
+// differences, swapping OpenCV's BGR(A) order to RGB(A) on the way.
+void filterRow(const uchar* src, uchar* dst, int width, int channels) {
+    *dst++ = 1;
+    if (channels == 1) {
+        uchar prev = 0;
+        for (int x = 0; x < width; ++x) {
+            dst[x] = (uchar)(src[x] - prev);
+            prev = src[x];
+        }
+        return;
+    }
+    uchar pr = 0, pg = 0, pb = 0, pa = 0;
+    for (int x = 0; x < width; ++x, src += channels, dst += channels) {
+        uchar b = src[0], g = src[1], r = src[2];
+        dst[0] = (uchar)(r - pr);
+        dst[1] = (uchar)(g - pg);
+        dst[2] = (uchar)(b - pb);
+        pr = r; pg = g; pb = b;
+        if (channels == 4) {
+            dst[3] = (uchar)(src[3] - pa);
+            pa = src[3];
+        }
+    }
+}
+
+struct Stripe {
+    std::vector<uchar> deflated;
+    uLong adler = 1;
+    size_t rawLength = 0;
+    bool ok = false;
+};
+
+// Deflate rows [begin, end) as a raw deflate segment. Every stripe except the
+// last ends with a sync flush so the segments can simply be concatenated into
+// one stream, the same trick pigz uses.
+void deflateStripe(const cv::Mat& image, int begin, int end, int level, bool last, Stripe& stripe) {
+    const int channels = image.channels();
+    const size_t rowBytes = (size_t)image.cols * channels + 1;
+    std::vector<uchar> raw(rowBytes * (end - begin));
+    for (int y = begin; y < end; ++y) {
+        filterRow(image.ptr<uchar>(y), raw.data() + rowBytes * (y - begin), image.cols, channels);
+    }
+    stripe.rawLength = raw.size();
+    stripe.adler = adler32(1L, raw.data(), (uInt)raw.size());
+
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    // Z_RLE is several times faster than the default matcher on filtered
+    // image rows and loses little, so use it for the fast levels.
+    int strategy = level <= 2 ? Z_RLE : Z_FILTERED;
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) return;
+
+    stripe.deflated.resize(deflateBound(&zs, (uLong)raw.size()) + 16);
+    zs.next_in = raw.data();
+    zs.avail_in = (uInt)raw.size();
+    zs.next_out = stripe.deflated.data();
+    zs.avail_out = (uInt)stripe.deflated.size();
+    int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    stripe.ok = last ? ret == Z_STREAM_END : (ret == Z_OK && zs.avail_in == 0);
+    stripe.deflated.resize(stripe.deflated.size() - zs.avail_out);
+    deflateEnd(&zs);
+}
+
+bool isSupported(const cv::Mat& image) {
+    int c = image.channels();
+    return !image.empty() && image.depth() == CV_8U && (c == 1 || c == 3 || c == 4);
+}
+
+} // namespace
+
+cv::Mat to8Bit(const cv::Mat& image) {
+    double scale = 255.0, offset = 0; // floating point, 0..1
+    switch (image.depth()) {
+    case CV_8U: return image;
+    case CV_8S: scale = 1.0; offset = 128; break;
+    case CV_16U: scale = 1.0 / 257; break;
+    case CV_16S: scale = 1.0 / 257; offset = 128; break;
+    case CV_32S: scale = 1.0 / 16843009; offset = 128; break;
+    default: break;
+    }
+    cv::Mat converted;
+    image.convertTo(converted, CV_8U, scale, offset);
+    return converted;
+}
+
+const char* imageMimeType(ImageFormat format) {
+    switch (format) {
+    case ImageFormat::QOI: return "image/qoi";
+    case ImageFormat::JPEG: return "image/jpeg";
+    case ImageFormat::RAW: return "application/octet-stream";
+    default: return "image/png";
+    }
+}
+
+const char* imageFormatName(ImageFormat format) {
+    switch (format) {
+    case ImageFormat::QOI: return "qoi";
+    case ImageFormat::JPEG: return "jpeg";
+    case ImageFormat::RAW: return "raw";
+    default: return "png";
+    }
+}
+
+bool parseImageFormat(const std::string& name, ImageFormat& format) {
+    if (name == "png") format = ImageFormat::PNG;
+    else if (name == "qoi") format = ImageFormat::QOI;
+    else if (name == "jpeg" || name == "jpg") format = ImageFormat::JPEG;
+    else if (name == "raw" || name == "rgba") format = ImageFormat::RAW;
+    else return false;
+    return true;
+}
+
+ImageFormat negotiateImageFormat(const std::string& query, const std::string& accept, bool hasAlpha) {
+    ImageFormat format;
+    if (!query.empty() && parseImageFormat(query, format)) return format;
+
+    // Take the first acceptable media type in header order, skipping q=0.
+    size_t pos = 0;
+    while (pos < accept.size()) {
+        size_t comma = accept.find(',', pos);
+        if (comma == std::string::npos) comma = accept.size();
+        std::string item = accept.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        size_t semi = item.find(';');
+        std::string params = semi == std::string::npos ? "" : item.substr(semi);
+        std::string type = item.substr(0, semi);
+        type.erase(0, type.find_first_not_of(" \t"));
+        type.erase(type.find_last_not_of(" \t") + 1);
+        if (params.find("q=0") != std::string::npos && params.find("q=0.") == std::string::npos) continue;
+
+        if (type == "image/png" || type == "image/*" || type == "*/*") return ImageFormat::PNG;
+        if (type == "image/qoi") return ImageFormat::QOI;
+        if (type == "image/jpeg" && !hasAlpha) return ImageFormat::JPEG;
+        if (type == "image/x-rgba" || type == "application/octet-stream") return ImageFormat::RAW;
+    }
+    return ImageFormat::PNG;
+}
+
+bool encodePng(const cv::Mat& source, int level, int stripes, std::vector<uchar>& out) {
+    out.clear();
+    const cv::Mat image = to8Bit(source);
+    if (!isSupported(image)) return false;
+    level = std::max(0, std::min(9, level));
+
+    // Stripes much smaller than the 32 KB deflate window compress poorly.
+    const int channels = image.channels();
+    const size_t rowBytes = (size_t)image.cols * channels + 1;
+    int minRows = (int)std::max<size_t>(1, (256 * 1024) / rowBytes);
+    if (stripes <= 0) stripes = std::max(1, cv::getNumThreads());
+    stripes = std::max(1, std::min(stripes, (image.rows + minRows - 1) / minRows));
+
+    std::vector<Stripe> parts(stripes);
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            int begin = (int)((int64_t)image.rows * i / stripes);
+            int end = (int)((int64_t)image.rows * (i + 1) / stripes);
+            deflateStripe(image, begin, end, level, i == stripes - 1, parts[i]);
+        }
+    });
+
+    size_t idatSize = 6;
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (const Stripe& s : parts) {
+        if (!s.ok) return false;
+        idatSize += s.deflated.size();
+        adler = adler32_combine(adler, s.adler, (z_off_t)s.rawLength);
+    }
+
+    static const uchar signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.reserve(8 + 25 + 12 + idatSize + 12);
+    out.insert(out.end(), signature, signature + 8);
+
+    std::vector<uchar> ihdr;
+    putBE32(ihdr, (uint32_t)image.cols);
+    putBE32(ihdr, (uint32_t)image.rows);
+    ihdr.push_back(8);
+    ihdr.push_back(channels == 1 ? 0 : channels == 3 ? 2 : 6);
+    ihdr.insert(ihdr.end(), { 0, 0, 0 });
+    putChunk(out, "IHDR", ihdr.data(), ihdr.size());
+
+    std::vector<uchar> idat;
+    idat.reserve(idatSize);
+    idat.push_back(0x78); // zlib header: deflate, 32K window
+    idat.push_back(0x01);
+    for (const Stripe& s : parts) {
+        idat.insert(idat.end(), s.deflated.begin(), s.deflated.end());
+    }
+    putBE32(idat, (uint32_t)adler);
+    putChunk(out, "IDAT", idat.data(), idat.size());
+    putChunk(out, "IEND", nullptr, 0);
+    return true;
+}
+
+bool encodeQoi(const cv::Mat& source, std::vector<uchar>& out) {
+    out.clear();
+    const cv::Mat image = to8Bit(source);
+    if (!isSupported(image)) return false;
+
+    const int srcChannels = image.channels();
+    const int channels = srcChannels == 4 ? 4 : 3;
+    const size_t pixels = (size_t)image.cols * image.rows;
+    out.reserve(14 + pixels * (channels + 1) / 2 + 8);
+
+    out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+    putBE32(out, (uint32_t)image.cols);
+    putBE32(out, (uint32_t)image.rows);
+    out.push_back((uchar)channels);
+    out.push_back(0); // sRGB with linear alpha
+
+    uchar index[64][4];
+    std::memset(index, 0, sizeof(index));
+    uchar prev[4] = { 0, 0, 0, 255 };
+    int run = 0;
+
+    for (int y = 0; y < image.rows; ++y) {
+        const uchar* row = image.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; ++x, row += srcChannels) {
+            uchar px[4];
+            if (srcChannels == 1) {
+                px[0] = px[1] = px[2] = row[0];
+                px[3] = 255;
+            }
+            else {
+                px[0] = row[2];
+                px[1] = row[1];
+                px[2] = row[0];
+                px[3] = srcChannels == 4 ? row[3] : 255;
+            }
+            const bool lastPixel = y == image.rows - 1 && x == image.cols - 1;
+
+            if (std::memcmp(px, prev, 4) == 0) {
+                if (++run == 62 || lastPixel) {
+                    out.push_back((uchar)(0xc0 | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push_back((uchar)(0xc0 | (run - 1)));
+                run = 0;
+            }
+
+            int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+            if (std::memcmp(index[hash], px, 4) == 0) {
+                out.push_back((uchar)hash);
+            }
+            else {
+                std::memcpy(index[hash], px, 4);
+                if (px[3] == prev[3]) {
+                    signed char vr = (signed char)(px[0] - prev[0]);
+                    signed char vg = (signed char)(px[1] - prev[1]);
+                    signed char vb = (signed char)(px[2] - prev[2]);
+                    int vgr = vr - vg;
+                    int vgb = vb - vg;
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        out.push_back((uchar)(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)));
+                    }
+                    else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                        out.push_back((uchar)(0x80 | (vg + 32)));
+                        out.push_back((uchar)((vgr + 8) << 4 | (vgb + 8)));
+                    }
+                    else {
+                        out.insert(out.end(), { 0xfe, px[0], px[1], px[2] });
+                    }
+                }
+                else {
+                    out.insert(out.end(), { 0xff, px[0], px[1], px[2], px[3] });
+                }
+            }
+            std::memcpy(prev, px, 4);
+        }
+    }
+
+    out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    return true;
+}
+
+bool encodeRawRgba(const cv::Mat& source, std::vector<uchar>& out) {
+    out.clear();
+    const cv::Mat image = to8Bit(source);
+    if (!isSupported(image)) return false;
+    out.resize((size_t)image.cols * image.rows * 4);
+    cv::Mat rgba(image.rows, image.cols, CV_8UC4, out.data());
+    int code = image.channels() == 1 ? cv::COLOR_GRAY2RGBA
+        : image.channels() == 3 ? cv::COLOR_BGR2RGBA : cv::COLOR_BGRA2RGBA;
+    cv::cvtColor(image, rgba, code);
+    return true;
+}
+
+bool encodeImage(const cv::Mat& image, const EncodeOptions& options, std::vector<uchar>& out) {
+    MW_TRACE_SCOPE("encodeImage");
+    switch (options.format) {
+    case ImageFormat::QOI:
+        return encodeQoi(image, out);
+    case ImageFormat::RAW:
+        return encodeRawRgba(image, out);
+    case ImageFormat::JPEG: {
+        cv::Mat opaque = to8Bit(image);
+        if (!isSupported(opaque)) return false;
+        if (opaque.channels() == 4) cv::cvtColor(opaque, opaque, cv::COLOR_BGRA2BGR);
+        return cv::imencode(".jpg", opaque, out, { cv::IMWRITE_JPEG_QUALITY, options.jpegQuality });
+    }
+    default:
+        return encodePng(image, options.pngLevel, options.stripes, out);
+    }
+}
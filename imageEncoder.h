@@ -0,0 +1,46 @@
+#ifndef IMAGEENCODER_H
+#define IMAGEENCODER_H
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Output formats for image responses.
+enum class ImageFormat {
+    PNG,  // lossless, alpha, striped multithreaded deflate
+    QOI,  // lossless, alpha, much faster than PNG at a slightly larger size
+    JPEG, // lossy, no alpha; for opaque previews
+    RAW,  // uncompressed RGBA, for clients that upload straight to a texture
+};
+
+struct EncodeOptions {
+    ImageFormat format = ImageFormat::PNG;
+    int pngLevel = 1;       // zlib level 0-9
+    int jpegQuality = 85;   // 0-100
+    int stripes = 0;        // PNG deflate stripes, 0 = one per OpenCV thread
+};
+
+const char* imageMimeType(ImageFormat format);
+const char* imageFormatName(ImageFormat format);
+bool parseImageFormat(const std::string& name, ImageFormat& format);
+
+// Pick a format from an explicit query value (?fmt=) or else the Accept
+// header. JPEG is only chosen from Accept when the image has no alpha.
+ImageFormat negotiateImageFormat(const std::string& query, const std::string& accept, bool hasAlpha);
+
+// 8-bit version of image, scaled by depth: 16-bit from 0..65535, 32-bit
+// integers from their full range, floating point from 0..1; signed depths
+// are offset to mid-gray. 8-bit images are returned as they are.
+cv::Mat to8Bit(const cv::Mat& image);
+
+// Encode a gray, BGR or BGRA Mat; other depths go through to8Bit() first.
+// Returns false on unsupported input.
+bool encodeImage(const cv::Mat& image, const EncodeOptions& options, std::vector<uchar>& out);
+
+bool encodePng(const cv::Mat& image, int level, int stripes, std::vector<uchar>& out);
+bool encodeQoi(const cv::Mat& image, std::vector<uchar>& out);
+bool encodeRawRgba(const cv::Mat& image, std::vector<uchar>& out);
+
+#endif // IMAGEENCODER_H
@@ -1,3 +1,105 @@
 #include "imgProc.h"
+#include "trace.h"
 
+void buildGrid(Grid& grid, const cv::Size& size, int step)
+{
+    MW_TRACE_SCOPE("buildGrid");
+    for (auto tri : grid.triangles) {
+        delete tri;
+    }
+    for (auto node : grid.nodes) {
+        delete node;
+    }
+    grid.triangles.clear();
+    grid.nodes.clear();
 
+    if (size.width <= 0 || size.height <= 0 || step <= 0) return;
+
+    std::vector<float> xs, ys;
+    for (int x = 0; x < size.width - 1; x += step) xs.push_back((float)x);
+    xs.push_back((float)(size.width - 1));
+    for (int y = 0; y < size.height - 1; y += step) ys.push_back((float)y);
+    ys.push_back((float)(size.height - 1));
+
+    const int cols = (int)xs.size();
+    const int rows = (int)ys.size();
+    grid.nodes.reserve(cols * rows);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            grid.nodes.push_back(new GridNode(cv::Point2f(xs[c], ys[r])));
+        }
+    }
+
+    auto at = [&](int r, int c) { return grid.nodes[r * cols + c]; };
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            GridNode* node = at(r, c);
+            if (c > 0) node->neighbors.push_back(at(r, c - 1));
+            if (c + 1 < cols) node->neighbors.push_back(at(r, c + 1));
+            if (r > 0) node->neighbors.push_back(at(r - 1, c));
+            if (r + 1 < rows) node->neighbors.push_back(at(r + 1, c));
+        }
+    }
+
+    // 每個格子切成兩個三角形
+    for (int r = 0; r + 1 < rows; ++r) {
+        for (int c = 0; c + 1 < cols; ++c) {
+            grid.addTriangle(at(r, c), at(r, c + 1), at(r + 1, c));
+            grid.addTriangle(at(r, c + 1), at(r + 1, c + 1), at(r + 1, c));
+        }
+    }
+}
+
+std::vector<WarpTriangle> collectWarpTriangles(const Grid& grid)
+{
+    std::vector<WarpTriangle> result;
+    result.reserve(grid.triangles.size());
+    for (const Triangle* tri : grid.triangles) {
+        const GridNode* v[3] = { tri->v1, tri->v2, tri->v3 };
+        WarpTriangle wt;
+        for (int i = 0; i < 3; ++i) {
+            wt.src[i] = v[i]->position;
+            wt.dst[i] = v[i]->position_modified;
+        }
+        result.push_back(wt);
+    }
+    return result;
+}
+
+void warpImage(const cv::Mat& src, cv::Mat& dst, const std::vector<WarpTriangle>& triangles,
+               const AlphaCoverage* coverage)
+{
+    MW_TRACE_SCOPE("warpImage");
+    dst = cv::Mat::zeros(src.size(), src.type());
+    const cv::Rect bounds(0, 0, src.cols, src.rows);
+
+    for (const WarpTriangle& t : triangles) {
+        std::vector<cv::Point2f> srcPts(t.src, t.src + 3);
+        std::vector<cv::Point2f> dstPts(t.dst, t.dst + 3);
+        cv::Rect r1 = cv::boundingRect(srcPts) & bounds;
+        cv::Rect r2 = cv::boundingRect(dstPts);
+        cv::Rect r2Clipped = r2 & bounds;
+        if (r1.empty() || r2Clipped.empty()) continue;
+        // 來源完全透明，變形後仍是透明，不必處理
+        if (coverage && !coverage->anyVisible(r1)) continue;
+
+        // 轉成各自包圍框內的局部座標
+        cv::Point2f srcLocal[3], dstLocal[3];
+        cv::Point dstPoly[3];
+        for (int i = 0; i < 3; ++i) {
+            srcLocal[i] = cv::Point2f(t.src[i].x - r1.x, t.src[i].y - r1.y);
+            dstLocal[i] = cv::Point2f(t.dst[i].x - r2.x, t.dst[i].y - r2.y);
+            dstPoly[i] = cv::Point((int)std::lround(dstLocal[i].x), (int)std::lround(dstLocal[i].y));
+        }
+
+        cv::Mat affine = cv::getAffineTransform(srcLocal, dstLocal);
+        cv::Mat patch;
+        cv::warpAffine(src(r1), patch, affine, r2.size(), cv::INTER_LINEAR, cv::BORDER_REFLECT);
+
+        cv::Mat mask = cv::Mat::zeros(r2.size(), CV_8UC1);
+        cv::fillConvexPoly(mask, dstPoly, 3, cv::Scalar(255));
+
+        cv::Rect local(r2Clipped.x - r2.x, r2Clipped.y - r2.y, r2Clipped.width, r2Clipped.height);
+        patch(local).copyTo(dst(r2Clipped), mask(local));
+    }
+}
@@ -4,10 +4,30 @@
 #pragma once
 
 #include "KDTree.h"
+#include "spriteAlpha.h"
 #include "opencv2/opencv.hpp"
 #include <unordered_set>
 using namespace cv;
 using namespace std;
 
+// Build a regular triangulated grid covering an image of the given size.
+// step is the spacing between grid nodes in pixels; the last row/column is
+// snapped to the image border so the mesh always covers the whole image.
+void buildGrid(Grid& grid, const cv::Size& size, int step);
+
+// One triangle of a piecewise-affine warp, copied out of the Grid so the warp
+// can run on another thread while the grid keeps being edited.
+struct WarpTriangle {
+    cv::Point2f src[3]; // position
+    cv::Point2f dst[3]; // position_modified
+};
+
+std::vector<WarpTriangle> collectWarpTriangles(const Grid& grid);
+
+// Warp src into dst by mapping every triangle from its original to its
+// modified position. Pixels not covered by any triangle are left transparent.
+// With coverage (of src), triangles over fully transparent cells are skipped.
+void warpImage(const cv::Mat& src, cv::Mat& dst, const std::vector<WarpTriangle>& triangles,
+               const AlphaCoverage* coverage = nullptr);
 
 #endif // IMGPROC_H
@@ -0,0 +1,276 @@
+#include "jobSystem.h"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include "trace.h"
+
+namespace {
+
+// Worker index of the calling thread in the JobSystem it belongs to.
+thread_local const void* localSystem = nullptr;
+thread_local size_t localIndex = 0;
+
+void atomicMin(std::atomic<int64_t>& value, int64_t candidate) {
+    int64_t current = value.load(std::memory_order_relaxed);
+    while ((current == 0 || candidate < current) &&
+           !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+    }
+}
+
+void atomicMax(std::atomic<int64_t>& value, int64_t candidate) {
+    int64_t current = value.load(std::memory_order_relaxed);
+    while (candidate > current && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+// JobGraph implementation
+JobGraph::Job JobGraph::add(const char* name, std::function<void()> fn) {
+    nodes.emplace_back();
+    nodes.back().name = name;
+    nodes.back().fn = std::move(fn);
+    checked = false;
+    return (Job)(nodes.size() - 1);
+}
+
+JobGraph::Job JobGraph::addRange(const char* name, std::function<size_t()> count, size_t grain,
+                                 std::function<void(size_t begin, size_t end)> fn) {
+    nodes.emplace_back();
+    Node& node = nodes.back();
+    node.name = name;
+    node.count = std::move(count);
+    node.grain = std::max<size_t>(grain, 1);
+    node.rangeFn = std::move(fn);
+    checked = false;
+    return (Job)(nodes.size() - 1);
+}
+
+void JobGraph::after(Job job, Job prerequisite) {
+    if (job >= nodes.size() || prerequisite >= nodes.size() || job == prerequisite) {
+        throw std::out_of_range("JobGraph::after: bad job");
+    }
+    nodes[job].prerequisites.push_back(prerequisite);
+    nodes[prerequisite].dependents.push_back(job);
+    checked = false;
+}
+
+nlohmann::json JobGraph::profileJson() const {
+    // Longest chain of job durations along the edges, i.e. the best a run
+    // could do with unlimited cores.
+    std::vector<int64_t> finish(nodes.size(), -1);
+    std::function<int64_t(Job)> longest = [&](Job job) -> int64_t {
+        if (finish[job] >= 0) return finish[job];
+        int64_t before = 0;
+        for (Job p : nodes[job].prerequisites) before = std::max(before, longest(p));
+        const Node& n = nodes[job];
+        return finish[job] = before + std::max<int64_t>(0, n.endNs.load() - n.startNs.load());
+    };
+    int64_t critical = 0;
+    nlohmann::json jobs = nlohmann::json::array();
+    for (Job id = 0; id < nodes.size(); ++id) {
+        const Node& n = nodes[id];
+        critical = std::max(critical, longest(id));
+        uint64_t mask = n.threadMask.load();
+        int threads = 0;
+        for (; mask; mask &= mask - 1) ++threads;
+        int64_t start = n.startNs.load(), end = n.endNs.load();
+        jobs.push_back({ {"id", id}, {"name", n.name}, {"after", n.prerequisites}, {"items", n.items},
+                         {"chunks", n.chunks}, {"threads", threads},
+                         {"startUs", start ? (start - runStartNs) / 1000.0 : 0.0},
+                         {"endUs", end ? (end - runStartNs) / 1000.0 : 0.0} });
+    }
+    return { {"wallUs", (runEndNs - runStartNs) / 1000.0}, {"criticalPathUs", critical / 1000.0}, {"jobs", jobs} };
+}
+
+std::string JobGraph::dot() const {
+    std::string out = "digraph jobs {\n";
+    char buf[256];
+    for (Job id = 0; id < nodes.size(); ++id) {
+        const Node& n = nodes[id];
+        double us = std::max<int64_t>(0, n.endNs.load() - n.startNs.load()) / 1000.0;
+        snprintf(buf, sizeof(buf), "  j%u [label=\"%s\\n%.1f us, %zu chunks\"];\n", id, n.name, us, n.chunks);
+        out += buf;
+        for (Job p : n.prerequisites) {
+            snprintf(buf, sizeof(buf), "  j%u -> j%u;\n", p, id);
+            out += buf;
+        }
+    }
+    return out + "}\n";
+}
+
+// JobSystem implementation
+JobSystem& JobSystem::global() {
+    static JobSystem system;
+    return system;
+}
+
+JobSystem::JobSystem(size_t count) {
+    if (count == 0) {
+        unsigned hw = std::thread::hardware_concurrency();
+        count = hw > 1 ? hw - 1 : 1;
+    }
+    for (size_t i = 0; i <= count; ++i) queues.emplace_back(new Queue());
+    threads.reserve(count);
+    for (size_t i = 0; i < count; ++i) threads.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+size_t JobSystem::ownQueue() const {
+    return localSystem == this ? localIndex : queues.size() - 1;
+}
+
+void JobSystem::push(const Task& task) {
+    Queue& q = *queues[ownQueue()];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(task);
+    }
+    queued.fetch_add(1);
+    // Pairs with the sleepers increment in workerLoop: either the worker
+    // sees the task or we see the sleeper.
+    if (sleepers.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+}
+
+bool JobSystem::take(Task& task, size_t self) {
+    {
+        Queue& q = *queues[self];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    for (size_t k = 1; k < queues.size(); ++k) {
+        Queue& q = *queues[(self + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::workerLoop(size_t index) {
+    localSystem = this;
+    localIndex = index;
+    trace::setThreadName("job worker");
+    Task task;
+    for (;;) {
+        if (take(task, index)) {
+            execute(task, index);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepers.fetch_add(1);
+        wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+        sleepers.fetch_sub(1);
+        if (stopping) return;
+    }
+}
+
+void JobSystem::execute(const Task& task, size_t self) {
+    JobGraph::Node& node = task.graph->nodes[task.node];
+    atomicMin(node.startNs, trace::nowNs());
+    node.threadMask.fetch_or(1ull << (self % 64), std::memory_order_relaxed);
+    {
+        MW_TRACE_SCOPE(node.name);
+        if (node.rangeFn) node.rangeFn(task.begin, task.end);
+        else node.fn();
+    }
+    atomicMax(node.endNs, trace::nowNs());
+    if (node.chunksLeft.fetch_sub(1) == 1) finish(*task.graph, task.node);
+}
+
+void JobSystem::schedule(JobGraph& graph, uint32_t id) {
+    JobGraph::Node& node = graph.nodes[id];
+    node.items = node.rangeFn ? (node.count ? node.count() : 0) : 1;
+    if (node.items == 0) {
+        node.chunks = 0;
+        finish(graph, id);
+        return;
+    }
+    node.chunks = (node.items + node.grain - 1) / node.grain;
+    if (!node.rangeFn) node.chunks = 1;
+    node.chunksLeft.store(node.chunks);
+    // Push the last chunk first so the owner pops them in order.
+    for (size_t c = node.chunks; c-- > 0;) {
+        size_t begin = c * node.grain;
+        push({ &graph, id, begin, std::min(begin + node.grain, node.items) });
+    }
+}
+
+void JobSystem::finish(JobGraph& graph, uint32_t id) {
+    for (uint32_t next : graph.nodes[id].dependents) {
+        if (graph.nodes[next].waiting.fetch_sub(1) == 1) schedule(graph, next);
+    }
+    graph.remaining.fetch_sub(1);
+}
+
+void JobSystem::run(JobGraph& graph) {
+    MW_TRACE_SCOPE("JobSystem::run");
+    if (!graph.checked) {
+        // Kahn's algorithm: every job must become ready at some point.
+        std::vector<uint32_t> waiting(graph.nodes.size()), ready;
+        for (uint32_t id = 0; id < graph.nodes.size(); ++id) {
+            waiting[id] = (uint32_t)graph.nodes[id].prerequisites.size();
+            if (!waiting[id]) ready.push_back(id);
+        }
+        size_t seen = 0;
+        while (!ready.empty()) {
+            uint32_t id = ready.back();
+            ready.pop_back();
+            ++seen;
+            for (uint32_t next : graph.nodes[id].dependents) {
+                if (--waiting[next] == 0) ready.push_back(next);
+            }
+        }
+        if (seen != graph.nodes.size()) throw std::logic_error("JobGraph has a cycle");
+        graph.checked = true;
+    }
+
+    graph.runStartNs = trace::nowNs();
+    graph.remaining.store(graph.nodes.size());
+    for (JobGraph::Node& node : graph.nodes) {
+        node.waiting.store((uint32_t)node.prerequisites.size());
+        node.startNs.store(0);
+        node.endNs.store(0);
+        node.threadMask.store(0);
+        node.items = node.chunks = 0;
+    }
+    for (uint32_t id = 0; id < graph.nodes.size(); ++id) {
+        if (graph.nodes[id].prerequisites.empty()) schedule(graph, id);
+    }
+    // Help until done. Tasks of other graphs may be picked up too, which
+    // is fine: they all have to run anyway.
+    size_t self = ownQueue();
+    Task task;
+    while (graph.remaining.load() > 0) {
+        if (take(task, self)) execute(task, self);
+        else std::this_thread::yield();
+    }
+    graph.runEndNs = trace::nowNs();
+}
+
+void JobSystem::parallelFor(const char* name, size_t count, size_t grain,
+                            std::function<void(size_t begin, size_t end)> fn) {
+    JobGraph graph;
+    graph.addRange(name, [count] { return count; }, grain, std::move(fn));
+    run(graph);
+}
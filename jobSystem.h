@@ -0,0 +1,139 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+
+// A set of jobs and the order constraints between them, built once and run
+// as often as needed (typically once per frame). A job is either a single
+// call or a range of items split into chunks that different threads take.
+//
+//     JobGraph frame;
+//     auto pose = frame.addRange("pose", [&] { return characters.size(); }, 4, posePart);
+//     auto skin = frame.addRange("skin", [&] { return meshes.size(); }, 8, skinPart);
+//     frame.after(skin, pose);
+//     JobSystem::global().run(frame);
+//
+// After a run, profileJson() and dot() describe the graph with the timing
+// of every job, for profiling; each chunk also shows up as a trace span.
+class JobGraph {
+public:
+    using Job = uint32_t;
+
+    JobGraph() = default;
+    JobGraph(const JobGraph&) = delete;
+    JobGraph& operator=(const JobGraph&) = delete;
+
+    Job add(const char* name, std::function<void()> fn);
+    // fn(begin, end) over [0, count()) in chunks of at most grain items.
+    // count() is called when the job becomes ready, so earlier jobs can
+    // decide how much work there is.
+    Job addRange(const char* name, std::function<size_t()> count, size_t grain,
+                 std::function<void(size_t begin, size_t end)> fn);
+    // job starts only once prerequisite has finished.
+    void after(Job job, Job prerequisite);
+
+    size_t size() const { return nodes.size(); }
+    const char* name(Job job) const { return nodes[job].name; }
+
+    // {"wallUs", "criticalPathUs", "jobs": [{"id", "name", "after", "items",
+    // "chunks", "threads", "startUs", "endUs"}]}, times relative to the start
+    // of the last run.
+    nlohmann::json profileJson() const;
+    // Graphviz digraph of the jobs, labelled with their last durations.
+    std::string dot() const;
+
+private:
+    friend class JobSystem;
+
+    struct Node {
+        const char* name = "";
+        std::function<void()> fn;
+        std::function<size_t()> count; // range jobs only
+        size_t grain = 1;
+        std::function<void(size_t, size_t)> rangeFn;
+        std::vector<Job> prerequisites;
+        std::vector<Job> dependents;
+
+        // Per run.
+        std::atomic<uint32_t> waiting{ 0 };
+        std::atomic<size_t> chunksLeft{ 0 };
+        std::atomic<int64_t> startNs{ 0 };
+        std::atomic<int64_t> endNs{ 0 };
+        std::atomic<uint64_t> threadMask{ 0 };
+        size_t items = 0;
+        size_t chunks = 0;
+    };
+
+    std::deque<Node> nodes; // stable addresses: nodes hold atomics
+    bool checked = false;   // acyclic, verified on the first run after a change
+    std::atomic<size_t> remaining{ 0 };
+    int64_t runStartNs = 0;
+    int64_t runEndNs = 0;
+};
+
+// Work-stealing scheduler. Every worker owns a deque: it pushes and pops
+// its own tasks at the back (newest first, still warm in cache) while idle
+// workers steal from the front of the others. Threads outside the pool
+// submit through one shared deque and help execute until their graph is
+// done, so run() may also be called from inside a job.
+class JobSystem {
+public:
+    static JobSystem& global();
+
+    // threads == 0 picks hardware_concurrency() - 1 workers (at least one);
+    // the thread calling run() makes up the last core.
+    explicit JobSystem(size_t threads = 0);
+    ~JobSystem();
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Run every job of graph, respecting after() edges, and return once all
+    // have finished. Throws std::logic_error if the edges form a cycle.
+    void run(JobGraph& graph);
+    // One-off range job.
+    void parallelFor(const char* name, size_t count, size_t grain, std::function<void(size_t begin, size_t end)> fn);
+
+    size_t threadCount() const { return threads.size() + 1; }
+
+private:
+    struct Task {
+        JobGraph* graph;
+        uint32_t node;
+        size_t begin;
+        size_t end;
+    };
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(size_t index);
+    size_t ownQueue() const;
+    void push(const Task& task);
+    bool take(Task& task, size_t self);
+    void execute(const Task& task, size_t self);
+    void schedule(JobGraph& graph, uint32_t node);
+    void finish(JobGraph& graph, uint32_t node);
+
+    std::vector<std::unique_ptr<Queue>> queues; // one per worker, then the shared one
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued{ 0 };
+    std::atomic<size_t> sleepers{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+#endif // JOBSYSTEM_H
@@ -0,0 +1,373 @@
+// Load generator: replays recorded drag traces against a running server.
+//
+//   loadGen [options] traces/drag_flick.jsonl traces/drag_arc.jsonl ...
+//     --url http://127.0.0.1:8000   server to load
+//     --connections N               concurrent clients, one connection each (8)
+//     --duration S                  seconds to run (10)
+//     --pace realtime|max           keep the recorded gaps between events, or
+//                                   send the next request as soon as the last
+//                                   one answered (realtime)
+//     --shared-session              all clients drag in the default session
+//                                   instead of creating one each
+//     --out result.json             write the summary for --compare
+//
+//   loadGen --compare base.json new.json [--threshold 10]
+//     prints both runs side by side and exits 1 when p50/p99 latency grew or
+//     throughput dropped by more than threshold percent on any endpoint.
+//
+// A trace is one JSON object per line, the requests ImageCanvasManager.js
+// sends during one drag, with t in milliseconds since the clickStart:
+//   {"t":16,"uri":"/api/drag","body":{"x":306,"y":251,"scw":800,"sch":600}}
+//
+// Each client loops over the traces round-robin, one request in flight at a
+// time, like a browser tab. Latency is measured from sending the request to
+// the complete response.
+//
+// Build: g++ -std=c++17 -O2 loadGen.cpp metrics.cpp mongoose.c -o loadGen
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include "metrics.h"
+#include "mongoose.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+struct TraceEvent {
+    int64_t offsetMs;
+    string uri;
+    string body;
+};
+
+struct Trace {
+    string name;
+    vector<TraceEvent> events;
+};
+
+struct EndpointStats {
+    LatencyHistogram latency;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+};
+
+struct Options {
+    string url = "http://127.0.0.1:8000";
+    int connections = 8;
+    double durationS = 10;
+    bool realtime = true;
+    bool sharedSession = false;
+    string out;
+};
+
+struct Client;
+
+struct Run {
+    Options options;
+    vector<Trace> traces;
+    map<string, unique_ptr<EndpointStats>> endpoints;
+    vector<unique_ptr<Client>> clients;
+    bool sending = true;
+    uint64_t dragsCompleted = 0;
+    uint64_t connectErrors = 0;
+
+    EndpointStats& endpoint(const string& uri) {
+        auto& slot = endpoints[uri];
+        if (!slot) slot.reset(new EndpointStats());
+        return *slot;
+    }
+};
+
+struct Client {
+    Run* run = nullptr;
+    struct mg_connection* conn = nullptr;
+    string session;
+    size_t trace = 0;
+    size_t step = 0;
+    int64_t traceStartNs = 0;
+    int64_t nextAtNs = 0;
+    int64_t sentAtNs = 0;
+    string pendingUri; // empty when idle
+};
+
+int64_t nowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool loadTrace(const string& path, Trace& trace) {
+    ifstream in(path);
+    if (!in) return false;
+    trace.name = path;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty()) continue;
+        json j = json::parse(line, nullptr, false);
+        if (j.is_discarded() || !j.contains("uri")) return false;
+        trace.events.push_back({ j.value("t", (int64_t)0), j["uri"].get<string>(), j.value("body", json::object()).dump() });
+    }
+    return !trace.events.empty();
+}
+
+void sendRequest(Client& client, const string& uri, const string& body) {
+    mg_printf(client.conn,
+              "POST %s HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\n%s%s%s"
+              "Content-Length: %d\r\n\r\n%s",
+              uri.c_str(),
+              client.session.empty() ? "" : "X-Session: ", client.session.c_str(), client.session.empty() ? "" : "\r\n",
+              (int)body.size(), body.c_str());
+    client.pendingUri = uri;
+    client.sentAtNs = nowNs();
+}
+
+void startTrace(Client& client, int64_t now) {
+    client.step = 0;
+    client.traceStartNs = now;
+    client.nextAtNs = now;
+}
+
+// Send the client's next trace event if it is due.
+void pump(Client& client) {
+    Run& run = *client.run;
+    if (!client.conn || !client.pendingUri.empty() || !run.sending) return;
+    if (!run.options.sharedSession && client.session.empty()) {
+        sendRequest(client, "/api/session", "{}");
+        return;
+    }
+    int64_t now = nowNs();
+    if (now < client.nextAtNs) return;
+    const TraceEvent& event = run.traces[client.trace].events[client.step];
+    sendRequest(client, event.uri, event.body);
+}
+
+void onResponse(Client& client, struct mg_http_message* hm) {
+    Run& run = *client.run;
+    int64_t now = nowNs();
+    int status = mg_http_status(hm);
+    EndpointStats& stats = run.endpoint(client.pendingUri);
+    stats.latency.record((uint64_t)(now - client.sentAtNs));
+    ++stats.requests;
+    if (status < 200 || status >= 300) ++stats.errors;
+
+    if (client.pendingUri == "/api/session") {
+        json j = json::parse(hm->body.buf, hm->body.buf + hm->body.len, nullptr, false);
+        if (!j.is_discarded() && j.contains("session")) client.session = j["session"].get<string>();
+        client.pendingUri.clear();
+        startTrace(client, now);
+        return;
+    }
+    client.pendingUri.clear();
+
+    const Trace& trace = run.traces[client.trace];
+    if (++client.step >= trace.events.size()) {
+        ++run.dragsCompleted;
+        client.trace = (client.trace + 1) % run.traces.size();
+        startTrace(client, now);
+    }
+    else if (run.options.realtime) {
+        client.nextAtNs = client.traceStartNs + trace.events[client.step].offsetMs * 1000000;
+    }
+    else {
+        client.nextAtNs = now;
+    }
+    pump(client);
+}
+
+void clientHandler(struct mg_connection* c, int ev, void* ev_data) {
+    Client* client = (Client*)c->fn_data;
+    if (ev == MG_EV_CONNECT) {
+        pump(*client);
+    }
+    else if (ev == MG_EV_HTTP_MSG) {
+        onResponse(*client, (struct mg_http_message*)ev_data);
+    }
+    else if (ev == MG_EV_POLL) {
+        pump(*client);
+    }
+    else if (ev == MG_EV_ERROR) {
+        ++client->run->connectErrors;
+    }
+    else if (ev == MG_EV_CLOSE) {
+        if (!client->pendingUri.empty()) {
+            ++client->run->endpoint(client->pendingUri).errors;
+            client->pendingUri.clear();
+        }
+        client->conn = nullptr;
+    }
+}
+
+// Rates are over the sending window; elapsedS also covers the final drain.
+json summarize(const Run& run, double elapsedS) {
+    double windowS = min(elapsedS, run.options.durationS);
+    json out;
+    out["connections"] = run.options.connections;
+    out["durationS"] = elapsedS;
+    out["pace"] = run.options.realtime ? "realtime" : "max";
+    out["drags"] = run.dragsCompleted;
+    out["connectErrors"] = run.connectErrors;
+    uint64_t total = 0;
+    for (auto& item : run.endpoints) {
+        const EndpointStats& stats = *item.second;
+        LatencyHistogram::Snapshot s = stats.latency.snapshot();
+        out["endpoints"][item.first] = {
+            { "requests", stats.requests },
+            { "errors", stats.errors },
+            { "throughput", stats.requests / windowS },
+            { "meanMs", s.count ? s.sumNs / 1e6 / s.count : 0.0 },
+            { "p50Ms", s.quantileNs(0.50) / 1e6 },
+            { "p90Ms", s.quantileNs(0.90) / 1e6 },
+            { "p99Ms", s.quantileNs(0.99) / 1e6 },
+            { "maxMs", s.maxNs / 1e6 },
+        };
+        total += stats.requests;
+    }
+    out["throughput"] = total / windowS;
+    return out;
+}
+
+void printSummary(const json& summary) {
+    printf("%d connections, %.1f s, pace %s: %.0f req/s, %llu drags, %llu connect errors\n",
+           summary["connections"].get<int>(), summary["durationS"].get<double>(),
+           summary["pace"].get<string>().c_str(), summary["throughput"].get<double>(),
+           (unsigned long long)summary["drags"].get<uint64_t>(), (unsigned long long)summary["connectErrors"].get<uint64_t>());
+    printf("%-18s %9s %7s %9s %9s %9s %9s %9s\n", "endpoint", "requests", "errors", "req/s", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (auto& item : summary["endpoints"].items()) {
+        const json& e = item.value();
+        printf("%-18s %9llu %7llu %9.1f %9.3f %9.3f %9.3f %9.3f\n", item.key().c_str(),
+               (unsigned long long)e["requests"].get<uint64_t>(), (unsigned long long)e["errors"].get<uint64_t>(),
+               e["throughput"].get<double>(), e["p50Ms"].get<double>(), e["p90Ms"].get<double>(),
+               e["p99Ms"].get<double>(), e["maxMs"].get<double>());
+    }
+}
+
+bool readJson(const string& path, json& out) {
+    ifstream in(path);
+    if (!in) return false;
+    out = json::parse(in, nullptr, false);
+    return !out.is_discarded();
+}
+
+// Percent change from base to current, positive = worse.
+double worse(double base, double current, bool higherIsBetter) {
+    if (base <= 0) return 0;
+    double change = (current - base) / base * 100.0;
+    return higherIsBetter ? -change : change;
+}
+
+int compare(const string& basePath, const string& currentPath, double threshold) {
+    json base, current;
+    if (!readJson(basePath, base) || !readJson(currentPath, current)) {
+        fprintf(stderr, "cannot read %s or %s\n", basePath.c_str(), currentPath.c_str());
+        return 2;
+    }
+    if (base["connections"] != current["connections"] || base["pace"] != current["pace"]) {
+        printf("warning: runs used different --connections or --pace\n");
+    }
+    int regressions = 0;
+    printf("%-18s %-6s %10s %10s %8s\n", "endpoint", "metric", "base", "current", "change");
+    for (auto& item : current["endpoints"].items()) {
+        if (!base["endpoints"].contains(item.key())) continue;
+        const json& b = base["endpoints"][item.key()];
+        const json& c = item.value();
+        struct Metric {
+            const char* key;
+            const char* label;
+            bool higherIsBetter;
+        };
+        for (const Metric& m : { Metric{ "p50Ms", "p50", false }, Metric{ "p99Ms", "p99", false },
+                                 Metric{ "throughput", "req/s", true } }) {
+            double bv = b[m.key].get<double>(), cv = c[m.key].get<double>();
+            double w = worse(bv, cv, m.higherIsBetter);
+            bool flagged = w > threshold;
+            regressions += flagged;
+            printf("%-18s %-6s %10.3f %10.3f %+7.1f%%%s\n", item.key().c_str(), m.label, bv, cv,
+                   bv > 0 ? (cv - bv) / bv * 100.0 : 0.0, flagged ? "  REGRESSION" : "");
+        }
+    }
+    printf("%d regression(s) above %.0f%%\n", regressions, threshold);
+    return regressions ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    vector<string> tracePaths;
+    string compareBase, compareCurrent;
+    double threshold = 10;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--url" && hasValue) options.url = argv[++i];
+        else if (arg == "--connections" && hasValue) options.connections = max(1, atoi(argv[++i]));
+        else if (arg == "--duration" && hasValue) options.durationS = atof(argv[++i]);
+        else if (arg == "--pace" && hasValue) options.realtime = string(argv[++i]) != "max";
+        else if (arg == "--shared-session") options.sharedSession = true;
+        else if (arg == "--out" && hasValue) options.out = argv[++i];
+        else if (arg == "--threshold" && hasValue) threshold = atof(argv[++i]);
+        else if (arg == "--compare" && i + 2 < argc) {
+            compareBase = argv[++i];
+            compareCurrent = argv[++i];
+        }
+        else if (!arg.empty() && arg[0] != '-') tracePaths.push_back(arg);
+        else {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+    }
+    if (!compareBase.empty()) return compare(compareBase, compareCurrent, threshold);
+
+    Run run;
+    run.options = options;
+    if (tracePaths.empty()) {
+        tracePaths = { "traces/drag_flick.jsonl", "traces/drag_arc.jsonl", "traces/drag_zigzag.jsonl" };
+    }
+    for (const string& path : tracePaths) {
+        Trace trace;
+        if (!loadTrace(path, trace)) {
+            fprintf(stderr, "cannot load trace %s\n", path.c_str());
+            return 2;
+        }
+        run.traces.push_back(std::move(trace));
+    }
+
+    struct mg_mgr mgr;
+    mg_mgr_init(&mgr);
+    mg_log_set(MG_LL_NONE);
+    for (int i = 0; i < options.connections; ++i) {
+        run.clients.emplace_back(new Client());
+        Client& client = *run.clients.back();
+        client.run = &run;
+        client.trace = i % run.traces.size(); // spread clients over the traces
+        startTrace(client, nowNs());
+    }
+
+    int64_t start = nowNs();
+    int64_t stopAt = start + (int64_t)(options.durationS * 1e9);
+    int64_t drainUntil = stopAt + 5000000000LL;
+    for (;;) {
+        int64_t now = nowNs();
+        if (now >= stopAt) run.sending = false;
+        bool inFlight = false;
+        for (auto& client : run.clients) {
+            if (!client->conn && run.sending) {
+                client->conn = mg_http_connect(&mgr, options.url.c_str(), clientHandler, client.get());
+            }
+            inFlight |= client->conn && !client->pendingUri.empty();
+        }
+        if (!run.sending && (!inFlight || now >= drainUntil)) break;
+        mg_mgr_poll(&mgr, 1);
+    }
+    double elapsedS = (nowNs() - start) / 1e9;
+    mg_mgr_free(&mgr);
+
+    json summary = summarize(run, elapsedS);
+    printSummary(summary);
+    if (!options.out.empty()) {
+        ofstream(options.out) << summary.dump(2) << "\n";
+    }
+    return 0;
+}
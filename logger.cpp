@@ -0,0 +1,228 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace logging {
+
+std::atomic<int> levelValue{ MW_LOG_MIN_LEVEL };
+
+namespace {
+
+const size_t kCapacity = 1024; // records per thread, power of two
+
+// Single producer (the owning thread), single consumer (whoever holds
+// drainMutex). head and tail count records ever written and read.
+struct ThreadBuffer {
+    uint32_t tid = 0;
+    std::unique_ptr<Record[]> records{ new Record[kCapacity] };
+    std::atomic<uint64_t> head{ 0 };
+    std::atomic<uint64_t> tail{ 0 };
+};
+
+// Buffers outlive their threads so late records of finished threads still
+// get written.
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;
+uint32_t nextTid = 1;
+thread_local ThreadBuffer* localBuffer = nullptr;
+
+std::atomic<uint64_t> droppedCount{ 0 };
+
+std::mutex drainMutex;
+std::function<void(const char*, size_t)> sinkFunction;
+
+const char kLevelNames[] = { 'D', 'I', 'W', 'E' };
+
+void appendArg(std::string& out, const Record& r, const Arg& a) {
+    char buf[32];
+    switch (a.type) {
+    case Arg::Int: snprintf(buf, sizeof(buf), "%lld", (long long)a.i); break;
+    case Arg::Uint: snprintf(buf, sizeof(buf), "%llu", (unsigned long long)a.u); break;
+    case Arg::Double: snprintf(buf, sizeof(buf), "%g", a.d); break;
+    case Arg::Bool: snprintf(buf, sizeof(buf), "%s", a.u ? "true" : "false"); break;
+    case Arg::Pointer: snprintf(buf, sizeof(buf), "%p", a.p); break;
+    case Arg::Text: out.append(r.text + a.text.offset, a.text.length); return;
+    }
+    out += buf;
+}
+
+// "HH:MM:SS.mmm L tN message\n", each "{}" replaced by the next argument.
+void formatRecord(std::string& out, const Record& r, uint32_t tid) {
+    int64_t ms = r.timeNs / 1000000;
+    std::time_t seconds = (std::time_t)(ms / 1000);
+    std::tm local;
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%03d %c t%u ", local.tm_hour, local.tm_min, local.tm_sec,
+             (int)(ms % 1000), kLevelNames[std::min<int>(r.level, 3)], tid);
+    out += prefix;
+    int next = 0;
+    for (const char* f = r.format; *f; ++f) {
+        if (f[0] == '{' && f[1] == '}' && next < r.argCount) {
+            appendArg(out, r, r.args[next++]);
+            ++f;
+        }
+        else {
+            out += *f;
+        }
+    }
+    out += '\n';
+}
+
+struct Pending {
+    const Record* record;
+    uint32_t tid;
+};
+
+// Caller holds drainMutex. Returns whether anything was written.
+bool drainLocked() {
+    std::vector<std::pair<ThreadBuffer*, uint64_t>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto& buffer : registry) buffers.push_back({ buffer.get(), buffer->head.load(std::memory_order_acquire) });
+    }
+    // Records stay in their rings until tail moves past them below.
+    std::vector<Pending> pending;
+    for (auto& b : buffers) {
+        for (uint64_t i = b.first->tail.load(std::memory_order_relaxed); i < b.second; ++i) {
+            pending.push_back({ &b.first->records[i & (kCapacity - 1)], b.first->tid });
+        }
+    }
+    if (pending.empty()) return false;
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const Pending& a, const Pending& b) { return a.record->timeNs < b.record->timeNs; });
+    std::string out;
+    out.reserve(pending.size() * 96);
+    for (const Pending& p : pending) formatRecord(out, *p.record, p.tid);
+    for (auto& b : buffers) b.first->tail.store(b.second, std::memory_order_release);
+    if (sinkFunction) {
+        sinkFunction(out.data(), out.size());
+    }
+    else {
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+    }
+    return true;
+}
+
+// Started with the first buffer; drains every few milliseconds, sooner
+// when a ring fills past half (see beginRecord), and once more at exit.
+class Writer {
+public:
+    Writer() : thread([this] { run(); }) {}
+
+    void nudge() {
+        if (!nudged.exchange(true, std::memory_order_relaxed)) wake.notify_one();
+    }
+    ~Writer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+        std::lock_guard<std::mutex> lock(drainMutex);
+        drainLocked();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> drain(drainMutex);
+                drainLocked();
+            }
+            lock.lock();
+            if (!nudged.exchange(false, std::memory_order_relaxed)) {
+                wake.wait_for(lock, std::chrono::milliseconds(5), [this] { return stopping || nudged.load(); });
+                nudged.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::atomic<bool> nudged{ false };
+    std::thread thread;
+};
+
+Writer& writer() {
+    static Writer instance;
+    return instance;
+}
+
+ThreadBuffer* threadBuffer() {
+    if (!localBuffer) {
+        writer();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.push_back(std::make_unique<ThreadBuffer>());
+        localBuffer = registry.back().get();
+        localBuffer->tid = nextTid++;
+    }
+    return localBuffer;
+}
+
+} // namespace
+
+void setLevel(Level level) {
+    levelValue.store(level, std::memory_order_relaxed);
+}
+
+Level level() {
+    return (Level)levelValue.load(std::memory_order_relaxed);
+}
+
+void setSink(std::function<void(const char* data, size_t size)> sink) {
+    std::lock_guard<std::mutex> lock(drainMutex);
+    sinkFunction = std::move(sink);
+}
+
+void flush() {
+    std::lock_guard<std::mutex> lock(drainMutex);
+    drainLocked();
+}
+
+uint64_t dropped() {
+    return droppedCount.load(std::memory_order_relaxed);
+}
+
+Record* beginRecord(Level level, const char* format) {
+    ThreadBuffer* buffer = threadBuffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    uint64_t used = head - buffer->tail.load(std::memory_order_acquire);
+    if (used >= kCapacity) {
+        droppedCount.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (used == kCapacity / 2) writer().nudge();
+    Record& r = buffer->records[head & (kCapacity - 1)];
+    r.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    r.format = format;
+    r.level = (uint8_t)level;
+    r.argCount = 0;
+    r.textUsed = 0;
+    return &r;
+}
+
+void commitRecord() {
+    ThreadBuffer* buffer = localBuffer;
+    buffer->head.store(buffer->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+} // namespace logging
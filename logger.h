@@ -0,0 +1,181 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+// Leveled logger with asynchronous formatting.
+//
+//     MW_LOG_DEBUG("update node {} -> {},{}", id, p.x, p.y);
+//     MW_LOG_ERROR("cannot read {}", path);
+//
+// A call site copies its arguments into a fixed-size record in the calling
+// thread's ring buffer and returns: no lock, no formatting, no I/O. A
+// background thread turns the records into "{}"-substituted lines and
+// writes them to the sink in timestamp order. When a ring is full the
+// record is dropped and counted rather than stalling the caller.
+//
+// Levels below MW_LOG_MIN_LEVEL are removed at compile time, arguments and
+// all; it defaults to Info in NDEBUG builds and Debug otherwise. Above it,
+// a disabled level costs one relaxed atomic load (see setLevel()).
+//
+// The format must be a string literal or otherwise outlive the logger.
+// Arguments may be integers, floating point, bool, pointers and strings;
+// strings are copied, up to the room left in the record.
+
+namespace logging {
+
+enum Level : int { Debug = 0, Info = 1, Warn = 2, Error = 3, Off = 4 };
+
+extern std::atomic<int> levelValue;
+
+inline bool enabled(Level level) { return level >= levelValue.load(std::memory_order_relaxed); }
+void setLevel(Level level);
+Level level();
+
+// Where formatted lines go, one call per batch; stdout by default. Called
+// from the logging thread only.
+void setSink(std::function<void(const char* data, size_t size)> sink);
+// Format and write everything recorded so far before returning.
+void flush();
+// Records lost to full rings since start.
+uint64_t dropped();
+
+struct Arg {
+    enum Type : uint8_t { Int, Uint, Double, Bool, Pointer, Text };
+    Type type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const void* p;
+        struct {
+            uint16_t offset; // into Record::text
+            uint16_t length;
+        } text;
+    };
+};
+
+struct Record {
+    static const int kMaxArgs = 8;
+    static const int kTextSize = 160;
+
+    int64_t timeNs;
+    const char* format;
+    uint8_t level;
+    uint8_t argCount;
+    uint16_t textUsed;
+    Arg args[kMaxArgs];
+    char text[kTextSize];
+};
+
+// Claim the calling thread's next record, or null when its ring is full.
+Record* beginRecord(Level level, const char* format);
+void commitRecord();
+
+inline void put(Record& r, Arg a) {
+    if (r.argCount < Record::kMaxArgs) r.args[r.argCount++] = a;
+}
+
+inline void putText(Record& r, const char* s, size_t n) {
+    Arg a;
+    a.type = Arg::Text;
+    n = std::min(n, (size_t)(Record::kTextSize - r.textUsed));
+    memcpy(r.text + r.textUsed, s, n);
+    a.text.offset = r.textUsed;
+    a.text.length = (uint16_t)n;
+    r.textUsed = (uint16_t)(r.textUsed + n);
+    put(r, a);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value>::type encode(Record& r, T value) {
+    Arg a;
+    if (std::is_same<T, bool>::value) {
+        a.type = Arg::Bool;
+        a.u = value ? 1 : 0;
+    }
+    else if (std::is_signed<T>::value) {
+        a.type = Arg::Int;
+        a.i = (int64_t)value;
+    }
+    else {
+        a.type = Arg::Uint;
+        a.u = (uint64_t)value;
+    }
+    put(r, a);
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type encode(Record& r, T value) {
+    Arg a;
+    a.type = Arg::Double;
+    a.d = (double)value;
+    put(r, a);
+}
+
+template <typename T>
+typename std::enable_if<std::is_enum<T>::value>::type encode(Record& r, T value) {
+    encode(r, (int64_t)value);
+}
+
+inline void encode(Record& r, const void* value) {
+    Arg a;
+    a.type = Arg::Pointer;
+    a.p = value;
+    put(r, a);
+}
+
+inline void encode(Record& r, const char* value) { putText(r, value ? value : "(null)", value ? strlen(value) : 6); }
+inline void encode(Record& r, char* value) { encode(r, (const char*)value); }
+inline void encode(Record& r, const std::string& value) { putText(r, value.data(), value.size()); }
+
+template <typename... Args>
+void write(Level level, const char* format, const Args&... args) {
+    Record* r = beginRecord(level, format);
+    if (!r) return;
+    int expand[] = { 0, (encode(*r, args), 0)... };
+    (void)expand;
+    commitRecord();
+}
+
+} // namespace logging
+
+#ifndef MW_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define MW_LOG_MIN_LEVEL 1
+#else
+#define MW_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+#define MW_LOG_AT(level, ...) \
+    do { \
+        if (::logging::enabled(level)) ::logging::write(level, __VA_ARGS__); \
+    } while (0)
+
+#if MW_LOG_MIN_LEVEL <= 0
+#define MW_LOG_DEBUG(...) MW_LOG_AT(::logging::Debug, __VA_ARGS__)
+#else
+#define MW_LOG_DEBUG(...) ((void)0)
+#endif
+#if MW_LOG_MIN_LEVEL <= 1
+#define MW_LOG_INFO(...) MW_LOG_AT(::logging::Info, __VA_ARGS__)
+#else
+#define MW_LOG_INFO(...) ((void)0)
+#endif
+#if MW_LOG_MIN_LEVEL <= 2
+#define MW_LOG_WARN(...) MW_LOG_AT(::logging::Warn, __VA_ARGS__)
+#else
+#define MW_LOG_WARN(...) ((void)0)
+#endif
+#define MW_LOG_ERROR(...) MW_LOG_AT(::logging::Error, __VA_ARGS__)
+
+#endif // LOGGER_H
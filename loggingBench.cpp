@@ -0,0 +1,77 @@
+// Logging benchmark: drag throughput with the hot-path log lines written
+// the old way (std::cout with std::endl), through the async logger at Debug,
+// and with Debug disabled at run time. Every thread drags nodes of its own
+// grid like /api/drag does (nearest node, KDTree::updateNodePosition) and
+// touches a GameObject (FindByName, Update), so each drag hits three log
+// sites. Building with -DMW_LOG_MIN_LEVEL=1 removes the sites entirely.
+//
+// loggingBench [threads] [drags per thread] > log.txt   (results on stderr)
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "KDTree.h"
+#include "gameObject.h"
+#include "logger.h"
+
+using namespace std;
+
+enum class Mode { Stream, Logger, Off };
+
+double dragsPerSecond(Mode mode, int threads, int drags) {
+    logging::setLevel(mode == Mode::Logger ? logging::Debug : logging::Info);
+    vector<shared_ptr<GameObject>> objects;
+    for (int t = 0; t < threads; ++t) objects.push_back(Bone::Create("drag_" + to_string(t)));
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            vector<GridNode> nodes;
+            for (int y = 0; y < 64; ++y) {
+                for (int x = 0; x < 64; ++x) nodes.emplace_back(cv::Point2f(x * 16.0f, y * 16.0f));
+            }
+            KDTree tree;
+            tree.build(nodes);
+            string name = "drag_" + to_string(t);
+            mt19937 rng(t + 1);
+            uniform_real_distribution<float> coord(0, 1024);
+            for (int i = 0; i < drags; ++i) {
+                cv::Point2f target(coord(rng), coord(rng));
+                GridNode* node = tree.findNearest(target);
+                if (mode == Mode::Stream) std::cout << " update select gridNode ..." << std::endl;
+                tree.updateNodePosition(node, target);
+                if (mode == Mode::Stream) std::cout << " I found : " << name << std::endl;
+                auto object = GameObject::FindByName(name);
+                if (mode == Mode::Stream) std::cout << "Updating GameObject: " << object->GetName() << std::endl;
+                object->Update();
+            }
+        });
+    }
+    for (thread& w : workers) w.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    logging::flush();
+    return threads * (double)drags / seconds;
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : max(2, (int)thread::hardware_concurrency());
+    int drags = argc > 2 ? atoi(argv[2]) : 100000;
+
+    logging::setLevel(logging::Info);
+    fprintf(stderr, "%d threads x %d drags, MW_LOG_MIN_LEVEL %d\n", threads, drags, MW_LOG_MIN_LEVEL);
+    double stream = dragsPerSecond(Mode::Stream, threads, drags);
+    fprintf(stderr, "  std::cout + endl:       %10.0f drags/s\n", stream);
+    uint64_t droppedBefore = logging::dropped();
+    double logger = dragsPerSecond(Mode::Logger, threads, drags);
+    fprintf(stderr, "  logger, Debug on:       %10.0f drags/s (%4.1fx, %llu lines dropped)\n", logger, logger / stream,
+            (unsigned long long)(logging::dropped() - droppedBefore));
+    double off = dragsPerSecond(Mode::Off, threads, drags);
+    fprintf(stderr, "  logger, Debug disabled: %10.0f drags/s (%4.1fx)\n", off, off / stream);
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+int highestBit(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+}
+
+void appendf(std::string& out, const char* fmt, ...) {
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = std::vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0) out.append(buf, std::min<size_t>((size_t)n, sizeof(buf) - 1));
+}
+
+} // namespace
+
+int LatencyHistogram::bucketOf(uint64_t ns) {
+    if (ns < (uint64_t)kSubCount) return (int)ns;
+    if (ns >> 48) return kBuckets - 1;
+    int e = highestBit(ns); // kSubBits..47
+    int shift = e - kSubBits;
+    return kSubCount + shift * kSubCount + (int)((ns >> shift) & (kSubCount - 1));
+}
+
+uint64_t LatencyHistogram::bucketUpperNs(int bucket) {
+    if (bucket < kSubCount) return (uint64_t)bucket;
+    int shift = (bucket - kSubCount) / kSubCount;
+    uint64_t sub = (uint64_t)((bucket - kSubCount) % kSubCount);
+    uint64_t lower = ((uint64_t)kSubCount + sub) << shift;
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t seen = max.load(std::memory_order_relaxed);
+    while (ns > seen && !max.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    // Not an atomic cut across buckets; a scrape racing with record() can be
+    // off by the requests in flight, which is fine for monitoring.
+    Snapshot snap;
+    snap.counts.resize(kBuckets);
+    for (int i = 0; i < kBuckets; ++i) {
+        snap.counts[i] = counts[i].load(std::memory_order_relaxed);
+        snap.count += snap.counts[i];
+    }
+    snap.sumNs = sum.load(std::memory_order_relaxed);
+    snap.maxNs = max.load(std::memory_order_relaxed);
+    return snap;
+}
+
+uint64_t LatencyHistogram::Snapshot::quantileNs(double q) const {
+    if (count == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)count + 0.5);
+    rank = std::min(std::max<uint64_t>(rank, 1), count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= rank) return std::min(bucketUpperNs((int)i), maxNs);
+    }
+    return maxNs;
+}
+
+void RouteMetrics::countReply(const char* reply, size_t len) {
+    // "HTTP/1.1 404 ..."
+    if (len < 12 || std::memcmp(reply, "HTTP/", 5) != 0) return;
+    const char* status = static_cast<const char*>(std::memchr(reply, ' ', len - 3));
+    if (status && (status[1] == '4' || status[1] == '5')) errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+MetricsRegistry::MetricsRegistry(const std::string& fallbackName) {
+    routes.emplace_back(fallbackName, "");
+    fallback = &routes.back();
+}
+
+RouteMetrics& MetricsRegistry::addRoute(const std::string& name, const std::string& pattern) {
+    routes.emplace_back(name, pattern);
+    return routes.back();
+}
+
+void MetricsRegistry::addGauge(const std::string& name, const std::string& help, std::function<double()> read) {
+    gauges.push_back({ name, help, std::move(read) });
+}
+
+RouteMetrics& MetricsRegistry::match(struct mg_str uri) {
+    for (RouteMetrics& route : routes) {
+        if (!route.pattern.empty() && mg_match(uri, mg_str(route.pattern.c_str()), NULL)) return route;
+    }
+    return *fallback;
+}
+
+std::string MetricsRegistry::prometheus() const {
+    std::string out;
+    out.reserve(4096);
+
+    out += "# HELP mw_http_request_duration_seconds Request latency from parse to reply, per route.\n";
+    out += "# TYPE mw_http_request_duration_seconds summary\n";
+    std::vector<LatencyHistogram::Snapshot> snaps;
+    snaps.reserve(routes.size());
+    for (const RouteMetrics& route : routes) {
+        snaps.push_back(route.latency.snapshot());
+        const LatencyHistogram::Snapshot& s = snaps.back();
+        const char* name = route.name.c_str();
+        for (double q : { 0.5, 0.9, 0.99 }) {
+            appendf(out, "mw_http_request_duration_seconds{route=\"%s\",quantile=\"%g\"} %.9f\n",
+                    name, q, s.quantileNs(q) * 1e-9);
+        }
+        appendf(out, "mw_http_request_duration_seconds_sum{route=\"%s\"} %.9f\n", name, s.sumNs * 1e-9);
+        appendf(out, "mw_http_request_duration_seconds_count{route=\"%s\"} %llu\n", name, (unsigned long long)s.count);
+    }
+
+    out += "# HELP mw_http_request_duration_max_seconds Slowest request seen, per route.\n";
+    out += "# TYPE mw_http_request_duration_max_seconds gauge\n";
+    for (size_t i = 0; i < routes.size(); ++i) {
+        appendf(out, "mw_http_request_duration_max_seconds{route=\"%s\"} %.9f\n",
+                routes[i].name.c_str(), snaps[i].maxNs * 1e-9);
+    }
+
+    out += "# HELP mw_http_requests_total Requests received, per route.\n";
+    out += "# TYPE mw_http_requests_total counter\n";
+    for (const RouteMetrics& route : routes) {
+        appendf(out, "mw_http_requests_total{route=\"%s\"} %llu\n", route.name.c_str(),
+                (unsigned long long)route.requests.load(std::memory_order_relaxed));
+    }
+    out += "# HELP mw_http_request_errors_total Requests answered with a 4xx or 5xx status, per route.\n";
+    out += "# TYPE mw_http_request_errors_total counter\n";
+    for (const RouteMetrics& route : routes) {
+        appendf(out, "mw_http_request_errors_total{route=\"%s\"} %llu\n", route.name.c_str(),
+                (unsigned long long)route.errors.load(std::memory_order_relaxed));
+    }
+    out += "# HELP mw_http_request_bytes_total Request bytes (headers and body), per route.\n";
+    out += "# TYPE mw_http_request_bytes_total counter\n";
+    for (const RouteMetrics& route : routes) {
+        appendf(out, "mw_http_request_bytes_total{route=\"%s\"} %llu\n", route.name.c_str(),
+                (unsigned long long)route.requestBytes.load(std::memory_order_relaxed));
+    }
+
+    out += "# HELP mw_network_received_bytes_total Bytes read from client sockets.\n";
+    out += "# TYPE mw_network_received_bytes_total counter\n";
+    appendf(out, "mw_network_received_bytes_total %llu\n", (unsigned long long)bytesReceived.load(std::memory_order_relaxed));
+    out += "# HELP mw_network_sent_bytes_total Bytes written to client sockets.\n";
+    out += "# TYPE mw_network_sent_bytes_total counter\n";
+    appendf(out, "mw_network_sent_bytes_total %llu\n", (unsigned long long)bytesSent.load(std::memory_order_relaxed));
+    out += "# HELP mw_connections_opened_total Accepted client connections.\n";
+    out += "# TYPE mw_connections_opened_total counter\n";
+    appendf(out, "mw_connections_opened_total %llu\n", (unsigned long long)connectionsOpened.load(std::memory_order_relaxed));
+
+    for (const Gauge& gauge : gauges) {
+        appendf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n", gauge.name.c_str(), gauge.help.c_str(),
+                gauge.name.c_str(), gauge.name.c_str(), gauge.read());
+    }
+    return out;
+}
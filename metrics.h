@@ -0,0 +1,96 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include "mongoose.h"
+
+// Log-linear latency histogram in the spirit of HdrHistogram: 16 linear
+// sub-buckets per power of two, about 6% relative error, 1 ns to ~78 h.
+// record() is a handful of relaxed atomic operations and never blocks.
+class LatencyHistogram {
+public:
+    static const int kSubBits = 4;
+    static const int kSubCount = 1 << kSubBits;
+    static const int kBuckets = kSubCount + (48 - kSubBits) * kSubCount;
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sumNs = 0;
+        uint64_t maxNs = 0;
+        std::vector<uint64_t> counts;
+        // Upper bound of the bucket holding quantile q (0..1).
+        uint64_t quantileNs(double q) const;
+    };
+
+    void record(uint64_t ns);
+    Snapshot snapshot() const;
+
+    static int bucketOf(uint64_t ns);
+    static uint64_t bucketUpperNs(int bucket);
+
+private:
+    std::atomic<uint64_t> counts[kBuckets] = {};
+    std::atomic<uint64_t> sum{ 0 };
+    std::atomic<uint64_t> max{ 0 };
+};
+
+struct RouteMetrics {
+    RouteMetrics(const std::string& name, const std::string& pattern) : name(name), pattern(pattern) {}
+
+    const std::string name;    // Prometheus route label
+    const std::string pattern; // mg_match pattern
+    LatencyHistogram latency;
+    std::atomic<uint64_t> requests{ 0 };
+    std::atomic<uint64_t> requestBytes{ 0 };
+    std::atomic<uint64_t> errors{ 0 }; // requests answered with a 4xx/5xx status
+
+    // Count an error if reply, e.g. what a handler appended to
+    // mg_connection::send, starts with a 4xx/5xx status line.
+    void countReply(const char* reply, size_t len);
+};
+
+// Per-route latency histograms, traffic counters and gauges rendered in the
+// Prometheus text exposition format.
+//
+// Routes and gauges are registered once at startup; after that the registry
+// is only read, so lookups and recording take no locks.
+class MetricsRegistry {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // fallbackName labels requests that match no route, e.g. static files.
+    explicit MetricsRegistry(const std::string& fallbackName = "other");
+
+    RouteMetrics& addRoute(const std::string& name, const std::string& pattern);
+    void addGauge(const std::string& name, const std::string& help, std::function<double()> read);
+
+    // First route whose pattern matches uri, or the fallback route.
+    RouteMetrics& match(struct mg_str uri);
+
+    std::atomic<uint64_t> bytesReceived{ 0 };
+    std::atomic<uint64_t> bytesSent{ 0 };
+    std::atomic<uint64_t> connectionsOpened{ 0 };
+
+    std::string prometheus() const;
+
+private:
+    struct Gauge {
+        std::string name;
+        std::string help;
+        std::function<double()> read;
+    };
+
+    std::deque<RouteMetrics> routes; // deque keeps references stable
+    std::vector<Gauge> gauges;
+    RouteMetrics* fallback = nullptr;
+};
+
+#endif // METRICS_H
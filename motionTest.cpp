@@ -9,6 +9,7 @@
 #include "json.hpp"
 #include <opencv2/opencv.hpp>
 
+#include <unordered_map>
 #include <unordered_set>
 #include <functional>
 #include <opencv2/core/ocl.hpp>
@@ -18,116 +19,971 @@
 #include <atomic>
 #include <functional>
 //#include "gameObject.h"
+#include "imgProc.h"
+#include "vertexBuffer.h"
+#include "workerPool.h"
+#include "imageEncoder.h"
+#include "tilePyramid.h"
+#include "base64.h"
+#include "session.h"
+#include "eventLoop.h"
+#include "staticAssets.h"
+#include "metrics.h"
+#include "trace.h"
+#include "logger.h"
+#include "uploadStream.h"
 
 using json = nlohmann::json;
 
 using namespace cv;
 using namespace std;
-UMat image;
-UMat image_post;
+// 每個使用者/文件各自的編輯狀態 (影像、網格、KD 樹…) 放在 session 裡
+SessionManager sessions;
+UMat defaultImage;  // 新 session 的起始影像
+const char* kDefaultSession = "default"; // 沒帶 token 的舊前端共用這個 session
+const int64_t kSessionIdleMs = 30 * 60 * 1000;
 
-// Base64 encoding function
-std::string base64_encode(const unsigned char* data, size_t length) {
-    static const std::string base64_chars =
-            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz"
-        "0123456789+/";
+// 依待處理工作決定 poll 等待時間，並管理連線數與 keep-alive
+EventLoop eventLoop;
+// 耗時工作 (變形、編碼、網格產生) 在這裡執行，完成後經 eventLoop 回到主執行緒
+WorkerPool workerPool(eventLoop);
+// 網頁檔案啟動時載入記憶體並預先壓縮
+StaticAssetCache staticAssets;
+// 各路由延遲分佈與流量統計，於 /metrics 輸出
+MetricsRegistry metrics("static");
 
-    std::string encoded;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
+// 交給工作執行緒的請求，完成回覆後才記錄延遲
+struct PendingRequest {
+    RouteMetrics* route;
+    MetricsRegistry::Clock::time_point start;
+};
+std::unordered_map<unsigned long, PendingRequest> pendingRequests;
 
-    while (length--) {
-        char_array_3[i++] = *(data++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
+// 上傳中的請求: 本體邊收邊存，不等 mongoose 緩衝整個請求
+struct Upload {
+    UploadStream stream;
+    std::shared_ptr<EditorSession> session;
+    MetricsRegistry::Clock::time_point start;
+};
+std::unordered_map<unsigned long, Upload> uploads;
 
-            for (i = 0; i < 4; i++)
-                encoded += base64_chars[char_array_4[i]];
-            i = 0;
+const int kGridStep = 20;
+const int kPngLevel = 1; // 互動拖曳時以速度優先，?level= 可覆寫
+
+// 以 base64 串流寫入連線的送出緩衝區，不經過中間字串
+// 分段編碼讓每次只擴充一小段緩衝區
+void sendBase64(struct mg_connection* conn, const unsigned char* data, size_t length) {
+    const size_t kChunk = 48 * 1024;
+    Base64Encoder encoder;
+    for (size_t offset = 0; offset < length; offset += kChunk) {
+        size_t n = std::min(kChunk, length - offset);
+        if (!mg_iobuf_resize(&conn->send, conn->send.len + encoder.maxOutput(n))) return;
+        conn->send.len += encoder.update(data + offset, n, (char*)conn->send.buf + conn->send.len);
+    }
+    if (!mg_iobuf_resize(&conn->send, conn->send.len + 4)) return;
+    conn->send.len += encoder.finish((char*)conn->send.buf + conn->send.len);
+}
+
+// 將前端容器座標 (x, y, scw, sch) 轉成影像座標
+bool parseImagePoint(struct mg_http_message* hm, const UMat& image, Point2f& pt) {
+    MW_TRACE_SCOPE("parseImagePoint");
+    json body = json::parse(hm->body.buf, hm->body.buf + hm->body.len, nullptr, false);
+    // 欄位型別不對時 get<float>() 會丟例外，在事件循環上等於讓伺服器結束，所以先檢查
+    if (!body.is_object() || !body.contains("x") || !body.contains("y")) return false;
+    if (!body["x"].is_number() || !body["y"].is_number()) return false;
+    auto optionalNumber = [&](const char* name, float& out) {
+        auto it = body.find(name);
+        if (it == body.end() || it->is_null()) return true;
+        if (!it->is_number()) return false;
+        out = it->get<float>();
+        return true;
+    };
+
+    float x = body["x"].get<float>();
+    float y = body["y"].get<float>();
+    float scw = 0, sch = 0;
+    if (!optionalNumber("scw", scw) || !optionalNumber("sch", sch)) return false;
+    if (scw > 0 && sch > 0 && !image.empty()) {
+        x = x * image.cols / scw;
+        y = y * image.rows / sch;
+    }
+    pt = Point2f(x, y);
+    return true;
+}
+
+int queryInt(struct mg_http_message* hm, const char* name, int fallback) {
+    char buf[32];
+    if (mg_http_get_var(&hm->query, name, buf, sizeof(buf)) <= 0) return fallback;
+    return atoi(buf);
+}
+
+std::string queryString(struct mg_http_message* hm, const char* name) {
+    char buf[64];
+    if (mg_http_get_var(&hm->query, name, buf, sizeof(buf)) <= 0) return "";
+    return buf;
+}
+
+std::string headerString(struct mg_http_message* hm, const char* name) {
+    struct mg_str* value = mg_http_get_header(hm, name);
+    return value ? std::string(value->buf, value->len) : "";
+}
+
+void replyJson(struct mg_connection* conn, int status, const json& body) {
+    mg_http_reply(conn, status, "Content-Type: application/json\r\n", "%s", body.dump().c_str());
+}
+
+// 讀取整數環境變數，未設定或無法解析時回傳 fallback
+int envInt(const char* name, int fallback) {
+    const char* v = std::getenv(name);
+    if (!v || !*v) return fallback;
+    char* end = nullptr;
+    long n = std::strtol(v, &end, 10);
+    return (end && *end == 0) ? (int)n : fallback;
+}
+
+// session token 依序取自 X-Session 標頭、?session= 或 session cookie
+std::string sessionToken(struct mg_http_message* hm) {
+    std::string token = headerString(hm, "X-Session");
+    if (token.empty()) token = queryString(hm, "session");
+    if (token.empty()) {
+        struct mg_str* cookie = mg_http_get_header(hm, "Cookie");
+        if (cookie) {
+            struct mg_str v = mg_http_get_header_var(*cookie, mg_str("session"));
+            token.assign(v.buf ? v.buf : "", v.buf ? v.len : 0);
         }
     }
+    return token;
+}
 
-    if (i) {
-        for (j = i; j < 3; j++)
-            char_array_3[j] = '\0';
+// 沒帶 token 用預設 session；帶了卻找不到 (已被清掉或是偽造的) 回傳 nullptr，
+// 不可退回預設 session，否則舊客戶端會改到其他人共用的狀態
+std::shared_ptr<EditorSession> findSession(struct mg_http_message* hm) {
+    std::string token = sessionToken(hm);
+    return sessions.find(token.empty() ? kDefaultSession : token);
+}
 
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+// 同 findSession，找不到時回覆 410 讓客戶端重新建立 session
+std::shared_ptr<EditorSession> sessionFor(struct mg_connection* conn, struct mg_http_message* hm) {
+    std::shared_ptr<EditorSession> session = findSession(hm);
+    if (!session) replyJson(conn, 410, { {"error", "unknown or expired session"} });
+    return session;
+}
 
-        for (j = 0; j < i + 1; j++)
-            encoded += base64_chars[char_array_4[j]];
+// 把拖曳中的節點移到滑鼠位置並產生新的網格版本
+uint32_t moveDragNode(EditorSession& s, const Point2f& mouse) {
+    MW_TRACE_SCOPE("moveDragNode");
+    Point2f target = s.dragNodeStart + (mouse - s.dragMouseStart);
+    s.kdTree.updateNodePosition(s.dragNode, target);
+    return s.vertexCache.commit(s.grid);
+}
 
-        while (i++ < 3)
-            encoded += '=';
+// 拖曳節點所屬三角形在拖曳前後涵蓋的範圍
+Rect dragDirtyRect(GridNode* node, const Point2f& before) {
+    std::vector<Point2f> pts = { before, node->position_modified };
+    for (Triangle* tri : node->triangles) {
+        pts.push_back(tri->v1->position_modified);
+        pts.push_back(tri->v2->position_modified);
+        pts.push_back(tri->v3->position_modified);
     }
+    Rect r = boundingRect(pts);
+    return Rect(r.x - 2, r.y - 2, r.width + 4, r.height + 4);
+}
 
-    return encoded;
+TilePyramid* findTileLayer(EditorSession& s, const std::string& layer) {
+    if (layer == "post") return &s.postTiles;
+    return nullptr;
 }
 
-// Helper function to encode vector of bytes
-std::string base64_encode(const std::vector<unsigned char>& data) {
-    return base64_encode(data.data(), data.size());
+// 尚未套用的合併拖曳先移到目前節點上，再換節點 (呼叫者持有鎖)
+void applyPendingDrag(EditorSession& s) {
+    if (s.dragPending && s.dragNode) moveDragNode(s, s.dragTarget);
+    s.dragPending = false;
 }
-// 處理HTTP請求的回調函數
-void http_handler(struct mg_connection* conn, int ev, void* ev_data, void* fn_data) {
-    if (ev == MG_EV_HTTP_MSG) {
-        struct mg_http_message* hm = (struct mg_http_message*)ev_data;
 
-        // 處理根路徑請求 - 顯示HTML頁面
-        if (mg_match(hm->uri, mg_str("/image"), NULL)) {
-            // 配置圖片路徑，這裡假設圖片名為 "image.jpg" 並位於當前目錄
-            // 讀取 PNG 圖片，保留 Alpha 通道
-            Mat image = imread("png.png", IMREAD_UNCHANGED);
-
-            std::cout << " image channel: " << image.channels() << std::endl;
-            if (image.empty()) {
-                mg_printf(conn, "HTTP/1.1 500 Internal Server Error\r\n"
-                    "Content-Type: text/plain\r\n"
-                    "Content-Length: 20\r\n\r\n"
-                    "Failed to load image");
-                return;
+void replyDragResult(struct mg_connection* conn, EditorSession& s, uint32_t version) {
+    // 回報這次拖曳若以頂點差量傳送所需的位元組數，與影像路徑做比較
+    VertexBufferRequest request;
+    request.quantize16 = true;
+    request.sinceVersion = version - 1;
+    std::vector<uint8_t> delta;
+    {
+        MW_TRACE_SCOPE("vertexCache.encode");
+        s.vertexCache.encode(request, delta);
+    }
+    replyJson(conn, 200, { {"version", version}, {"vertexBytes", delta.size()}, {"imageBytes", s.lastImageBytes} });
+}
+
+// 記錄延遲，並依 send 緩衝區 replyStart 起的回覆狀態碼計算錯誤數
+void recordReply(struct mg_connection* conn, RouteMetrics& route, MetricsRegistry::Clock::time_point start,
+                 size_t replyStart) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(MetricsRegistry::Clock::now() - start).count();
+    route.latency.record((uint64_t)ns);
+    if (replyStart < conn->send.len) {
+        route.countReply((const char*)conn->send.buf + replyStart, conn->send.len - replyStart);
+    }
+}
+
+// 非同步請求回覆後記錄；conn 為 nullptr 表示客戶端已離開，不記錄
+void finishPendingRequest(unsigned long connId, struct mg_connection* conn, size_t replyStart) {
+    auto it = pendingRequests.find(connId);
+    if (it == pendingRequests.end()) return;
+    if (conn) recordReply(conn, *it->second.route, it->second.start, replyStart);
+    pendingRequests.erase(it);
+}
+
+// 套用這輪合併的拖曳，回覆所有等待的請求後讓連線繼續處理後續請求
+void finishDrag(const std::shared_ptr<EditorSession>& session) {
+    std::vector<unsigned long> waiters;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        waiters.swap(session->dragWaiters);
+        // 拖曳可能已被同一輪的 dragDone 結束或網格重建取消
+        uint32_t version = session->vertexCache.version();
+        if (session->dragPending && session->dragNode) version = moveDragNode(*session, session->dragTarget);
+        session->dragPending = false;
+        for (unsigned long id : waiters) {
+            struct mg_connection* conn = eventLoop.connection(id);
+            size_t replyStart = conn ? conn->send.len : 0;
+            if (conn) replyDragResult(conn, *session, version);
+            finishPendingRequest(id, conn, replyStart);
+        }
+    }
+    for (unsigned long id : waiters) {
+        if (struct mg_connection* conn = eventLoop.connection(id)) EventLoop::resume(conn);
+    }
+}
+
+json layersJson(const EditorSession& s) {
+    json layers = json::array();
+    for (size_t i = 0; i < s.layers.size(); ++i) {
+        const SessionLayer& layer = s.layers[i];
+        layers.push_back({ {"index", i}, {"name", layer.name}, {"x", layer.rect.x}, {"y", layer.rect.y},
+            {"width", layer.rect.width}, {"height", layer.rect.height},
+            {"opacity", layer.opacity}, {"visible", layer.visible}, {"decoded", !layer.image.empty()} });
+    }
+    return layers;
+}
+
+// 依路由分派 HTTP 請求
+void handleRequest(struct mg_connection* conn, struct mg_http_message* hm) {
+    struct mg_str caps[5];
+
+    // 處理根路徑請求 - 顯示HTML頁面
+    if (mg_match(hm->uri, mg_str("/image"), NULL)) {
+        // 回傳變形後的影像 image_post，編碼交給工作執行緒
+        // 格式由 ?fmt=png|qoi|jpeg|raw 或 Accept 標頭決定
+        // ?encoding=dataurl 回傳 data URL 文字，可直接放進 <img src>
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::unique_lock<std::mutex> lock(session->mutex);
+        UMat post = session->image_post;
+        lock.unlock();
+        bool dataUrl = queryString(hm, "encoding") == "dataurl";
+        EncodeOptions options;
+        options.format = negotiateImageFormat(queryString(hm, "fmt"), headerString(hm, "Accept"), post.channels() == 4);
+        options.pngLevel = queryInt(hm, "level", kPngLevel);
+        options.jpegQuality = queryInt(hm, "quality", options.jpegQuality);
+        workerPool.submit(conn, [session, post, options, dataUrl]() -> WorkerPool::Completion {
+            auto buffer = std::make_shared<std::vector<uchar>>();
+            bool ok = false;
+            cv::Size size = post.size();
+            if (!post.empty()) {
+                Mat mat = post.getMat(ACCESS_READ);
+                ok = encodeImage(mat, options, *buffer);
             }
+            return [session, ok, buffer, options, size, dataUrl](struct mg_connection* conn) {
+                if (ok) {
+                    std::lock_guard<std::mutex> lock(session->mutex);
+                    session->lastImageBytes = buffer->size();
+                }
+                if (!conn) return;
+                if (!ok) {
+                    mg_printf(conn, "HTTP/1.1 500 Internal Server Error\r\n"
+                        "Content-Type: text/plain\r\n"
+                        "Content-Length: 22\r\n\r\n"
+                        "Failed to encode image");
+                    return;
+                }
+
+                if (dataUrl) {
+                    std::string prefix = std::string("data:") + imageMimeType(options.format) + ";base64,";
+                    mg_printf(conn, "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/plain\r\n"
+                        "Content-Length: %d\r\n\r\n%s",
+                        (int)(prefix.size() + base64EncodedSize(buffer->size())), prefix.c_str());
+                    sendBase64(conn, buffer->data(), buffer->size());
+                    return;
+                }
+
+                // 設置 HTTP 響應標頭，raw 格式需要寬高才能還原
+                mg_printf(conn, "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: %s\r\n"
+                    "Vary: Accept\r\n"
+                    "X-Image-Width: %d\r\n"
+                    "X-Image-Height: %d\r\n"
+                    "Content-Length: %d\r\n\r\n",
+                    imageMimeType(options.format), size.width, size.height, (int)buffer->size());
+
+                // 發送圖片數據
+                mg_send(conn, buffer->data(), buffer->size());
+            };
+        });
+    }
+
+    // 建立新的 session，token 同時以 JSON 與 cookie 回傳
+    else if (mg_match(hm->uri, mg_str("/api/session"), NULL)) {
+        // 數量有上限 (含預設 session，MW_MAX_SESSIONS)，滿了先清掉最久沒用的 session
+        static const size_t maxSessions = (size_t)std::max(2, envInt("MW_MAX_SESSIONS", 64));
+        size_t evicted = sessions.evictOldest(maxSessions - 1, kDefaultSession);
+        if (evicted) MW_LOG_INFO("evicted least recently used sessions: {}", evicted);
+        auto session = sessions.create();
+        // 載入 (複製影像、網格、KD 樹、整個圖塊金字塔) 在工作執行緒上做，完成後才回覆 token
+        UMat source = defaultImage;
+        workerPool.submit(conn, [session, source]() -> WorkerPool::Completion {
+            {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                session->load(source, kGridStep);
+            }
+            return [session](struct mg_connection* conn) {
+                if (!conn) return;
+                json body = { {"session", session->token}, {"sessions", sessions.size()} };
+                std::string cookie = "Set-Cookie: session=" + session->token + "; Path=/; SameSite=Strict\r\n"
+                    "Content-Type: application/json\r\n";
+                mg_http_reply(conn, 200, cookie.c_str(), "%s", body.dump().c_str());
+            };
+        });
+    }
+
+    // 追蹤資料 (Chrome trace / Perfetto JSON)
+    // ?enable=1|0 開關追蹤，?clear=1 清除緩衝，其餘回傳目前的追蹤
+    else if (mg_match(hm->uri, mg_str("/api/trace"), NULL)) {
+        std::string enable = queryString(hm, "enable");
+        if (!enable.empty()) trace::setEnabled(enable != "0");
+        if (queryInt(hm, "clear", 0)) trace::clear();
+        if (!enable.empty() || queryInt(hm, "clear", 0)) {
+            replyJson(conn, 200, { {"enabled", trace::enabled()} });
+            return;
+        }
+        std::string body = trace::exportChromeJson();
+        mg_http_reply(conn, 200, "Content-Type: application/json\r\n"
+            "Content-Disposition: attachment; filename=\"trace.json\"\r\n", "%s", body.c_str());
+    }
+
+    // Prometheus 格式的效能指標
+    else if (mg_match(hm->uri, mg_str("/metrics"), NULL)) {
+        std::string text = metrics.prometheus();
+        mg_http_reply(conn, 200, "Content-Type: text/plain; version=0.0.4\r\n", "%s", text.c_str());
+    }
+
+    // 事件循環與連線統計，用來調整 EventLoopOptions
+    else if (mg_match(hm->uri, mg_str("/api/loop"), NULL)) {
+        EventLoopStats st = eventLoop.stats();
+        const EventLoopOptions& opt = eventLoop.options();
+        replyJson(conn, 200, {
+            {"iterations", st.iterations}, {"tasksRun", st.tasksRun}, {"timersFired", st.timersFired},
+            {"budgetExhausted", st.budgetExhausted},
+            {"latencyAvgUs", (st.tasksRun + st.timersFired) ? st.latencySumUs / (st.tasksRun + st.timersFired) : 0},
+            {"latencyMaxUs", st.latencyMaxUs},
+            {"connections", st.connections}, {"peakConnections", st.peakConnections},
+            {"accepted", st.accepted}, {"rejected", st.rejected},
+            {"idleClosed", st.idleClosed}, {"recycled", st.recycled},
+            {"workerQueue", workerPool.queueDepth()},
+            {"options", { {"maxPollMs", opt.maxPollMs}, {"runBudgetUs", opt.runBudgetUs},
+                {"maxConnections", opt.maxConnections}, {"keepAliveIdleMs", opt.keepAliveIdleMs},
+                {"maxRequestsPerConnection", opt.maxRequestsPerConnection} }} });
+    }
 
-            std::cout << "Read image size: " << image.size() << ", Channels: " << image.channels() << std::endl;
+    // 選取最近的網格點，開始拖曳
+    else if (mg_match(hm->uri, mg_str("/api/clickStart"), NULL)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        Point2f pt;
+        if (!parseImagePoint(hm, session->image, pt)) {
+            mg_http_reply(conn, 400, "", "Bad request");
+            return;
+        }
+        applyPendingDrag(*session);
+        {
+            MW_TRACE_SCOPE("kdTree.findNearest");
+            session->dragNode = session->kdTree.findNearest(pt);
+        }
+        if (!session->dragNode) {
+            mg_http_reply(conn, 404, "", "No grid");
+            return;
+        }
+        session->dragNodeStart = session->dragNode->position_modified;
+        session->dragMouseStart = pt;
+        replyJson(conn, 200, { {"x", session->dragNodeStart.x}, {"y", session->dragNodeStart.y} });
+    }
+
+    else if (mg_match(hm->uri, mg_str("/api/drag"), NULL)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        Point2f pt;
+        if (!session->dragNode || !parseImagePoint(hm, session->image, pt)) {
+            mg_http_reply(conn, 400, "", "Bad request");
+            return;
+        }
+        // 同一輪 poll 收到的拖曳合併成一次移動，回覆等 defer 的工作一起送出
+        session->dragPending = true;
+        session->dragTarget = pt;
+        session->dragWaiters.push_back(conn->id);
+        conn->is_resp = 1;
+        if (session->dragWaiters.size() == 1) {
+            eventLoop.defer([session]() { finishDrag(session); });
+        }
+    }
 
-            // 使用 OpenCV imencode 將 Mat 轉換成 PNG 二進制數據
-            std::vector<uchar> buffer;
-            if (!imencode(".png", image, buffer)) {
-                mg_printf(conn, "HTTP/1.1 500 Internal Server Error\r\n"
-                    "Content-Type: text/plain\r\n"
-                    "Content-Length: 22\r\n\r\n"
-                    "Failed to encode image");
-                return;
+    else if (mg_match(hm->uri, mg_str("/api/dragDone"), NULL)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        Point2f pt;
+        if (!session->dragNode || !parseImagePoint(hm, session->image, pt)) {
+            mg_http_reply(conn, 400, "", "Bad request");
+            return;
+        }
+        uint32_t version = moveDragNode(*session, pt);
+        session->pendingDirty |= dragDirtyRect(session->dragNode, session->dragNodeStart);
+        session->lastWarpVersion = version;
+        session->dragNode = nullptr;
+        // 節點已移動，重建 KD 樹以維持搜尋正確
+        {
+            MW_TRACE_SCOPE("kdTree.build");
+            session->kdTree.build(session->grid.nodes);
+        }
+
+        // 在工作執行緒上變形影像並更新圖塊，完成後才更新 image_post 並回覆
+        UMat src = session->image;
+        auto coverage = session->imageCoverage;
+        Rect dirty = session->pendingDirty;
+        std::vector<WarpTriangle> triangles = collectWarpTriangles(session->grid);
+        workerPool.submit(conn, [session, src, coverage, triangles, version, dirty]() -> WorkerPool::Completion {
+            Mat warped;
+            {
+                Mat mat = src.getMat(ACCESS_READ);
+                warpImage(mat, warped, triangles, coverage.get());
             }
+            // TilePyramid 內部自行上鎖，/tiles/* 的工作可同時讀取
+            session->postTiles.update(warped, version, dirty);
+            UMat out;
+            warped.copyTo(out);
+            return [session, out, version](struct mg_connection* conn) {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                // 較晚送出的變形可能先完成，只保留最新版本
+                if (version > session->postVersion) {
+                    session->image_post = out;
+                    session->postVersion = version;
+                }
+                if (version == session->lastWarpVersion) session->pendingDirty = Rect();
+                if (conn) replyDragResult(conn, *session, version);
+            };
+        });
+    }
 
-            // 設置 HTTP 響應標頭
-            mg_printf(conn, "HTTP/1.1 200 OK\r\n"
-                "Content-Type: image/png\r\n"
-                "Content-Length: %d\r\n\r\n", (int)buffer.size());
+    // 重新產生網格: ?step=<格點間距>
+    else if (mg_match(hm->uri, mg_str("/api/mesh"), NULL)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        int step = std::max(2, queryInt(hm, "step", kGridStep));
+        std::unique_lock<std::mutex> lock(session->mutex);
+        cv::Size size = session->image.size();
+        lock.unlock();
+        workerPool.submit(conn, [session, size, step]() -> WorkerPool::Completion {
+            auto fresh = std::make_shared<Grid>();
+            buildGrid(*fresh, size, step);
+            return [session, fresh](struct mg_connection* conn) {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                EditorSession& s = *session;
+                // 換上新網格，舊節點隨 fresh 一起釋放
+                std::swap(s.grid.nodes, fresh->nodes);
+                std::swap(s.grid.triangles, fresh->triangles);
+                s.dragNode = nullptr;
+                s.kdTree.build(s.grid.nodes);
+                s.vertexCache.reset(s.grid);
+                s.postVersion = s.vertexCache.version();
+                s.lastWarpVersion = s.postVersion;
+                s.image_post = s.image.clone();
+                // 網格重建很少發生，直接在事件循環上重建整個金字塔
+                s.postTiles.update(s.image.getMat(ACCESS_READ), s.postVersion);
+                s.pendingDirty = Rect();
+                if (conn) {
+                    replyJson(conn, 200, { {"version", s.vertexCache.version()},
+                        {"nodes", s.grid.nodes.size()}, {"triangles", s.grid.triangles.size()} });
+                }
+            };
+        });
+    }
 
-            // 發送圖片數據
-            mg_send(conn, buffer.data(), buffer.size());
+    // 回傳最近的網格點
+    else if (mg_match(hm->uri, mg_str("/api/points"), NULL)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        Point2f pt;
+        GridNode* node = parseImagePoint(hm, session->image, pt) ? session->kdTree.findNearest(pt) : nullptr;
+        if (!node) {
+            mg_http_reply(conn, 404, "", "No grid");
+            return;
         }
+        replyJson(conn, 200, { {"x", node->position_modified.x}, {"y", node->position_modified.y} });
+    }
+
+    // 以二進位回傳網格頂點與三角形索引 (格式見 vertexBuffer.h)
+    // ?q=16 量化成 int16, ?since=<版本> 只送差量, ?indices=0 不送索引
+    else if (mg_match(hm->uri, mg_str("/api/vertices"), NULL)) {
+        VertexBufferRequest request;
+        request.quantize16 = queryInt(hm, "q", 32) == 16;
+        request.sinceVersion = (uint32_t)queryInt(hm, "since", 0);
+        request.includeIndices = queryInt(hm, "indices", 1) != 0;
 
-        // 處理其他路徑請求 - 返回404錯誤
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        std::vector<uint8_t> buffer;
+        session->vertexCache.encode(request, buffer);
+
+        mg_printf(conn, "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/octet-stream\r\n"
+            "Cache-Control: no-store\r\n"
+            "X-Mesh-Version: %u\r\n"
+            "X-Image-Bytes: %lu\r\n"
+            "Content-Length: %d\r\n\r\n",
+            session->vertexCache.version(), (unsigned long)session->lastImageBytes, (int)buffer.size());
+        mg_send(conn, buffer.data(), buffer.size());
+    }
+
+    // 上傳文件的圖層清單
+    else if (mg_match(hm->uri, mg_str("/api/layers"), NULL)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        replyJson(conn, 200, { {"session", session->token}, {"layers", layersJson(*session)} });
+    }
+
+    // 場景階層: 帶 ?since=版本 且該版本仍在歷史中時回傳 RFC 6902 差量 (沒變就是空陣列)，否則回傳完整階層
+    else if (mg_match(hm->uri, mg_str("/api/hierarchy"), NULL)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::lock_guard<std::mutex> lock(session->mutex);
+        SceneStore& scene = session->scene;
+        unsigned long long version = scene.hierarchyVersion(session->sceneRoot);
+        std::string since = queryString(hm, "since");
+        json patch;
+        if (!since.empty() && scene.hierarchyPatch(session->sceneRoot, strtoull(since.c_str(), nullptr, 10), patch)) {
+            replyJson(conn, 200, { {"version", version}, {"patch", patch} });
+        }
         else {
-            // Serve web root directory
-            struct mg_http_serve_opts opts = { 0 };
-            opts.root_dir = ".";
-            opts.ssi_pattern = "#.html";
-            mg_http_serve_dir(conn, hm, &opts);
+            // 完整階層用快取好的字串，不必每次重新序列化
+            mg_http_reply(conn, 200, "Content-Type: application/json\r\n", "{\"version\":%llu,\"hierarchy\":%s}", version,
+                          scene.hierarchyText(session->sceneRoot).c_str());
+        }
+    }
+
+    // 單一圖層影像: /api/layers/{index}，格式協商同 /image
+    else if (mg_match(hm->uri, mg_str("/api/layers/*"), caps)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        int index = atoi(std::string(caps[0].buf, caps[0].len).c_str());
+        std::unique_lock<std::mutex> lock(session->mutex);
+        if (index < 0 || index >= (int)session->layers.size()) {
+            lock.unlock();
+            mg_http_reply(conn, 404, "", "No such layer");
+            return;
+        }
+        // 隱藏圖層上傳時不解碼，第一次要求時才從 PSD 解出
+        UMat image = session->layers[index].image;
+        std::shared_ptr<PsdFile> document = session->document;
+        lock.unlock();
+        EncodeOptions options;
+        options.format = negotiateImageFormat(queryString(hm, "fmt"), headerString(hm, "Accept"), true);
+        options.pngLevel = queryInt(hm, "level", kPngLevel);
+        workerPool.submit(conn, [session, image, document, index, options]() -> WorkerPool::Completion {
+            Mat pixels = !image.empty() ? image.getMat(ACCESS_READ) : document ? document->layerImage(index) : Mat();
+            auto buffer = std::make_shared<std::vector<uchar>>();
+            bool found = !pixels.empty();
+            bool ok = found && encodeImage(pixels, options, *buffer);
+            return [found, ok, buffer, options](struct mg_connection* conn) {
+                if (!conn) return;
+                if (!found) {
+                    mg_http_reply(conn, 404, "", "Layer has no pixels");
+                    return;
+                }
+                if (!ok) {
+                    mg_http_reply(conn, 500, "", "Failed to encode layer");
+                    return;
+                }
+                mg_printf(conn, "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: %s\r\n"
+                    "Cache-Control: no-cache\r\n"
+                    "Content-Length: %d\r\n\r\n",
+                    imageMimeType(options.format), (int)buffer->size());
+                mg_send(conn, buffer->data(), buffer->size());
+            };
+        });
+    }
+
+    // 把圖層打包成圖集 (Spine .atlas + 頁面 PNG)，參數: maxSize, padding, bleed, rotate, trim, pot
+    else if (mg_match(hm->uri, mg_str("/api/atlas"), NULL) && mg_strcasecmp(hm->method, mg_str("POST")) == 0) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        AtlasOptions options;
+        options.maxPageSize = queryInt(hm, "maxSize", options.maxPageSize);
+        options.padding = queryInt(hm, "padding", options.padding);
+        options.bleed = queryInt(hm, "bleed", options.bleed);
+        options.rotate = queryInt(hm, "rotate", options.rotate) != 0;
+        options.trim = queryInt(hm, "trim", options.trim) != 0;
+        options.powerOfTwo = queryInt(hm, "pot", options.powerOfTwo) != 0;
+        std::vector<SessionLayer> layers;
+        std::shared_ptr<PsdFile> document;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            layers = session->layers;
+            document = session->document;
+        }
+        workerPool.submit(conn, [session, layers, document, options]() -> WorkerPool::Completion {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<AtlasSprite> sprites;
+            for (size_t i = 0; i < layers.size(); ++i) {
+                AtlasSprite sprite;
+                sprite.name = layers[i].name;
+                if (!layers[i].image.empty()) layers[i].image.copyTo(sprite.image);
+                else if (document) sprite.image = document->layerImage(i);
+                if (!sprite.image.empty()) sprites.push_back(sprite);
+            }
+            auto atlas = std::make_shared<Atlas>();
+            std::string error;
+            bool ok = !sprites.empty() && packAtlas(sprites, options, "skeleton", *atlas, error);
+            if (sprites.empty()) error = "no layers with pixels";
+            double packMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return [session, atlas, ok, error, packMs](struct mg_connection* conn) {
+                if (ok) {
+                    std::lock_guard<std::mutex> lock(session->mutex);
+                    session->atlas = atlas;
+                }
+                if (!conn) return;
+                if (!ok) {
+                    replyJson(conn, 422, { {"error", error} });
+                    return;
+                }
+                json pages = json::array();
+                for (const AtlasPage& page : atlas->pages) {
+                    pages.push_back({ {"file", page.file}, {"width", page.image.cols}, {"height", page.image.rows} });
+                }
+                replyJson(conn, 200, { {"atlas", "/api/atlas"}, {"pages", pages}, {"regions", atlas->regions.size()},
+                    {"heuristic", atlas->heuristic}, {"occupancy", atlas->occupancy}, {"packMs", packMs} });
+            };
+        });
+    }
+
+    // 圖集描述檔 (.atlas)
+    else if (mg_match(hm->uri, mg_str("/api/atlas"), NULL)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::shared_ptr<const Atlas> atlas;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            atlas = session->atlas;
+        }
+        if (!atlas) {
+            mg_http_reply(conn, 404, "", "No atlas packed yet");
+            return;
+        }
+        mg_http_reply(conn, 200, "Content-Type: text/plain; charset=utf-8\r\n"
+            "Content-Disposition: attachment; filename=\"skeleton.atlas\"\r\n", "%s", spineAtlasText(*atlas).c_str());
+    }
+
+    // 圖集頁面: /api/atlas/{file}，一律 PNG
+    else if (mg_match(hm->uri, mg_str("/api/atlas/*"), caps)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        std::string file(caps[0].buf, caps[0].len);
+        std::shared_ptr<const Atlas> atlas;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            atlas = session->atlas;
+        }
+        const AtlasPage* page = nullptr;
+        for (size_t i = 0; atlas && i < atlas->pages.size() && !page; ++i) {
+            if (atlas->pages[i].file == file) page = &atlas->pages[i];
+        }
+        if (!page) {
+            mg_http_reply(conn, 404, "", "No such atlas page");
+            return;
+        }
+        EncodeOptions options;
+        options.format = ImageFormat::PNG;
+        options.pngLevel = queryInt(hm, "level", 6);
+        workerPool.submit(conn, [atlas, page, options]() -> WorkerPool::Completion {
+            auto buffer = std::make_shared<std::vector<uchar>>();
+            bool ok = encodeImage(page->image, options, *buffer);
+            return [ok, buffer](struct mg_connection* conn) {
+                if (!conn) return;
+                if (!ok) {
+                    mg_http_reply(conn, 500, "", "Failed to encode atlas page");
+                    return;
+                }
+                mg_printf(conn, "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: image/png\r\n"
+                    "Cache-Control: no-cache\r\n"
+                    "Content-Length: %d\r\n\r\n", (int)buffer->size());
+                mg_send(conn, buffer->data(), buffer->size());
+            };
+        });
+    }
+
+    // 圖塊版本列表: /tiles/{layer}/versions?z=<層>&since=<版本>
+    // 前端只需抓取可見且版本有變的圖塊
+    else if (mg_match(hm->uri, mg_str("/tiles/*/versions"), caps)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        TilePyramid* tiles = findTileLayer(*session, std::string(caps[0].buf, caps[0].len));
+        if (!tiles) {
+            mg_http_reply(conn, 404, "", "No such layer");
+            return;
+        }
+        int z = queryInt(hm, "z", 0);
+        json levels = json::array();
+        for (int i = 0; i < tiles->levelCount(); ++i) {
+            cv::Size size = tiles->levelSize(i);
+            cv::Size count = tiles->tileGrid(i);
+            levels.push_back({ {"width", size.width}, {"height", size.height},
+                {"tilesX", count.width}, {"tilesY", count.height} });
         }
+        json changed = json::array();
+        for (const auto& t : tiles->changedSince(z, (uint32_t)queryInt(hm, "since", 0))) {
+            changed.push_back({ t.x, t.y, t.version });
+        }
+        replyJson(conn, 200, { {"version", tiles->version()}, {"tileSize", tiles->tileSize()},
+            {"z", z}, {"levels", levels}, {"tiles", changed} });
+    }
 
+    // 單一圖塊: /tiles/{layer}/{z}/{x}/{y}，z = 0 為原始解析度
+    else if (mg_match(hm->uri, mg_str("/tiles/*/*/*/*"), caps)) {
+        auto session = sessionFor(conn, hm);
+        if (!session) return;
+        TilePyramid* tiles = findTileLayer(*session, std::string(caps[0].buf, caps[0].len));
+        int z = atoi(std::string(caps[1].buf, caps[1].len).c_str());
+        int x = atoi(std::string(caps[2].buf, caps[2].len).c_str());
+        int y = atoi(std::string(caps[3].buf, caps[3].len).c_str());
+        EncodeOptions options;
+        options.format = negotiateImageFormat(queryString(hm, "fmt"), headerString(hm, "Accept"), true);
+        options.pngLevel = queryInt(hm, "level", kPngLevel);
+        options.stripes = 1; // 圖塊很小，不需再切條
+        std::string etag = headerString(hm, "If-None-Match");
+        // session 一併捕捉，確保圖塊在工作期間不被回收
+        workerPool.submit(conn, [session, tiles, z, x, y, options, etag]() -> WorkerPool::Completion {
+            Mat tile;
+            uint32_t tileVersion = 0;
+            auto buffer = std::make_shared<std::vector<uchar>>();
+            bool found = tiles && tiles->tile(z, x, y, tile, tileVersion);
+            std::string tag = "\"" + std::to_string(tileVersion) + "\"";
+            bool notModified = found && etag == tag;
+            bool ok = found && (notModified || encodeImage(tile, options, *buffer));
+            return [found, ok, notModified, buffer, options, tag, tileVersion](struct mg_connection* conn) {
+                if (!conn) return;
+                if (!found) {
+                    mg_http_reply(conn, 404, "", "No such tile");
+                }
+                else if (notModified) {
+                    mg_printf(conn, "HTTP/1.1 304 Not Modified\r\n"
+                        "ETag: %s\r\n"
+                        "Content-Length: 0\r\n\r\n", tag.c_str());
+                }
+                else if (!ok) {
+                    mg_http_reply(conn, 500, "", "Failed to encode tile");
+                }
+                else {
+                    mg_printf(conn, "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: %s\r\n"
+                        "Cache-Control: no-cache\r\n"
+                        "ETag: %s\r\n"
+                        "X-Tile-Version: %u\r\n"
+                        "Content-Length: %d\r\n\r\n",
+                        imageMimeType(options.format), tag.c_str(), tileVersion, (int)buffer->size());
+                    mg_send(conn, buffer->data(), buffer->size());
+                }
+            };
+        });
+    }
+
+    // 處理其他路徑請求 - 返回404錯誤
+    else if (staticAssets.serve(conn, hm)) {
+        // 已由記憶體快取或 sendfile 回覆
+    }
+    else {
+        // Serve web root directory
+        struct mg_http_serve_opts opts = { 0 };
+        opts.root_dir = ".";
+        opts.ssi_pattern = "#.html";
+        mg_http_serve_dir(conn, hm, &opts);
     }
 }
 
+// 記錄請求延遲與錯誤；仍在等待工作執行緒 (is_resp) 的請求留到完成時再記錄
+void finishRequest(struct mg_connection* conn, RouteMetrics& route, MetricsRegistry::Clock::time_point start,
+                   size_t replyStart) {
+    if (conn->is_resp) {
+        pendingRequests[conn->id] = { &route, start };
+        return;
+    }
+    recordReply(conn, route, start, replyStart);
+}
+
+double msSince(MetricsRegistry::Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(MetricsRegistry::Clock::now() - start).count();
+}
+
+// 上傳結束後關閉連線：錯誤時剩餘的本體不再讀取，成功時也不接受管線化請求
+void replyUploadError(struct mg_connection* conn, int status, const std::string& message) {
+    metrics.match(mg_str("/api/upload")).errors.fetch_add(1, std::memory_order_relaxed);
+    mg_http_reply(conn, status, "Content-Type: application/json\r\nConnection: close\r\n", "%s",
+                  json({ {"error", message} }).dump().c_str());
+    conn->is_draining = 1;
+}
+
+// POST /api/upload 的標頭已到: 接手連線的接收緩衝區，之後的資料由 MG_EV_READ 餵給 UploadStream
+void beginUpload(struct mg_connection* conn, struct mg_http_message* hm) {
+    static const size_t maxBytes = (size_t)envInt("MW_MAX_UPLOAD_MB", 1024) << 20;
+    Upload& upload = uploads[conn->id];
+    upload.start = MetricsRegistry::Clock::now();
+    upload.session = findSession(hm);
+    metrics.match(hm->uri).requests.fetch_add(1, std::memory_order_relaxed);
+    if (!upload.session) {
+        replyUploadError(conn, 410, "unknown or expired session");
+        uploads.erase(conn->id);
+        conn->recv.len = 0;
+        return;
+    }
+    if (!upload.stream.begin(hm, maxBytes)) {
+        replyUploadError(conn, upload.stream.errorStatus(), upload.stream.error());
+        uploads.erase(conn->id);
+        conn->recv.len = 0; // 不再解析這個請求
+        return;
+    }
+    struct mg_str* expect = mg_http_get_header(hm, "Expect");
+    if (expect && mg_strcasecmp(*expect, mg_str("100-continue")) == 0) {
+        mg_printf(conn, "HTTP/1.1 100 Continue\r\n\r\n");
+    }
+    // 移除標頭後 mongoose 的 HTTP 解析器就不再處理這條連線
+    mg_iobuf_del(&conn->recv, 0, (size_t)(hm->body.buf - (char*)conn->recv.buf));
+}
+
+// 本體收齊: 解碼 (PSD 或一般影像) 交給工作執行緒，完成後換掉 session 的文件
+void finishUpload(struct mg_connection* conn, Upload& upload) {
+    auto stream = std::make_shared<UploadStream>(std::move(upload.stream));
+    auto session = upload.session;
+    auto start = upload.start;
+    double receiveMs = msSince(start);
+    metrics.match(mg_str("/api/upload")).requestBytes.fetch_add(stream->received(), std::memory_order_relaxed);
+    uploads.erase(conn->id);
+
+    workerPool.submit(conn, [session, stream, start, receiveMs]() -> WorkerPool::Completion {
+        auto decodeStart = MetricsRegistry::Clock::now();
+        auto doc = std::make_shared<PsdDocument>();
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+        std::string filename, error;
+        bool ok = stream->filePayload(data, size, filename);
+        if (!ok) error = "no file in upload";
+        else ok = decodeDocument(data, size, filename, stream, *doc, error);
+        double decodeMs = msSince(decodeStart);
+        std::string format = ok && isPsd(data, size) ? "psd" : "image";
+        size_t bytes = size;
+
+        // 圖層複製、場景同步與 load (網格、KD 樹、整個圖塊金字塔) 都在這裡做，
+        // 不佔用事件循環；完成時只需回覆
+        if (ok) {
+            std::vector<SessionLayer> layers;
+            for (PsdLayer& layer : doc->layers) {
+                SessionLayer l;
+                l.name = layer.name;
+                l.rect = layer.rect;
+                l.opacity = layer.opacity;
+                l.visible = layer.visible;
+                layer.image.copyTo(l.image);
+                layers.push_back(std::move(l));
+            }
+            UMat composite;
+            doc->composite.copyTo(composite);
+            std::lock_guard<std::mutex> lock(session->mutex);
+            session->layers.swap(layers);
+            session->document = doc->file;
+            session->syncScene();
+            session->load(composite, kGridStep);
+        }
+
+        return [session, doc, ok, error, format, bytes, start, receiveMs, decodeMs](struct mg_connection* conn) {
+            if (!conn) return;
+            if (!ok) {
+                replyUploadError(conn, 422, error);
+            }
+            else {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                json reply = { {"session", session->token}, {"width", doc->width}, {"height", doc->height},
+                    {"format", format}, {"bytes", bytes}, {"receiveMs", receiveMs}, {"decodeMs", decodeMs},
+                    {"readyMs", msSince(start)}, {"layers", layersJson(*session)} };
+                mg_http_reply(conn, 200, "Content-Type: application/json\r\nConnection: close\r\n", "%s",
+                              reply.dump().c_str());
+                conn->is_draining = 1;
+            }
+            RouteMetrics& route = metrics.match(mg_str("/api/upload"));
+            route.latency.record((uint64_t)(msSince(start) * 1e6));
+        };
+    });
+}
+
+// 處理HTTP請求的回調函數
+void http_handler(struct mg_connection* conn, int ev, void* ev_data, void* fn_data) {
+    if (!eventLoop.onEvent(conn, ev)) return;
+    if (ev == MG_EV_READ) {
+        metrics.bytesReceived.fetch_add((uint64_t)*(long*)ev_data, std::memory_order_relaxed);
+        auto it = uploads.find(conn->id);
+        if (it != uploads.end()) {
+            UploadStream::State state = it->second.stream.feed(conn->recv.buf, conn->recv.len);
+            conn->recv.len = 0;
+            if (state == UploadStream::State::Error) {
+                replyUploadError(conn, it->second.stream.errorStatus(), it->second.stream.error());
+                uploads.erase(it);
+            }
+            else if (state == UploadStream::State::Done) {
+                finishUpload(conn, it->second);
+            }
+        }
+    }
+    else if (ev == MG_EV_HTTP_HDRS) {
+        struct mg_http_message* hm = (struct mg_http_message*)ev_data;
+        if (mg_match(hm->uri, mg_str("/api/upload"), NULL) && mg_strcasecmp(hm->method, mg_str("POST")) == 0) {
+            beginUpload(conn, hm);
+        }
+    }
+    else if (ev == MG_EV_WRITE) {
+        metrics.bytesSent.fetch_add((uint64_t)*(long*)ev_data, std::memory_order_relaxed);
+    }
+    else if (ev == MG_EV_ACCEPT) {
+        metrics.connectionsOpened.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (ev == MG_EV_CLOSE) {
+        // 客戶端已離開，不記錄未完成的請求
+        pendingRequests.erase(conn->id);
+        uploads.erase(conn->id);
+    }
+    else if (ev == MG_EV_HTTP_MSG) {
+        struct mg_http_message* hm = (struct mg_http_message*)ev_data;
+        auto start = MetricsRegistry::Clock::now();
+        RouteMetrics& route = metrics.match(hm->uri);
+        MW_TRACE_SCOPE(route.name.c_str());
+        MW_LOG_DEBUG("{} {} ({} bytes)", std::string(hm->method.buf, hm->method.len),
+                     std::string(hm->uri.buf, hm->uri.len), hm->message.len);
+        route.requests.fetch_add(1, std::memory_order_relaxed);
+        route.requestBytes.fetch_add(hm->message.len, std::memory_order_relaxed);
+        size_t replyStart = conn->send.len;
+        handleRequest(conn, hm);
+        finishRequest(conn, route, start, replyStart);
+    }
+}
 
 void displayOpenCLDeviceInfo() {
     // 檢查 OpenCV 是否支援 OpenCL
@@ -177,7 +1033,7 @@ void grayscaleWithOpenCL(const std::string& imagePath) {
     cv::UMat inputImage, grayImage; // 使用 UMat 以啟用 OpenCL 加速
     inputImage = cv::imread(imagePath, cv::IMREAD_COLOR).getUMat(cv::ACCESS_READ);
     if (inputImage.empty()) {
-        std::cerr << "無法讀取影像: " << imagePath << std::endl;
+        MW_LOG_ERROR("無法讀取影像: {}", imagePath);
         return;
     }
 
@@ -222,11 +1078,59 @@ int main() {
     // grayscaleWithOpenCL("test.jpg");
     std::cout << " go go hh ..." << std::endl;
 
+    trace::setThreadName("event loop");
+    trace::setEnabled(envInt("MW_TRACE", 0) != 0);
+    // 0 debug, 1 info, 2 warn, 3 error, 4 關閉; debug 在 release 建置中已編譯移除
+    logging::setLevel((logging::Level)envInt("MW_LOG_LEVEL", logging::level()));
+
     struct mg_mgr mgr;
     mg_mgr_init(&mgr);
+    mg_wakeup_init(&mgr); // 讓工作執行緒能喚醒事件循環
+
+    imread("png3.png", IMREAD_UNCHANGED).copyTo(defaultImage);
+    {
+        auto session = sessions.create(kDefaultSession);
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->load(defaultImage, kGridStep);
+    }
+
+    staticAssets.load(".");
+    const StaticAssetCache::Stats& assetStats = staticAssets.stats();
+    std::cout << "static assets: " << assetStats.files << " files, " << assetStats.rawBytes << " bytes -> gzip "
+              << assetStats.gzipBytes << ", br " << assetStats.brotliBytes << " (" << assetStats.loadMs << " ms)" << std::endl;
 
-    image = imread("png3.png", IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-    image_post = image.clone();
+    // 連線政策可用環境變數調整，方便壓測時比較
+    EventLoopOptions loopOptions;
+    loopOptions.maxPollMs = envInt("MW_MAX_POLL_MS", loopOptions.maxPollMs);
+    loopOptions.runBudgetUs = envInt("MW_RUN_BUDGET_US", (int)loopOptions.runBudgetUs);
+    loopOptions.maxConnections = envInt("MW_MAX_CONNECTIONS", (int)loopOptions.maxConnections);
+    loopOptions.keepAliveIdleMs = envInt("MW_KEEPALIVE_IDLE_MS", loopOptions.keepAliveIdleMs);
+    loopOptions.maxRequestsPerConnection = envInt("MW_MAX_REQUESTS_PER_CONN", (int)loopOptions.maxRequestsPerConnection);
+    eventLoop.attach(&mgr, loopOptions);
+    workerPool.setFinished(finishPendingRequest);
+
+    // 路由需在開始服務前註冊，之後只讀取
+    for (const char* route : { "/image", "/api/session", "/api/loop", "/api/clickStart", "/api/drag",
+                               "/api/dragDone", "/api/mesh", "/api/points", "/api/vertices",
+                               "/tiles/*/versions", "/tiles/*/*/*/*", "/metrics", "/api/trace",
+                               "/api/upload", "/api/layers", "/api/layers/*", "/api/atlas", "/api/atlas/*",
+                               "/api/hierarchy" }) {
+        metrics.addRoute(route, route);
+    }
+    metrics.addGauge("mw_worker_queue_depth", "Tasks queued or running on the worker pool.",
+                     []() { return (double)workerPool.queueDepth(); });
+    metrics.addGauge("mw_worker_threads", "Worker pool threads.",
+                     []() { return (double)workerPool.threadCount(); });
+    metrics.addGauge("mw_connections_active", "Open client connections.",
+                     []() { return (double)eventLoop.stats().connections; });
+    metrics.addGauge("mw_sessions", "Live editor sessions.",
+                     []() { return (double)sessions.size(); });
+
+    // 每分鐘清掉閒置的 session (預設 session 保留)
+    eventLoop.addTimer(60 * 1000, true, []() {
+        size_t evicted = sessions.evictIdle(kSessionIdleMs, kDefaultSession);
+        if (evicted) MW_LOG_INFO("evicted sessions: {}", evicted);
+    });
 
     // 設置HTTP服務器監聽地址和端口
     const char* listen_addr = "http://0.0.0.0:8000";
@@ -238,9 +1142,7 @@ int main() {
     std::cout << "按 Ctrl+C 退出服務器" << std::endl;
 
     // 事件循環
-    while (true) {
-        mg_mgr_poll(&mgr, 1000);
-    }
+    eventLoop.run();
 
     // 釋放資源
     mg_mgr_free(&mgr);
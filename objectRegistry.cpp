@@ -0,0 +1,240 @@
+#include "objectRegistry.h"
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+// NameTable implementation
+NameTable::Index::Index(size_t capacity) : mask(capacity - 1), slots(new std::atomic<uint32_t>[capacity]) {
+    for (size_t i = 0; i < capacity; ++i) slots[i].store(kNone, std::memory_order_relaxed);
+}
+
+NameTable::NameTable() : index(new Index(1024)) {
+    for (auto& chunk : chunks) chunk.store(nullptr, std::memory_order_relaxed);
+}
+
+NameTable::~NameTable() {
+    for (auto& chunk : chunks) delete[] chunk.load(std::memory_order_relaxed);
+    delete index.load(std::memory_order_relaxed);
+}
+
+const NameTable::Entry* NameTable::entry(uint32_t id) const {
+    const Entry* chunk = chunks[id >> kChunkBits].load(std::memory_order_acquire);
+    return &chunk[id & ((1u << kChunkBits) - 1)];
+}
+
+void NameTable::insert(Index& target, uint32_t id, uint64_t hash) {
+    for (size_t i = hash & target.mask;; i = (i + 1) & target.mask) {
+        if (target.slots[i].load(std::memory_order_relaxed) == kNone) {
+            target.slots[i].store(id, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+uint32_t NameTable::intern(const std::string& text) {
+    uint32_t id = find(text);
+    if (id != kNone) return id;
+
+    std::lock_guard<std::mutex> lock(writeLock);
+    id = find(text); // interned while we waited
+    if (id != kNone) return id;
+    id = count.load(std::memory_order_relaxed);
+    if ((id >> kChunkBits) >= (uint32_t)kMaxChunks) throw std::length_error("NameTable is full");
+
+    std::atomic<Entry*>& chunk = chunks[id >> kChunkBits];
+    if (!chunk.load(std::memory_order_relaxed)) chunk.store(new Entry[1u << kChunkBits], std::memory_order_release);
+    Entry& e = chunk.load(std::memory_order_relaxed)[id & ((1u << kChunkBits) - 1)];
+    e.text = text;
+    e.hash = std::hash<std::string>()(text);
+
+    // Keep the index at most half full. Readers may still be probing the
+    // old one, so it is retired rather than freed.
+    Index* current = index.load(std::memory_order_relaxed);
+    if ((size_t)(id + 1) * 2 > current->mask + 1) {
+        Index* bigger = new Index((current->mask + 1) * 2);
+        for (uint32_t i = 0; i < id; ++i) insert(*bigger, i, entry(i)->hash);
+        retired.emplace_back(current);
+        index.store(bigger, std::memory_order_release);
+        current = bigger;
+    }
+    insert(*current, id, e.hash);
+    count.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+uint32_t NameTable::find(const std::string& text) const {
+    uint64_t hash = std::hash<std::string>()(text);
+    const Index* current = index.load(std::memory_order_acquire);
+    for (size_t i = hash & current->mask;; i = (i + 1) & current->mask) {
+        uint32_t id = current->slots[i].load(std::memory_order_acquire);
+        if (id == kNone) return kNone;
+        const Entry* e = entry(id);
+        if (e->hash == hash && e->text == text) return id;
+    }
+}
+
+const std::string& NameTable::name(uint32_t id) const {
+    static const std::string none;
+    return id < size() ? entry(id)->text : none;
+}
+
+// ObjectRegistry implementation
+ObjectRegistry& ObjectRegistry::global() {
+    static ObjectRegistry registry;
+    return registry;
+}
+
+ObjectRegistry::ObjectRegistry() {
+    for (auto& chunk : slotChunks) chunk.store(nullptr, std::memory_order_relaxed);
+    for (auto& chunk : nameChunks) chunk.store(nullptr, std::memory_order_relaxed);
+}
+
+ObjectRegistry::~ObjectRegistry() {
+    for (auto& chunk : slotChunks) delete[] chunk.load(std::memory_order_relaxed);
+    for (auto& chunk : nameChunks) {
+        NameList* lists = chunk.load(std::memory_order_relaxed);
+        if (!lists) continue;
+        for (uint32_t i = 0; i < (1u << kChunkBits); ++i) delete lists[i].handles.load(std::memory_order_relaxed);
+        delete[] lists;
+    }
+}
+
+ObjectRegistry::Slot* ObjectRegistry::slot(uint32_t index) const {
+    if ((index >> kChunkBits) >= (uint32_t)kMaxChunks) return nullptr;
+    Slot* chunk = slotChunks[index >> kChunkBits].load(std::memory_order_acquire);
+    return chunk ? &chunk[index & ((1u << kChunkBits) - 1)] : nullptr;
+}
+
+ObjectRegistry::NameList* ObjectRegistry::nameList(uint32_t nameId) const {
+    if ((nameId >> kChunkBits) >= (uint32_t)kMaxChunks) return nullptr;
+    NameList* chunk = nameChunks[nameId >> kChunkBits].load(std::memory_order_acquire);
+    return chunk ? &chunk[nameId & ((1u << kChunkBits) - 1)] : nullptr;
+}
+
+ObjectRegistry::NameList& ObjectRegistry::nameListForWrite(uint32_t nameId) {
+    std::atomic<NameList*>& chunk = nameChunks[nameId >> kChunkBits];
+    if (!chunk.load(std::memory_order_relaxed)) chunk.store(new NameList[1u << kChunkBits], std::memory_order_release);
+    return chunk.load(std::memory_order_relaxed)[nameId & ((1u << kChunkBits) - 1)];
+}
+
+// Copy-on-write: publish the new list, wait out readers of the old one.
+void ObjectRegistry::link(uint32_t nameId, Handle handle) {
+    NameList& list = nameListForWrite(nameId);
+    const std::vector<Handle>* old = list.handles.load(std::memory_order_relaxed);
+    auto* next = old ? new std::vector<Handle>(*old) : new std::vector<Handle>();
+    next->push_back(handle);
+    list.handles.store(next);
+    while (list.readers.load() != 0) std::this_thread::yield();
+    delete old;
+}
+
+void ObjectRegistry::unlink(uint32_t nameId, Handle handle) {
+    NameList& list = nameListForWrite(nameId);
+    const std::vector<Handle>* old = list.handles.load(std::memory_order_relaxed);
+    if (!old) return;
+    auto* next = new std::vector<Handle>(*old);
+    next->erase(std::remove(next->begin(), next->end(), handle), next->end());
+    if (next->empty()) {
+        delete next;
+        next = nullptr;
+    }
+    list.handles.store(next);
+    while (list.readers.load() != 0) std::this_thread::yield();
+    delete old;
+}
+
+Handle ObjectRegistry::add(const std::weak_ptr<GameObject>& object, const std::string& name) {
+    uint32_t nameId = nameTable.intern(name);
+    std::lock_guard<std::mutex> lock(writeLock);
+    uint32_t index;
+    if (!freeSlots.empty()) {
+        index = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else {
+        index = slotCount;
+        if ((index >> kChunkBits) >= (uint32_t)kMaxChunks) throw std::length_error("ObjectRegistry is full");
+        std::atomic<Slot*>& chunk = slotChunks[index >> kChunkBits];
+        if (!chunk.load(std::memory_order_relaxed)) chunk.store(new Slot[1u << kChunkBits], std::memory_order_release);
+        ++slotCount;
+    }
+    // The generation is even here, so no reader touches object until the
+    // new one is published.
+    Slot& s = *slot(index);
+    s.object = object;
+    s.nameId = nameId;
+    Handle handle;
+    handle.index = index;
+    handle.generation = s.generation.load(std::memory_order_relaxed) + 1;
+    s.generation.store(handle.generation, std::memory_order_release);
+    link(nameId, handle);
+    live.fetch_add(1, std::memory_order_relaxed);
+    return handle;
+}
+
+void ObjectRegistry::remove(Handle handle) {
+    std::lock_guard<std::mutex> lock(writeLock);
+    Slot* s = slot(handle.index);
+    if (!s || !(handle.generation & 1) || s->generation.load(std::memory_order_relaxed) != handle.generation) return;
+    // Unlink first: readers that found the handle in a name list may then
+    // use the slot without a guard of their own (see findLatest).
+    unlink(s->nameId, handle);
+    s->nameId = NameTable::kNone;
+    // New readers now fail the generation check; wait for the ones inside.
+    s->generation.store(handle.generation + 1);
+    while (s->readers.load() != 0) std::this_thread::yield();
+    s->object.reset();
+    freeSlots.push_back(handle.index);
+    live.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ObjectRegistry::rename(Handle handle, const std::string& name) {
+    uint32_t nameId = nameTable.intern(name);
+    std::lock_guard<std::mutex> lock(writeLock);
+    Slot* s = slot(handle.index);
+    if (!s || !(handle.generation & 1) || s->generation.load(std::memory_order_relaxed) != handle.generation) return;
+    if (s->nameId == nameId) return;
+    unlink(s->nameId, handle);
+    link(nameId, handle);
+    s->nameId = nameId;
+}
+
+std::shared_ptr<GameObject> ObjectRegistry::resolve(Handle handle) const {
+    Slot* s = slot(handle.index);
+    if (!s || !(handle.generation & 1)) return nullptr;
+    std::shared_ptr<GameObject> object;
+    s->readers.fetch_add(1);
+    if (s->generation.load() == handle.generation) object = s->object.lock();
+    s->readers.fetch_sub(1, std::memory_order_release);
+    return object;
+}
+
+std::vector<Handle> ObjectRegistry::find(uint32_t nameId) const {
+    std::vector<Handle> result;
+    NameList* list = nameList(nameId);
+    if (!list) return result;
+    list->readers.fetch_add(1);
+    if (const std::vector<Handle>* handles = list->handles.load()) result = *handles;
+    list->readers.fetch_sub(1, std::memory_order_release);
+    return result;
+}
+
+std::vector<Handle> ObjectRegistry::find(const std::string& name) const {
+    return find(nameTable.find(name));
+}
+
+std::shared_ptr<GameObject> ObjectRegistry::findLatest(const std::string& name) const {
+    NameList* list = nameList(nameTable.find(name));
+    if (!list) return nullptr;
+    std::shared_ptr<GameObject> object;
+    list->readers.fetch_add(1);
+    if (const std::vector<Handle>* handles = list->handles.load()) {
+        // Listed handles are live until remove() has waited for this guard.
+        for (auto it = handles->rbegin(); it != handles->rend() && !object; ++it) {
+            object = slot(it->index)->object.lock();
+        }
+    }
+    list->readers.fetch_sub(1, std::memory_order_release);
+    return object;
+}
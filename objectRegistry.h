@@ -0,0 +1,127 @@
+#ifndef OBJECTREGISTRY_H
+#define OBJECTREGISTRY_H
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class GameObject;
+
+// Generational handle of a registered object: index picks the slot, the
+// generation (odd while live) tells it apart from earlier occupants.
+struct Handle {
+    static constexpr uint32_t kNone = 0xFFFFFFFFu;
+
+    uint32_t index = kNone;
+    uint32_t generation = 0;
+
+    bool valid() const { return index != kNone; }
+    uint64_t id() const { return (uint64_t)generation << 32 | index; }
+    bool operator==(const Handle& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Handle& other) const { return !(*this == other); }
+};
+
+// Interned strings with dense ids. Interning takes a lock; find() and
+// name() never do. Names are never removed.
+class NameTable {
+public:
+    static constexpr uint32_t kNone = 0xFFFFFFFFu;
+
+    NameTable();
+    ~NameTable();
+    NameTable(const NameTable&) = delete;
+    NameTable& operator=(const NameTable&) = delete;
+
+    uint32_t intern(const std::string& text);
+    uint32_t find(const std::string& text) const; // kNone when never interned
+    const std::string& name(uint32_t id) const;
+    uint32_t size() const { return count.load(std::memory_order_acquire); }
+
+private:
+    struct Entry {
+        std::string text;
+        uint64_t hash = 0;
+    };
+    // Open addressing over ids; replaced wholesale when it fills up.
+    struct Index {
+        size_t mask;
+        std::unique_ptr<std::atomic<uint32_t>[]> slots;
+        explicit Index(size_t capacity);
+    };
+    static constexpr int kChunkBits = 10;
+    static constexpr int kMaxChunks = 1 << 12;
+
+    const Entry* entry(uint32_t id) const;
+    void insert(Index& index, uint32_t id, uint64_t hash);
+
+    std::mutex writeLock;
+    std::atomic<uint32_t> count{ 0 };
+    std::atomic<Entry*> chunks[kMaxChunks];
+    std::atomic<Index*> index;
+    std::vector<std::unique_ptr<Index>> retired; // old indexes readers may still hold
+};
+
+// Registry of live GameObjects, safe to use from any thread. Writers
+// (add/remove/rename) serialize on a mutex; resolving a handle or a name
+// never locks: each slot and each name's handle list counts its readers so
+// a writer only retires data nobody is still reading. That covers the
+// registry only: what callers do with a resolved object is up to the object.
+class ObjectRegistry {
+public:
+    static ObjectRegistry& global();
+
+    ObjectRegistry();
+    ~ObjectRegistry();
+    ObjectRegistry(const ObjectRegistry&) = delete;
+    ObjectRegistry& operator=(const ObjectRegistry&) = delete;
+
+    Handle add(const std::weak_ptr<GameObject>& object, const std::string& name);
+    void remove(Handle handle);
+    void rename(Handle handle, const std::string& name);
+
+    std::shared_ptr<GameObject> resolve(Handle handle) const;
+    // Objects called name, in the order they took it (add or rename);
+    // names may repeat.
+    std::vector<Handle> find(const std::string& name) const;
+    std::vector<Handle> find(uint32_t nameId) const;
+    // The live object that took name last, by add or by rename.
+    std::shared_ptr<GameObject> findLatest(const std::string& name) const;
+
+    NameTable& names() { return nameTable; }
+    size_t size() const { return live.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(64) Slot { // one per cache line, readers of different objects never share
+        std::atomic<uint32_t> generation{ 0 }; // odd while live
+        std::atomic<uint32_t> readers{ 0 };
+        uint32_t nameId = NameTable::kNone;    // writer side only
+        std::weak_ptr<GameObject> object;      // written only while no reader can pass the generation check
+    };
+    struct alignas(64) NameList {
+        std::atomic<const std::vector<Handle>*> handles{ nullptr };
+        std::atomic<uint32_t> readers{ 0 };
+    };
+    static constexpr int kChunkBits = 10;
+    static constexpr int kMaxChunks = 1 << 12;
+
+    Slot* slot(uint32_t index) const;
+    NameList* nameList(uint32_t nameId) const;
+    NameList& nameListForWrite(uint32_t nameId);
+    void link(uint32_t nameId, Handle handle);
+    void unlink(uint32_t nameId, Handle handle);
+
+    NameTable nameTable;
+    std::mutex writeLock;
+    std::atomic<Slot*> slotChunks[kMaxChunks];
+    std::atomic<NameList*> nameChunks[kMaxChunks];
+    uint32_t slotCount = 0;
+    std::vector<uint32_t> freeSlots;
+    std::atomic<size_t> live{ 0 };
+};
+
+#endif // OBJECTREGISTRY_H
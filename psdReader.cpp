@@ -0,0 +1,616 @@
+#include "psdReader.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include "trace.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PSD_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PSD_NEON 1
+#endif
+
+namespace {
+
+// Big-endian cursor over the file. Reads past the end set ok = false and
+// return zeros, so parsing code can check once per section.
+struct Reader {
+    const uint8_t* data;
+    uint64_t size;
+    uint64_t pos = 0;
+    bool ok = true;
+
+    Reader(const uint8_t* data, uint64_t size) : data(data), size(size) {}
+
+    bool has(uint64_t n) const { return ok && pos <= size && n <= size - pos; }
+    const uint8_t* take(uint64_t n) {
+        if (!has(n)) {
+            ok = false;
+            return nullptr;
+        }
+        const uint8_t* p = data + pos;
+        pos += n;
+        return p;
+    }
+    void skip(uint64_t n) { take(n); }
+    uint8_t u8() {
+        const uint8_t* p = take(1);
+        return p ? p[0] : 0;
+    }
+    uint16_t u16() {
+        const uint8_t* p = take(2);
+        return p ? (uint16_t)(p[0] << 8 | p[1]) : 0;
+    }
+    uint32_t u32() {
+        const uint8_t* p = take(4);
+        return p ? (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3] : 0;
+    }
+    uint64_t u64() {
+        uint64_t high = u32();
+        return high << 32 | u32();
+    }
+    // Section lengths are 4 bytes in PSD and 8 in PSB.
+    uint64_t length(bool large) { return large ? u64() : u32(); }
+    int16_t i16() { return (int16_t)u16(); }
+    int32_t i32() { return (int32_t)u32(); }
+    std::string str(size_t n) {
+        const uint8_t* p = take(n);
+        return p ? std::string((const char*)p, n) : std::string();
+    }
+};
+
+// Largest width or height the format allows; anything bigger is corrupt or
+// hostile and is refused before a plane is allocated for it.
+int64_t maxDimension(bool large) {
+    return large ? 300000 : 30000;
+}
+
+void appendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    }
+    else if (cp < 0x800) {
+        out += (char)(0xC0 | cp >> 6);
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000) {
+        out += (char)(0xE0 | cp >> 12);
+        out += (char)(0x80 | (cp >> 6 & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else {
+        out += (char)(0xF0 | cp >> 18);
+        out += (char)(0x80 | (cp >> 12 & 0x3F));
+        out += (char)(0x80 | (cp >> 6 & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+std::string readUnicodeName(Reader& r) {
+    uint32_t count = r.u32();
+    std::string out;
+    for (uint32_t i = 0; i < count && r.ok; ++i) {
+        uint32_t c = r.u16();
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < count) {
+            uint32_t low = r.u16();
+            ++i;
+            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+        }
+        if (c) appendUtf8(out, c);
+    }
+    return out;
+}
+
+// Tagged blocks whose length field grows to 8 bytes in PSB files.
+bool hasLongLength(const std::string& key) {
+    static const char* keys[] = { "LMsk", "Lr16", "Lr32", "Layr", "Mt16", "Mt32", "Mtrn",
+                                  "Alph", "FMsk", "lnk2", "FEid", "FXid", "PxSD" };
+    for (const char* k : keys) {
+        if (key == k) return true;
+    }
+    return false;
+}
+
+// 16-byte block moves. Runs are decoded a whole block at a time whenever the
+// row has room, so most runs cost one or two stores instead of a call into
+// memcpy/memset or a byte loop; bytes written past the run are overwritten
+// by the next one.
+inline void copy16(uint8_t* dst, const uint8_t* src) {
+#if defined(PSD_SSE2)
+    _mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+#elif defined(PSD_NEON)
+    vst1q_u8(dst, vld1q_u8(src));
+#else
+    std::memcpy(dst, src, 16);
+#endif
+}
+
+inline void fill16(uint8_t* dst, uint8_t value, size_t blocks) {
+#if defined(PSD_SSE2)
+    __m128i v = _mm_set1_epi8((char)value);
+    for (size_t k = 0; k < blocks; ++k) _mm_storeu_si128((__m128i*)(dst + k * 16), v);
+#elif defined(PSD_NEON)
+    uint8x16_t v = vdupq_n_u8(value);
+    for (size_t k = 0; k < blocks; ++k) vst1q_u8(dst + k * 16, v);
+#else
+    std::memset(dst, value, blocks * 16);
+#endif
+}
+
+// PackBits: n >= 0 copies n + 1 literal bytes, -127..-1 repeats the next
+// byte 1 - n times, -128 is a no-op. srcAvail is how far src may be read,
+// which can extend past this row into the rest of the channel.
+bool unpackBitsRow(const uint8_t* src, size_t srcLen, size_t srcAvail, uint8_t* dst, size_t dstLen) {
+    size_t i = 0, o = 0;
+    while (i < srcLen && o < dstLen) {
+        int8_t n = (int8_t)src[i++];
+        if (n >= 0) {
+            size_t count = (size_t)n + 1;
+            if (count > srcLen - i || count > dstLen - o) return false;
+            size_t span = (count + 15) & ~(size_t)15;
+            if (span <= srcAvail - i && span <= dstLen - o) {
+                for (size_t k = 0; k < span; k += 16) copy16(dst + o + k, src + i + k);
+            }
+            else {
+                std::memcpy(dst + o, src + i, count);
+            }
+            i += count;
+            o += count;
+        }
+        else if (n != -128) {
+            size_t count = (size_t)(1 - n);
+            if (i >= srcLen || count > dstLen - o) return false;
+            size_t span = (count + 15) & ~(size_t)15;
+            if (span <= dstLen - o) fill16(dst + o, src[i], span / 16);
+            else std::memset(dst + o, src[i], count);
+            ++i;
+            o += count;
+        }
+    }
+    return o == dstLen;
+}
+
+// Decode the first planeCount of totalPlanes planes of width x height that
+// follow one compression field, as in a layer channel (totalPlanes = 1) or
+// the merged image. RLE rows are independent once their offsets are summed
+// from the count table, so large planes are split across threads by row.
+bool decodePlanes(const uint8_t* src, uint64_t len, int compression, int width, int height, int totalPlanes,
+                  int planeCount, bool large, std::vector<cv::Mat>& planes, std::string& error) {
+    planes.assign(planeCount, cv::Mat());
+    const size_t rowBytes = (size_t)width;
+    const size_t rows = (size_t)planeCount * height;
+    // Planes are only allocated once the data is known to be there.
+    auto allocate = [&]() {
+        for (cv::Mat& plane : planes) plane.create(height, width, CV_8U);
+    };
+
+    if (compression == 0) {
+        if ((uint64_t)rowBytes * rows > len) {
+            error = "truncated image data";
+            return false;
+        }
+        allocate();
+        for (size_t row = 0; row < rows; ++row) {
+            std::memcpy(planes[row / height].ptr((int)(row % height)), src + row * rowBytes, rowBytes);
+        }
+        return true;
+    }
+    if (compression != 1) {
+        error = "unsupported channel compression " + std::to_string(compression);
+        return false;
+    }
+
+    const size_t countBytes = large ? 4 : 2;
+    const uint64_t tableBytes = (uint64_t)countBytes * totalPlanes * height;
+    if (tableBytes > len) {
+        error = "truncated RLE table";
+        return false;
+    }
+    // A PackBits packet unpacks to at most 128 bytes from at least 2, which
+    // bounds the planes by the size of the data they come from.
+    const uint64_t minRowBytes = 2 * (((uint64_t)rowBytes + 127) / 128);
+    std::vector<uint64_t> offsets(rows + 1);
+    offsets[0] = tableBytes;
+    for (size_t row = 0; row < rows; ++row) {
+        const uint8_t* p = src + row * countBytes;
+        uint32_t n = large ? (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]
+                           : (uint32_t)(p[0] << 8 | p[1]);
+        if (n < minRowBytes) {
+            error = "corrupt RLE table";
+            return false;
+        }
+        offsets[row + 1] = offsets[row] + n;
+    }
+    if (offsets[rows] > len) {
+        error = "truncated RLE data";
+        return false;
+    }
+    allocate();
+
+    std::atomic<bool> ok(true);
+    auto decodeRows = [&](const cv::Range& range) {
+        for (int row = range.start; row < range.end && ok.load(std::memory_order_relaxed); ++row) {
+            uint8_t* dst = planes[row / height].ptr(row % height);
+            if (!unpackBitsRow(src + offsets[row], (size_t)(offsets[row + 1] - offsets[row]),
+                               (size_t)(len - offsets[row]), dst, rowBytes)) {
+                ok = false;
+            }
+        }
+    };
+    if (rows * rowBytes >= ((size_t)1 << 20)) {
+        cv::parallel_for_(cv::Range(0, (int)rows), decodeRows, cv::getNumThreads() * 4.0);
+    }
+    else {
+        decodeRows(cv::Range(0, (int)rows));
+    }
+    if (!ok) error = "corrupt RLE data";
+    return ok;
+}
+
+// Merge R, G, B (or gray) and alpha planes into BGRA; missing planes are
+// black, missing alpha is opaque.
+cv::Mat toBgra(const cv::Mat& red, const cv::Mat& green, const cv::Mat& blue, const cv::Mat& alpha, int width, int height) {
+    cv::Mat zero, opaque;
+    if (red.empty() || green.empty() || blue.empty()) zero = cv::Mat::zeros(height, width, CV_8U);
+    if (alpha.empty()) opaque = cv::Mat(height, width, CV_8U, cv::Scalar(255));
+    std::vector<cv::Mat> planes = {
+        blue.empty() ? zero : blue,
+        green.empty() ? zero : green,
+        red.empty() ? zero : red,
+        alpha.empty() ? opaque : alpha,
+    };
+    cv::Mat out;
+    cv::merge(planes, out);
+    return out;
+}
+
+} // namespace
+
+PsdFile::~PsdFile() {
+    if (!mapped) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(const_cast<uint8_t*>(data), length);
+#endif
+}
+
+bool PsdFile::open(const std::string& path, std::string& error) {
+    MW_TRACE_SCOPE("psd.open");
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = "cannot open " + path;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    HANDLE map = fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    const void* view = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    // The view keeps the mapping alive on its own.
+    if (map) CloseHandle(map);
+    CloseHandle(file);
+    if (!view) {
+        error = "cannot map " + path;
+        return false;
+    }
+    data = (const uint8_t*)view;
+    length = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    void* view = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        error = "cannot map " + path;
+        return false;
+    }
+    data = (const uint8_t*)view;
+    length = (size_t)st.st_size;
+#endif
+    mapped = true;
+    return index(error);
+}
+
+bool PsdFile::openMemory(const uint8_t* bytes, size_t size, std::shared_ptr<const void> keepAlive, std::string& error) {
+    data = bytes;
+    length = size;
+    owner = std::move(keepAlive);
+    return index(error);
+}
+
+bool PsdFile::index(std::string& error) {
+    MW_TRACE_SCOPE("psd.index");
+    Reader r(data, length);
+    if (!isPsd(data, length)) {
+        error = "not a PSD file";
+        return false;
+    }
+    r.skip(4);
+    version = r.u16();
+    r.skip(6);
+    docChannels = r.u16();
+    uint32_t height = r.u32(), width = r.u32();
+    docDepth = r.u16();
+    docColorMode = r.u16();
+    if (!r.ok) {
+        error = "truncated header";
+        return false;
+    }
+    if (version != 1 && version != 2) {
+        error = "unknown PSD version " + std::to_string(version);
+        return false;
+    }
+    if (docDepth != 8 || (docColorMode != 3 && docColorMode != 1)) {
+        error = "only 8-bit RGB and grayscale PSDs are supported";
+        return false;
+    }
+    if (docChannels < 1 || docChannels > 56) {
+        error = "bad channel count " + std::to_string(docChannels);
+        return false;
+    }
+    if (width < 1 || height < 1 || width > maxDimension(large()) || height > maxDimension(large())) {
+        error = "bad image size " + std::to_string(width) + "x" + std::to_string(height);
+        return false;
+    }
+    docWidth = (int)width;
+    docHeight = (int)height;
+
+    r.skip(r.u32()); // color mode data
+    r.skip(r.u32()); // image resources
+    uint64_t layerMaskLen = r.length(large());
+    uint64_t layerMaskEnd = r.pos + layerMaskLen;
+    if (!r.ok || layerMaskEnd > length) {
+        error = "truncated file";
+        return false;
+    }
+    if (layerMaskLen > 0) {
+        uint64_t layerInfoLen = r.length(large());
+        uint64_t layerInfoEnd = r.pos + layerInfoLen;
+        if (!r.ok || layerInfoEnd > layerMaskEnd) {
+            error = "truncated layer info";
+            return false;
+        }
+        if (layerInfoLen > 0 && !indexLayers(r.pos, layerInfoEnd, error)) return false;
+    }
+    compositeOffset = layerMaskEnd;
+    slots.reset(new Slot[records.size()]);
+    return true;
+}
+
+bool PsdFile::indexLayers(uint64_t pos, uint64_t end, std::string& error) {
+    Reader r(data, end);
+    r.pos = pos;
+    int layerCount = std::abs((int)r.i16());
+    records.assign(layerCount, PsdLayerInfo());
+    std::vector<uint32_t> sectionTypes(layerCount, 0);
+
+    for (int i = 0; i < layerCount && r.ok; ++i) {
+        PsdLayerInfo& layer = records[i];
+        int top = r.i32(), left = r.i32(), bottom = r.i32(), right = r.i32();
+        int64_t width = (int64_t)right - left, height = (int64_t)bottom - top;
+        if (r.ok && (width < 0 || height < 0 || width > maxDimension(large()) || height > maxDimension(large()))) {
+            error = "bad layer bounds";
+            return false;
+        }
+        layer.rect = cv::Rect(left, top, (int)width, (int)height);
+        int channelCount = r.u16();
+        for (int c = 0; c < channelCount && r.ok; ++c) {
+            PsdChannel channel;
+            channel.id = r.i16();
+            channel.length = r.length(large()); // includes the compression field for now
+            layer.channels.push_back(channel);
+        }
+        r.skip(4); // "8BIM"
+        layer.blendMode = r.str(4);
+        layer.opacity = r.u8();
+        r.skip(1); // clipping
+        uint8_t flags = r.u8();
+        layer.visible = (flags & 0x02) == 0;
+        r.skip(1); // filler
+
+        uint64_t extraLen = r.u32();
+        uint64_t extraEnd = r.pos + extraLen;
+        r.skip(r.u32()); // layer mask data
+        r.skip(r.u32()); // blending ranges
+        uint8_t nameLen = r.u8();
+        layer.name = r.str(nameLen);
+        // The Pascal name is padded to a multiple of 4 bytes, length byte included.
+        r.skip((4 - (1 + nameLen) % 4) % 4);
+        while (r.ok && r.pos + 12 <= extraEnd) {
+            r.skip(4); // "8BIM" or "8B64"
+            std::string key = r.str(4);
+            uint64_t len = large() && hasLongLength(key) ? r.u64() : r.u32();
+            uint64_t blockEnd = r.pos + len;
+            if (blockEnd < r.pos || blockEnd > extraEnd) {
+                r.ok = false;
+                break;
+            }
+            if (key == "luni") layer.name = readUnicodeName(r);
+            else if (key == "lsct" || key == "lsdk") sectionTypes[i] = r.u32();
+            r.pos = blockEnd;
+        }
+        if (extraEnd > end) r.ok = false;
+        else r.pos = extraEnd;
+    }
+    if (!r.ok) {
+        error = "truncated layer records";
+        return false;
+    }
+
+    // Channel data follows the records, layer by layer; only offsets are kept.
+    for (PsdLayerInfo& layer : records) {
+        for (PsdChannel& channel : layer.channels) {
+            if (channel.length < 2 || channel.length > end - r.pos) {
+                error = "truncated channel data";
+                return false;
+            }
+            channel.compression = r.u16();
+            channel.offset = r.pos;
+            channel.length -= 2;
+            r.pos += channel.length;
+        }
+    }
+
+    // Groups are stored as an end marker (type 3) below their children and
+    // the folder record (type 1 or 2) above them, so walk top to bottom.
+    std::vector<bool> hiddenGroups;
+    for (int i = layerCount - 1; i >= 0; --i) {
+        PsdLayerInfo& layer = records[i];
+        bool parentHidden = !hiddenGroups.empty() && hiddenGroups.back();
+        uint32_t type = sectionTypes[i];
+        layer.group = type != 0;
+        layer.shown = layer.visible && !parentHidden;
+        if (type == 1 || type == 2) hiddenGroups.push_back(!layer.shown);
+        else if (type == 3 && !hiddenGroups.empty()) hiddenGroups.pop_back();
+    }
+    return true;
+}
+
+std::vector<size_t> PsdFile::shownLayers() const {
+    std::vector<size_t> out;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (records[i].shown && records[i].hasPixels()) out.push_back(i);
+    }
+    return out;
+}
+
+void PsdFile::decodeSlot(Slot& slot, const std::function<bool(cv::Mat&, std::string&)>& decode) {
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    if (slot.done) return;
+    if (!decode(slot.image, slot.error)) slot.image.release();
+    slot.done = true;
+}
+
+cv::Mat PsdFile::layerImage(size_t index, std::string* error) {
+    if (index >= records.size()) {
+        if (error) *error = "no such layer";
+        return cv::Mat();
+    }
+    Slot& slot = slots[index];
+    decodeSlot(slot, [this, index](cv::Mat& image, std::string& err) {
+        MW_TRACE_SCOPE("psd.decodeLayer");
+        const PsdLayerInfo& layer = records[index];
+        if (!layer.hasPixels()) return true;
+        const int w = layer.rect.width, h = layer.rect.height;
+        cv::Mat red, green, blue, alpha;
+        for (const PsdChannel& channel : layer.channels) {
+            // The user mask (-2) has its own rect; it is not part of the pixels.
+            if (channel.id < -1 || channel.id > 2) continue;
+            std::vector<cv::Mat> plane;
+            if (!decodePlanes(data + channel.offset, channel.length, channel.compression, w, h, 1, 1, large(),
+                              plane, err)) {
+                return false;
+            }
+            if (channel.id == 0) red = plane[0];
+            else if (channel.id == 1) green = plane[0];
+            else if (channel.id == 2) blue = plane[0];
+            else alpha = plane[0];
+        }
+        image = docColorMode == 1 ? toBgra(red, red, red, alpha, w, h) : toBgra(red, green, blue, alpha, w, h);
+        return true;
+    });
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    if (error) *error = slot.error;
+    return slot.image;
+}
+
+bool PsdFile::decoded(size_t index) const {
+    if (index >= records.size()) return false;
+    std::lock_guard<std::mutex> lock(slots[index].mutex);
+    return slots[index].done;
+}
+
+void PsdFile::decodeLayers(const std::vector<size_t>& indices) {
+    cv::parallel_for_(cv::Range(0, (int)indices.size()), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) layerImage(indices[i]);
+    }, (double)indices.size());
+}
+
+cv::Mat PsdFile::composite(std::string* error) {
+    decodeSlot(compositeSlot, [this](cv::Mat& image, std::string& err) {
+        MW_TRACE_SCOPE("psd.decodeComposite");
+        Reader r(data, length);
+        r.pos = compositeOffset;
+        int compression = r.u16();
+        if (!r.ok) {
+            err = "missing merged image";
+            return false;
+        }
+        // Color planes then alpha; further alpha channels are skipped.
+        int wanted = std::min(docChannels, docColorMode == 1 ? 2 : 4);
+        std::vector<cv::Mat> planes;
+        if (!decodePlanes(data + r.pos, length - r.pos, compression, docWidth, docHeight, docChannels, wanted,
+                          large(), planes, err)) {
+            return false;
+        }
+        cv::Mat none;
+        if (docColorMode == 1) {
+            image = toBgra(planes[0], planes[0], planes[0], wanted > 1 ? planes[1] : none, docWidth, docHeight);
+        }
+        else {
+            image = toBgra(planes[0], wanted > 1 ? planes[1] : none, wanted > 2 ? planes[2] : none,
+                           wanted > 3 ? planes[3] : none, docWidth, docHeight);
+        }
+        return true;
+    });
+    std::lock_guard<std::mutex> lock(compositeSlot.mutex);
+    if (error) *error = compositeSlot.error;
+    return compositeSlot.image;
+}
+
+bool readPsd(const std::shared_ptr<PsdFile>& file, PsdDocument& doc, std::string& error) {
+    doc = PsdDocument();
+    doc.width = file->width();
+    doc.height = file->height();
+    doc.channels = file->channels();
+    doc.depth = file->depth();
+    doc.colorMode = file->colorMode();
+    doc.file = file;
+
+    std::vector<size_t> shown = file->shownLayers();
+    file->decodeLayers(shown);
+    for (size_t i = 0; i < file->layers().size(); ++i) {
+        const PsdLayerInfo& info = file->layers()[i];
+        PsdLayer layer;
+        layer.name = info.name;
+        layer.rect = info.rect;
+        layer.opacity = info.opacity;
+        layer.visible = info.shown;
+        layer.blendMode = info.blendMode;
+        if (file->decoded(i)) layer.image = file->layerImage(i);
+        doc.layers.push_back(layer);
+    }
+    doc.composite = file->composite(&error);
+    return !doc.composite.empty();
+}
+
+bool isPsd(const uint8_t* data, size_t size) {
+    return size >= 4 && std::memcmp(data, "8BPS", 4) == 0;
+}
+
+bool psdUnpackBits(const uint8_t* src, size_t srcLen, uint8_t* dst, size_t dstLen) {
+    return unpackBitsRow(src, srcLen, srcLen, dst, dstLen);
+}
@@ -0,0 +1,139 @@
+#ifndef PSDREADER_H
+#define PSDREADER_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Where one channel's pixels live in the file. Nothing is decoded until the
+// layer is asked for.
+struct PsdChannel {
+    int16_t id = 0;        // 0..2 color, -1 transparency, -2 user mask
+    int compression = 0;   // 0 raw, 1 PackBits
+    uint64_t offset = 0;   // first byte after the compression field
+    uint64_t length = 0;
+};
+
+// Layer record as indexed from the file.
+struct PsdLayerInfo {
+    std::string name;      // UTF-8, from the Unicode name when present
+    cv::Rect rect;         // position in document pixels
+    uint8_t opacity = 255;
+    bool visible = true;   // the layer's own eye toggle
+    bool shown = true;     // visible and every enclosing group visible
+    bool group = false;    // group folder or group end marker, never has pixels
+    std::string blendMode; // four-character key, e.g. "norm"
+    std::vector<PsdChannel> channels;
+
+    bool hasPixels() const { return !group && rect.width > 0 && rect.height > 0; }
+};
+
+// A PSD or PSB opened for random access.
+//
+// open() memory-maps the file and openMemory() wraps a buffer; either way
+// only the header and layer records are parsed, which takes milliseconds
+// regardless of file size. Layer pixels are decoded on the first
+// layerImage() call and cached, so a document with hundreds of layers only
+// pays for the ones that are looked at. All accessors are thread-safe.
+class PsdFile {
+public:
+    PsdFile() = default;
+    ~PsdFile();
+    PsdFile(const PsdFile&) = delete;
+    PsdFile& operator=(const PsdFile&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    // data must stay valid while owner is held; owner may be null when the
+    // caller guarantees that itself.
+    bool openMemory(const uint8_t* data, size_t size, std::shared_ptr<const void> owner, std::string& error);
+
+    int width() const { return docWidth; }
+    int height() const { return docHeight; }
+    int channels() const { return docChannels; }
+    int depth() const { return docDepth; }
+    int colorMode() const { return docColorMode; }
+    bool large() const { return version == 2; }
+    size_t size() const { return length; }
+
+    // Bottom to top, as stored in the file.
+    const std::vector<PsdLayerInfo>& layers() const { return records; }
+    std::vector<size_t> shownLayers() const;
+
+    // BGRA pixels covering the layer rect; empty for layers without pixels
+    // or when the channel data is corrupt (error says why).
+    cv::Mat layerImage(size_t index, std::string* error = nullptr);
+    bool decoded(size_t index) const;
+    // Decode several layers at once, one per thread.
+    void decodeLayers(const std::vector<size_t>& indices);
+
+    // The merged image stored after the layers, BGRA.
+    cv::Mat composite(std::string* error = nullptr);
+
+private:
+    struct Slot {
+        mutable std::mutex mutex;
+        bool done = false;
+        cv::Mat image;
+        std::string error;
+    };
+
+    bool index(std::string& error);
+    bool indexLayers(uint64_t pos, uint64_t end, std::string& error);
+    void decodeSlot(Slot& slot, const std::function<bool(cv::Mat&, std::string&)>& decode);
+
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    std::shared_ptr<const void> owner;
+    bool mapped = false; // data is an open() mapping to unmap
+
+    int version = 1;
+    int docWidth = 0;
+    int docHeight = 0;
+    int docChannels = 0;
+    int docDepth = 0;
+    int docColorMode = 0;
+    uint64_t compositeOffset = 0;
+    std::vector<PsdLayerInfo> records;
+    std::unique_ptr<Slot[]> slots;
+    Slot compositeSlot;
+};
+
+// One layer of a decoded document. image is BGRA covering rect; it is empty
+// for layers without pixels and for hidden layers, which stay in the file
+// until asked for.
+struct PsdLayer {
+    std::string name;
+    cv::Rect rect;
+    uint8_t opacity = 255;
+    bool visible = true;
+    std::string blendMode;
+    cv::Mat image;
+};
+
+struct PsdDocument {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int depth = 0;
+    int colorMode = 0;
+    std::vector<PsdLayer> layers; // bottom to top, as stored in the file
+    cv::Mat composite;            // merged image, BGRA
+    std::shared_ptr<PsdFile> file; // source of layers not decoded yet; null for non-PSD images
+};
+
+// Decode the composite and every shown layer of file (in parallel) into doc.
+bool readPsd(const std::shared_ptr<PsdFile>& file, PsdDocument& doc, std::string& error);
+
+bool isPsd(const uint8_t* data, size_t size);
+
+// PackBits-decode one row. Exposed for benchmarks.
+bool psdUnpackBits(const uint8_t* src, size_t srcLen, uint8_t* dst, size_t dstLen);
+
+#endif // PSDREADER_H
@@ -0,0 +1,186 @@
+// Scene update benchmark: the same random skeleton scenes as a shared_ptr
+// tree of virtual objects (the old GameObject layout) and as a SceneStore.
+// Times world matrices for every node, first the old way (each node walks
+// its parent chain to the root) and then with the store's cached hierarchy,
+// for a full pose and for a pose touching 1% of the bones.
+//
+// sceneBench [entities ...]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "sceneStore.h"
+
+using namespace std;
+
+// The previous layout: every node and its transform separately allocated,
+// children reached through shared_ptr, matrices from virtual calls.
+struct LegacyTransform {
+    cv::Point2f position;
+    float rotation = 0;
+    cv::Point2f scale = cv::Point2f(1, 1);
+};
+
+cv::Matx23f compose(const cv::Matx23f& p, const cv::Matx23f& l) {
+    return cv::Matx23f(p(0, 0) * l(0, 0) + p(0, 1) * l(1, 0), p(0, 0) * l(0, 1) + p(0, 1) * l(1, 1),
+                       p(0, 0) * l(0, 2) + p(0, 1) * l(1, 2) + p(0, 2),
+                       p(1, 0) * l(0, 0) + p(1, 1) * l(1, 0), p(1, 0) * l(0, 1) + p(1, 1) * l(1, 1),
+                       p(1, 0) * l(0, 2) + p(1, 1) * l(1, 2) + p(1, 2));
+}
+
+struct LegacyNode {
+    shared_ptr<LegacyTransform> transform = make_shared<LegacyTransform>();
+    weak_ptr<LegacyNode> parent;
+    vector<shared_ptr<LegacyNode>> children;
+
+    virtual ~LegacyNode() = default;
+    virtual cv::Matx23f LocalMatrix() const {
+        const LegacyTransform& t = *transform;
+        float radians = t.rotation * (float)(CV_PI / 180.0);
+        float c = cos(radians), s = sin(radians);
+        return cv::Matx23f(c * t.scale.x, -s * t.scale.y, t.position.x, s * t.scale.x, c * t.scale.y, t.position.y);
+    }
+    // Nothing is cached: collect the chain up to the root, compose downwards.
+    cv::Matx23f WorldMatrix() const {
+        vector<const LegacyNode*> chain{ this };
+        for (auto up = parent.lock(); up; up = up->parent.lock()) chain.push_back(up.get());
+        cv::Matx23f world = chain.back()->LocalMatrix();
+        for (size_t i = chain.size() - 1; i-- > 0;) world = compose(world, chain[i]->LocalMatrix());
+        return world;
+    }
+};
+
+struct LegacyBone : LegacyNode {
+    cv::Point head, tail;
+};
+
+struct LegacySprite : LegacyNode {
+    cv::Mat sprite;
+};
+
+// Characters of 100 entities: a root, 60 bones mostly chained onto the
+// previous one (deep limbs) and 39 sprites hanging off random bones. Both
+// layouts get the same shape and transforms.
+struct Shape {
+    int parent;  // index into the shape, -1 for a root
+    bool bone;
+    cv::Point2f position;
+    float rotation;
+};
+
+vector<Shape> makeShape(int count, unsigned seed) {
+    mt19937 rng(seed);
+    uniform_real_distribution<float> offset(-50, 50), angle(-180, 180);
+    vector<Shape> shape;
+    vector<int> bones;
+    for (int i = 0; i < count; ++i) {
+        bool root = i % 100 == 0;
+        if (root) bones.clear();
+        bool bone = root || i % 100 < 60;
+        bool chain = bone && rng() % 10 < 8;
+        int parent = root ? -1 : chain ? bones.back() : bones[uniform_int_distribution<int>(0, (int)bones.size() - 1)(rng)];
+        if (bone) bones.push_back(i);
+        shape.push_back({ parent, bone, cv::Point2f(offset(rng), offset(rng)), angle(rng) });
+    }
+    return shape;
+}
+
+int maxDepth(const vector<Shape>& shape) {
+    vector<int> depth(shape.size());
+    int deepest = 0;
+    for (size_t i = 0; i < shape.size(); ++i) {
+        depth[i] = shape[i].parent < 0 ? 1 : depth[shape[i].parent] + 1;
+        deepest = max(deepest, depth[i]);
+    }
+    return deepest;
+}
+
+template <typename F>
+double bestMs(int iterations, F f) {
+    double best = 1e30;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = chrono::steady_clock::now();
+        f();
+        best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    vector<int> counts;
+    for (int i = 1; i < argc; ++i) counts.push_back(atoi(argv[i]));
+    if (counts.empty()) counts = { 1000, 10000, 100000 };
+
+    for (int count : counts) {
+        vector<Shape> shape = makeShape(count, 42);
+
+        vector<shared_ptr<LegacyNode>> legacy(count), legacyRoots;
+        for (int i = 0; i < count; ++i) {
+            legacy[i] = shape[i].bone ? shared_ptr<LegacyNode>(make_shared<LegacyBone>())
+                                      : shared_ptr<LegacyNode>(make_shared<LegacySprite>());
+            legacy[i]->transform->position = shape[i].position;
+            legacy[i]->transform->rotation = shape[i].rotation;
+            if (shape[i].parent < 0) {
+                legacyRoots.push_back(legacy[i]);
+                continue;
+            }
+            legacy[i]->parent = legacy[shape[i].parent];
+            legacy[shape[i].parent]->children.push_back(legacy[i]);
+        }
+
+        SceneStore store;
+        vector<Entity> entities(count);
+        for (int i = 0; i < count; ++i) {
+            entities[i] = store.create("node_" + to_string(i));
+            Transform& transform = store.transforms.get(entities[i].index);
+            transform.position = shape[i].position;
+            transform.rotation = shape[i].rotation;
+            if (shape[i].bone) store.bones.add(entities[i].index);
+            else store.sprites.add(entities[i].index);
+            if (shape[i].parent >= 0) store.setParent(entities[i], entities[shape[i].parent]);
+        }
+
+        store.update();
+
+        int iterations = max(3, 200000 / count);
+        vector<cv::Matx23f> legacyWorlds(count);
+        double walkMs = bestMs(iterations, [&] {
+            for (int i = 0; i < count; ++i) legacyWorlds[i] = legacy[i]->WorldMatrix();
+        });
+
+        // Pose every transform, or 1% of the bones, then read all worlds back.
+        vector<cv::Matx23f> storeWorlds(count);
+        auto readWorlds = [&] {
+            for (int i = 0; i < count; ++i) storeWorlds[i] = store.world(entities[i]);
+        };
+        double fullMs = bestMs(iterations, [&] {
+            for (int i = 0; i < count; ++i) store.setRotation(entities[i], shape[i].rotation);
+            store.update();
+            readWorlds();
+        });
+        vector<int> posed;
+        for (int i = 0; i < count; ++i) {
+            if (shape[i].bone && i % 100 == 37) posed.push_back(i);
+        }
+        double partialMs = bestMs(iterations, [&] {
+            for (int i : posed) store.setRotation(entities[i], shape[i].rotation);
+            store.update();
+            readWorlds();
+        });
+
+        float maxError = 0;
+        for (int i = 0; i < count; ++i) {
+            for (int k = 0; k < 6; ++k) maxError = max(maxError, fabs(legacyWorlds[i].val[k] - storeWorlds[i].val[k]));
+        }
+        printf("%6d entities (depth %d): walk to root %8.3f ms, SceneStore full %7.3f ms (%5.1fx), 1%% posed %7.3f ms "
+               "(%5.1fx), max error %g\n",
+               count, maxDepth(shape), walkMs, fullMs, walkMs / max(fullMs, 1e-6), partialMs,
+               walkMs / max(partialMs, 1e-6), maxError);
+    }
+    return 0;
+}
@@ -0,0 +1,455 @@
+#include "sceneSnapshot.h"
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include "trace.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char kMagic[8] = { 'M', 'W', 'S', 'C', 'E', 'N', 'E', 0 };
+const uint32_t kByteOrder = 0x01020304;
+const size_t kAlignment = 64;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+    uint64_t fileSize;
+    uint32_t byteOrder;
+    uint8_t reserved[36];
+};
+
+struct SectionEntry {
+    uint32_t type;
+    uint32_t recordSize;
+    uint64_t offset;
+    uint64_t count;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(FileHeader) == 64, "snapshot header layout");
+static_assert(sizeof(SectionEntry) == 32, "snapshot section table layout");
+static_assert(sizeof(SnapshotEntity) == 48, "snapshot entity layout");
+static_assert(sizeof(SnapshotBone) == 56, "snapshot bone layout");
+static_assert(sizeof(SnapshotMesh) == 48, "snapshot mesh layout");
+static_assert(sizeof(cv::Point2f) == 8 && sizeof(cv::Vec3i) == 12, "snapshot geometry layout");
+
+// Record size of each section type, in SceneSnapshot::SectionType order.
+const uint32_t kRecordSizes[] = {
+    sizeof(SnapshotEntity), 1, sizeof(SnapshotBone), sizeof(SnapshotMesh), sizeof(cv::Point2f),
+    sizeof(cv::Vec3i), sizeof(uint32_t), sizeof(SnapshotWeight), sizeof(SnapshotClip), 1,
+};
+const uint32_t kSectionCount = sizeof(kRecordSizes) / sizeof(kRecordSizes[0]);
+
+size_t alignUp(size_t n) {
+    return (n + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Section contents while writing, in section type order.
+struct Sections {
+    std::vector<SnapshotEntity> entities;
+    std::string names;
+    std::vector<SnapshotBone> bones;
+    std::vector<SnapshotMesh> meshes;
+    std::vector<cv::Point2f> vertices;
+    std::vector<cv::Vec3i> triangles;
+    std::vector<uint32_t> weightStarts;
+    std::vector<SnapshotWeight> weights;
+    std::vector<SnapshotClip> clips;
+    std::vector<uint8_t> clipData;
+
+    uint32_t addName(const std::string& name, uint32_t& length) {
+        uint32_t offset = (uint32_t)names.size();
+        names += name;
+        length = (uint32_t)name.size();
+        return offset;
+    }
+};
+
+template <typename T>
+std::pair<const void*, size_t> bytesOf(const std::vector<T>& v) {
+    return { v.data(), v.size() * sizeof(T) };
+}
+
+} // namespace
+
+std::vector<uint8_t> encodeSceneSnapshot(const SceneStore& store, const std::vector<Entity>& roots,
+                                         const std::vector<nlohmann::json>& clips) {
+    MW_TRACE_SCOPE("snapshot.encode");
+    Sections s;
+    std::unordered_map<uint32_t, uint32_t> snapshotIndex; // store entity index -> snapshot index
+
+    // Depth-first, so parents come before their children.
+    std::vector<Entity> open;
+    std::vector<Entity> tops = roots.empty() ? store.roots() : roots;
+    for (auto it = tops.rbegin(); it != tops.rend(); ++it) open.push_back(*it);
+    std::vector<Entity> order;
+    while (!open.empty()) {
+        Entity entity = open.back();
+        open.pop_back();
+        if (!store.alive(entity) || snapshotIndex.count(entity.index)) continue;
+        snapshotIndex[entity.index] = (uint32_t)order.size();
+        order.push_back(entity);
+        std::vector<Entity> children;
+        for (Entity child = store.firstChild(entity); child.valid(); child = store.nextSibling(child)) {
+            children.push_back(child);
+        }
+        for (auto it = children.rbegin(); it != children.rend(); ++it) open.push_back(*it);
+    }
+
+    for (Entity entity : order) {
+        SnapshotEntity e = {};
+        Entity parent = store.parent(entity);
+        auto up = parent.valid() ? snapshotIndex.find(parent.index) : snapshotIndex.end();
+        e.parent = up != snapshotIndex.end() ? up->second : Entity::kNone;
+        e.nameOffset = s.addName(store.name(entity), e.nameLength);
+        const Transform& transform = store.transforms.get(entity.index);
+        e.position[0] = transform.position.x;
+        e.position[1] = transform.position.y;
+        e.rotation = transform.rotation;
+        e.scale[0] = transform.scale.x;
+        e.scale[1] = transform.scale.y;
+        e.bone = e.mesh = Entity::kNone;
+
+        if (const BoneData* bone = store.bones.find(entity.index)) {
+            SnapshotBone b = {};
+            b.head[0] = bone->head.x;
+            b.head[1] = bone->head.y;
+            b.tail[0] = bone->tail.x;
+            b.tail[1] = bone->tail.y;
+            b.thickness = bone->thickness;
+            for (int k = 0; k < 4; ++k) b.color[k] = bone->color[k];
+            e.flags |= SnapshotEntity::kBone;
+            e.bone = (uint32_t)s.bones.size();
+            s.bones.push_back(b);
+        }
+        if (store.sprites.has(entity.index)) e.flags |= SnapshotEntity::kSprite;
+        if (const Mesh* mesh = store.meshes.find(entity.index)) {
+            SnapshotMesh m = {};
+            m.vertexStart = s.vertices.size();
+            m.vertexCount = (uint32_t)mesh->vertices.size();
+            s.vertices.insert(s.vertices.end(), mesh->vertices.begin(), mesh->vertices.end());
+            m.triangleStart = s.triangles.size();
+            for (const auto& triangle : mesh->triangles) {
+                if (triangle.size() < 3) continue;
+                s.triangles.emplace_back(triangle[0], triangle[1], triangle[2]);
+            }
+            m.triangleCount = (uint32_t)(s.triangles.size() - m.triangleStart);
+            if (mesh->skinned()) {
+                // Starts rebased to the mesh's first weight, bones to snapshot indices.
+                m.skinned = 1;
+                m.weightStartStart = s.weightStarts.size();
+                m.weightStart = s.weights.size();
+                uint32_t base = mesh->weightStarts.front();
+                for (uint32_t start : mesh->weightStarts) s.weightStarts.push_back(start - base);
+                for (size_t w = base; w < mesh->weightStarts.back(); ++w) {
+                    auto bone = snapshotIndex.find(mesh->weights[w].bone);
+                    s.weights.push_back({ bone != snapshotIndex.end() ? bone->second : Entity::kNone,
+                                          mesh->weights[w].weight });
+                }
+                m.weightCount = (uint32_t)(s.weights.size() - m.weightStart);
+            }
+            e.flags |= SnapshotEntity::kMesh;
+            e.mesh = (uint32_t)s.meshes.size();
+            s.meshes.push_back(m);
+        }
+        s.entities.push_back(e);
+    }
+
+    for (const auto& clip : clips) {
+        SnapshotClip c = {};
+        std::string name = clip.is_object() ? clip.value("name", std::string()) : std::string();
+        c.nameOffset = s.addName(name, c.nameLength);
+        std::vector<uint8_t> packed = nlohmann::json::to_msgpack(clip);
+        c.dataOffset = s.clipData.size();
+        c.dataSize = packed.size();
+        s.clipData.insert(s.clipData.end(), packed.begin(), packed.end());
+        s.clips.push_back(c);
+    }
+
+    std::pair<const void*, size_t> contents[kSectionCount] = {
+        bytesOf(s.entities), { s.names.data(), s.names.size() }, bytesOf(s.bones), bytesOf(s.meshes),
+        bytesOf(s.vertices), bytesOf(s.triangles), bytesOf(s.weightStarts), bytesOf(s.weights),
+        bytesOf(s.clips), bytesOf(s.clipData),
+    };
+    size_t offset = alignUp(sizeof(FileHeader) + kSectionCount * sizeof(SectionEntry));
+    SectionEntry table[kSectionCount] = {};
+    for (uint32_t type = 0; type < kSectionCount; ++type) {
+        table[type].type = type;
+        table[type].recordSize = kRecordSizes[type];
+        table[type].offset = offset;
+        table[type].count = contents[type].second / kRecordSizes[type];
+        offset = alignUp(offset + contents[type].second);
+    }
+
+    std::vector<uint8_t> bytes(offset);
+    FileHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = SceneSnapshot::kVersion;
+    header.sectionCount = kSectionCount;
+    header.fileSize = bytes.size();
+    header.byteOrder = kByteOrder;
+    memcpy(bytes.data(), &header, sizeof(header));
+    memcpy(bytes.data() + sizeof(header), table, sizeof(table));
+    for (uint32_t type = 0; type < kSectionCount; ++type) {
+        if (contents[type].second) memcpy(bytes.data() + table[type].offset, contents[type].first, contents[type].second);
+    }
+    return bytes;
+}
+
+bool saveSceneSnapshot(const std::string& path, const std::vector<uint8_t>& bytes, std::string& error) {
+    MW_TRACE_SCOPE("snapshot.save");
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (out) out.write((const char*)bytes.data(), (std::streamsize)bytes.size());
+    if (!out) {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+// SceneSnapshot implementation
+SceneSnapshot::~SceneSnapshot() {
+    if (!mapped) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(const_cast<uint8_t*>(data), length);
+#endif
+}
+
+bool SceneSnapshot::open(const std::string& path, std::string& error) {
+    MW_TRACE_SCOPE("snapshot.open");
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = "cannot open " + path;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    HANDLE map = fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    const void* view = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    // The view keeps the mapping alive on its own.
+    if (map) CloseHandle(map);
+    CloseHandle(file);
+    if (!view) {
+        error = "cannot map " + path;
+        return false;
+    }
+    data = (const uint8_t*)view;
+    length = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    void* view = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        error = "cannot map " + path;
+        return false;
+    }
+    data = (const uint8_t*)view;
+    length = (size_t)st.st_size;
+#endif
+    mapped = true;
+    return index(error);
+}
+
+bool SceneSnapshot::openMemory(const uint8_t* bytes, size_t size, std::shared_ptr<const void> keepAlive,
+                               std::string& error) {
+    data = bytes;
+    length = size;
+    owner = std::move(keepAlive);
+    return index(error);
+}
+
+// Header and section table only; records are checked where they are used.
+bool SceneSnapshot::index(std::string& error) {
+    if ((uintptr_t)data % 8 != 0) {
+        error = "snapshot data is not 8-byte aligned";
+        return false;
+    }
+    FileHeader header;
+    if (length < sizeof(header)) {
+        error = "not a scene snapshot";
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        error = "not a scene snapshot";
+        return false;
+    }
+    if (header.byteOrder != kByteOrder) {
+        error = "scene snapshot written with a different byte order";
+        return false;
+    }
+    if (header.version != kVersion) {
+        error = "unsupported scene snapshot version " + std::to_string(header.version);
+        return false;
+    }
+    if (header.fileSize != length || (uint64_t)header.sectionCount * sizeof(SectionEntry) > length - sizeof(header)) {
+        error = "truncated scene snapshot";
+        return false;
+    }
+    fileVersion = header.version;
+
+    bool seen[kSectionTypes] = {};
+    const SectionEntry* table = reinterpret_cast<const SectionEntry*>(data + sizeof(header));
+    for (uint32_t i = 0; i < header.sectionCount; ++i) {
+        const SectionEntry& entry = table[i];
+        if (entry.type >= kSectionTypes) continue; // from a newer writer, not needed here
+        if (seen[entry.type] || entry.recordSize != kRecordSizes[entry.type] || entry.offset % 8 != 0 ||
+            entry.offset > length || entry.count > (length - entry.offset) / entry.recordSize) {
+            error = "bad scene snapshot section " + std::to_string(entry.type);
+            return false;
+        }
+        seen[entry.type] = true;
+        sections[entry.type].offset = entry.offset;
+        sections[entry.type].count = entry.count;
+    }
+    clipSlots.reset(new ClipSlot[clipCount()]);
+    return true;
+}
+
+std::string SceneSnapshot::name(size_t entity) const {
+    if (entity >= entityCount()) return std::string();
+    const SnapshotEntity& e = entities()[entity];
+    if ((uint64_t)e.nameOffset + e.nameLength > section(kNames).count) return std::string();
+    return std::string((const char*)data + section(kNames).offset + e.nameOffset, e.nameLength);
+}
+
+std::string SceneSnapshot::clipName(size_t clip) const {
+    if (clip >= clipCount()) return std::string();
+    const SnapshotClip& c = view<SnapshotClip>(kClips)[clip];
+    if ((uint64_t)c.nameOffset + c.nameLength > section(kNames).count) return std::string();
+    return std::string((const char*)data + section(kNames).offset + c.nameOffset, c.nameLength);
+}
+
+const nlohmann::json* SceneSnapshot::clip(size_t clip, std::string* error) {
+    if (clip >= clipCount()) {
+        if (error) *error = "no clip " + std::to_string(clip);
+        return nullptr;
+    }
+    ClipSlot& slot = clipSlots[clip];
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    if (!slot.done) {
+        MW_TRACE_SCOPE("snapshot.clip");
+        const SnapshotClip& c = view<SnapshotClip>(kClips)[clip];
+        if (c.dataOffset > section(kClipData).count || c.dataSize > section(kClipData).count - c.dataOffset) {
+            slot.error = "clip " + std::to_string(clip) + " is outside the clip data";
+        }
+        else {
+            try {
+                const uint8_t* packed = data + section(kClipData).offset + c.dataOffset;
+                slot.value.reset(new nlohmann::json(nlohmann::json::from_msgpack(packed, packed + c.dataSize)));
+            }
+            catch (const nlohmann::json::exception& e) {
+                slot.error = e.what();
+            }
+        }
+        slot.done = true;
+    }
+    if (!slot.value && error) *error = slot.error;
+    return slot.value.get();
+}
+
+std::vector<Entity> SceneSnapshot::instantiate(SceneStore& store, std::string& error) const {
+    MW_TRACE_SCOPE("snapshot.instantiate");
+    size_t count = entityCount();
+    const SnapshotEntity* records = entities();
+    std::vector<Entity> created;
+    created.reserve(count);
+    auto fail = [&](const std::string& message) {
+        error = message;
+        for (auto it = created.rbegin(); it != created.rend(); ++it) store.destroy(*it);
+        created.clear();
+        return created;
+    };
+
+    for (size_t i = 0; i < count; ++i) {
+        const SnapshotEntity& e = records[i];
+        if (e.parent != Entity::kNone && e.parent >= i) return fail("entity " + std::to_string(i) + " has a bad parent");
+        Entity entity = store.create(name(i));
+        created.push_back(entity);
+        Transform& transform = store.transforms.get(entity.index);
+        transform.position = cv::Point2f(e.position[0], e.position[1]);
+        transform.rotation = e.rotation;
+        transform.scale = cv::Point2f(e.scale[0], e.scale[1]);
+        if (e.parent != Entity::kNone) store.setParent(entity, created[e.parent]);
+
+        if (e.flags & SnapshotEntity::kBone) {
+            if (e.bone >= boneCount()) return fail("entity " + std::to_string(i) + " has a bad bone");
+            const SnapshotBone& b = bones()[e.bone];
+            store.bones.add(entity.index, BoneData{ cv::Point(b.head[0], b.head[1]), cv::Point(b.tail[0], b.tail[1]),
+                                                    b.thickness, cv::Scalar(b.color[0], b.color[1], b.color[2], b.color[3]) });
+        }
+        if (e.flags & SnapshotEntity::kSprite) store.sprites.add(entity.index);
+    }
+
+    // Meshes last, once every bone a weight may name has been created.
+    for (size_t i = 0; i < count; ++i) {
+        const SnapshotEntity& e = records[i];
+        if (!(e.flags & SnapshotEntity::kMesh)) continue;
+        const SnapshotMesh* m = e.mesh < meshCount() ? &meshes()[e.mesh] : nullptr;
+        bool inside = m && m->vertexStart <= section(kVertices).count &&
+                      m->vertexCount <= section(kVertices).count - m->vertexStart &&
+                      m->triangleStart <= section(kTriangles).count &&
+                      m->triangleCount <= section(kTriangles).count - m->triangleStart;
+        if (inside && m->isSkinned()) {
+            inside = m->weightStartStart <= section(kWeightStarts).count &&
+                     (uint64_t)m->vertexCount + 1 <= section(kWeightStarts).count - m->weightStartStart &&
+                     m->weightStart <= section(kWeights).count &&
+                     m->weightCount <= section(kWeights).count - m->weightStart;
+        }
+        if (!inside) return fail("entity " + std::to_string(i) + " has a bad mesh");
+
+        Mesh& mesh = store.meshes.add(created[i].index);
+        const cv::Point2f* v = vertices() + m->vertexStart;
+        mesh.vertices.assign(v, v + m->vertexCount);
+        const cv::Vec3i* t = triangles() + m->triangleStart;
+        mesh.triangles.resize(m->triangleCount);
+        for (uint32_t k = 0; k < m->triangleCount; ++k) {
+            // Negative indices wrap to large ones and fail the same check.
+            if ((uint32_t)t[k][0] >= m->vertexCount || (uint32_t)t[k][1] >= m->vertexCount ||
+                (uint32_t)t[k][2] >= m->vertexCount) {
+                return fail("entity " + std::to_string(i) + " has a bad triangle");
+            }
+            mesh.triangles[k] = { t[k][0], t[k][1], t[k][2] };
+        }
+        if (!m->isSkinned()) continue;
+        const uint32_t* starts = weightStarts() + m->weightStartStart;
+        for (uint32_t k = 0; k < m->vertexCount; ++k) {
+            if (starts[k] > starts[k + 1] || starts[k + 1] > m->weightCount) {
+                return fail("entity " + std::to_string(i) + " has bad weights");
+            }
+        }
+        mesh.weightStarts.assign(starts, starts + m->vertexCount + 1);
+        const SnapshotWeight* w = weights() + m->weightStart;
+        mesh.weights.resize(m->weightCount);
+        for (uint32_t k = 0; k < m->weightCount; ++k) {
+            mesh.weights[k].bone = w[k].bone < count ? created[w[k].bone].index : Entity::kNone;
+            mesh.weights[k].weight = w[k].weight;
+        }
+    }
+    return created;
+}
@@ -0,0 +1,163 @@
+#ifndef SCENESNAPSHOT_H
+#define SCENESNAPSHOT_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include <opencv2/opencv.hpp>
+#include "sceneStore.h"
+
+// Binary scene snapshot (.mwscene).
+//
+// A 64-byte header, a section table and the sections, each starting on a
+// 64-byte boundary. Every section is a packed array of one of the records
+// below in the writer's byte order (little-endian wherever we build; a
+// reader of the other order rejects the file), so a mapped file is used in
+// place: entities, transforms, bones and mesh geometry are read straight
+// from the mapping, and nothing is copied until instantiate() builds a
+// SceneStore.
+// Animation clips are MessagePack and decoded one at a time on first use.
+//
+// Entities are stored depth-first (parents before children, siblings in
+// order), so parent indices always point backwards. Sprite pixels are not
+// part of the snapshot; they stay with the document the sprites come from.
+
+struct SnapshotEntity {
+    static constexpr uint32_t kBone = 1, kSprite = 2, kMesh = 4;
+
+    uint32_t parent;     // snapshot entity index, Entity::kNone for roots
+    uint32_t nameOffset; // into the names section
+    uint32_t nameLength;
+    uint32_t flags;      // kBone | kSprite | kMesh
+    uint32_t bone;       // index into bones(), Entity::kNone without
+    uint32_t mesh;       // index into meshes(), Entity::kNone without
+    float position[2];
+    float rotation;
+    float scale[2];
+    uint32_t reserved;
+};
+
+struct SnapshotBone {
+    int32_t head[2];
+    int32_t tail[2];
+    float thickness;
+    uint32_t reserved;
+    double color[4];
+};
+
+// Ranges into the vertex, triangle and weight sections. A skinned mesh has
+// vertexCount + 1 weight starts, relative to weightStart.
+struct SnapshotMesh {
+    uint64_t vertexStart;
+    uint64_t triangleStart;
+    uint64_t weightStartStart; // into weightStarts(), when skinned
+    uint64_t weightStart;      // into weights()
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    uint32_t weightCount;
+    uint32_t skinned;
+
+    bool isSkinned() const { return skinned != 0; }
+};
+
+struct SnapshotWeight {
+    uint32_t bone; // snapshot entity index
+    float weight;
+};
+
+struct SnapshotClip {
+    uint32_t nameOffset; // into the names section
+    uint32_t nameLength;
+    uint64_t dataOffset; // into the clip data section
+    uint64_t dataSize;
+};
+
+// Serialize roots and their descendants, plus clips (AnimationController
+// JSON, named by their "name" field). roots empty means every root of store.
+std::vector<uint8_t> encodeSceneSnapshot(const SceneStore& store, const std::vector<Entity>& roots,
+                                         const std::vector<nlohmann::json>& clips);
+bool saveSceneSnapshot(const std::string& path, const std::vector<uint8_t>& bytes, std::string& error);
+
+// A snapshot opened for reading, laid out like PsdFile: open() maps the
+// file and openMemory() wraps a buffer; only the header and section table
+// are checked up front. Views point into the snapshot data and live as
+// long as the object. All accessors are thread-safe.
+class SceneSnapshot {
+public:
+    static constexpr uint32_t kVersion = 1;
+
+    SceneSnapshot() = default;
+    ~SceneSnapshot();
+    SceneSnapshot(const SceneSnapshot&) = delete;
+    SceneSnapshot& operator=(const SceneSnapshot&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    // data must stay valid while owner is held; it must be 8-byte aligned.
+    bool openMemory(const uint8_t* data, size_t size, std::shared_ptr<const void> owner, std::string& error);
+
+    uint32_t version() const { return fileVersion; }
+    size_t size() const { return length; }
+
+    size_t entityCount() const { return section(kEntities).count; }
+    const SnapshotEntity* entities() const { return view<SnapshotEntity>(kEntities); }
+    std::string name(size_t entity) const;
+    size_t boneCount() const { return section(kBones).count; }
+    const SnapshotBone* bones() const { return view<SnapshotBone>(kBones); }
+    size_t meshCount() const { return section(kMeshes).count; }
+    const SnapshotMesh* meshes() const { return view<SnapshotMesh>(kMeshes); }
+    const cv::Point2f* vertices() const { return view<cv::Point2f>(kVertices); }
+    const cv::Vec3i* triangles() const { return view<cv::Vec3i>(kTriangles); }
+    const uint32_t* weightStarts() const { return view<uint32_t>(kWeightStarts); }
+    const SnapshotWeight* weights() const { return view<SnapshotWeight>(kWeights); }
+
+    size_t clipCount() const { return section(kClips).count; }
+    std::string clipName(size_t clip) const;
+    // Decoded on the first call for each clip and cached; null when the
+    // clip data is corrupt (error says why).
+    const nlohmann::json* clip(size_t clip, std::string* error = nullptr);
+
+    // Create the snapshot's entities in store with their transforms, bones,
+    // sprite flags and meshes. Returns them in snapshot order, or nothing
+    // when a record points outside its section.
+    std::vector<Entity> instantiate(SceneStore& store, std::string& error) const;
+
+private:
+    enum SectionType : uint32_t {
+        kEntities, kNames, kBones, kMeshes, kVertices, kTriangles, kWeightStarts, kWeights, kClips, kClipData,
+        kSectionTypes
+    };
+    struct Section {
+        uint64_t offset = 0;
+        uint64_t count = 0; // records
+    };
+    struct ClipSlot {
+        std::mutex mutex;
+        bool done = false;
+        std::unique_ptr<nlohmann::json> value;
+        std::string error;
+    };
+
+    bool index(std::string& error);
+    const Section& section(SectionType type) const { return sections[type]; }
+    template <typename T>
+    const T* view(SectionType type) const {
+        return sections[type].count ? reinterpret_cast<const T*>(data + sections[type].offset) : nullptr;
+    }
+
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    std::shared_ptr<const void> owner;
+    bool mapped = false; // data is an open() mapping to unmap
+
+    uint32_t fileVersion = 0;
+    Section sections[kSectionTypes];
+    std::unique_ptr<ClipSlot[]> clipSlots;
+};
+
+#endif // SCENESNAPSHOT_H
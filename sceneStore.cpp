@@ -0,0 +1,463 @@
+#include "sceneStore.h"
+#include <algorithm>
+#include <cmath>
+#include "logger.h"
+#include "trace.h"
+
+namespace {
+
+// parent * local for affine 2x3 matrices.
+inline cv::Matx23f compose(const cv::Matx23f& p, const cv::Matx23f& l) {
+    return cv::Matx23f(p(0, 0) * l(0, 0) + p(0, 1) * l(1, 0), p(0, 0) * l(0, 1) + p(0, 1) * l(1, 1),
+                       p(0, 0) * l(0, 2) + p(0, 1) * l(1, 2) + p(0, 2),
+                       p(1, 0) * l(0, 0) + p(1, 1) * l(1, 0), p(1, 0) * l(0, 1) + p(1, 1) * l(1, 1),
+                       p(1, 0) * l(0, 2) + p(1, 1) * l(1, 2) + p(1, 2));
+}
+
+} // namespace
+
+// Transform implementation
+Transform::Transform() : position(0, 0), rotation(0.0f), scale(1.0f, 1.0f) {}
+
+cv::Matx23f Transform::LocalMatrix() const {
+    float radians = rotation * (float)(CV_PI / 180.0);
+    float c = std::cos(radians), s = std::sin(radians);
+    return cv::Matx23f(c * scale.x, -s * scale.y, position.x,
+                       s * scale.x, c * scale.y, position.y);
+}
+
+// Mesh implementation
+Mesh::Mesh() {}
+
+void Mesh::LoadFromJson(const nlohmann::json& data) {
+    if (data.count("vertices")) {
+        for (const auto& vertex : data["vertices"]) {
+            vertices.emplace_back(vertex[0], vertex[1]);
+        }
+    }
+    if (data.count("triangles")) {
+        for (const auto& triangle : data["triangles"]) {
+            if (!triangle.is_array() || triangle.size() < 3) continue;
+            std::vector<int> indices = { triangle[0], triangle[1], triangle[2] };
+            // Drop triangles that point past the vertex list (negative too).
+            bool valid = true;
+            for (int index : indices) valid = valid && index >= 0 && (size_t)index < vertices.size();
+            if (!valid) {
+                MW_LOG_ERROR("mesh triangle [{}, {}, {}] is out of range, dropped", indices[0], indices[1], indices[2]);
+                continue;
+            }
+            triangles.push_back(indices);
+        }
+    }
+    // "weights": per vertex, a list of [bone entity index, weight] pairs
+    if (data.count("weights")) {
+        weightStarts.assign(1, (uint32_t)weights.size());
+        for (const auto& influences : data["weights"]) {
+            for (const auto& influence : influences) {
+                BoneWeight w;
+                w.bone = influence[0];
+                w.weight = influence[1];
+                weights.push_back(w);
+            }
+            weightStarts.push_back((uint32_t)weights.size());
+        }
+    }
+}
+
+// SceneStore implementation
+SceneStore& SceneStore::global() {
+    static SceneStore store;
+    return store;
+}
+
+Entity SceneStore::create(const std::string& name) {
+    uint32_t index;
+    if (!freeSlots.empty()) {
+        index = freeSlots.back();
+        freeSlots.pop_back();
+        links[index] = Links();
+        names[index] = name;
+    }
+    else {
+        index = (uint32_t)generations.size();
+        generations.push_back(0);
+        links.emplace_back();
+        names.push_back(name);
+        dirtyFlags.push_back(0);
+        versions.push_back(0);
+        subtreeVersions.push_back(0);
+    }
+    versions[index] = subtreeVersions[index] = ++revision;
+    ++generations[index];
+    ++live;
+    transforms.add(index);
+    orderStale = true;
+    return handle(index);
+}
+
+void SceneStore::destroy(Entity entity) {
+    if (!alive(entity)) return;
+    uint32_t index = entity.index;
+    if (links[index].parent != Entity::kNone) touch(links[index].parent);
+    detach(index);
+    for (uint32_t child = links[index].firstChild; child != Entity::kNone;) {
+        uint32_t next = links[child].next;
+        links[child].parent = links[child].prev = links[child].next = Entity::kNone;
+        child = next;
+    }
+    transforms.remove(index);
+    bones.remove(index);
+    sprites.remove(index);
+    meshes.remove(index);
+    setupPoses.remove(index);
+    names[index].clear();
+    hierarchyCaches.erase(index);
+    ++generations[index];
+    freeSlots.push_back(index);
+    --live;
+    orderStale = true;
+}
+
+bool SceneStore::alive(Entity entity) const {
+    return entity.index < generations.size() && generations[entity.index] == entity.generation &&
+           (entity.generation & 1) != 0;
+}
+
+const std::string& SceneStore::name(Entity entity) const {
+    static const std::string none;
+    return alive(entity) ? names[entity.index] : none;
+}
+
+void SceneStore::setName(Entity entity, const std::string& name) {
+    if (!alive(entity) || names[entity.index] == name) return;
+    names[entity.index] = name;
+    touch(entity.index);
+}
+
+bool SceneStore::setParent(Entity child, Entity parent) {
+    if (!alive(child) || (parent.valid() && !alive(parent))) return false;
+    for (uint32_t up = parent.index; up != Entity::kNone; up = links[up].parent) {
+        if (up == child.index) return false;
+    }
+    if (links[child.index].parent != Entity::kNone) touch(links[child.index].parent);
+    detach(child.index);
+    orderStale = true;
+    if (!parent.valid()) return true;
+    Links& p = links[parent.index];
+    Links& c = links[child.index];
+    c.parent = parent.index;
+    c.prev = p.lastChild;
+    if (p.lastChild != Entity::kNone) links[p.lastChild].next = child.index;
+    else p.firstChild = child.index;
+    p.lastChild = child.index;
+    touch(parent.index);
+    return true;
+}
+
+Entity SceneStore::parent(Entity entity) const {
+    return alive(entity) ? handle(links[entity.index].parent) : Entity();
+}
+
+Entity SceneStore::firstChild(Entity entity) const {
+    return alive(entity) ? handle(links[entity.index].firstChild) : Entity();
+}
+
+Entity SceneStore::nextSibling(Entity entity) const {
+    return alive(entity) ? handle(links[entity.index].next) : Entity();
+}
+
+std::vector<Entity> SceneStore::roots() const {
+    std::vector<Entity> result;
+    for (uint32_t index = 0; index < generations.size(); ++index) {
+        if ((generations[index] & 1) != 0 && links[index].parent == Entity::kNone) result.push_back(handle(index));
+    }
+    return result;
+}
+
+SceneStore::HierarchyCache* SceneStore::hierarchyCache(Entity root) {
+    if (!alive(root)) return nullptr;
+    HierarchyCache& cache = hierarchyCaches[root.index];
+    if (cache.generation != root.generation) cache = HierarchyCache();
+    cache.generation = root.generation;
+    if (!cache.tree || cache.version != subtreeVersions[root.index]) {
+        MW_TRACE_SCOPE("SceneStore::hierarchyJson");
+        auto tree = std::make_shared<nlohmann::json>();
+        appendJson(root.index, *tree);
+        cache.version = subtreeVersions[root.index];
+        cache.tree = tree;
+        cache.textValid = false;
+        cache.history.emplace_back(cache.version, cache.tree);
+        if (cache.history.size() > HierarchyCache::kHistory) cache.history.pop_front();
+    }
+    return &cache;
+}
+
+const nlohmann::json& SceneStore::hierarchyJson(Entity root) {
+    static const nlohmann::json none;
+    HierarchyCache* cache = hierarchyCache(root);
+    return cache ? *cache->tree : none;
+}
+
+const std::string& SceneStore::hierarchyText(Entity root) {
+    static const std::string none = "null";
+    HierarchyCache* cache = hierarchyCache(root);
+    if (!cache) return none;
+    if (!cache->textValid) {
+        cache->text = cache->tree->dump();
+        cache->textValid = true;
+    }
+    return cache->text;
+}
+
+uint64_t SceneStore::hierarchyVersion(Entity root) const {
+    return alive(root) ? subtreeVersions[root.index] : 0;
+}
+
+bool SceneStore::hierarchyPatch(Entity root, uint64_t since, nlohmann::json& patch) {
+    patch = nlohmann::json::array();
+    HierarchyCache* cache = hierarchyCache(root);
+    if (!cache) return false;
+    if (since == cache->version) return true;
+    for (const auto& served : cache->history) {
+        if (served.first != since) continue;
+        MW_TRACE_SCOPE("SceneStore::hierarchyPatch");
+        diffNode(*served.second, *cache->tree, since, "", patch);
+        return true;
+    }
+    return false;
+}
+
+void SceneStore::setPosition(Entity entity, const cv::Point2f& position) {
+    if (!alive(entity)) return;
+    transforms.get(entity.index).position = position;
+    markDirty(entity);
+}
+
+void SceneStore::setRotation(Entity entity, float degrees) {
+    if (!alive(entity)) return;
+    transforms.get(entity.index).rotation = degrees;
+    markDirty(entity);
+}
+
+void SceneStore::setScale(Entity entity, const cv::Point2f& scale) {
+    if (!alive(entity)) return;
+    transforms.get(entity.index).scale = scale;
+    markDirty(entity);
+}
+
+Transform SceneStore::setupPose(Entity entity) {
+    if (!alive(entity)) return Transform();
+    if (const Transform* setup = setupPoses.find(entity.index)) return *setup;
+    return setupPoses.add(entity.index, transforms.get(entity.index));
+}
+
+void SceneStore::restoreSetupPose(Entity entity) {
+    const Transform* setup = alive(entity) ? setupPoses.find(entity.index) : nullptr;
+    if (!setup) return;
+    transforms.get(entity.index) = *setup;
+    markDirty(entity);
+}
+
+void SceneStore::markDirty(Entity entity) {
+    if (!alive(entity) || dirtyFlags[entity.index]) return;
+    dirtyFlags[entity.index] = 1;
+    dirty.push_back(entity.index);
+}
+
+void SceneStore::update() {
+    MW_TRACE_SCOPE("SceneStore::update");
+    updateSubtrees(0, beginUpdate());
+}
+
+size_t SceneStore::beginUpdate() {
+    subtrees.clear();
+    if (orderStale) {
+        rebuildOrder();
+        allDirty = true;
+    }
+    if (allDirty) {
+        // Every root's subtree, locals included.
+        for (uint32_t p = 0; p < order.size(); p = subtreeEnd[p]) subtrees.push_back({ p, subtreeEnd[p], true });
+        for (uint32_t index : dirty) dirtyFlags[index] = 0;
+        dirty.clear();
+        allDirty = false;
+        return subtrees.size();
+    }
+    if (dirty.empty()) return 0;
+
+    // New locals for the changed transforms, then recompose each changed
+    // subtree once; subtrees nested in an earlier one are already covered.
+    std::vector<uint32_t> starts;
+    starts.reserve(dirty.size());
+    for (uint32_t index : dirty) {
+        uint32_t p = positions[index];
+        locals[p] = transforms.get(index).LocalMatrix();
+        starts.push_back(p);
+        dirtyFlags[index] = 0;
+    }
+    dirty.clear();
+    std::sort(starts.begin(), starts.end());
+    uint32_t covered = 0;
+    for (uint32_t start : starts) {
+        if (start < covered) continue;
+        subtrees.push_back({ start, subtreeEnd[start], false });
+        covered = subtreeEnd[start];
+    }
+    return subtrees.size();
+}
+
+// A subtree's parent is outside it and not inside any other listed
+// subtree, so disjoint ranges never read what another range writes.
+void SceneStore::updateSubtrees(size_t begin, size_t end) {
+    for (size_t s = begin; s < end; ++s) {
+        const Subtree& subtree = subtrees[s];
+        for (uint32_t p = subtree.begin; p < subtree.end; ++p) {
+            if (subtree.locals) locals[p] = transforms.get(order[p]).LocalMatrix();
+            worlds[p] = orderParent[p] == Entity::kNone ? locals[p] : compose(worlds[orderParent[p]], locals[p]);
+        }
+    }
+}
+
+cv::Matx23f SceneStore::local(Entity entity) {
+    if (!alive(entity)) return cv::Matx23f(1, 0, 0, 0, 1, 0);
+    update();
+    return locals[positions[entity.index]];
+}
+
+cv::Matx23f SceneStore::world(Entity entity) {
+    if (!alive(entity)) return cv::Matx23f(1, 0, 0, 0, 1, 0);
+    update();
+    return worlds[positions[entity.index]];
+}
+
+Entity SceneStore::handle(uint32_t index) const {
+    Entity entity;
+    if (index != Entity::kNone) {
+        entity.index = index;
+        entity.generation = generations[index];
+    }
+    return entity;
+}
+
+void SceneStore::detach(uint32_t index) {
+    Links& c = links[index];
+    if (c.parent == Entity::kNone) return;
+    Links& p = links[c.parent];
+    if (c.prev != Entity::kNone) links[c.prev].next = c.next;
+    else p.firstChild = c.next;
+    if (c.next != Entity::kNone) links[c.next].prev = c.prev;
+    else p.lastChild = c.prev;
+    c.parent = c.prev = c.next = Entity::kNone;
+}
+
+void SceneStore::appendJson(uint32_t index, nlohmann::json& out) const {
+    out["name"] = names[index];
+    out["id"] = handle(index).id();
+    // Recursively process child objects
+    if (links[index].firstChild == Entity::kNone) return;
+    nlohmann::json& children = out["children"] = nlohmann::json::array();
+    for (uint32_t child = links[index].firstChild; child != Entity::kNone; child = links[child].next) {
+        children.push_back(nlohmann::json::object());
+        appendJson(child, children.back());
+    }
+}
+
+void SceneStore::rebuildOrder() {
+    MW_TRACE_SCOPE("SceneStore::rebuildOrder");
+    order.clear();
+    orderParent.clear();
+    positions.assign(generations.size(), Entity::kNone);
+    // Depth-first from every root, in slot order.
+    std::vector<uint32_t> open;
+    for (uint32_t root = 0; root < generations.size(); ++root) {
+        if ((generations[root] & 1) == 0 || links[root].parent != Entity::kNone) continue;
+        open.push_back(root);
+        while (!open.empty()) {
+            uint32_t index = open.back();
+            open.pop_back();
+            positions[index] = (uint32_t)order.size();
+            order.push_back(index);
+            uint32_t parent = links[index].parent;
+            orderParent.push_back(parent == Entity::kNone ? Entity::kNone : positions[parent]);
+            // Push in reverse so children come out in their sibling order.
+            for (uint32_t child = links[index].lastChild; child != Entity::kNone; child = links[child].prev) {
+                open.push_back(child);
+            }
+        }
+    }
+    // Walking backwards, every descendant of p has already extended
+    // subtreeEnd[p] by the time p is reached.
+    subtreeEnd.assign(order.size(), 0);
+    for (uint32_t p = (uint32_t)order.size(); p-- > 0;) {
+        subtreeEnd[p] = std::max(subtreeEnd[p], p + 1);
+        uint32_t parent = orderParent[p];
+        if (parent != Entity::kNone) subtreeEnd[parent] = std::max(subtreeEnd[parent], subtreeEnd[p]);
+    }
+    locals.resize(order.size());
+    worlds.resize(order.size());
+    orderStale = false;
+}
+
+void SceneStore::touch(uint32_t index) {
+    versions[index] = ++revision;
+    for (uint32_t up = index; up != Entity::kNone; up = links[up].parent) subtreeVersions[up] = revision;
+}
+
+// Walks both trees together, skipping every subtree whose version says it
+// has not changed since. Children are matched by id: removals, then
+// insertions, then the survivors recursively; a reorder replaces the list.
+void SceneStore::diffNode(const nlohmann::json& before, const nlohmann::json& after, uint64_t since,
+                          const std::string& path, nlohmann::json& patch) const {
+    uint32_t index = (uint32_t)(after["id"].get<uint64_t>() & 0xFFFFFFFFu);
+    if (subtreeVersions[index] <= since) return;
+    if (before["name"] != after["name"]) {
+        patch.push_back({ {"op", "replace"}, {"path", path + "/name"}, {"value", after["name"]} });
+    }
+
+    static const nlohmann::json empty = nlohmann::json::array();
+    const nlohmann::json& oldChildren = before.contains("children") ? before["children"] : empty;
+    const nlohmann::json& newChildren = after.contains("children") ? after["children"] : empty;
+    if (versions[index] > since) {
+        if (oldChildren.empty() && newChildren.empty()) return;
+        if (newChildren.empty()) {
+            patch.push_back({ {"op", "remove"}, {"path", path + "/children"} });
+            return;
+        }
+        if (oldChildren.empty()) {
+            patch.push_back({ {"op", "add"}, {"path", path + "/children"}, {"value", newChildren} });
+            return;
+        }
+        std::unordered_map<uint64_t, size_t> newPositions;
+        for (size_t i = 0; i < newChildren.size(); ++i) newPositions[newChildren[i]["id"].get<uint64_t>()] = i;
+        std::vector<size_t> kept; // old positions that survive, in order
+        for (size_t i = 0; i < oldChildren.size(); ++i) {
+            if (newPositions.count(oldChildren[i]["id"].get<uint64_t>())) kept.push_back(i);
+        }
+        bool ordered = true;
+        for (size_t k = 1; k < kept.size() && ordered; ++k) {
+            ordered = newPositions[oldChildren[kept[k - 1]]["id"].get<uint64_t>()] <
+                      newPositions[oldChildren[kept[k]]["id"].get<uint64_t>()];
+        }
+        if (!ordered) {
+            patch.push_back({ {"op", "replace"}, {"path", path + "/children"}, {"value", newChildren} });
+            return;
+        }
+        for (size_t i = oldChildren.size(), k = kept.size(); i-- > 0;) {
+            if (k > 0 && kept[k - 1] == i) --k;
+            else patch.push_back({ {"op", "remove"}, {"path", path + "/children/" + std::to_string(i)} });
+        }
+        std::unordered_map<uint64_t, size_t> oldPositions;
+        for (size_t i : kept) oldPositions[oldChildren[i]["id"].get<uint64_t>()] = i;
+        for (size_t i = 0; i < newChildren.size(); ++i) {
+            auto old = oldPositions.find(newChildren[i]["id"].get<uint64_t>());
+            std::string childPath = path + "/children/" + std::to_string(i);
+            if (old == oldPositions.end()) patch.push_back({ {"op", "add"}, {"path", childPath}, {"value", newChildren[i]} });
+            else diffNode(oldChildren[old->second], newChildren[i], since, childPath, patch);
+        }
+        return;
+    }
+    // Same children as before; only something below them changed.
+    for (size_t i = 0; i < newChildren.size(); ++i) {
+        diffNode(oldChildren[i], newChildren[i], since, path + "/children/" + std::to_string(i), patch);
+    }
+}
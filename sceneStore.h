@@ -0,0 +1,271 @@
+#ifndef SCENESTORE_H
+#define SCENESTORE_H
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "json.hpp"
+#include <opencv2/opencv.hpp>
+#include "spriteAlpha.h"
+
+// Generational entity id: index picks the slot, generation tells the live
+// entity apart from earlier ones that used the same slot.
+struct Entity {
+    static constexpr uint32_t kNone = 0xFFFFFFFFu;
+
+    uint32_t index = kNone;
+    uint32_t generation = 0;
+
+    bool valid() const { return index != kNone; }
+    uint64_t id() const { return (uint64_t)generation << 32 | index; }
+    bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+// Components of one type packed densely (a sparse set). Iteration touches
+// only live components, lookup by entity index is two array reads, and
+// removal moves the last component into the hole. References returned by
+// get()/add() are invalidated by the next add() or remove().
+template <typename T>
+class ComponentPool {
+public:
+    bool has(uint32_t index) const { return index < sparse.size() && sparse[index] != Entity::kNone; }
+    T& get(uint32_t index) { return dense[sparse[index]]; }
+    const T& get(uint32_t index) const { return dense[sparse[index]]; }
+    T* find(uint32_t index) { return has(index) ? &dense[sparse[index]] : nullptr; }
+    const T* find(uint32_t index) const { return has(index) ? &dense[sparse[index]] : nullptr; }
+
+    T& add(uint32_t index, T value = T()) {
+        if (index >= sparse.size()) sparse.resize(index + 1, Entity::kNone);
+        if (sparse[index] != Entity::kNone) return dense[sparse[index]] = std::move(value);
+        sparse[index] = (uint32_t)dense.size();
+        dense.push_back(std::move(value));
+        owners.push_back(index);
+        return dense.back();
+    }
+
+    void remove(uint32_t index) {
+        if (!has(index)) return;
+        uint32_t slot = sparse[index], last = (uint32_t)dense.size() - 1;
+        if (slot != last) {
+            dense[slot] = std::move(dense[last]);
+            owners[slot] = owners[last];
+            sparse[owners[slot]] = slot;
+        }
+        dense.pop_back();
+        owners.pop_back();
+        sparse[index] = Entity::kNone;
+    }
+
+    size_t size() const { return dense.size(); }
+    std::vector<T>& components() { return dense; }
+    const std::vector<T>& components() const { return dense; }
+    // Entity index owning each component, parallel to components().
+    const std::vector<uint32_t>& entities() const { return owners; }
+
+private:
+    std::vector<T> dense;
+    std::vector<uint32_t> owners;
+    std::vector<uint32_t> sparse; // entity index -> slot in dense, kNone when absent
+};
+
+// Transform is responsible for recording position, rotation, and scale
+class Transform {
+public:
+    cv::Point2f position; // Position
+    float rotation;       // Rotation angle in degrees, as in Spine
+    cv::Point2f scale;    // Scale
+
+    Transform();
+    cv::Matx23f LocalMatrix() const; // scale, then rotate, then translate
+};
+
+// Influence of one bone on a skinned vertex.
+struct BoneWeight {
+    uint32_t bone = Entity::kNone; // entity index of the bone in the mesh's store
+    float weight = 0;
+};
+
+// Mesh is responsible for recording mesh points
+class Mesh {
+public:
+    std::vector<cv::Point2f> vertices; // Vertices
+    std::vector<std::vector<int>> triangles; // Triangle indices
+    // Skinning: vertex v is moved by weights[weightStarts[v] .. weightStarts[v + 1]).
+    // Both are empty for a mesh that is not bound to bones.
+    std::vector<uint32_t> weightStarts;
+    std::vector<BoneWeight> weights;
+    // Vertices after the last skinning pass (see SceneUpdate): the weighted
+    // sum of bone world matrices applied to each vertex, bones being at
+    // identity in the bind pose. Unskinned meshes keep their vertices.
+    std::vector<cv::Point2f> deformed;
+    // Per-vertex offsets from a deform timeline, added to the vertices before
+    // skinning; empty when no animation deforms the mesh.
+    std::vector<cv::Point2f> deformOffsets;
+
+    Mesh();
+    void LoadFromJson(const nlohmann::json& data); // Load mesh data from JSON
+    bool skinned() const { return !weightStarts.empty(); }
+};
+
+struct BoneData {
+    cv::Point head;
+    cv::Point tail;
+    float thickness = 5;
+    cv::Scalar color;
+};
+
+struct SpriteData {
+    cv::Mat sprite;
+    // Alpha coverage cache, see SpriteRenderer::GetAlphaCoverage().
+    AlphaCoverage alphaCoverage;
+    bool alphaValid = false;
+    const uchar* alphaData = nullptr; // sprite buffer alphaCoverage was built from
+    cv::Mat warped; // sprite warped from its mesh's vertices to the deformed ones, by SceneUpdate
+    cv::Scalar color = cv::Scalar(1, 1, 1, 1); // slot tint (RGBA, 0..1) set by color timelines
+};
+
+// Entities, their hierarchy and their components in contiguous arrays.
+// Every entity has a Transform; bones, sprites and meshes are optional.
+// Local and world matrices are cached in hierarchy order (parents before
+// children, each subtree contiguous), so update() recomposes only the
+// subtrees under changed transforms. Not thread-safe, like the GameObject
+// tree it backs.
+class SceneStore {
+public:
+    // Store used by the GameObject facades.
+    static SceneStore& global();
+
+    Entity create(const std::string& name);
+    // Detach from the parent, orphan the children and drop all components.
+    void destroy(Entity entity);
+    bool alive(Entity entity) const;
+    size_t size() const { return live; }
+
+    const std::string& name(Entity entity) const;
+    void setName(Entity entity, const std::string& name);
+
+    // Append child to parent's children; an invalid parent detaches it.
+    // Fails when either entity is dead or parent is child or its descendant.
+    bool setParent(Entity child, Entity parent);
+    Entity parent(Entity entity) const;
+    Entity firstChild(Entity entity) const;
+    Entity nextSibling(Entity entity) const;
+    std::vector<Entity> roots() const; // live entities without a parent, in slot order
+    // {"name", "id", "children": [...]} for root and its descendants. Built
+    // once per hierarchy version and cached, so polling an unchanged scene
+    // costs a lookup; the reference is valid until the next change.
+    const nlohmann::json& hierarchyJson(Entity root);
+    const std::string& hierarchyText(Entity root); // hierarchyJson(root).dump(), cached too
+    // Revision of the last rename or child list change under root. Every
+    // entity carries its own and its subtree's version.
+    uint64_t hierarchyVersion(Entity root) const;
+    // RFC 6902 operations turning the hierarchy served at version since into
+    // the current one. False when since was never served for root or has
+    // aged out of the history; send hierarchyJson() instead.
+    bool hierarchyPatch(Entity root, uint64_t since, nlohmann::json& patch);
+
+    // Set a local transform and mark it and its descendants for update.
+    void setPosition(Entity entity, const cv::Point2f& position);
+    void setRotation(Entity entity, float degrees);
+    void setScale(Entity entity, const cv::Point2f& scale);
+    // For code that writes transforms.get() directly.
+    void markDirty(Entity entity);
+    // Setup (rest) transform of entity, copied from its transform the first
+    // time it is asked for and kept from then on, so animations binding to
+    // it later start from the pose the scene was built in rather than the
+    // one the last animation left. Remove it from setupPoses after editing
+    // the rest pose to capture it again.
+    Transform setupPose(Entity entity);
+    // Put entity's transform back to its setup pose, if one was captured.
+    void restoreSetupPose(Entity entity);
+    // Recompute every transform on the next update, e.g. after posing whole
+    // skeletons from several threads.
+    void markAllDirty() { allDirty = true; }
+
+    // Recompute the world matrices of changed transforms and everything
+    // below them. A hierarchy change recomputes the whole scene once.
+    void update();
+    // update() split for threads: beginUpdate() returns how many independent
+    // subtrees need recomputing, then updateSubtrees() may run on disjoint
+    // ranges of them concurrently. Nothing else may touch the store between
+    // beginUpdate() and the last updateSubtrees().
+    size_t beginUpdate();
+    void updateSubtrees(size_t begin, size_t end);
+    // World matrix by entity index as of the last update, without updating.
+    const cv::Matx23f& cachedWorld(uint32_t index) const { return worlds[positions[index]]; }
+    // Matrices as of the latest changes; both call update() first.
+    cv::Matx23f local(Entity entity);
+    cv::Matx23f world(Entity entity);
+
+    ComponentPool<Transform> transforms;
+    ComponentPool<BoneData> bones;
+    ComponentPool<SpriteData> sprites;
+    ComponentPool<Mesh> meshes;
+    ComponentPool<Transform> setupPoses; // see setupPose()
+
+private:
+    struct Links {
+        uint32_t parent = Entity::kNone;
+        uint32_t firstChild = Entity::kNone;
+        uint32_t lastChild = Entity::kNone;
+        uint32_t prev = Entity::kNone;
+        uint32_t next = Entity::kNone;
+    };
+
+    // Served hierarchies of one root: the current one and a few earlier
+    // ones that patches can start from.
+    struct HierarchyCache {
+        static const size_t kHistory = 16;
+        uint32_t generation = 0;
+        uint64_t version = 0;
+        std::shared_ptr<const nlohmann::json> tree;
+        std::string text;
+        bool textValid = false;
+        std::deque<std::pair<uint64_t, std::shared_ptr<const nlohmann::json>>> history; // oldest first
+    };
+
+    Entity handle(uint32_t index) const;
+    void detach(uint32_t index);
+    void touch(uint32_t index); // index's node changed: bump it and its ancestors' subtree versions
+    void appendJson(uint32_t index, nlohmann::json& out) const;
+    HierarchyCache* hierarchyCache(Entity root);
+    void diffNode(const nlohmann::json& before, const nlohmann::json& after, uint64_t since, const std::string& path,
+                  nlohmann::json& patch) const;
+    void rebuildOrder();
+
+    std::vector<uint32_t> generations; // odd while the slot is in use
+    std::vector<Links> links;
+    std::vector<std::string> names;
+    std::vector<uint32_t> freeSlots;
+    size_t live = 0;
+
+    uint64_t revision = 0;                 // bumped by every hierarchy change
+    std::vector<uint64_t> versions;        // entity index -> revision of its last rename or child change
+    std::vector<uint64_t> subtreeVersions; // entity index -> newest version at or below it
+    std::unordered_map<uint32_t, HierarchyCache> hierarchyCaches; // by root entity index
+
+    // Hierarchy order, rebuilt after creates, destroys and reparenting.
+    struct Subtree {
+        uint32_t begin, end; // positions
+        bool locals;         // recompute local matrices too
+    };
+    bool orderStale = true;
+    bool allDirty = false;
+    std::vector<Subtree> subtrees; // work of the current update
+    std::vector<uint32_t> order;       // position -> entity index, parents first
+    std::vector<uint32_t> orderParent; // position -> parent's position, kNone for roots
+    std::vector<uint32_t> subtreeEnd;  // position -> one past its last descendant
+    std::vector<uint32_t> positions;   // entity index -> position
+    std::vector<cv::Matx23f> locals;   // by position
+    std::vector<cv::Matx23f> worlds;   // by position
+    std::vector<uint32_t> dirty;       // entity indices changed since the last update()
+    std::vector<uint8_t> dirtyFlags;   // entity index -> listed in dirty
+};
+
+#endif // SCENESTORE_H
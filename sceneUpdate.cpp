@@ -0,0 +1,108 @@
+#include "sceneUpdate.h"
+#include "imgProc.h"
+#include "trace.h"
+
+SceneUpdate::SceneUpdate(SceneStore& store) : store(store) {
+    JobGraph::Job pose = frame.addRange("scene.pose", [this] { return poseFn ? poseCount() : 0; }, 4,
+                                        [this](size_t begin, size_t end) { poseFn(begin, end); });
+    // Finding the changed subtrees is serial; composing them is not.
+    JobGraph::Job plan = frame.add("scene.beginUpdate", [this] {
+        if (poseFn) this->store.markAllDirty();
+        subtreeCount = this->store.beginUpdate();
+    });
+    JobGraph::Job transforms = frame.addRange("scene.transforms", [this] { return subtreeCount; }, 1,
+                                              [this](size_t begin, size_t end) {
+                                                  this->store.updateSubtrees(begin, end);
+                                              });
+    JobGraph::Job skinning = frame.addRange("scene.skinning", [this] { return this->store.meshes.size(); }, 4,
+                                            [this](size_t begin, size_t end) { skinMeshes(begin, end); });
+    JobGraph::Job warp = frame.addRange("scene.warp", [this] { return this->store.sprites.size(); }, 1,
+                                        [this](size_t begin, size_t end) { warpSprites(begin, end); });
+    frame.after(plan, pose);
+    frame.after(transforms, plan);
+    frame.after(skinning, transforms);
+    frame.after(warp, skinning);
+}
+
+void SceneUpdate::setPose(std::function<size_t()> count, std::function<void(size_t begin, size_t end)> fn) {
+    poseCount = std::move(count);
+    poseFn = std::move(fn);
+}
+
+void SceneUpdate::run(JobSystem& jobs) {
+    MW_TRACE_SCOPE("SceneUpdate::run");
+    jobs.run(frame);
+}
+
+void SceneUpdate::runSerial() {
+    MW_TRACE_SCOPE("SceneUpdate::runSerial");
+    if (poseFn) {
+        poseFn(0, poseCount());
+        store.markAllDirty();
+    }
+    store.update();
+    skinMeshes(0, store.meshes.size());
+    warpSprites(0, store.sprites.size());
+}
+
+void SceneUpdate::skinMeshes(size_t begin, size_t end) {
+    std::vector<Mesh>& meshes = store.meshes.components();
+    for (size_t m = begin; m < end; ++m) {
+        Mesh& mesh = meshes[m];
+        mesh.deformed.resize(mesh.vertices.size());
+        bool offsets = mesh.deformOffsets.size() == mesh.vertices.size();
+        if (!mesh.skinned() || mesh.weightStarts.size() != mesh.vertices.size() + 1) {
+            for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+                mesh.deformed[v] = offsets ? mesh.vertices[v] + mesh.deformOffsets[v] : mesh.vertices[v];
+            }
+            continue;
+        }
+        for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+            const cv::Point2f p = offsets ? mesh.vertices[v] + mesh.deformOffsets[v] : mesh.vertices[v];
+            float x = 0, y = 0;
+            for (uint32_t w = mesh.weightStarts[v]; w < mesh.weightStarts[v + 1]; ++w) {
+                const BoneWeight& bw = mesh.weights[w];
+                if (!store.transforms.has(bw.bone)) continue;
+                const cv::Matx23f& m = store.cachedWorld(bw.bone);
+                x += bw.weight * (m(0, 0) * p.x + m(0, 1) * p.y + m(0, 2));
+                y += bw.weight * (m(1, 0) * p.x + m(1, 1) * p.y + m(1, 2));
+            }
+            mesh.deformed[v] = cv::Point2f(x, y);
+        }
+    }
+}
+
+void SceneUpdate::warpSprites(size_t begin, size_t end) {
+    const std::vector<uint32_t>& owners = store.sprites.entities();
+    std::vector<SpriteData>& sprites = store.sprites.components();
+    std::vector<WarpTriangle> triangles;
+    for (size_t s = begin; s < end; ++s) {
+        SpriteData& sprite = sprites[s];
+        const Mesh* mesh = store.meshes.find(owners[s]);
+        if (!mesh || sprite.sprite.empty() || mesh->deformed.size() != mesh->vertices.size()) continue;
+        triangles.clear();
+        for (const auto& t : mesh->triangles) {
+            // Meshes can come from JSON, snapshots or edits; skip any
+            // triangle whose indices don't name a vertex.
+            if (t.size() < 3) continue;
+            size_t n = mesh->vertices.size();
+            if ((size_t)t[0] >= n || (size_t)t[1] >= n || (size_t)t[2] >= n) continue;
+            WarpTriangle w;
+            for (int k = 0; k < 3; ++k) {
+                w.src[k] = mesh->vertices[t[k]];
+                w.dst[k] = mesh->deformed[t[k]];
+            }
+            triangles.push_back(w);
+        }
+        // Coverage is refreshed here rather than through SpriteRenderer so
+        // the warp only reads sprite state owned by this chunk.
+        bool stale = !sprite.alphaValid || sprite.alphaData != sprite.sprite.data ||
+                     sprite.alphaCoverage.size != sprite.sprite.size() || sprite.alphaCoverage.threshold != 0;
+        if (stale) {
+            sprite.alphaCoverage = analyzeAlpha(sprite.sprite, 0);
+            sprite.alphaData = sprite.sprite.data;
+            sprite.alphaValid = true;
+        }
+        warpImage(sprite.sprite, sprite.warped, triangles, &sprite.alphaCoverage);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef SCENEUPDATE_H
+#define SCENEUPDATE_H
+
+#pragma once
+
+#include <functional>
+#include "jobSystem.h"
+#include "sceneStore.h"
+
+// One frame of a SceneStore as a job graph, built once and run per frame:
+//
+//     pose -> transforms -> skinning -> warp
+//
+// pose is an optional range supplied by the caller (animation sampling);
+// transforms recomposes the changed subtrees, one root per chunk at most;
+// skinning fills Mesh::deformed for every mesh; warp renders every sprite
+// that has a mesh into SpriteData::warped. Each stage fans out over all
+// cores and starts when the previous one is complete. graph() exposes the
+// jobs and their timings (JobGraph::profileJson) for profiling.
+class SceneUpdate {
+public:
+    explicit SceneUpdate(SceneStore& store);
+    SceneUpdate(const SceneUpdate&) = delete;
+    SceneUpdate& operator=(const SceneUpdate&) = delete;
+
+    // fn(begin, end) over [0, count()) writes local transforms through
+    // store.transforms.get(), each range to its own entities; the whole
+    // scene is then recomposed.
+    void setPose(std::function<size_t()> count, std::function<void(size_t begin, size_t end)> fn);
+
+    void run(JobSystem& jobs = JobSystem::global());
+    // The same stages on the calling thread only, for comparison.
+    void runSerial();
+
+    const JobGraph& graph() const { return frame; }
+
+private:
+    void skinMeshes(size_t begin, size_t end);
+    void warpSprites(size_t begin, size_t end);
+
+    SceneStore& store;
+    JobGraph frame;
+    std::function<size_t()> poseCount;
+    std::function<void(size_t, size_t)> poseFn;
+    size_t subtreeCount = 0;
+};
+
+#endif // SCENEUPDATE_H
@@ -0,0 +1,157 @@
+#include "session.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include "imageEncoder.h"
+#include "imgProc.h"
+
+EditorSession::EditorSession(const std::string& token) : token(token), lastUsed(SessionManager::nowMs()) {
+    sceneRoot = scene.create("document");
+}
+
+void EditorSession::load(const cv::UMat& source, int gridStep) {
+    // Tiles and pixel comparisons assume 8-bit pixels, whatever the source.
+    if (source.depth() == CV_8U) image = source;
+    else to8Bit(source.getMat(cv::ACCESS_READ)).copyTo(image);
+    image_post = source.clone();
+    imageCoverage = std::make_shared<AlphaCoverage>(analyzeAlpha(image.getMat(cv::ACCESS_READ)));
+    dragNode = nullptr;
+    buildGrid(grid, image.size(), gridStep);
+    kdTree.build(grid.nodes);
+    vertexCache.reset(grid);
+    postVersion = vertexCache.version();
+    lastWarpVersion = postVersion;
+    pendingDirty = cv::Rect();
+    postTiles.update(image.getMat(cv::ACCESS_READ), postVersion);
+}
+
+void EditorSession::syncScene() {
+    std::vector<Entity> children;
+    for (Entity child = scene.firstChild(sceneRoot); child.valid(); child = scene.nextSibling(child)) {
+        children.push_back(child);
+    }
+    for (size_t i = 0; i < layers.size(); ++i) {
+        Entity entity = i < children.size() ? children[i] : scene.create(layers[i].name);
+        scene.setName(entity, layers[i].name);
+        scene.setPosition(entity, cv::Point2f((float)layers[i].rect.x, (float)layers[i].rect.y));
+        if (i >= children.size()) scene.setParent(entity, sceneRoot);
+    }
+    for (size_t i = layers.size(); i < children.size(); ++i) scene.destroy(children[i]);
+}
+
+void EditorSession::touch() {
+    lastUsed.store(SessionManager::nowMs(), std::memory_order_relaxed);
+}
+
+SessionManager::SessionManager(size_t shardCount) {
+    shards.resize(shardCount ? shardCount : 1);
+    for (auto& shard : shards) {
+        shard.reset(new Shard());
+    }
+}
+
+int64_t SessionManager::nowMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+SessionManager::Shard& SessionManager::shardFor(const std::string& token) {
+    return *shards[std::hash<std::string>()(token) % shards.size()];
+}
+
+std::string SessionManager::newToken() {
+    static std::mt19937_64 rng(std::random_device{}());
+    uint64_t a, b;
+    {
+        std::lock_guard<std::mutex> lock(tokenMutex);
+        a = rng();
+        b = rng();
+    }
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)a, (unsigned long long)b);
+    return buf;
+}
+
+std::shared_ptr<EditorSession> SessionManager::create() {
+    return create(newToken());
+}
+
+std::shared_ptr<EditorSession> SessionManager::create(const std::string& token) {
+    auto session = std::make_shared<EditorSession>(token);
+    Shard& shard = shardFor(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sessions[token] = session;
+    return session;
+}
+
+std::shared_ptr<EditorSession> SessionManager::find(const std::string& token) {
+    Shard& shard = shardFor(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(token);
+    if (it == shard.sessions.end()) return nullptr;
+    it->second->touch();
+    return it->second;
+}
+
+void SessionManager::remove(const std::string& token) {
+    Shard& shard = shardFor(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sessions.erase(token);
+}
+
+size_t SessionManager::evictIdle(int64_t idleMs, const std::string& pinned) {
+    const int64_t cutoff = nowMs() - idleMs;
+    size_t evicted = 0;
+    for (auto& shard : shards) {
+        // Release the sessions outside the shard lock; freeing a large grid
+        // and its images should not block lookups.
+        std::vector<std::shared_ptr<EditorSession>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            for (auto it = shard->sessions.begin(); it != shard->sessions.end();) {
+                if (it->first != pinned && it->second->lastUsed.load(std::memory_order_relaxed) < cutoff) {
+                    dropped.push_back(std::move(it->second));
+                    it = shard->sessions.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+        evicted += dropped.size();
+    }
+    return evicted;
+}
+
+size_t SessionManager::evictOldest(size_t keep, const std::string& pinned) {
+    struct Candidate {
+        int64_t lastUsed;
+        std::string token;
+    };
+    std::vector<Candidate> candidates;
+    size_t total = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->sessions.size();
+        for (auto& item : shard->sessions) {
+            if (item.first != pinned) candidates.push_back({ item.second->lastUsed.load(std::memory_order_relaxed), item.first });
+        }
+    }
+    if (total <= keep) return 0;
+    size_t count = std::min(total - keep, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                      [](const Candidate& a, const Candidate& b) { return a.lastUsed < b.lastUsed; });
+    for (size_t i = 0; i < count; ++i) remove(candidates[i].token);
+    return count;
+}
+
+size_t SessionManager::size() {
+    size_t total = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->sessions.size();
+    }
+    return total;
+}
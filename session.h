@@ -0,0 +1,120 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "KDTree.h"
+#include "vertexBuffer.h"
+#include "tilePyramid.h"
+#include "psdReader.h"
+#include "atlasPacker.h"
+#include "spriteAlpha.h"
+#include "sceneStore.h"
+
+// A layer of the document the session is editing, as uploaded.
+struct SessionLayer {
+    std::string name;
+    cv::Rect rect;        // position in document pixels
+    uint8_t opacity = 255;
+    bool visible = true;
+    cv::UMat image;       // BGRA
+};
+
+// Editing state of one document for one user: source and warped images, the
+// deformation grid with its KD-tree, drag state and the derived caches.
+//
+// The mutex guards every field. Worker jobs copy what they need while holding
+// it and hold a shared_ptr so an evicted session stays alive until they end.
+struct EditorSession {
+    explicit EditorSession(const std::string& token);
+
+    // Load a new source image and build a fresh grid over it. Caller locks.
+    void load(const cv::UMat& source, int gridStep);
+    // Mirror layers into scene: one child of sceneRoot per layer, reusing
+    // the existing entities in order so an edited document re-uploads as a
+    // small hierarchy patch. Caller locks.
+    void syncScene();
+    void touch();
+
+    const std::string token;
+    std::mutex mutex;
+
+    std::vector<SessionLayer> layers; // empty until a document is uploaded
+    std::shared_ptr<PsdFile> document; // uploaded PSD, decodes hidden layers on demand
+    std::shared_ptr<const Atlas> atlas; // last packed layer atlas, for export
+    SceneStore scene;     // object hierarchy of the document, served by /api/hierarchy
+    Entity sceneRoot;
+    cv::UMat image;       // source image, never modified in place
+    std::shared_ptr<const AlphaCoverage> imageCoverage; // of image, lets warps skip transparent triangles
+    cv::UMat image_post;  // warped output
+
+    Grid grid;
+    KDTree kdTree;
+    VertexBufferCache vertexCache;
+    GridNode* dragNode = nullptr;
+    cv::Point2f dragNodeStart;   // node position at clickStart
+    cv::Point2f dragMouseStart;  // mouse position (image space) at clickStart
+    // /api/drag requests arriving in the same poll move the node once, to
+    // the latest point; their replies wait on the deferred move.
+    bool dragPending = false;
+    cv::Point2f dragTarget;      // latest mouse position not yet applied
+    std::vector<unsigned long> dragWaiters; // connection ids
+
+    size_t lastImageBytes = 0;   // size of the last /image response
+    uint32_t postVersion = 0;    // mesh version image_post was warped from
+
+    TilePyramid postTiles;       // tiles of image_post for /tiles
+    // Region changed since the last warp that completed with no newer warp
+    // pending; every warp job carries all of it so a dropped out-of-order
+    // warp cannot leave stale tiles behind.
+    cv::Rect pendingDirty;
+    uint32_t lastWarpVersion = 0;
+
+    std::atomic<int64_t> lastUsed; // steady clock, milliseconds
+};
+
+// Sessions keyed by token, spread over independently locked shards so that
+// lookups for different sessions do not contend.
+class SessionManager {
+public:
+    explicit SessionManager(size_t shardCount = 16);
+
+    // Create a session with a random token.
+    std::shared_ptr<EditorSession> create();
+    // Create or replace a session under a fixed token (e.g. the default one).
+    std::shared_ptr<EditorSession> create(const std::string& token);
+    std::shared_ptr<EditorSession> find(const std::string& token);
+    void remove(const std::string& token);
+
+    // Drop sessions idle for longer than idleMs, except pinned tokens.
+    // Returns the number evicted.
+    size_t evictIdle(int64_t idleMs, const std::string& pinned = "");
+    // Drop the least recently used sessions, except pinned, until at most
+    // keep remain. Returns the number evicted.
+    size_t evictOldest(size_t keep, const std::string& pinned = "");
+    size_t size();
+
+    static int64_t nowMs();
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<EditorSession>> sessions;
+    };
+
+    Shard& shardFor(const std::string& token);
+    std::string newToken();
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::mutex tokenMutex;
+};
+
+#endif // SESSION_H
@@ -0,0 +1,229 @@
+// Scene snapshot benchmark: the same skinned scene saved as JSON (meshes in
+// the Mesh::LoadFromJson layout, hierarchy as nested entity records) and as
+// a binary snapshot, then loaded back into a SceneStore both ways. The
+// binary side is also timed for open alone (map + section table) and for
+// reading every vertex in place without instantiating anything.
+//
+// snapshotBench [megabytes]   approximate snapshot size, default 100
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "sceneSnapshot.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+double timeMs(const function<void()>& fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Characters of 40 chained bones with 8 skinned meshes each, every vertex
+// weighted to two bones. About 0.5 MB of snapshot per character.
+const int kBones = 40, kMeshes = 8, kVertices = 1200;
+
+void buildCharacter(SceneStore& store, int id, mt19937& rng) {
+    uniform_real_distribution<float> coord(-200, 200), angle(-180, 180), unit(0, 1);
+    Entity root = store.create("character_" + to_string(id));
+    vector<Entity> bones;
+    for (int b = 0; b < kBones; ++b) {
+        Entity bone = store.create("bone_" + to_string(b));
+        store.setParent(bone, bones.empty() ? root : bones[rng() % bones.size()]);
+        store.setPosition(bone, cv::Point2f(coord(rng), coord(rng)));
+        store.setRotation(bone, angle(rng));
+        store.bones.add(bone.index, BoneData{ cv::Point(0, 0), cv::Point(30, 0), 5, cv::Scalar(0, 255, 0) });
+        bones.push_back(bone);
+    }
+    for (int m = 0; m < kMeshes; ++m) {
+        Entity part = store.create("part_" + to_string(m));
+        store.setParent(part, root);
+        store.sprites.add(part.index);
+        Mesh& mesh = store.meshes.add(part.index);
+        mesh.weightStarts.push_back(0);
+        for (int v = 0; v < kVertices; ++v) {
+            mesh.vertices.emplace_back(coord(rng), coord(rng));
+            float w = unit(rng);
+            mesh.weights.push_back({ bones[rng() % kBones].index, w });
+            mesh.weights.push_back({ bones[rng() % kBones].index, 1 - w });
+            mesh.weightStarts.push_back((uint32_t)mesh.weights.size());
+        }
+        for (int t = 0; t + 2 < kVertices * 2; ++t) {
+            mesh.triangles.push_back({ t % kVertices, (t + 1) % kVertices, (t + 2) % kVertices });
+        }
+    }
+}
+
+json makeClip(int id, mt19937& rng) {
+    uniform_real_distribution<float> angle(-180, 180);
+    json bones = json::object();
+    for (int b = 0; b < kBones; ++b) {
+        json keys = json::array();
+        for (int k = 0; k < 30; ++k) keys.push_back({ {"time", k / 30.0}, {"angle", angle(rng)} });
+        bones["bone_" + to_string(b)] = { {"rotate", keys} };
+    }
+    return { {"name", "clip_" + to_string(id)}, {"bones", bones} };
+}
+
+// The JSON path: one record per entity in depth-first order, parents by
+// record index, meshes as Mesh::LoadFromJson reads them.
+string toJson(const SceneStore& store, const vector<json>& clips) {
+    json entities = json::array();
+    vector<pair<Entity, int>> open;
+    vector<Entity> roots = store.roots();
+    for (auto it = roots.rbegin(); it != roots.rend(); ++it) open.push_back({ *it, -1 });
+    unordered_map<uint32_t, uint32_t> recordOf; // store index -> record index
+    while (!open.empty()) {
+        Entity entity = open.back().first;
+        int parent = open.back().second;
+        open.pop_back();
+        int record = (int)entities.size();
+        recordOf[entity.index] = record;
+        const Transform& t = store.transforms.get(entity.index);
+        json e = { {"name", store.name(entity)}, {"parent", parent}, {"position", {t.position.x, t.position.y}},
+                   {"rotation", t.rotation}, {"scale", {t.scale.x, t.scale.y}} };
+        if (const BoneData* bone = store.bones.find(entity.index)) {
+            e["bone"] = { {"head", {bone->head.x, bone->head.y}}, {"tail", {bone->tail.x, bone->tail.y}},
+                          {"thickness", bone->thickness}, {"color", {bone->color[0], bone->color[1], bone->color[2]}} };
+        }
+        if (store.sprites.has(entity.index)) e["sprite"] = true;
+        if (const Mesh* mesh = store.meshes.find(entity.index)) {
+            json vertices = json::array(), triangles = json::array(), weights = json::array();
+            for (const auto& v : mesh->vertices) vertices.push_back({ v.x, v.y });
+            for (const auto& t : mesh->triangles) triangles.push_back(t);
+            for (size_t v = 0; v + 1 < mesh->weightStarts.size(); ++v) {
+                json influences = json::array();
+                for (uint32_t w = mesh->weightStarts[v]; w < mesh->weightStarts[v + 1]; ++w) {
+                    influences.push_back({ recordOf[mesh->weights[w].bone], mesh->weights[w].weight });
+                }
+                weights.push_back(influences);
+            }
+            e["mesh"] = { {"vertices", vertices}, {"triangles", triangles}, {"weights", weights} };
+        }
+        entities.push_back(e);
+        vector<Entity> children;
+        for (Entity c = store.firstChild(entity); c.valid(); c = store.nextSibling(c)) children.push_back(c);
+        for (auto it = children.rbegin(); it != children.rend(); ++it) open.push_back({ *it, record });
+    }
+    return json({ {"entities", entities}, {"clips", clips} }).dump();
+}
+
+// Weight bones in the file are record indices; meshes are loaded after all
+// entities exist so they can be rewritten to store indices.
+size_t loadJson(const string& path, SceneStore& store) {
+    ifstream in(path, ios::binary);
+    stringstream text;
+    text << in.rdbuf();
+    json doc = json::parse(text.str());
+    vector<Entity> created;
+    for (const auto& e : doc["entities"]) {
+        Entity entity = store.create(e["name"]);
+        created.push_back(entity);
+        int parent = e["parent"];
+        if (parent >= 0) store.setParent(entity, created[parent]);
+        Transform& t = store.transforms.get(entity.index);
+        t.position = cv::Point2f(e["position"][0], e["position"][1]);
+        t.rotation = e["rotation"];
+        t.scale = cv::Point2f(e["scale"][0], e["scale"][1]);
+        if (e.count("bone")) {
+            const json& b = e["bone"];
+            store.bones.add(entity.index, BoneData{ cv::Point(b["head"][0], b["head"][1]), cv::Point(b["tail"][0], b["tail"][1]),
+                                                    b["thickness"], cv::Scalar(b["color"][0], b["color"][1], b["color"][2]) });
+        }
+        if (e.count("sprite")) store.sprites.add(entity.index);
+    }
+    for (size_t i = 0; i < created.size(); ++i) {
+        const json& e = doc["entities"][i];
+        if (!e.count("mesh")) continue;
+        Mesh& mesh = store.meshes.add(created[i].index);
+        mesh.LoadFromJson(e["mesh"]);
+        for (BoneWeight& w : mesh.weights) w.bone = created[w.bone].index;
+    }
+    return doc["clips"].size();
+}
+
+int main(int argc, char** argv) {
+    double megabytes = argc > 1 ? atof(argv[1]) : 100;
+    int characters = max(1, (int)(megabytes / 0.52));
+
+    SceneStore scene;
+    mt19937 rng(42);
+    for (int c = 0; c < characters; ++c) buildCharacter(scene, c, rng);
+    vector<json> clips;
+    for (int i = 0; i < 20; ++i) clips.push_back(makeClip(i, rng));
+
+    string error;
+    vector<uint8_t> bytes = encodeSceneSnapshot(scene, {}, clips);
+    if (!saveSceneSnapshot("snapshotBench.mwscene", bytes, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    {
+        ofstream out("snapshotBench.json", ios::binary);
+        out << toJson(scene, clips);
+    }
+    ifstream jsonFile("snapshotBench.json", ios::binary | ios::ate);
+    printf("%d characters, %zu entities: snapshot %.1f MB, JSON %.1f MB\n", characters, scene.size(),
+           bytes.size() / 1e6, (double)jsonFile.tellg() / 1e6);
+
+    SceneStore fromJson;
+    size_t jsonClips = 0;
+    double jsonMs = timeMs([&] { jsonClips = loadJson("snapshotBench.json", fromJson); });
+    printf("  JSON parse + load:              %9.1f ms (%zu entities, %zu clips)\n", jsonMs, fromJson.size(), jsonClips);
+
+    SceneSnapshot snapshot;
+    double openMs = timeMs([&] {
+        if (!snapshot.open("snapshotBench.mwscene", error)) fprintf(stderr, "%s\n", error.c_str());
+    });
+    printf("  snapshot open (map + table):    %9.3f ms\n", openMs);
+
+    // Every vertex read straight from the mapping, first touch included.
+    cv::Point2f low(1e9f, 1e9f), high(-1e9f, -1e9f);
+    double viewMs = timeMs([&] {
+        const cv::Point2f* v = snapshot.vertices();
+        size_t count = 0;
+        for (size_t m = 0; m < snapshot.meshCount(); ++m) count += snapshot.meshes()[m].vertexCount;
+        for (size_t i = 0; i < count; ++i) {
+            low.x = min(low.x, v[i].x), low.y = min(low.y, v[i].y);
+            high.x = max(high.x, v[i].x), high.y = max(high.y, v[i].y);
+        }
+    });
+    printf("  snapshot scan vertices in place:%9.1f ms (bounds %.0f,%.0f .. %.0f,%.0f)\n", viewMs, low.x, low.y, high.x,
+           high.y);
+
+    SceneStore fromSnapshot;
+    vector<Entity> created;
+    double instantiateMs = timeMs([&] { created = snapshot.instantiate(fromSnapshot, error); });
+    printf("  snapshot instantiate:           %9.1f ms (%zu entities) %.1fx faster than JSON\n", instantiateMs,
+           created.size(), jsonMs / max(openMs + instantiateMs, 1e-3));
+
+    double clipMs = timeMs([&] { snapshot.clip(3); });
+    printf("  first use of one clip:          %9.3f ms (%s)\n", clipMs,
+           snapshot.clip(3) && *snapshot.clip(3) == clips[3] ? "matches" : "MISMATCH");
+
+    // Same scene either way: compare meshes in creation order.
+    bool same = fromJson.meshes.size() == fromSnapshot.meshes.size();
+    for (size_t i = 0; same && i < fromJson.meshes.size(); ++i) {
+        const Mesh& a = fromJson.meshes.components()[i];
+        const Mesh& b = fromSnapshot.meshes.components()[i];
+        same = a.vertices == b.vertices && a.triangles == b.triangles && a.weightStarts == b.weightStarts &&
+               a.weights.size() == b.weights.size();
+        for (size_t w = 0; same && w < a.weights.size(); ++w) {
+            same = a.weights[w].weight == b.weights[w].weight &&
+                   fromJson.name(Entity{ a.weights[w].bone, 1 }) == fromSnapshot.name(Entity{ b.weights[w].bone, 1 });
+        }
+    }
+    printf("  JSON and snapshot scenes %s\n", same ? "match" : "DIFFER");
+    remove("snapshotBench.json");
+    remove("snapshotBench.mwscene");
+    return same ? 0 : 1;
+}
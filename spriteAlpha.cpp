@@ -0,0 +1,153 @@
+#include "spriteAlpha.h"
+#include <algorithm>
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ALPHA_SSE2 1
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+const int kBlock = AlphaCoverage::kCellSize; // pixels per mask; one cell column
+
+int lowestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+int highestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return (int)index;
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+// Bit i of visible/opaque describes pixel i of the block.
+void blockMasksScalar(const uint8_t* bgra, int count, uint8_t threshold, uint32_t& visible, uint32_t& opaque) {
+    visible = opaque = 0;
+    for (int i = 0; i < count; ++i) {
+        uint8_t a = bgra[i * 4 + 3];
+        visible |= (uint32_t)(a > threshold) << i;
+        opaque |= (uint32_t)(a == 255) << i;
+    }
+}
+
+#ifdef ALPHA_SSE2
+// 16 BGRA pixels: shift each alpha to the bottom of its lane, narrow the
+// four vectors to one of 16 bytes, then compare and take the sign bits.
+inline void blockMasksSse2(const uint8_t* bgra, __m128i threshold, uint32_t& visible, uint32_t& opaque) {
+    const __m128i* p = (const __m128i*)bgra;
+    __m128i a0 = _mm_srli_epi32(_mm_loadu_si128(p), 24);
+    __m128i a1 = _mm_srli_epi32(_mm_loadu_si128(p + 1), 24);
+    __m128i a2 = _mm_srli_epi32(_mm_loadu_si128(p + 2), 24);
+    __m128i a3 = _mm_srli_epi32(_mm_loadu_si128(p + 3), 24);
+    __m128i alpha = _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+    // a > t exactly when the saturating a - t is non-zero.
+    __m128i transparent = _mm_cmpeq_epi8(_mm_subs_epu8(alpha, threshold), _mm_setzero_si128());
+    visible = ~(uint32_t)_mm_movemask_epi8(transparent) & 0xFFFF;
+    opaque = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(alpha, _mm_set1_epi8((char)0xFF)));
+}
+#endif
+
+} // namespace
+
+bool AlphaCoverage::anyVisible(const cv::Rect& rect) const {
+    cv::Rect r = rect & cv::Rect(0, 0, size.width, size.height);
+    if (r.empty() || (r & bounds).empty()) return false;
+    int cx0 = r.x / kCellSize, cx1 = (r.x + r.width - 1) / kCellSize;
+    int cy0 = r.y / kCellSize, cy1 = (r.y + r.height - 1) / kCellSize;
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        const uint8_t* row = &cells[(size_t)cy * grid.width];
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            if (row[cx] != Empty) return true;
+        }
+    }
+    return false;
+}
+
+AlphaCoverage analyzeAlpha(const cv::Mat& image, uint8_t threshold) {
+    MW_TRACE_SCOPE("analyzeAlpha");
+    AlphaCoverage out;
+    out.size = image.size();
+    out.threshold = threshold;
+    out.grid = cv::Size((image.cols + kBlock - 1) / kBlock, (image.rows + kBlock - 1) / kBlock);
+    out.rows.resize(image.rows);
+    out.cells.assign((size_t)out.grid.area(), AlphaCoverage::Empty);
+    if (image.empty()) return out;
+
+    if (image.type() != CV_8UC4) {
+        for (AlphaSpan& span : out.rows) span = { 0, image.cols - 1 };
+        std::fill(out.cells.begin(), out.cells.end(), (uint8_t)AlphaCoverage::Opaque);
+        out.bounds = cv::Rect(0, 0, image.cols, image.rows);
+        return out;
+    }
+
+    const int fullBlocks = image.cols / kBlock;
+    const int tail = image.cols - fullBlocks * kBlock;
+    // Per cell column of the current cell row: any pixel visible / every pixel opaque.
+    std::vector<uint8_t> anyVisible(out.grid.width), allOpaque(out.grid.width);
+    int top = -1, bottom = -1, left = image.cols, right = -1;
+#ifdef ALPHA_SSE2
+    const __m128i thresholdVec = _mm_set1_epi8((char)threshold);
+#endif
+
+    for (int y = 0; y < image.rows; ++y) {
+        if (y % kBlock == 0) {
+            std::fill(anyVisible.begin(), anyVisible.end(), 0);
+            std::fill(allOpaque.begin(), allOpaque.end(), 1);
+        }
+        const uint8_t* row = image.ptr(y);
+        AlphaSpan& span = out.rows[y];
+        for (int b = 0; b < out.grid.width; ++b) {
+            uint32_t visible, opaque;
+            int count = b < fullBlocks ? kBlock : tail;
+#ifdef ALPHA_SSE2
+            if (count == kBlock) blockMasksSse2(row + b * kBlock * 4, thresholdVec, visible, opaque);
+            else blockMasksScalar(row + b * kBlock * 4, count, threshold, visible, opaque);
+#else
+            blockMasksScalar(row + b * kBlock * 4, count, threshold, visible, opaque);
+#endif
+            uint32_t full = (1u << count) - 1;
+            allOpaque[b] &= (uint8_t)(opaque == full);
+            if (!visible) continue;
+            anyVisible[b] = 1;
+            if (span.first < 0) span.first = b * kBlock + lowestBit(visible);
+            span.last = b * kBlock + highestBit(visible);
+        }
+        if (!span.empty()) {
+            if (top < 0) top = y;
+            bottom = y;
+            left = std::min(left, span.first);
+            right = std::max(right, span.last);
+        }
+        if (y % kBlock == kBlock - 1 || y == image.rows - 1) {
+            uint8_t* cellRow = &out.cells[(size_t)(y / kBlock) * out.grid.width];
+            for (int b = 0; b < out.grid.width; ++b) {
+                cellRow[b] = allOpaque[b] ? AlphaCoverage::Opaque : anyVisible[b] ? AlphaCoverage::Partial
+                                                                                  : AlphaCoverage::Empty;
+            }
+        }
+    }
+    if (top >= 0) out.bounds = cv::Rect(left, top, right - left + 1, bottom - top + 1);
+    return out;
+}
+
+const char* alphaImplementation() {
+#ifdef ALPHA_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
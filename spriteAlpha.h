@@ -0,0 +1,44 @@
+#ifndef SPRITEALPHA_H
+#define SPRITEALPHA_H
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Visible columns of one row, inclusive; first < 0 when the row is empty.
+struct AlphaSpan {
+    int first = -1;
+    int last = -1;
+
+    bool empty() const { return first < 0; }
+};
+
+// Where an image's alpha is above a threshold, from a single pass over it:
+// tight bounds, per-row spans and a coarse map of kCellSize-square cells.
+struct AlphaCoverage {
+    static const int kCellSize = 16;
+    enum Cell : uint8_t { Empty = 0, Partial = 1, Opaque = 2 };
+
+    cv::Size size;                // analysed image size
+    uint8_t threshold = 0;        // alpha at or below this counts as transparent
+    cv::Rect bounds;              // empty when nothing is visible
+    std::vector<AlphaSpan> rows;  // one per image row
+    cv::Size grid;                // cells across and down; edge cells may be smaller
+    std::vector<uint8_t> cells;   // Cell values, row-major
+
+    Cell cell(int cx, int cy) const { return (Cell)cells[(size_t)cy * grid.width + cx]; }
+    // False only when every cell touching rect is empty, so callers can skip
+    // work on transparent regions without missing anything.
+    bool anyVisible(const cv::Rect& rect) const;
+};
+
+// Analyse a BGRA image with SSE2 where available. Images without an alpha
+// channel are reported as fully opaque.
+AlphaCoverage analyzeAlpha(const cv::Mat& image, uint8_t threshold = 0);
+
+// "sse2" or "scalar".
+const char* alphaImplementation();
+
+#endif // SPRITEALPHA_H
@@ -0,0 +1,389 @@
+#include "staticAssets.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <zlib.h>
+#ifdef MW_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct MimeEntry {
+    const char* ext;
+    const char* mime;
+    bool text; // cached and compressed in memory
+};
+
+const MimeEntry kMimeTypes[] = {
+    { "html", "text/html; charset=utf-8", true },
+    { "htm", "text/html; charset=utf-8", true },
+    { "js", "text/javascript; charset=utf-8", true },
+    { "mjs", "text/javascript; charset=utf-8", true },
+    { "css", "text/css; charset=utf-8", true },
+    { "json", "application/json", true },
+    { "map", "application/json", true },
+    { "svg", "image/svg+xml", true },
+    { "txt", "text/plain; charset=utf-8", true },
+    { "atlas", "text/plain; charset=utf-8", true },
+    { "xml", "application/xml", true },
+    { "csv", "text/csv", true },
+    { "png", "image/png", false },
+    { "jpg", "image/jpeg", false },
+    { "jpeg", "image/jpeg", false },
+    { "gif", "image/gif", false },
+    { "webp", "image/webp", false },
+    { "psd", "image/vnd.adobe.photoshop", false },
+    { "wasm", "application/wasm", false },
+    { "skel", "application/octet-stream", false },
+};
+
+const MimeEntry* lookupMime(const std::string& path) {
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos) return nullptr;
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    for (const MimeEntry& entry : kMimeTypes) {
+        if (ext == entry.ext) return &entry;
+    }
+    return nullptr;
+}
+
+uint64_t fnv1a(const std::vector<uint8_t>& data) {
+    uint64_t h = 1469598103934665603ULL;
+    for (uint8_t b : data) {
+        h ^= b;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool gzipCompress(const std::vector<uint8_t>& in, int level, std::vector<uint8_t>& out) {
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    // windowBits 15 + 16 selects the gzip wrapper.
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    out.resize(deflateBound(&zs, (uLong)in.size()) + 32);
+    zs.next_in = const_cast<Bytef*>(in.data());
+    zs.avail_in = (uInt)in.size();
+    zs.next_out = out.data();
+    zs.avail_out = (uInt)out.size();
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+bool brotliCompress(const std::vector<uint8_t>& in, int quality, std::vector<uint8_t>& out) {
+#ifdef MW_HAVE_BROTLI
+    size_t size = BrotliEncoderMaxCompressedSize(in.size());
+    if (size == 0) return false;
+    out.resize(size);
+    if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               in.size(), in.data(), &size, out.data())) {
+        return false;
+    }
+    out.resize(size);
+    return true;
+#else
+    (void)in;
+    (void)quality;
+    (void)out;
+    return false;
+#endif
+}
+
+// Accept-Encoding token check; "gzip;q=0" counts as not accepted.
+bool acceptsEncoding(const struct mg_str* header, const char* coding) {
+    if (!header) return false;
+    std::string value(header->buf, header->len);
+    size_t pos = 0;
+    while (pos < value.size()) {
+        size_t end = value.find(',', pos);
+        if (end == std::string::npos) end = value.size();
+        std::string item = value.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t semi = item.find(';');
+        std::string name = item.substr(0, semi);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (name != coding && name != "*") continue;
+        if (semi != std::string::npos) {
+            size_t q = item.find("q=", semi);
+            if (q != std::string::npos && std::atof(item.c_str() + q + 2) <= 0) return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool etagMatches(struct mg_http_message* hm, const std::string& etag) {
+    struct mg_str* inm = mg_http_get_header(hm, "If-None-Match");
+    if (!inm) return false;
+    std::string value(inm->buf, inm->len);
+    return value == "*" || value.find(etag) != std::string::npos;
+}
+
+bool isHead(struct mg_http_message* hm) {
+    return mg_strcasecmp(hm->method, mg_str("HEAD")) == 0;
+}
+
+#ifdef __linux__
+// Per-connection state while a file is streamed with sendfile(). It replaces
+// the connection's protocol handler for the duration, like mongoose's own
+// static file streaming does, and puts the old one back when done.
+struct SendFileState {
+    int fd;
+    off_t offset;
+    size_t remaining;
+    mg_event_handler_t pfn;
+    void* pfnData;
+};
+
+void finishSendFile(struct mg_connection* c) {
+    SendFileState* state = (SendFileState*)c->pfn_data;
+    close(state->fd);
+    c->pfn = state->pfn;
+    c->pfn_data = state->pfnData;
+    c->is_resp = 0;
+    delete state;
+}
+
+void sendFileCb(struct mg_connection* c, int ev, void* ev_data) {
+    (void)ev_data;
+    SendFileState* state = (SendFileState*)c->pfn_data;
+    if (ev == MG_EV_CLOSE) {
+        finishSendFile(c);
+        return;
+    }
+    if (ev != MG_EV_WRITE && ev != MG_EV_POLL) return;
+    // Headers (or the parked byte below) have to leave the send buffer first.
+    if (c->send.len > 0) return;
+
+    int sock = (int)(size_t)c->fd;
+    while (state->remaining > 0) {
+        ssize_t n = sendfile(sock, state->fd, &state->offset, std::min<size_t>(state->remaining, 1 << 20));
+        if (n > 0) {
+            state->remaining -= (size_t)n;
+        }
+        else if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // mongoose only waits for POLLOUT while the send buffer is not
+            // empty. Park one byte there so the next chunk goes out as soon
+            // as the socket drains instead of on the next poll timeout.
+            uint8_t byte;
+            if (pread(state->fd, &byte, 1, state->offset) != 1) {
+                c->is_closing = 1;
+                return;
+            }
+            mg_send(c, &byte, 1);
+            state->offset += 1;
+            state->remaining -= 1;
+            break;
+        }
+        else {
+            c->is_closing = 1; // I/O error or the file shrank
+            return;
+        }
+    }
+    if (state->remaining == 0) finishSendFile(c);
+}
+#endif
+
+} // namespace
+
+size_t StaticAssetCache::load(const std::string& root, const StaticAssetOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    rootDir = root;
+    opts = options;
+
+    std::vector<std::pair<std::string, fs::path>> files;
+    std::error_code ec;
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (it->is_directory(ec)) {
+            // Skip .git and build output directories.
+            if (!name.empty() && (name[0] == '.' || name[0] == '_')) it.disable_recursion_pending();
+            continue;
+        }
+        const MimeEntry* mime = lookupMime(name);
+        if (!mime || !mime->text || !it->is_regular_file(ec)) continue;
+        if (it->file_size(ec) > opts.maxMemoryFileSize) continue;
+        std::string rel = fs::relative(it->path(), root, ec).generic_string();
+        files.emplace_back("/" + rel, it->path());
+    }
+
+    std::vector<std::pair<std::string, Asset>> loaded(files.size());
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < files.size(); i = next++) {
+            Asset& asset = loaded[i].second;
+            std::ifstream in(files[i].second, std::ios::binary);
+            asset.raw.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            // Pages using server side includes must go through mg_http_serve_dir.
+            static const char ssi[] = "<!--#";
+            if (std::search(asset.raw.begin(), asset.raw.end(), ssi, ssi + 5) != asset.raw.end()) continue;
+
+            loaded[i].first = files[i].first;
+            asset.mime = lookupMime(files[i].first)->mime;
+            char etag[24];
+            std::snprintf(etag, sizeof(etag), "%016llx", (unsigned long long)fnv1a(asset.raw));
+            asset.etag = etag;
+            if (!gzipCompress(asset.raw, opts.gzipLevel, asset.gzip) || asset.gzip.size() >= asset.raw.size()) {
+                asset.gzip.clear();
+            }
+            if (!brotliCompress(asset.raw, opts.brotliQuality, asset.brotli) || asset.brotli.size() >= asset.raw.size()) {
+                asset.brotli.clear();
+            }
+        }
+    };
+    // Brotli at quality 11 is slow; compress on all cores at startup.
+    std::vector<std::thread> threads;
+    unsigned count = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), (unsigned)files.size()));
+    for (unsigned i = 1; i < count; ++i) threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads) t.join();
+
+    assets.clear();
+    Stats fresh;
+    for (auto& item : loaded) {
+        if (item.first.empty()) continue;
+        fresh.rawBytes += item.second.raw.size();
+        fresh.gzipBytes += item.second.gzip.empty() ? item.second.raw.size() : item.second.gzip.size();
+        fresh.brotliBytes += item.second.brotli.empty() ? item.second.raw.size() : item.second.brotli.size();
+        assets.emplace(std::move(item.first), std::move(item.second));
+    }
+    fresh.files = assets.size();
+    fresh.loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    counters = fresh;
+    return assets.size();
+}
+
+const StaticAssetCache::Asset* StaticAssetCache::find(const std::string& path) const {
+    auto it = assets.find(path);
+    return it == assets.end() ? nullptr : &it->second;
+}
+
+bool StaticAssetCache::resolve(struct mg_http_message* hm, std::string& path) const {
+    char buf[512];
+    int n = mg_url_decode(hm->uri.buf, hm->uri.len, buf, sizeof(buf), 0);
+    if (n <= 0 || buf[0] != '/') return false;
+    path.assign(buf, (size_t)n);
+    if (path.find("..") != std::string::npos || path.find('\\') != std::string::npos) return false;
+    if (path.back() == '/') path += "index.html";
+    return true;
+}
+
+bool StaticAssetCache::serve(struct mg_connection* conn, struct mg_http_message* hm) {
+    if (mg_strcasecmp(hm->method, mg_str("GET")) != 0 && !isHead(hm)) return false;
+    std::string path;
+    if (!resolve(hm, path)) return false;
+
+    auto it = assets.find(path);
+    if (it != assets.end()) return serveAsset(conn, hm, it->second);
+    return streamFile(conn, hm, path);
+}
+
+bool StaticAssetCache::serveAsset(struct mg_connection* conn, struct mg_http_message* hm, const Asset& asset) {
+    struct mg_str* ae = mg_http_get_header(hm, "Accept-Encoding");
+    const std::vector<uint8_t>* body = &asset.raw;
+    const char* encoding = nullptr;
+    std::string etag = "\"" + asset.etag;
+    if (!asset.brotli.empty() && acceptsEncoding(ae, "br")) {
+        body = &asset.brotli;
+        encoding = "br";
+        etag += "-br";
+    }
+    else if (!asset.gzip.empty() && acceptsEncoding(ae, "gzip")) {
+        body = &asset.gzip;
+        encoding = "gzip";
+        etag += "-gz";
+    }
+    etag += "\"";
+
+    if (etagMatches(hm, etag)) {
+        mg_printf(conn, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nCache-Control: %s\r\n"
+                  "Vary: Accept-Encoding\r\nContent-Length: 0\r\n\r\n",
+                  etag.c_str(), opts.cacheControl.c_str());
+        ++counters.notModified;
+    }
+    else {
+        mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %lu\r\nETag: %s\r\n"
+                  "Cache-Control: %s\r\nVary: Accept-Encoding\r\n%s%s%s\r\n",
+                  asset.mime.c_str(), (unsigned long)body->size(), etag.c_str(), opts.cacheControl.c_str(),
+                  encoding ? "Content-Encoding: " : "", encoding ? encoding : "", encoding ? "\r\n" : "");
+        if (!isHead(hm)) mg_send(conn, body->data(), body->size());
+        ++counters.hits;
+    }
+    conn->is_resp = 0;
+    return true;
+}
+
+bool StaticAssetCache::streamFile(struct mg_connection* conn, struct mg_http_message* hm, const std::string& path) {
+#ifdef __linux__
+    const MimeEntry* mime = lookupMime(path);
+    if (!mime || mime->text) return false;
+    // Partial content keeps going through mongoose.
+    if (mg_http_get_header(hm, "Range")) return false;
+
+    std::string full = rootDir + path;
+    int fd = open(full.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sendFileSize) {
+        close(fd);
+        return false;
+    }
+
+    char etag[64];
+    std::snprintf(etag, sizeof(etag), "\"%llx.%llx\"", (unsigned long long)st.st_mtime, (unsigned long long)st.st_size);
+    if (etagMatches(hm, etag)) {
+        close(fd);
+        mg_printf(conn, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nCache-Control: %s\r\nContent-Length: 0\r\n\r\n",
+                  etag, opts.cacheControl.c_str());
+        conn->is_resp = 0;
+        ++counters.notModified;
+        return true;
+    }
+
+    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %llu\r\nETag: %s\r\n"
+              "Cache-Control: %s\r\nAccept-Ranges: bytes\r\n\r\n",
+              mime->mime, (unsigned long long)st.st_size, etag, opts.cacheControl.c_str());
+    ++counters.streamed;
+    if (isHead(hm)) {
+        close(fd);
+        conn->is_resp = 0;
+        return true;
+    }
+
+    // is_resp stays set until the whole file is out so that pipelined
+    // requests wait behind it.
+    conn->is_resp = 1;
+    conn->pfn_data = new SendFileState{ fd, 0, (size_t)st.st_size, conn->pfn, conn->pfn_data };
+    conn->pfn = sendFileCb;
+    return true;
+#else
+    (void)conn;
+    (void)hm;
+    (void)path;
+    return false;
+#endif
+}
@@ -0,0 +1,81 @@
+#ifndef STATICASSETS_H
+#define STATICASSETS_H
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "mongoose.h"
+
+// Brotli variants are built when the encoder headers are available; link
+// with -lbrotlienc in that case.
+#if defined(__has_include)
+#if __has_include(<brotli/encode.h>) && !defined(MW_NO_BROTLI)
+#define MW_HAVE_BROTLI 1
+#endif
+#endif
+
+struct StaticAssetOptions {
+    size_t maxMemoryFileSize = 2 * 1024 * 1024; // Larger files are streamed
+    int gzipLevel = 9;
+    int brotliQuality = 11;
+    // Assets are not fingerprinted, so browsers revalidate with the ETag and
+    // get a 304 back instead of the body.
+    std::string cacheControl = "no-cache";
+};
+
+// The web root held in memory with gzip and brotli variants compressed once
+// at startup.
+//
+// Text assets (html, js, css, json, svg...) are loaded into memory and served
+// with a strong content-hash ETag in the best encoding the client accepts.
+// Other files at least sendFileSize bytes (psd, images) are streamed straight
+// from disk with sendfile() on Linux. Everything else, including Range
+// requests and html using SSI, is left to mg_http_serve_dir.
+class StaticAssetCache {
+public:
+    struct Stats {
+        size_t files = 0;
+        size_t rawBytes = 0;
+        size_t gzipBytes = 0;
+        size_t brotliBytes = 0;
+        double loadMs = 0;
+        uint64_t hits = 0;
+        uint64_t notModified = 0;
+        uint64_t streamed = 0;
+    };
+
+    // Load every cacheable file below root. May be called again to reload.
+    size_t load(const std::string& root, const StaticAssetOptions& options = StaticAssetOptions());
+
+    // Reply to hm if it is a GET/HEAD for a cached or streamable file.
+    // Returns false when the caller should fall back to mg_http_serve_dir.
+    bool serve(struct mg_connection* conn, struct mg_http_message* hm);
+
+    const Stats& stats() const { return counters; }
+
+    struct Asset {
+        std::string mime;
+        std::string etag;
+        std::vector<uint8_t> raw;
+        std::vector<uint8_t> gzip;   // empty when it would not be smaller
+        std::vector<uint8_t> brotli; // empty when unavailable or not smaller
+    };
+    const Asset* find(const std::string& path) const;
+
+    static const size_t sendFileSize = 64 * 1024;
+
+private:
+    bool resolve(struct mg_http_message* hm, std::string& path) const;
+    bool serveAsset(struct mg_connection* conn, struct mg_http_message* hm, const Asset& asset);
+    bool streamFile(struct mg_connection* conn, struct mg_http_message* hm, const std::string& path);
+
+    std::string rootDir;
+    StaticAssetOptions opts;
+    std::unordered_map<std::string, Asset> assets;
+    Stats counters;
+};
+
+#endif // STATICASSETS_H
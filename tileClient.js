@@ -0,0 +1,80 @@
+// tileClient.js
+
+/**
+ * 圖塊客戶端：依可視範圍從 /tiles/{layer}/{z}/{x}/{y} 抓取圖塊並畫到 canvas。
+ * 先以 /tiles/{layer}/versions 取得版本號，只請求「可見且版本有變」的圖塊，
+ * 拖曳時傳輸量只剩被改到的那幾塊。
+ */
+export class TileClient {
+  /**
+   * @param {HTMLCanvasElement} canvas - 繪製目標，尺寸等同 z 層的影像大小。
+   * @param {string} layer - 圖層名稱，目前伺服器提供 'post' (變形後影像)。
+   */
+  constructor(canvas, layer = 'post') {
+    this.canvas = canvas;
+    this.ctx = canvas.getContext('2d');
+    this.layer = layer;
+    this.tileSize = 256;
+    this.since = new Map();    // z -> 最後看過的金字塔版本
+    this.server = new Map();   // "z/x/y" -> 伺服器上的版本
+    this.loaded = new Map();   // "z/x/y" -> 已畫上的版本
+    this.bytes = 0;            // 累計下載的圖塊位元組，方便比較
+  }
+
+  /**
+   * 同步可視範圍內的圖塊。
+   * @param {{x:number, y:number, width:number, height:number}} viewport - z 層的像素座標。
+   * @param {number} z - 金字塔層級，0 為原始解析度。
+   */
+  async refresh(viewport, z = 0) {
+    const since = this.since.get(z) || 0;
+    const res = await fetch(`/tiles/${this.layer}/versions?z=${z}&since=${since}`);
+    if (!res.ok) return;
+    const info = await res.json();
+    this.tileSize = info.tileSize;
+    this.since.set(z, info.version);
+    for (const [x, y, version] of info.tiles) {
+      this.server.set(`${z}/${x}/${y}`, version);
+    }
+
+    const level = info.levels[z];
+    if (!level) return;
+    // 影像尺寸改變時重設 canvas，已畫上的圖塊全部作廢
+    if (this.canvas.width !== level.width || this.canvas.height !== level.height) {
+      this.canvas.width = level.width;
+      this.canvas.height = level.height;
+      this.loaded.clear();
+    }
+    const size = this.tileSize;
+    const x0 = Math.max(0, Math.floor(viewport.x / size));
+    const y0 = Math.max(0, Math.floor(viewport.y / size));
+    const x1 = Math.min(level.tilesX - 1, Math.floor((viewport.x + viewport.width - 1) / size));
+    const y1 = Math.min(level.tilesY - 1, Math.floor((viewport.y + viewport.height - 1) / size));
+
+    const jobs = [];
+    for (let y = y0; y <= y1; y++) {
+      for (let x = x0; x <= x1; x++) {
+        const key = `${z}/${x}/${y}`;
+        if (this.loaded.has(key) && this.loaded.get(key) === this.server.get(key)) continue;
+        jobs.push(this.fetchTile(z, x, y));
+      }
+    }
+    await Promise.all(jobs);
+  }
+
+  async fetchTile(z, x, y) {
+    const key = `${z}/${x}/${y}`;
+    const res = await fetch(`/tiles/${this.layer}/${key}`);
+    if (!res.ok) return;
+    const blob = await res.blob();
+    this.bytes += blob.size;
+    const bitmap = await createImageBitmap(blob);
+    const size = this.tileSize;
+    this.ctx.clearRect(x * size, y * size, bitmap.width, bitmap.height);
+    this.ctx.drawImage(bitmap, x * size, y * size);
+    bitmap.close();
+    this.loaded.set(key, Number(res.headers.get('X-Tile-Version')));
+  }
+}
+
+export default TileClient;
@@ -0,0 +1,152 @@
+#include "tilePyramid.h"
+#include <cstring>
+#include "trace.h"
+
+namespace {
+
+// Average 2x2 blocks of src into the dstRect part of a half-size image.
+// Blocks hanging over an odd edge average only the pixels that exist, so a
+// partial update produces exactly the same pixels as a full rebuild.
+void downsample2x(const cv::Mat& src, const cv::Rect& dstRect, cv::Mat& out) {
+    const int channels = src.channels();
+    out.create(dstRect.height, dstRect.width, src.type());
+    for (int y = 0; y < dstRect.height; ++y) {
+        int sy0 = (dstRect.y + y) * 2;
+        int sy1 = std::min(sy0 + 1, src.rows - 1);
+        const uchar* r0 = src.ptr<uchar>(sy0);
+        const uchar* r1 = src.ptr<uchar>(sy1);
+        uchar* d = out.ptr<uchar>(y);
+        for (int x = 0; x < dstRect.width; ++x) {
+            int sx0 = (dstRect.x + x) * 2;
+            int sx1 = std::min(sx0 + 1, src.cols - 1);
+            for (int c = 0; c < channels; ++c) {
+                int sum = r0[sx0 * channels + c] + r0[sx1 * channels + c] + r1[sx0 * channels + c] + r1[sx1 * channels + c];
+                *d++ = (uchar)((sum + 2) >> 2);
+            }
+        }
+    }
+}
+
+bool samePixels(const cv::Mat& a, const cv::Mat& b) {
+    const size_t rowBytes = (size_t)a.cols * a.elemSize();
+    for (int y = 0; y < a.rows; ++y) {
+        if (std::memcmp(a.ptr<uchar>(y), b.ptr<uchar>(y), rowBytes) != 0) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+TilePyramid::TilePyramid(int tileSize) : size(tileSize > 0 ? tileSize : 256) {}
+
+bool TilePyramid::update(const cv::Mat& image, uint32_t sourceVersion, const cv::Rect& dirty) {
+    MW_TRACE_SCOPE("TilePyramid::update");
+    std::lock_guard<std::mutex> lock(mutex);
+    if (sourceVersion != 0 && sourceVersion <= appliedSource) return false;
+    if (sourceVersion != 0) appliedSource = sourceVersion;
+
+    const cv::Rect bounds(0, 0, image.cols, image.rows);
+    cv::Rect region = dirty & bounds;
+    if (levels.empty() || levels[0].image.size() != image.size() ||
+        levels[0].image.type() != image.type() || dirty.empty()) {
+        rebuild(image);
+        return true;
+    }
+    if (region.empty()) return true;
+
+    ++currentVersion;
+    store(levels[0], region, image(region));
+    for (size_t z = 1; z < levels.size(); ++z) {
+        const cv::Mat& src = levels[z - 1].image;
+        cv::Rect levelBounds(0, 0, levels[z].image.cols, levels[z].image.rows);
+        int x0 = region.x / 2, y0 = region.y / 2;
+        int x1 = (region.x + region.width + 1) / 2, y1 = (region.y + region.height + 1) / 2;
+        region = cv::Rect(x0, y0, x1 - x0, y1 - y0) & levelBounds;
+        if (region.empty()) break;
+        cv::Mat pixels;
+        downsample2x(src, region, pixels);
+        store(levels[z], region, pixels);
+    }
+    return true;
+}
+
+void TilePyramid::rebuild(const cv::Mat& image) {
+    ++currentVersion;
+    levels.clear();
+    cv::Mat current = image.clone();
+    for (;;) {
+        Level level;
+        level.image = current;
+        level.tilesX = (current.cols + size - 1) / size;
+        level.tilesY = (current.rows + size - 1) / size;
+        level.versions.assign((size_t)level.tilesX * level.tilesY, currentVersion);
+        levels.push_back(level);
+        if (current.cols <= size && current.rows <= size) break;
+
+        cv::Mat next;
+        downsample2x(current, cv::Rect(0, 0, (current.cols + 1) / 2, (current.rows + 1) / 2), next);
+        current = next;
+    }
+}
+
+void TilePyramid::store(Level& level, const cv::Rect& rect, const cv::Mat& pixels) {
+    int tx0 = rect.x / size, ty0 = rect.y / size;
+    int tx1 = (rect.x + rect.width - 1) / size, ty1 = (rect.y + rect.height - 1) / size;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            cv::Rect part = cv::Rect(tx * size, ty * size, size, size) & rect;
+            cv::Rect local(part.x - rect.x, part.y - rect.y, part.width, part.height);
+            if (!samePixels(level.image(part), pixels(local))) {
+                level.versions[(size_t)ty * level.tilesX + tx] = currentVersion;
+            }
+        }
+    }
+    pixels.copyTo(level.image(rect));
+}
+
+bool TilePyramid::tile(int z, int x, int y, cv::Mat& out, uint32_t& tileVersion) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (z < 0 || z >= (int)levels.size()) return false;
+    const Level& level = levels[z];
+    if (x < 0 || y < 0 || x >= level.tilesX || y >= level.tilesY) return false;
+    cv::Rect rect = cv::Rect(x * size, y * size, size, size) & cv::Rect(0, 0, level.image.cols, level.image.rows);
+    out = level.image(rect).clone();
+    tileVersion = level.versions[(size_t)y * level.tilesX + x];
+    return true;
+}
+
+std::vector<TilePyramid::TileInfo> TilePyramid::changedSince(int z, uint32_t since) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<TileInfo> result;
+    if (z < 0 || z >= (int)levels.size()) return result;
+    const Level& level = levels[z];
+    for (int y = 0; y < level.tilesY; ++y) {
+        for (int x = 0; x < level.tilesX; ++x) {
+            uint32_t v = level.versions[(size_t)y * level.tilesX + x];
+            if (v > since) result.push_back({ x, y, v });
+        }
+    }
+    return result;
+}
+
+int TilePyramid::levelCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)levels.size();
+}
+
+cv::Size TilePyramid::levelSize(int z) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (z < 0 || z >= (int)levels.size()) return cv::Size();
+    return levels[z].image.size();
+}
+
+cv::Size TilePyramid::tileGrid(int z) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (z < 0 || z >= (int)levels.size()) return cv::Size();
+    return cv::Size(levels[z].tilesX, levels[z].tilesY);
+}
+
+uint32_t TilePyramid::version() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return currentVersion;
+}
@@ -0,0 +1,64 @@
+#ifndef TILEPYRAMID_H
+#define TILEPYRAMID_H
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Mip pyramid of an image cut into fixed-size tiles, each with a version.
+//
+// Level 0 is full resolution and every further level halves the size (2x2 box
+// filter) until the image fits in a single tile. A tile's version is the
+// pyramid version of the last update that actually changed its pixels, so a
+// client that remembers the version it last saw only refetches tiles that
+// differ. All methods lock internally and may be called from worker threads.
+class TilePyramid {
+public:
+    struct TileInfo {
+        int x;
+        int y;
+        uint32_t version;
+    };
+
+    explicit TilePyramid(int tileSize = 256);
+
+    // Replace the image. sourceVersion orders updates coming from concurrent
+    // jobs: an update older than the last applied one is dropped (0 always
+    // applies). dirty limits the work to the region that may have changed; an
+    // empty rect rebuilds everything. Returns false if the update was dropped.
+    bool update(const cv::Mat& image, uint32_t sourceVersion = 0, const cv::Rect& dirty = cv::Rect());
+
+    // Copy out tile (x, y) of level z. Edge tiles are smaller than tileSize.
+    bool tile(int z, int x, int y, cv::Mat& out, uint32_t& tileVersion) const;
+    // Tiles of level z whose version is newer than since.
+    std::vector<TileInfo> changedSince(int z, uint32_t since) const;
+
+    int tileSize() const { return size; }
+    int levelCount() const;
+    cv::Size levelSize(int z) const;
+    cv::Size tileGrid(int z) const;
+    uint32_t version() const;
+
+private:
+    struct Level {
+        cv::Mat image;
+        int tilesX = 0;
+        int tilesY = 0;
+        std::vector<uint32_t> versions;
+    };
+
+    void rebuild(const cv::Mat& image);
+    // Write fresh pixels into a level, bumping the tiles whose content differs.
+    void store(Level& level, const cv::Rect& rect, const cv::Mat& pixels);
+
+    int size;
+    uint32_t currentVersion = 0;
+    uint32_t appliedSource = 0;
+    std::vector<Level> levels;
+    mutable std::mutex mutex;
+};
+
+#endif // TILEPYRAMID_H
@@ -0,0 +1,139 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+std::atomic<bool> enabledFlag{ false };
+
+namespace {
+
+const size_t kCapacity = 16384; // spans per thread, power of two
+
+struct Span {
+    const char* name;
+    int64_t startNs;
+    int64_t endNs;
+};
+
+struct ThreadBuffer {
+    uint32_t tid = 0;
+    std::string name;
+    std::vector<Span> spans = std::vector<Span>(kCapacity);
+    // Total spans written. Only the owning thread stores to it; export reads
+    // it with acquire so the spans below it are complete.
+    std::atomic<uint64_t> head{ 0 };
+    std::atomic<uint64_t> clearedAt{ 0 };
+};
+
+// Buffers outlive their threads so spans of finished threads still export.
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;
+uint32_t nextTid = 1;
+thread_local ThreadBuffer* localBuffer = nullptr;
+thread_local const char* localName = nullptr;
+
+ThreadBuffer* threadBuffer() {
+    if (!localBuffer) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.push_back(std::make_unique<ThreadBuffer>());
+        localBuffer = registry.back().get();
+        localBuffer->tid = nextTid++;
+        if (localName) localBuffer->name = localName;
+    }
+    return localBuffer;
+}
+
+void appendEscaped(std::string& out, const char* s) {
+    for (; *s; ++s) {
+        char c = *s;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            out += ' ';
+        }
+        else {
+            out += c;
+        }
+    }
+}
+
+} // namespace
+
+void setEnabled(bool on) {
+    enabledFlag.store(on, std::memory_order_relaxed);
+}
+
+void setThreadName(const char* name) {
+    localName = name;
+    if (localBuffer) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        localBuffer->name = name;
+    }
+}
+
+int64_t nowNs() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void record(const char* name, int64_t startNs, int64_t endNs) {
+    ThreadBuffer* buffer = threadBuffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    buffer->spans[head & (kCapacity - 1)] = { name, startNs, endNs };
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void clear() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto& buffer : registry) {
+        buffer->clearedAt.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+std::string exportChromeJson() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::string out;
+    out.reserve(1 << 16);
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char buf[160];
+    for (auto& buffer : registry) {
+        if (!buffer->name.empty()) {
+            out += first ? "" : ",";
+            first = false;
+            std::snprintf(buf, sizeof(buf), "{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"",
+                          buffer->tid);
+            out += buf;
+            appendEscaped(out, buffer->name.c_str());
+            out += "\"}}";
+        }
+
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t begin = buffer->clearedAt.load(std::memory_order_relaxed);
+        // Leave a margin at the old end: the owning thread may be
+        // overwriting those slots while we read.
+        const uint64_t margin = 64;
+        if (head > kCapacity - margin && begin < head - (kCapacity - margin)) begin = head - (kCapacity - margin);
+        for (uint64_t i = begin; i < head; ++i) {
+            const Span& span = buffer->spans[i & (kCapacity - 1)];
+            out += first ? "" : ",";
+            first = false;
+            out += "{\"ph\":\"X\",\"pid\":1,\"name\":\"";
+            appendEscaped(out, span.name);
+            std::snprintf(buf, sizeof(buf), "\",\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", buffer->tid,
+                          span.startNs / 1000.0, (span.endNs - span.startNs) / 1000.0);
+            out += buf;
+        }
+    }
+    out += "]}";
+    return out;
+}
+
+} // namespace trace
@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped-span tracer exported as Chrome trace / Perfetto JSON.
+//
+//     void warp() {
+//         MW_TRACE_SCOPE("warp");
+//         ...
+//     }
+//
+// Each thread appends finished spans to its own fixed-size ring buffer, so
+// recording takes no locks; the oldest spans are overwritten when it wraps.
+// While tracing is disabled a scope costs one relaxed atomic load. Building
+// with MW_NO_TRACE removes the scopes entirely.
+//
+// Span names must be string literals or otherwise outlive the trace.
+
+namespace trace {
+
+extern std::atomic<bool> enabledFlag;
+
+inline bool enabled() { return enabledFlag.load(std::memory_order_relaxed); }
+void setEnabled(bool on);
+
+// Label the calling thread in the exported trace.
+void setThreadName(const char* name);
+
+int64_t nowNs();
+void record(const char* name, int64_t startNs, int64_t endNs);
+
+// Spans of every thread as {"traceEvents": [...]}, oldest first.
+std::string exportChromeJson();
+void clear();
+
+class Scope {
+public:
+    explicit Scope(const char* name) : name(enabled() ? name : nullptr), start(this->name ? nowNs() : 0) {}
+    ~Scope() {
+        if (name) record(name, start, nowNs());
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    const char* name;
+    int64_t start;
+};
+
+} // namespace trace
+
+#define MW_TRACE_CONCAT2(a, b) a##b
+#define MW_TRACE_CONCAT(a, b) MW_TRACE_CONCAT2(a, b)
+
+#ifdef MW_NO_TRACE
+#define MW_TRACE_SCOPE(name) ((void)0)
+#else
+#define MW_TRACE_SCOPE(name) ::trace::Scope MW_TRACE_CONCAT(mwTraceScope, __LINE__)(name)
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,175 @@
+#include "uploadStream.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <opencv2/opencv.hpp>
+#include "imageEncoder.h"
+#include "trace.h"
+
+bool UploadStream::begin(struct mg_http_message* hm, size_t maxBytes) {
+    limit = maxBytes;
+    struct mg_str* ct = mg_http_get_header(hm, "Content-Type");
+    if (ct) contentType.assign(ct->buf, ct->len);
+
+    struct mg_str* te = mg_http_get_header(hm, "Transfer-Encoding");
+    struct mg_str* cl = mg_http_get_header(hm, "Content-Length");
+    if (te && mg_strcasecmp(*te, mg_str("chunked")) == 0) {
+        chunked = true;
+    }
+    else if (te) {
+        fail(501, "unsupported Transfer-Encoding");
+        return false;
+    }
+    else if (cl) {
+        expected = (size_t)std::strtoull(std::string(cl->buf, cl->len).c_str(), nullptr, 10);
+        if (expected > limit) {
+            fail(413, "upload too large");
+            return false;
+        }
+        // Size the buffer once so large uploads are not copied on growth.
+        buffer.reserve(expected);
+    }
+    else {
+        fail(411, "Content-Length or chunked body required");
+        return false;
+    }
+    return true;
+}
+
+UploadStream::State UploadStream::fail(int code, const std::string& text) {
+    status = code;
+    message = text;
+    current = State::Error;
+    return current;
+}
+
+UploadStream::State UploadStream::feed(const uint8_t* data, size_t len) {
+    if (current != State::Receiving) return current;
+    if (chunked) return feedChunked(data, len);
+
+    // Anything past Content-Length would be a pipelined request; uploads
+    // close the connection afterwards, so it is dropped.
+    size_t take = std::min(len, expected - buffer.size());
+    buffer.insert(buffer.end(), data, data + take);
+    if (buffer.size() == expected) current = State::Done;
+    return current;
+}
+
+UploadStream::State UploadStream::feedChunked(const uint8_t* data, size_t len) {
+    size_t i = 0;
+    while (i < len && current == State::Receiving) {
+        switch (chunkState) {
+        case Chunk::Size:
+        case Chunk::Extension: {
+            uint8_t c = data[i++];
+            if (c == '\n') {
+                if (!sizeDigits) return fail(400, "invalid chunk size");
+                chunkState = chunkLeft ? Chunk::Data : Chunk::Trailer;
+                trailerLine = 0;
+                sizeDigits = false;
+            }
+            else if (c == '\r' || chunkState == Chunk::Extension) {
+                // skip
+            }
+            else if (c == ';') {
+                chunkState = Chunk::Extension;
+            }
+            else if (std::isxdigit(c)) {
+                int digit = std::isdigit(c) ? c - '0' : (std::tolower(c) - 'a' + 10);
+                if (chunkLeft > (limit >> 4)) return fail(413, "upload too large");
+                chunkLeft = chunkLeft * 16 + (size_t)digit;
+                sizeDigits = true;
+            }
+            else {
+                return fail(400, "invalid chunk size");
+            }
+            break;
+        }
+        case Chunk::Data: {
+            size_t take = std::min(chunkLeft, len - i);
+            if (buffer.size() + take > limit) return fail(413, "upload too large");
+            buffer.insert(buffer.end(), data + i, data + i + take);
+            i += take;
+            chunkLeft -= take;
+            if (chunkLeft == 0) chunkState = Chunk::DataEnd;
+            break;
+        }
+        case Chunk::DataEnd: {
+            uint8_t c = data[i++];
+            if (c == '\n') chunkState = Chunk::Size;
+            else if (c != '\r') return fail(400, "missing CRLF after chunk");
+            break;
+        }
+        case Chunk::Trailer: {
+            // Trailer fields end with an empty line.
+            uint8_t c = data[i++];
+            if (c == '\n') {
+                if (trailerLine == 0) current = State::Done;
+                trailerLine = 0;
+            }
+            else if (c != '\r') {
+                ++trailerLine;
+            }
+            break;
+        }
+        }
+    }
+    return current;
+}
+
+bool UploadStream::filePayload(const uint8_t*& data, size_t& size, std::string& filename) const {
+    data = buffer.data();
+    size = buffer.size();
+    filename.clear();
+    if (contentType.compare(0, 19, "multipart/form-data") != 0) return size > 0;
+
+    struct mg_str body = mg_str_n((const char*)buffer.data(), buffer.size());
+    struct mg_http_part part;
+    size_t ofs = 0;
+    while ((ofs = mg_http_next_multipart(body, ofs, &part)) > 0) {
+        if (part.filename.len == 0) continue;
+        data = (const uint8_t*)part.body.buf;
+        size = part.body.len;
+        filename.assign(part.filename.buf, part.filename.len);
+        return true;
+    }
+    return false;
+}
+
+bool decodeDocument(const uint8_t* data, size_t size, const std::string& filename, std::shared_ptr<const void> owner,
+                    PsdDocument& doc, std::string& error) {
+    MW_TRACE_SCOPE("decodeDocument");
+    if (isPsd(data, size)) {
+        auto file = std::make_shared<PsdFile>();
+        return file->openMemory(data, size, std::move(owner), error) && readPsd(file, doc, error);
+    }
+
+    // Wraps the upload buffer; imdecode reads it in place.
+    cv::Mat encoded(1, (int)size, CV_8U, const_cast<uint8_t*>(data));
+    cv::Mat image = cv::imdecode(encoded, cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+        error = "unsupported or corrupt image";
+        return false;
+    }
+    // 16-bit PNG/TIFF and float EXR/HDR each need their own scale.
+    image = to8Bit(image);
+    if (image.channels() == 1) cv::cvtColor(image, image, cv::COLOR_GRAY2BGRA);
+    else if (image.channels() == 3) cv::cvtColor(image, image, cv::COLOR_BGR2BGRA);
+
+    doc = PsdDocument();
+    doc.width = image.cols;
+    doc.height = image.rows;
+    doc.channels = 4;
+    doc.depth = 8;
+    doc.colorMode = 3;
+    doc.composite = image;
+    PsdLayer layer;
+    size_t slash = filename.find_last_of("/\\");
+    layer.name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+    layer.rect = cv::Rect(0, 0, image.cols, image.rows);
+    layer.blendMode = "norm";
+    layer.image = image;
+    doc.layers.push_back(layer);
+    return true;
+}
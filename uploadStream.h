@@ -0,0 +1,68 @@
+#ifndef UPLOADSTREAM_H
+#define UPLOADSTREAM_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mongoose.h"
+#include "psdReader.h"
+
+// Collects a request body as it arrives, without waiting for mongoose to
+// buffer all of it and without temp files.
+//
+// begin() is called from MG_EV_HTTP_HDRS; the caller then removes the header
+// bytes from conn->recv, which detaches mongoose's HTTP parser, and passes
+// every later MG_EV_READ payload to feed(). Both Content-Length and chunked
+// bodies are handled; multipart/form-data is unwrapped once complete.
+class UploadStream {
+public:
+    enum class State { Receiving, Done, Error };
+
+    // Returns false when the request cannot be accepted; errorStatus() and
+    // error() then describe the reply (411, 413...).
+    bool begin(struct mg_http_message* hm, size_t maxBytes);
+    State feed(const uint8_t* data, size_t len);
+
+    State state() const { return current; }
+    int errorStatus() const { return status; }
+    const std::string& error() const { return message; }
+    size_t received() const { return buffer.size(); }
+
+    // The uploaded file: the first multipart part with a filename, or the
+    // whole body. filename is empty when the client did not send one.
+    bool filePayload(const uint8_t*& data, size_t& size, std::string& filename) const;
+
+    std::vector<uint8_t>& body() { return buffer; }
+
+private:
+    enum class Chunk { Size, Extension, Data, DataEnd, Trailer };
+
+    State fail(int code, const std::string& text);
+    State feedChunked(const uint8_t* data, size_t len);
+
+    State current = State::Receiving;
+    int status = 0;
+    std::string message;
+    std::string contentType;
+    size_t limit = 0;
+    size_t expected = 0;
+    bool chunked = false;
+    std::vector<uint8_t> buffer;
+
+    Chunk chunkState = Chunk::Size;
+    size_t chunkLeft = 0;
+    bool sizeDigits = false;
+    size_t trailerLine = 0;
+};
+
+// Decode an uploaded PSD (composite and shown layers) or any image
+// cv::imdecode understands (as a single layer) into a BGRA document. owner
+// keeps data alive for the PSD layers that are decoded later on demand.
+bool decodeDocument(const uint8_t* data, size_t size, const std::string& filename, std::shared_ptr<const void> owner,
+                    PsdDocument& doc, std::string& error);
+
+#endif // UPLOADSTREAM_H
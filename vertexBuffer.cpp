@@ -0,0 +1,148 @@
+#include "vertexBuffer.h"
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+
+// Targets are little-endian (x86/ARM), so values are copied as-is.
+template <typename T>
+void put(std::vector<uint8_t>& out, T value) {
+    size_t offset = out.size();
+    out.resize(offset + sizeof(T));
+    std::memcpy(out.data() + offset, &value, sizeof(T));
+}
+
+const size_t kHeaderSize = 40;
+
+} // namespace
+
+VertexBufferCache::VertexBufferCache(size_t historySize) : historySize(historySize ? historySize : 1) {}
+
+void VertexBufferCache::reset(const Grid& grid) {
+    std::unordered_map<const GridNode*, uint32_t> indexOf;
+    indexOf.reserve(grid.nodes.size());
+    for (size_t i = 0; i < grid.nodes.size(); ++i) {
+        indexOf[grid.nodes[i]] = (uint32_t)i;
+    }
+
+    indices.clear();
+    indices.reserve(grid.triangles.size() * 3);
+    for (const Triangle* tri : grid.triangles) {
+        indices.push_back(indexOf[tri->v1]);
+        indices.push_back(indexOf[tri->v2]);
+        indices.push_back(indexOf[tri->v3]);
+    }
+
+    // Old snapshots have a different vertex layout and cannot serve deltas.
+    history.clear();
+    commit(grid);
+}
+
+uint32_t VertexBufferCache::commit(const Grid& grid) {
+    Snapshot snapshot;
+    snapshot.version = ++currentVersion;
+    snapshot.positions.reserve(grid.nodes.size());
+    for (const GridNode* node : grid.nodes) {
+        snapshot.positions.push_back(node->position_modified);
+    }
+    if (history.size() >= historySize) {
+        history.pop_front();
+    }
+    history.push_back(std::move(snapshot));
+    return currentVersion;
+}
+
+void VertexBufferCache::encode(const VertexBufferRequest& request, std::vector<uint8_t>& out) const {
+    out.clear();
+    if (history.empty()) return;
+
+    const std::vector<cv::Point2f>& current = history.back().positions;
+    const uint32_t vertexCount = (uint32_t)current.size();
+
+    // Resolve the delta base; fall back to a full payload if it has aged out.
+    const Snapshot* base = nullptr;
+    if (request.sinceVersion != 0) {
+        for (const Snapshot& s : history) {
+            if (s.version == request.sinceVersion) {
+                base = &s;
+                break;
+            }
+        }
+    }
+
+    std::vector<uint32_t> entries;
+    if (base) {
+        for (uint32_t i = 0; i < vertexCount; ++i) {
+            if (base->positions[i] != current[i]) entries.push_back(i);
+        }
+    }
+    const uint32_t entryCount = base ? (uint32_t)entries.size() : vertexCount;
+
+    float originX = 0.0f, originY = 0.0f, scale = 0.0f;
+    if (request.quantize16 && vertexCount > 0) {
+        float minX = current[0].x, maxX = current[0].x;
+        float minY = current[0].y, maxY = current[0].y;
+        for (const cv::Point2f& p : current) {
+            minX = std::min(minX, p.x); maxX = std::max(maxX, p.x);
+            minY = std::min(minY, p.y); maxY = std::max(maxY, p.y);
+        }
+        // Quantize around the centre so the full int16 range is used.
+        originX = (minX + maxX) * 0.5f;
+        originY = (minY + maxY) * 0.5f;
+        float halfExtent = std::max(maxX - minX, maxY - minY) * 0.5f;
+        scale = halfExtent > 0.0f ? halfExtent / 32767.0f : 1.0f;
+    }
+
+    const bool sendIndices = request.includeIndices && !base;
+    const bool index32 = vertexCount > 0xFFFF;
+    uint16_t flags = 0;
+    if (request.quantize16) flags |= VB_QUANT16;
+    if (base) flags |= VB_DELTA;
+    if (index32) flags |= VB_INDEX32;
+    if (!sendIndices) flags |= VB_NO_INDICES;
+
+    const size_t positionSize = request.quantize16 ? 4 : 8;
+    out.reserve(kHeaderSize + entryCount * (positionSize + (base ? 4 : 0)) +
+        (sendIndices ? indices.size() * (index32 ? 4 : 2) : 0));
+
+    out.insert(out.end(), { 'M', 'W', 'V', 'B' });
+    put<uint16_t>(out, 1);
+    put<uint16_t>(out, flags);
+    put<uint32_t>(out, currentVersion);
+    put<uint32_t>(out, base ? base->version : 0);
+    put<uint32_t>(out, vertexCount);
+    put<uint32_t>(out, entryCount);
+    put<uint32_t>(out, sendIndices ? (uint32_t)indices.size() : 0);
+    put<float>(out, originX);
+    put<float>(out, originY);
+    put<float>(out, scale);
+
+    if (base) {
+        for (uint32_t i : entries) put<uint32_t>(out, i);
+    }
+
+    auto writePosition = [&](const cv::Point2f& p) {
+        if (request.quantize16) {
+            put<int16_t>(out, (int16_t)std::lround((p.x - originX) / scale));
+            put<int16_t>(out, (int16_t)std::lround((p.y - originY) / scale));
+        }
+        else {
+            put<float>(out, p.x);
+            put<float>(out, p.y);
+        }
+    };
+    if (base) {
+        for (uint32_t i : entries) writePosition(current[i]);
+    }
+    else {
+        for (const cv::Point2f& p : current) writePosition(p);
+    }
+
+    if (sendIndices) {
+        for (uint32_t i : indices) {
+            if (index32) put<uint32_t>(out, i);
+            else put<uint16_t>(out, (uint16_t)i);
+        }
+    }
+}
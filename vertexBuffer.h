@@ -0,0 +1,67 @@
+#ifndef VERTEXBUFFER_H
+#define VERTEXBUFFER_H
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "KDTree.h"
+
+// Binary geometry payload for WebGL clients (all fields little-endian).
+//
+// Header (40 bytes):
+//   char[4]  magic "MWVB"
+//   uint16   format version (1)
+//   uint16   flags (VB_*)
+//   uint32   mesh version of this payload
+//   uint32   base version the delta is relative to (0 for full payloads)
+//   uint32   vertex count
+//   uint32   entry count (vertices in full payloads, changed vertices in deltas)
+//   uint32   index count (0 when VB_NO_INDICES is set)
+//   float32  quantization origin x, y
+//   float32  quantization scale (pixels per int16 step, 0 for float payloads)
+// Body:
+//   [VB_DELTA]    uint32 vertex index per entry
+//   positions     float32 x,y per entry, or int16 x,y with VB_QUANT16
+//   indices       uint16 per index, or uint32 with VB_INDEX32
+enum VertexBufferFlags : uint16_t {
+    VB_QUANT16 = 1 << 0,
+    VB_DELTA = 1 << 1,
+    VB_INDEX32 = 1 << 2,
+    VB_NO_INDICES = 1 << 3,
+};
+
+struct VertexBufferRequest {
+    bool quantize16 = false;     // encode positions as int16
+    uint32_t sinceVersion = 0;   // send only vertices changed after this version
+    bool includeIndices = true;  // append the triangle index buffer
+};
+
+// Keeps the index buffer and a short history of position_modified snapshots so
+// that drag updates can be sent as deltas against a client's last version.
+class VertexBufferCache {
+public:
+    explicit VertexBufferCache(size_t historySize = 64);
+
+    // Rebuild the index buffer after the grid topology changed.
+    void reset(const Grid& grid);
+    // Snapshot the current positions as a new version and return it.
+    uint32_t commit(const Grid& grid);
+    uint32_t version() const { return currentVersion; }
+
+    void encode(const VertexBufferRequest& request, std::vector<uint8_t>& out) const;
+
+private:
+    struct Snapshot {
+        uint32_t version;
+        std::vector<cv::Point2f> positions;
+    };
+
+    size_t historySize;
+    uint32_t currentVersion = 0;
+    std::vector<uint32_t> indices;
+    std::deque<Snapshot> history; // oldest first, back() is current
+};
+
+#endif // VERTEXBUFFER_H
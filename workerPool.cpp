@@ -0,0 +1,91 @@
+#include "workerPool.h"
+#include <exception>
+#include "logger.h"
+#include "trace.h"
+
+namespace {
+
+// Completion of a task that threw.
+void failed(struct mg_connection* conn) {
+    if (conn) mg_http_reply(conn, 500, "", "Internal error");
+}
+
+} // namespace
+
+WorkerPool::WorkerPool(EventLoop& loop, size_t count) : loop(loop) {
+    if (count == 0) {
+        unsigned hw = std::thread::hardware_concurrency();
+        count = hw > 1 ? hw - 1 : 1;
+    }
+    threads.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        threads.emplace_back(&WorkerPool::run, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void WorkerPool::submit(struct mg_connection* conn, Task task) {
+    conn->is_resp = 1;
+    queued.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        jobs.push_back({ conn->id, std::move(task) });
+    }
+    jobReady.notify_one();
+}
+
+void WorkerPool::run() {
+    trace::setThreadName("worker");
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        Completion completion;
+        {
+            MW_TRACE_SCOPE("worker.task");
+            // A throwing task (cv::Exception from an encoder, a bad_alloc on
+            // a huge image) must not take the server down: log it and answer
+            // the request with a 500 instead.
+            try {
+                completion = job.task();
+            } catch (const std::exception& e) {
+                MW_LOG_ERROR("Worker task failed: {}", e.what());
+                completion = failed;
+            } catch (...) {
+                MW_LOG_ERROR("Worker task failed with an unknown exception");
+                completion = failed;
+            }
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        unsigned long connId = job.connId;
+        loop.post([this, connId, completion]() { complete(connId, completion); });
+    }
+}
+
+void WorkerPool::complete(unsigned long connId, const Completion& completion) {
+    struct mg_connection* conn = loop.connection(connId);
+    size_t replyStart = conn ? conn->send.len : 0;
+    if (completion) {
+        MW_TRACE_SCOPE("worker.completion");
+        completion(conn);
+    }
+    if (finished) finished(connId, conn, replyStart);
+    // Requests pipelined behind this one were held back by is_resp.
+    if (conn) EventLoop::resume(conn);
+}
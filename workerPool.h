@@ -0,0 +1,75 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "eventLoop.h"
+#include "mongoose.h"
+
+// Runs CPU-heavy request work (warp, encode, mesh generation) off the
+// mongoose event loop.
+//
+// A task runs on a pool thread and returns a completion, which is posted to
+// the EventLoop and runs on the loop thread, the only thread allowed to touch
+// connections. A task may read or write editor session state only while
+// holding that session's mutex; the one exception is a session's
+// TilePyramid, which locks internally and is safe to use from any thread.
+// The completion receives the originating
+// connection, or nullptr if the client disconnected in the meantime, so state
+// updates still apply even when there is nobody left to reply to. A task
+// that throws is logged and its request answered with a 500.
+class WorkerPool {
+public:
+    using Completion = std::function<void(struct mg_connection*)>;
+    using Task = std::function<Completion()>;
+    // Runs on the loop thread after each completion, before the connection
+    // is resumed; conn is nullptr if the client has gone. The completion's
+    // reply, if any, starts at replyStart in conn->send.
+    using Finished = std::function<void(unsigned long connId, struct mg_connection* conn, size_t replyStart)>;
+
+    // loop must outlive the pool. threads == 0 picks
+    // hardware_concurrency() - 1 (at least one).
+    explicit WorkerPool(EventLoop& loop, size_t threads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Queue task on behalf of conn. The connection is marked is_resp so that
+    // mongoose holds back pipelined requests until the completion has replied.
+    void submit(struct mg_connection* conn, Task task);
+
+    // Set before the first submit.
+    void setFinished(Finished fn) { finished = std::move(fn); }
+
+    size_t queueDepth() const { return queued.load(std::memory_order_relaxed); }
+    size_t threadCount() const { return threads.size(); }
+
+private:
+    struct Job {
+        unsigned long connId;
+        Task task;
+    };
+
+    void run();
+    void complete(unsigned long connId, const Completion& completion);
+
+    EventLoop& loop;
+    Finished finished;
+    std::vector<std::thread> threads;
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+    std::deque<Job> jobs;
+    bool stopping = false;
+
+    std::atomic<size_t> queued{ 0 };
+};
+
+#endif // WORKERPOOL_H